@@ -5,6 +5,8 @@ const through = require("through2");
 const path = require("path");
 const fs = require("fs");
 const readline = require("readline");
+const zlib = require("zlib");
+const crypto = require("crypto");
 
 const destination = "new_http.c";
 
@@ -17,6 +19,61 @@ function dumpFileSize() {
   });
 }
 
+/** Replaces (or appends) region with given name in new_http.c */
+function mergeRegion(target_path, region_name, output, file, cb) {
+  const rl = readline.createInterface({
+    input: fs.createReadStream(target_path),
+    crlfDelay: Infinity,
+  });
+
+  const merged_contents = [];
+  const marker_start = `//region_start ${region_name}`;
+  const marker_end = `//region_end ${region_name}`;
+  let region_state = 0;
+
+  rl.on("line", (line) => {
+    if (line.trim() === marker_start) {
+      region_state = 1;
+      merged_contents.push(marker_start);
+      merged_contents.push(output);
+      merged_contents.push(marker_end);
+    } else {
+      //Skip all existing content lines till region ends
+      if (region_state === 1) {
+        if (line.trim() === marker_end) {
+          region_state = 2;
+        }
+      } else {
+        merged_contents.push(line);
+      }
+    }
+  });
+
+  rl.on("close", () => {
+    if (region_state === 0) {
+      //Starting marker was not found, append
+
+      merged_contents.push("");
+      merged_contents.push(marker_start);
+      merged_contents.push(output);
+      merged_contents.push(marker_end);
+    }
+
+    if (region_state === 1) {
+      cb(`Ending marker "${marker_end}" was not found.`, file);
+    } else {
+      fs.writeFile(
+        target_path,
+        merged_contents.join("\r\n"),
+        "utf8",
+        (err) => {
+          cb(err, file);
+        }
+      );
+    }
+  });
+}
+
 /** This function injects C for a const field in new_http.c */
 function generateCode(field_name, is_script) {
   return through.obj(function (file, enc, cb) {
@@ -36,58 +93,47 @@ function generateCode(field_name, is_script) {
       const target_path = path.join(path.dirname(file.path), destination);
       //console.log(`Updated ${target_path}`);
 
-      const rl = readline.createInterface({
-        input: fs.createReadStream(target_path),
-        crlfDelay: Infinity,
-      });
-
-      const merged_contents = [];
-      const marker_start = `//region_start ${field_name}`;
-      const marker_end = `//region_end ${field_name}`;
-      let region_state = 0;
-
-      rl.on("line", (line) => {
-        if (line.trim() === marker_start) {
-          region_state = 1;
-          merged_contents.push(marker_start);
-          merged_contents.push(output);
-          merged_contents.push(marker_end);
-        } else {
-          //Skip all existing content lines till region ends
-          if (region_state === 1) {
-            if (line.trim() === marker_end) {
-              region_state = 2;
-            }
-          } else {
-            merged_contents.push(line);
-          }
-        }
-      });
+      mergeRegion(target_path, field_name, output, file, cb);
+      return;
+    }
 
-      rl.on("close", () => {
-        if (region_state === 0) {
-          //Starting marker was not found, append
+    cb(null, file);
+  });
+}
 
-          merged_contents.push("");
-          merged_contents.push(marker_start);
-          merged_contents.push(output);
-          merged_contents.push(marker_end);
-        }
+/**
+ * Injects gzip-compressed copy of minified content, served with
+ * Content-Encoding: gzip from /static/. Hash of content is used for ETag
+ * and as version in URL, so browser may cache it for long.
+ */
+function generateGzipCode(field_name) {
+  return through.obj(function (file, enc, cb) {
+    if (file.isBuffer()) {
+      const contents = file.contents;
+      const gz = zlib.gzipSync(contents, { level: 9 });
+      const hash = crypto.createHash("sha1").update(contents).digest("hex").substring(0, 16);
+      console.log(
+        `Processing ${file.basename}, gzip length ${gz.length}`
+      );
 
-        if (region_state === 1) {
-          cb(`Ending marker "${marker_end}" was not found.`, file);
-        } else {
-          fs.writeFile(
-            target_path,
-            merged_contents.join("\r\n"),
-            "utf8",
-            (err) => {
-              cb(err, file);
-            }
-          );
+      const lines = [];
+      for (let i = 0; i < gz.length; i += 16) {
+        const row = [];
+        for (let j = i; j < i + 16 && j < gz.length; j++) {
+          row.push("0x" + gz[j].toString(16).padStart(2, "0"));
         }
-      });
+        lines.push(row.join(",") + ",");
+      }
+      const output = [
+        `const char ${field_name}_hash[] = "${hash}";`,
+        `const int ${field_name}_gzLen = ${gz.length};`,
+        `const unsigned char ${field_name}_gz[] = {`,
+        ...lines,
+        "};",
+      ].join("\r\n");
 
+      const target_path = path.join(path.dirname(file.path), destination);
+      mergeRegion(target_path, `${field_name}_gz`, output, file, cb);
       return;
     }
 
@@ -100,7 +146,8 @@ function minifyJs() {
     .src("./src/httpserver/script.js")
     .pipe(dumpFileSize())
     .pipe(uglify())
-    .pipe(generateCode("pageScript", true));
+    .pipe(generateCode("pageScript", true))
+    .pipe(generateGzipCode("pageScript"));
 }
 
 function minifyHassDiscoveryJs() {
@@ -108,7 +155,8 @@ function minifyHassDiscoveryJs() {
     .src("./src/httpserver/script_ha_discovery.js")
     .pipe(dumpFileSize())
     .pipe(uglify())
-    .pipe(generateCode("ha_discovery_script", true));
+    .pipe(generateCode("ha_discovery_script", true))
+    .pipe(generateGzipCode("ha_discovery_script"));
 }
 
 function minifyCss() {
@@ -116,7 +164,8 @@ function minifyCss() {
     .src("./src/httpserver/style.css")
     .pipe(dumpFileSize())
     .pipe(cssnano())
-    .pipe(generateCode("htmlHeadStyle", false));
+    .pipe(generateCode("htmlHeadStyle", false))
+    .pipe(generateGzipCode("htmlHeadStyle"));
 }
 
 exports.default = gulp.series(minifyJs, minifyHassDiscoveryJs, minifyCss);
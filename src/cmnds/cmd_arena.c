@@ -0,0 +1,206 @@
+#include "../new_common.h"
+#include "cmd_local.h"
+#include "../logging/logging.h"
+
+/*
+Bump arenas for scripting runtime memory.
+
+Event handlers, repeating events, script files and command aliases used to
+strdup/malloc every small string and struct on its own. On BK7231 heap_4 every
+such block costs a header and leaves a hole when freed, so after a few reloads
+of autoexec the heap was full of small holes. Now each owner has an arena:
+memory is taken from larger chunks, text is interned (same text is stored only once
+per arena), and everything is given back at once when owner is cleared.
+
+There is no per-allocation free. Owners that drop single items (repeating events)
+keep a free pool for structs and reset the arena when nothing is alive.
+
+arenaStats prints the usage. Largest free block is found by trial mallocs, which
+may briefly take all free heap from other tasks, so it's only done by arenaStats.
+*/
+
+// header overhead of a heap_4 block, used for the 'saved' estimate
+#define ARENA_HEAP_BLOCK_OVERHEAD 8
+#define ARENA_ALIGN(x) (((x) + (sizeof(void*) - 1)) & ~(sizeof(void*) - 1))
+
+typedef struct arenaChunk_s {
+	struct arenaChunk_s *next;
+	int size;
+	int used;
+	// data follows
+} arenaChunk_t;
+
+typedef struct arenaString_s {
+	struct arenaString_s *next;
+	unsigned int hash;
+	char text[1];
+} arenaString_t;
+
+#define ARENA_CHUNK_HEADER ARENA_ALIGN(sizeof(arenaChunk_t))
+
+static arena_t *g_arenas = 0;
+
+static void Arena_Register(arena_t *a) {
+	if (a->bRegistered)
+		return;
+	a->bRegistered = true;
+	a->nextArena = g_arenas;
+	g_arenas = a;
+}
+void *Arena_Alloc(arena_t *a, int size) {
+	arenaChunk_t *c;
+	int chunkSize;
+	byte *r;
+
+	Arena_Register(a);
+	size = ARENA_ALIGN(size);
+	c = a->chunks;
+	if (c == 0 || c->used + size > c->size) {
+		// big requests get a chunk of their own, so the current one is not wasted
+		if (size > ARENA_CHUNK_SIZE / 2) {
+			chunkSize = size;
+		} else {
+			chunkSize = ARENA_CHUNK_SIZE;
+		}
+		c = (arenaChunk_t*)malloc(ARENA_CHUNK_HEADER + chunkSize);
+		if (c == 0) {
+			ADDLOG_ERROR(LOG_FEATURE_CMD, "Arena %s: failed to alloc %i bytes", a->name, chunkSize);
+			return 0;
+		}
+		c->size = chunkSize;
+		c->used = 0;
+		a->numChunks++;
+		a->numChunkMallocs++;
+		a->reservedBytes += chunkSize;
+		if (chunkSize == size && a->chunks) {
+			// keep partially used chunk on top
+			c->next = a->chunks->next;
+			a->chunks->next = c;
+		} else {
+			c->next = a->chunks;
+			a->chunks = c;
+		}
+	}
+	r = ((byte*)c) + ARENA_CHUNK_HEADER + c->used;
+	c->used += size;
+	a->usedBytes += size;
+	a->numAllocs++;
+	return r;
+}
+static unsigned int Arena_HashString(const char *s, int *len) {
+	unsigned int hash = 5381;
+	const char *p = s;
+
+	while (*p) {
+		hash = hash * 33 + (byte)*p;
+		p++;
+	}
+	*len = p - s;
+	return hash;
+}
+const char *Arena_Intern(arena_t *a, const char *s) {
+	arenaString_t *str;
+	unsigned int hash;
+	int len;
+
+	if (s == 0)
+		return 0;
+	hash = Arena_HashString(s, &len);
+	for (str = a->strings[hash % ARENA_INTERN_BUCKETS]; str; str = str->next) {
+		if (str->hash == hash && !strcmp(str->text, s)) {
+			a->numInternHits++;
+			return str->text;
+		}
+	}
+	str = (arenaString_t*)Arena_Alloc(a, sizeof(arenaString_t) + len);
+	if (str == 0)
+		return 0;
+	str->hash = hash;
+	memcpy(str->text, s, len + 1);
+	str->next = a->strings[hash % ARENA_INTERN_BUCKETS];
+	a->strings[hash % ARENA_INTERN_BUCKETS] = str;
+	return str->text;
+}
+void Arena_Reset(arena_t *a) {
+	arenaChunk_t *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	a->chunks = 0;
+	memset(a->strings, 0, sizeof(a->strings));
+	a->numChunks = 0;
+	a->reservedBytes = 0;
+	a->usedBytes = 0;
+	a->numResets++;
+}
+// Finds the largest block malloc can give right now, by bisection.
+static int Arena_ProbeLargestFreeBlock() {
+	int lo, hi, mid;
+	void *p;
+
+	lo = 0;
+	hi = xPortGetFreeHeapSize();
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		p = malloc(mid);
+		if (p) {
+			free(p);
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return lo;
+}
+void Arena_MoveTo(arena_t *a, arena_t *to) {
+	arenaChunk_t *c;
+
+	if (a->chunks == 0)
+		return;
+	Arena_Register(to);
+	for (c = a->chunks; c->next; c = c->next) {
+	}
+	c->next = to->chunks;
+	to->chunks = a->chunks;
+	to->numChunks += a->numChunks;
+	to->reservedBytes += a->reservedBytes;
+	to->usedBytes += a->usedBytes;
+	a->chunks = 0;
+	memset(a->strings, 0, sizeof(a->strings));
+	a->numChunks = 0;
+	a->reservedBytes = 0;
+	a->usedBytes = 0;
+}
+void Arena_Release(arena_t *a) {
+	a->numReleases++;
+	a->freeHeapBefore = xPortGetFreeHeapSize();
+	Arena_Reset(a);
+	a->freeHeapAfter = xPortGetFreeHeapSize();
+}
+static commandResult_t CMD_ArenaStats(const void *context, const char *cmd, const char *args, int cmdFlags) {
+	arena_t *a;
+	int saved;
+
+	for (a = g_arenas; a; a = a->nextArena) {
+		// every allocation and interned duplicate would have been a heap block on its own
+		saved = (a->numAllocs + a->numInternHits - a->numChunkMallocs) * ARENA_HEAP_BLOCK_OVERHEAD;
+		ADDLOG_INFO(LOG_FEATURE_CMD, "Arena %s: %i chunks, %i/%i bytes used, %i allocs, %i interned dups, %i resets, ~%i bytes of block headers saved",
+			a->name, a->numChunks, a->usedBytes, a->reservedBytes, a->numAllocs, a->numInternHits, a->numResets, saved);
+		if (a->numReleases) {
+			ADDLOG_INFO(LOG_FEATURE_CMD, "Arena %s: last release - free heap %i -> %i",
+				a->name, a->freeHeapBefore, a->freeHeapAfter);
+		}
+	}
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Free heap %i, largest free block %i", xPortGetFreeHeapSize(), Arena_ProbeLargestFreeBlock());
+
+	return CMD_RES_OK;
+}
+void Arena_Init() {
+	//cmddetail:{"name":"arenaStats","args":"",
+	//cmddetail:"descr":"Prints usage of memory arenas used by event handlers, repeating events, scripts and aliases, free heap before and after last release of each arena, and current free heap and largest free block",
+	//cmddetail:"fn":"CMD_ArenaStats","file":"cmnds/cmd_arena.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("arenaStats", CMD_ArenaStats, NULL);
+}
@@ -122,7 +122,7 @@ static int EVENT_ParseRelation(const char *s) {
 	return EVENT_DEFAULT;
 }
 
-static int EVENT_ParseEventName(const char *s) {
+int EVENT_ParseEventName(const char *s) {
 	if(!wal_strnicmp(s,"channel",7)) {
 		return CMD_EVENT_CHANGE_CHANNEL0 + atoi(s+7);
 	}
@@ -254,125 +254,301 @@ typedef struct eventHandler_s {
 	int requiredArgument;
 	int requiredArgument2;
 	int requiredArgument3;
-	// command to execute when it happens
-	char *command;
+	// command to execute when it happens, interned in g_handlersArena
+	const char *command;
 	// for UART event handlers?
-	char *requiredArgumentText;
+	const char *requiredArgumentText;
+	// expressions compiled while running command
+	expressionList_t expressions;
 
+	// list of all handlers, for listing and freeing
 	struct eventHandler_s *next;
+	// next handler in the same dispatch bucket
+	struct eventHandler_s *nextInBucket;
+	// next handler in the same argument group, see below
+	struct eventHandler_s *nextInGroup;
 } eventHandler_t;
 
+// Handlers are indexed so firing an event only visits handlers that may match.
+// Change handlers (with relation, from addChangeHandler) are kept per event code,
+// because they must be evaluated for every value change of given variable.
+// Handlers with text argument are kept in a hash keyed by event code and text.
+// Handlers with integer arguments are grouped by event code and first argument,
+// and the group is keyed again by second argument. That way all IR 0x707 handlers
+// share one group, but IR 0x707 0x68 still visits only handlers for 0x68.
+// Single argument event ignores second argument, so it walks the whole group.
+#define EVENT_HANDLERS_HASH_SIZE 64
+#define EVENT_GROUP_HASH_SIZE 8
+
+typedef struct eventGroup_s {
+	byte eventCode;
+	int requiredArgument;
+	// all handlers of this group, for single argument events
+	eventHandler_t *handlers;
+	// the same handlers, keyed by second argument
+	eventHandler_t *byArgument2[EVENT_GROUP_HASH_SIZE];
+	// next group in the same dispatch bucket
+	struct eventGroup_s *next;
+} eventGroup_t;
+
+// handlers, groups and their text are never freed one by one, only all together
+static arena_t g_handlersArena = ARENA_INIT("handlers");
 static eventHandler_t *g_eventHandlers = 0;
+static eventHandler_t *g_changeHandlers[CMD_EVENT_MAX_TYPES];
+static eventGroup_t *g_argumentGroups[EVENT_HANDLERS_HASH_SIZE];
+static eventHandler_t *g_textHandlers[EVENT_HANDLERS_HASH_SIZE];
+// handlers cleared while a handler was running, they are freed
+// when the outermost handler returns
+static arena_t g_retiredHandlersArena = ARENA_INIT("retiredHandlers");
+static eventHandler_t *g_retiredHandlers = 0;
+static int g_handlersDepth = 0;
+// bumped by clearAllHandlers, so dispatch stops walking cleared handlers
+static int g_handlersGeneration = 0;
+
+static void EVENT_FreeHandlers(eventHandler_t *ev) {
+	for (; ev; ev = ev->next) {
+		CMD_FreeExpressions(&ev->expressions);
+	}
+}
+// returns false if handlers were cleared by the command
+static bool EVENT_RunHandler(eventHandler_t *ev) {
+	expressionList_t *prevOwner;
+	int generation;
+
+	generation = g_handlersGeneration;
+	prevOwner = CMD_SetExpressionOwner(&ev->expressions);
+	g_handlersDepth++;
+	CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+	g_handlersDepth--;
+	CMD_SetExpressionOwner(prevOwner);
+	if (g_handlersDepth == 0 && g_retiredHandlers) {
+		EVENT_FreeHandlers(g_retiredHandlers);
+		g_retiredHandlers = 0;
+		Arena_Release(&g_retiredHandlersArena);
+	}
+	return generation == g_handlersGeneration;
+}
+static int EVENT_HashArguments(byte eventCode, int argument) {
+	unsigned int hash;
 
+	hash = eventCode;
+	hash = hash * 31 + argument;
+	hash = hash ^ (hash >> 6) ^ (hash >> 12);
+	return hash & (EVENT_HANDLERS_HASH_SIZE - 1);
+}
+static int EVENT_HashArgument2(int argument2) {
+	unsigned int hash;
+
+	hash = argument2;
+	hash = hash ^ (hash >> 3) ^ (hash >> 8);
+	return hash & (EVENT_GROUP_HASH_SIZE - 1);
+}
+static eventGroup_t *EVENT_FindGroup(byte eventCode, int argument) {
+	eventGroup_t *g;
+
+	g = g_argumentGroups[EVENT_HashArguments(eventCode, argument)];
+	while (g) {
+		if (g->eventCode == eventCode && g->requiredArgument == argument)
+			return g;
+		g = g->next;
+	}
+	return 0;
+}
+static eventGroup_t *EVENT_GetOrAddGroup(byte eventCode, int argument) {
+	eventGroup_t *g;
+	int hash;
+
+	g = EVENT_FindGroup(eventCode, argument);
+	if (g)
+		return g;
+	g = Arena_Alloc(&g_handlersArena, sizeof(eventGroup_t));
+	if (g == 0)
+		return 0;
+	memset(g, 0, sizeof(eventGroup_t));
+	g->eventCode = eventCode;
+	g->requiredArgument = argument;
+	hash = EVENT_HashArguments(eventCode, argument);
+	g->next = g_argumentGroups[hash];
+	g_argumentGroups[hash] = g;
+	return g;
+}
+static int EVENT_HashText(byte eventCode, const char *s) {
+	unsigned int hash;
+
+	hash = eventCode;
+	while (*s) {
+		// 0x20 bit is forced, so it matches stricmp below
+		hash = hash * 31 + (*s | 0x20);
+		s++;
+	}
+	hash = hash ^ (hash >> 6) ^ (hash >> 12);
+	return hash & (EVENT_HANDLERS_HASH_SIZE - 1);
+}
 
 void EventHandlers_ProcessVariableChange_Integer(byte eventCode, int oldValue, int newValue) {
 	struct eventHandler_s *ev;
 
-	ev = g_eventHandlers;
+	if (eventCode >= CMD_EVENT_MAX_TYPES)
+		return;
+
+	// script threads waiting for this variable get the new value as argument
+	SVM_WakeWaitingThreads(eventCode, true, newValue);
+
+	ev = g_changeHandlers[eventCode];
 
 	while(ev) {
-		if(eventCode==ev->eventCode) {
-			if(EVENT_EvaluateChangeCondition(ev->eventType, ev->requiredArgument, oldValue, newValue)) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_ProcessVariableChange_Integer: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
+		if(EVENT_EvaluateChangeCondition(ev->eventType, ev->requiredArgument, oldValue, newValue)) {
+			ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_ProcessVariableChange_Integer: executing command %s",ev->command);
+			if (!EVENT_RunHandler(ev))
+				return;
 		}
-		ev = ev->next;
+		ev = ev->nextInBucket;
 	}
 }
 
 void EventHandlers_AddEventHandler_Integer(byte eventCode, int type, int requiredArgument, int requiredArgument2, int requiredArgument3, const char *commandToRun)
 {
-	eventHandler_t *ev = malloc(sizeof(eventHandler_t));
+	eventHandler_t *ev = Arena_Alloc(&g_handlersArena, sizeof(eventHandler_t));
+	eventGroup_t *g;
+	int hash;
+
+	if (ev == 0)
+		return;
 	memset(ev,0,sizeof(eventHandler_t));
 
+	g = 0;
+	if (type == EVENT_DEFAULT) {
+		g = EVENT_GetOrAddGroup(eventCode, requiredArgument);
+		if (g == 0)
+			return;
+	}
+
 	ev->next = g_eventHandlers;
 	g_eventHandlers = ev;
 
 	ev->requiredArgumentText = NULL;
 	ev->eventType = type;
-	ev->command = strdup(commandToRun);
+	ev->command = Arena_Intern(&g_handlersArena, commandToRun);
 	ev->eventCode = eventCode;
 	ev->requiredArgument = requiredArgument;
 	ev->requiredArgument2 = requiredArgument2;
 	ev->requiredArgument3 = requiredArgument3;
+
+	if (g) {
+		ev->nextInGroup = g->handlers;
+		g->handlers = ev;
+		hash = EVENT_HashArgument2(requiredArgument2);
+		ev->nextInBucket = g->byArgument2[hash];
+		g->byArgument2[hash] = ev;
+	}
+	else if (eventCode < CMD_EVENT_MAX_TYPES) {
+		ev->nextInBucket = g_changeHandlers[eventCode];
+		g_changeHandlers[eventCode] = ev;
+	}
 }
 
 void EventHandlers_AddEventHandler_String(byte eventCode, int type, const char *requiredArgument, const char *commandToRun)
 {
-	eventHandler_t *ev = malloc(sizeof(eventHandler_t));
+	eventHandler_t *ev = Arena_Alloc(&g_handlersArena, sizeof(eventHandler_t));
+	int hash;
+
+	if (ev == 0)
+		return;
 	memset(ev,0,sizeof(eventHandler_t));
 
 	ev->next = g_eventHandlers;
 	g_eventHandlers = ev;
 
-	ev->requiredArgumentText = strdup(requiredArgument);
+	ev->requiredArgumentText = Arena_Intern(&g_handlersArena, requiredArgument);
 	ev->eventType = type;
-	ev->command = strdup(commandToRun);
+	ev->command = Arena_Intern(&g_handlersArena, commandToRun);
 	ev->eventCode = eventCode;
 	ev->requiredArgument = 0;
 	ev->requiredArgument2 = 0;
+
+	hash = EVENT_HashText(eventCode, requiredArgument);
+	ev->nextInBucket = g_textHandlers[hash];
+	g_textHandlers[hash] = ev;
 }
 void EventHandlers_FireEvent3(byte eventCode, int argument, int argument2, int argument3) {
 	struct eventHandler_s *ev;
+	eventGroup_t *g;
 
-	ev = g_eventHandlers;
+	SVM_WakeWaitingThreads(eventCode, true, argument);
+
+	g = EVENT_FindGroup(eventCode, argument);
+	if (g == 0)
+		return;
+	ev = g->byArgument2[EVENT_HashArgument2(argument2)];
 
 	while (ev) {
-		if (eventCode == ev->eventCode) {
-			if (argument == ev->requiredArgument && argument2 == ev->requiredArgument2 && argument3 == ev->requiredArgument3) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent3: executing command %s", ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
+		if (argument2 == ev->requiredArgument2 && argument3 == ev->requiredArgument3) {
+			ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent3: executing command %s", ev->command);
+			if (!EVENT_RunHandler(ev))
+				return;
 		}
-		ev = ev->next;
+		ev = ev->nextInBucket;
 	}
 }
 void EventHandlers_FireEvent2(byte eventCode, int argument, int argument2) {
 	struct eventHandler_s *ev;
+	eventGroup_t *g;
 
-	ev = g_eventHandlers;
+	SVM_WakeWaitingThreads(eventCode, true, argument);
+
+	g = EVENT_FindGroup(eventCode, argument);
+	if (g == 0)
+		return;
+	ev = g->byArgument2[EVENT_HashArgument2(argument2)];
 
 	while(ev) {
-		if(eventCode==ev->eventCode) {
-			if(argument == ev->requiredArgument && argument2 == ev->requiredArgument2) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent2: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
+		if(argument2 == ev->requiredArgument2) {
+			ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent2: executing command %s",ev->command);
+			if (!EVENT_RunHandler(ev))
+				return;
 		}
-		ev = ev->next;
+		ev = ev->nextInBucket;
 	}
 }
 void EventHandlers_FireEvent(byte eventCode, int argument) {
 	struct eventHandler_s *ev;
+	eventGroup_t *g;
 
-	ev = g_eventHandlers;
+	SVM_WakeWaitingThreads(eventCode, true, argument);
+
+	g = EVENT_FindGroup(eventCode, argument);
+	if (g == 0)
+		return;
+	// second argument is not checked, so handlers that were added
+	// with more arguments also fire
+	ev = g->handlers;
 
 	while(ev) {
-		if(eventCode==ev->eventCode) {
-			if(argument == ev->requiredArgument) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
-		}
-		ev = ev->next;
+		ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent: executing command %s",ev->command);
+		if (!EVENT_RunHandler(ev))
+			return;
+		ev = ev->nextInGroup;
 	}
 }
 void EventHandlers_FireEvent_String(byte eventCode, const char *argument) {
 	struct eventHandler_s *ev;
 
-	ev = g_eventHandlers;
+	// only threads waiting without an argument are woken by text events
+	SVM_WakeWaitingThreads(eventCode, false, 0);
+
+	ev = g_textHandlers[EVENT_HashText(eventCode, argument)];
 
 	while(ev) {
 		if(eventCode==ev->eventCode) {
 			if(ev->requiredArgumentText != 0) {
 				if(!stricmp(argument,ev->requiredArgumentText)) {
 					ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent_String: executing command %s",ev->command);
-					CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+					if (!EVENT_RunHandler(ev))
+						return;
 				}
 			}
 		}
-		ev = ev->next;
+		ev = ev->nextInBucket;
 	}
 
 }
@@ -444,22 +620,31 @@ static commandResult_t CMD_AddEventHandler(const void *context, const char *cmd,
 commandResult_t CMD_ClearAllHandlers(const void *context, const char *cmd, const char *args, int cmdFlags){
 
 	int c = 0;
-	eventHandler_t *ev, *next;
+	eventHandler_t *ev;
 
-	ev = g_eventHandlers;
-
-	while(ev != 0) {
-		next = ev->next;
-
-		free(ev->command);
-		free(ev);
-
-		ev = next;
+	for (ev = g_eventHandlers; ev; ev = ev->next) {
 		c++;
 	}
+	if (g_handlersDepth > 0 && g_eventHandlers) {
+		// called from a handler, which still runs from this memory,
+		// so it's kept until the outermost handler returns
+		for (ev = g_eventHandlers; ev->next; ev = ev->next) {
+		}
+		ev->next = g_retiredHandlers;
+		g_retiredHandlers = g_eventHandlers;
+		Arena_MoveTo(&g_handlersArena, &g_retiredHandlersArena);
+	} else {
+		EVENT_FreeHandlers(g_eventHandlers);
+		// handlers and their text live in arena, so it's released at once
+		Arena_Release(&g_handlersArena);
+	}
+	g_handlersGeneration++;
 
 	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, "Fried %i handlers", c);
 	g_eventHandlers = 0;
+	memset(g_changeHandlers, 0, sizeof(g_changeHandlers));
+	memset(g_argumentGroups, 0, sizeof(g_argumentGroups));
+	memset(g_textHandlers, 0, sizeof(g_textHandlers));
 
 	return CMD_RES_OK;
 }
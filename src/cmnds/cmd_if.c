@@ -144,8 +144,6 @@ const char *strCompareBound(const char *s, const char *templ, const char *stoppe
 	}
 	return 0;
 }
-char *g_expDebugBuffer = 0;
-#define EXPRESSION_DEBUG_BUFFER_SIZE 128
 typedef struct {
 	const char *constantName;
 	float(*getValue)(const char *s);
@@ -310,26 +308,183 @@ const constant_t g_constants[] = {
 	//cnstdetail:"requires":""}
 	{"$uptime", &getUpTime},
 };
-static int g_totalConstants = sizeof(g_constants) / sizeof(g_constants[0]);
+#define TOTAL_CONSTANTS (sizeof(g_constants) / sizeof(g_constants[0]))
+static int g_totalConstants = TOTAL_CONSTANTS;
+
+// Constants are dispatched by first character of name (after '$').
+// A template can only match text that has the same first characters,
+// so only one small bucket is searched. Buckets keep g_constants order,
+// so longer wildcards ($CH***) are still tried before shorter ones.
+// Wildcard flags are computed once together with the buckets.
+#define CONSTANT_BUCKETS 32
+static byte g_constantOrder[TOTAL_CONSTANTS];
+static byte g_constantBucketStart[CONSTANT_BUCKETS + 1];
+static byte g_constantHasWildcard[TOTAL_CONSTANTS];
+static bool g_bConstantsIndexed = false;
+
+static int CMD_ConstantBucket(const char *s) {
+	if (*s == '$') {
+		s++;
+	}
+	return tolower((unsigned char)*s) & (CONSTANT_BUCKETS - 1);
+}
+static void CMD_IndexConstants() {
+	byte counts[CONSTANT_BUCKETS];
+	byte pos[CONSTANT_BUCKETS];
+	int i, b;
+
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < g_totalConstants; i++) {
+		counts[CMD_ConstantBucket(g_constants[i].constantName)]++;
+		g_constantHasWildcard[i] = strchr(g_constants[i].constantName, '*') != 0;
+	}
+	g_constantBucketStart[0] = 0;
+	for (b = 0; b < CONSTANT_BUCKETS; b++) {
+		g_constantBucketStart[b + 1] = g_constantBucketStart[b] + counts[b];
+		pos[b] = g_constantBucketStart[b];
+	}
+	for (i = 0; i < g_totalConstants; i++) {
+		b = CMD_ConstantBucket(g_constants[i].constantName);
+		g_constantOrder[pos[b]++] = i;
+	}
+	g_bConstantsIndexed = true;
+}
+static const constant_t *CMD_FindConstant(const char *s, const char *stop, const char **after) {
+	const constant_t *var;
+	const char *ret;
+	int i, b, idx;
+
+	if (g_bConstantsIndexed == false) {
+		CMD_IndexConstants();
+	}
+	b = CMD_ConstantBucket(s);
+	for (i = g_constantBucketStart[b]; i < g_constantBucketStart[b + 1]; i++) {
+		idx = g_constantOrder[i];
+		var = &g_constants[idx];
+		ret = strCompareBound(s, var->constantName, stop, g_constantHasWildcard[idx]);
+		if (ret) {
+			ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_FindConstant: %s", var->constantName);
+			*after = ret;
+			return var;
+		}
+	}
+	return 0;
+}
+
+// User variables, set by setVar and read as $name.
+// Each name gets a slot; compiled expressions keep the slot index, so a read
+// is an array access. Names are found by a small open-addressed index with
+// case folded hash, like commands. Only setVar creates variables.
+// Generation changes when a variable is created or all are cleared, then
+// compiled expressions look their names up again.
+#define SCRIPT_MAX_VARIABLES 32
+#define SCRIPT_VARIABLE_NAME_LEN 16
+#define SCRIPT_VARIABLE_INDEX_SIZE 64
+
+typedef struct scriptVariable_s {
+	char name[SCRIPT_VARIABLE_NAME_LEN];
+	float value;
+} scriptVariable_t;
+
+static scriptVariable_t g_variables[SCRIPT_MAX_VARIABLES];
+static int g_numVariables = 0;
+// slot + 1, 0 means empty
+static byte g_variableIndex[SCRIPT_VARIABLE_INDEX_SIZE];
+static int g_variablesGeneration = 0;
+
+// returns length of variable name after '$', or 0 if it's not a name
+static int CMD_ParseVariableName(const char *s, const char *stop) {
+	const char *p;
+
+	if (*s != '$')
+		return 0;
+	p = s + 1;
+	if (!(isalpha((unsigned char)*p) || *p == '_'))
+		return 0;
+	while ((stop == 0 || p < stop) && (isalnum((unsigned char)*p) || *p == '_')) {
+		p++;
+	}
+	return p - (s + 1);
+}
+static int CMD_FindVariable(const char *name, int len, bool bCreate) {
+	unsigned int hash = 5381;
+	scriptVariable_t *v;
+	int i, h, slot;
+
+	if (len <= 0 || len >= SCRIPT_VARIABLE_NAME_LEN)
+		return -1;
+	for (i = 0; i < len; i++) {
+		hash = hash * 33 + (name[i] | 0x20);
+	}
+	h = hash & (SCRIPT_VARIABLE_INDEX_SIZE - 1);
+	while (g_variableIndex[h]) {
+		slot = g_variableIndex[h] - 1;
+		v = &g_variables[slot];
+		if (!wal_strnicmp(v->name, name, len) && v->name[len] == 0)
+			return slot;
+		h = (h + 1) & (SCRIPT_VARIABLE_INDEX_SIZE - 1);
+	}
+	if (bCreate == false || g_numVariables >= SCRIPT_MAX_VARIABLES)
+		return -1;
+	slot = g_numVariables++;
+	v = &g_variables[slot];
+	memcpy(v->name, name, len);
+	v->name[len] = 0;
+	v->value = 0;
+	g_variableIndex[h] = slot + 1;
+	g_variablesGeneration++;
+	return slot;
+}
+void CMD_ResetVariables() {
+	g_numVariables = 0;
+	memset(g_variableIndex, 0, sizeof(g_variableIndex));
+	g_variablesGeneration++;
+}
+commandResult_t CMD_SetVar(const void *context, const char *cmd, const char *args, int cmdFlags) {
+	const char *name;
+	int slot;
+
+	Tokenizer_TokenizeString(args, 0);
+	// following check must be done after 'Tokenizer_TokenizeString',
+	// so we know arguments count in Tokenizer. 'cmd' argument is
+	// only for warning display
+	if (Tokenizer_CheckArgsCountAndPrintWarning(cmd, 2)) {
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+	name = Tokenizer_GetArg(0);
+	if (*name == '$')
+		name++;
+	slot = CMD_FindVariable(name, strlen(name), true);
+	if (slot < 0) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "setVar: bad name %s or no free variable slots", name);
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	g_variables[slot].value = Tokenizer_GetArgFloat(1);
 
+	return CMD_RES_OK;
+}
 // tries to expand a given string into a constant
 // So, for $CH1 it will set out to given channel value
 // For $led_dimmer it will set out to current led_dimmer value
+// For $name it will set out to value of variable set by setVar
 // Etc etc
 // Returns true if constant matches
 // Returns false if no constants found
 const char *CMD_ExpandConstant(const char *s, const char *stop, float *out) {
 	const constant_t *var;
-	int i;
-	var = g_constants;
-	for (i = 0; i < g_totalConstants; i++, var++) {
-		bool bAllowWildCard = strstr(var->constantName, "*");
-		const char *ret = strCompareBound(s, var->constantName, stop, bAllowWildCard);
-		if (ret) {
-			*out = var->getValue(s);
-			ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_ExpandConstant: %s", var->name);
-			return ret;
-		}
+	const char *ret;
+	int len, slot;
+
+	var = CMD_FindConstant(s, stop, &ret);
+	if (var) {
+		*out = var->getValue(s);
+		return ret;
+	}
+	len = CMD_ParseVariableName(s, stop);
+	slot = CMD_FindVariable(s + 1, len, false);
+	if (slot >= 0) {
+		*out = g_variables[slot].value;
+		return s + 1 + len;
 	}
 	return false;
 }
@@ -519,117 +674,415 @@ char *CMD_ExpandingStrdup(const char *in) {
 	CMD_ExpandConstantsWithinString(in, ret, realLen);
 	return ret;
 }
-float CMD_EvaluateExpression(const char *s, const char *stop) {
+// Expressions are compiled into a small tree of nodes before evaluation.
+// Compiled expressions are kept by the script line, event handler or repeating
+// event that runs them, so a condition of 'if' that runs in a script loop,
+// an argument of command fired by event/change handler, or a tokenizer
+// argument like $CH1*10 is parsed only once and then just evaluated.
+typedef enum {
+	EXPNODE_CONSTANT,
+	EXPNODE_CHANNEL,
+	EXPNODE_VARIABLE,
+	EXPNODE_GETTER,
+	EXPNODE_NOT,
+	EXPNODE_OPERATOR,
+} expNodeType_t;
+
+typedef struct expNode_s {
+	byte type;
+	// for EXPNODE_OPERATOR
+	byte opCode;
+	// child node indices, for EXPNODE_OPERATOR and EXPNODE_NOT
+	short a, b;
+	// for EXPNODE_CONSTANT
+	float value;
+	// for EXPNODE_CHANNEL
+	int channel;
+	// for EXPNODE_VARIABLE, slot in g_variables (-1 if not set yet),
+	// valid for variablesGeneration, and name without '$' in e->text
+	int variable;
+	int variablesGeneration;
+	const char *variableName;
+	int variableNameLen;
+	// for EXPNODE_GETTER
+	float(*getValue)(const char *s);
+	const char *getterArg;
+} expNode_t;
+
+typedef struct expression_s {
+	int textLen;
+	// copy of expression text, getter arguments point there
+	char *text;
+	expNode_t *nodes;
+	int numNodes;
+	int maxNodes;
+	short root;
+	// next in owner list
+	struct expression_s *next;
+} expression_t;
+
+// Compiled expressions are kept by the command source that evaluates them
+// (event handler, repeating event, script line), see CMD_SetExpressionOwner.
+// A source has only a few expressions, so its list is short and searched
+// by text, most recently used first. Expressions evaluated without owner
+// (console, MQTT, HTTP, drivers) share one longer list, which is used under
+// g_sharedExpressionsMutex. If other task is using it, expression is
+// compiled, run once and freed.
+#define EXPRESSION_MAX_PER_OWNER 4
+#define EXPRESSION_MAX_SHARED 8
+#define EXPRESSION_MAX_NUMBER_LEN 32
+
+static float CMD_ApplyOperator(byte opCode, float a, float b) {
+	switch(opCode)
+	{
+	case OP_EQUAL:
+		return a == b;
+	case OP_EQUAL_OR_GREATER:
+		return a >= b;
+	case OP_EQUAL_OR_LESS:
+		return a <= b;
+	case OP_NOT_EQUAL:
+		return a != b;
+	case OP_GREATER:
+		return a > b;
+	case OP_LESS:
+		return a < b;
+	case OP_AND:
+		return ((int)a) && ((int)b);
+	case OP_OR:
+		return ((int)a) || ((int)b);
+	case OP_ADD:
+		return a + b;
+	case OP_SUB:
+		return a - b;
+	case OP_MUL:
+		return a * b;
+	case OP_DIV:
+		return a / b;
+	}
+	return 0;
+}
+static const char *CMD_TrimExpression(const char *s, const char **stop) {
+	// cull whitespaces at the end of expression
+	while(*stop > s && isspace(((int)(*stop)[-1]))) {
+		(*stop)--;
+	}
+	while (s < *stop && isspace(((int)*s))) {
+		s++;
+	}
+	return s;
+}
+// returns -1 if out of memory
+static short CMD_AllocExpressionNode(expression_t *e, byte type) {
+	expNode_t *n;
+	int newMax;
+
+	if(e->numNodes >= e->maxNodes) {
+		newMax = e->maxNodes ? e->maxNodes * 2 : 8;
+		n = realloc(e->nodes, sizeof(expNode_t) * newMax);
+		if(n == 0) {
+			return -1;
+		}
+		e->nodes = n;
+		e->maxNodes = newMax;
+	}
+	n = &e->nodes[e->numNodes];
+	memset(n, 0, sizeof(expNode_t));
+	n->type = type;
+	return e->numNodes++;
+}
+// Builds node tree for given part of expression text.
+// This follows exactly the old recursive evaluator: split at the
+// operator with the highest priority value (last one wins on ties),
+// then handle '!' prefix, constants and plain numbers.
+// Returns -1 if out of memory.
+static short CMD_CompileExpressionPart(expression_t *e, const char *s, const char *stop) {
 	byte opCode;
 	const char *op;
-	float a, b, c;
+	const char *after;
+	const constant_t *var;
+	short a, b, r;
+	char tmp[EXPRESSION_MAX_NUMBER_LEN];
 	int idx;
 
-	if(s == 0)
-		return 0;
-	if(*s == 0)
-		return 0;
+	s = CMD_TrimExpression(s, &stop);
+	if(s >= stop) {
+		r = CMD_AllocExpressionNode(e, EXPNODE_CONSTANT);
+		if(r >= 0) {
+			e->nodes[r].value = 0;
+		}
+		return r;
+	}
 
-	// cull whitespaces at the end of expression
-	if(stop == 0) {
-		stop = s + strlen(s);
+	op = CMD_FindOperator(s, stop, &opCode);
+	if(op) {
+		ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_CompileExpressionPart: operator %i",opCode);
+
+		a = CMD_CompileExpressionPart(e, s, op);
+		b = CMD_CompileExpressionPart(e, op + g_operators[opCode].len, stop);
+		if(a < 0 || b < 0) {
+			return -1;
+		}
+		// constant folding
+		if(e->nodes[a].type == EXPNODE_CONSTANT && e->nodes[b].type == EXPNODE_CONSTANT) {
+			e->nodes[a].value = CMD_ApplyOperator(opCode, e->nodes[a].value, e->nodes[b].value);
+			return a;
+		}
+		r = CMD_AllocExpressionNode(e, EXPNODE_OPERATOR);
+		if(r < 0) {
+			return -1;
+		}
+		e->nodes[r].opCode = opCode;
+		e->nodes[r].a = a;
+		e->nodes[r].b = b;
+		return r;
 	}
-	while(stop > s && isspace(((int)stop[-1]))) {
-		stop --;
+	if(s[0] == '!') {
+		a = CMD_CompileExpressionPart(e, s + 1, stop);
+		if(a < 0) {
+			return -1;
+		}
+		if(e->nodes[a].type == EXPNODE_CONSTANT) {
+			e->nodes[a].value = !e->nodes[a].value;
+			return a;
+		}
+		r = CMD_AllocExpressionNode(e, EXPNODE_NOT);
+		if(r < 0) {
+			return -1;
+		}
+		e->nodes[r].a = a;
+		return r;
 	}
-	while (isspace(((int)*s))) {
-		s++;
-		if (s >= stop) {
-			return 0;
+	var = CMD_FindConstant(s, stop, &after);
+	if(var) {
+		if(var->getValue == getChannelValue) {
+			r = CMD_AllocExpressionNode(e, EXPNODE_CHANNEL);
+			if(r < 0) {
+				return -1;
+			}
+			e->nodes[r].channel = atoi(s + 3);
+		} else {
+			r = CMD_AllocExpressionNode(e, EXPNODE_GETTER);
+			if(r < 0) {
+				return -1;
+			}
+			e->nodes[r].getValue = var->getValue;
+			// s points into e->text, so it's safe to keep it
+			e->nodes[r].getterArg = s;
+		}
+		return r;
+	}
+	// whole token is a $name; variable may not exist yet, slot is looked up
+	// when expression runs, so setVar done after compiling is still seen
+	idx = CMD_ParseVariableName(s, stop);
+	if(idx > 0 && idx < SCRIPT_VARIABLE_NAME_LEN && s + 1 + idx == stop) {
+		r = CMD_AllocExpressionNode(e, EXPNODE_VARIABLE);
+		if(r < 0) {
+			return -1;
 		}
+		// s points into e->text, so it's safe to keep it
+		e->nodes[r].variableName = s + 1;
+		e->nodes[r].variableNameLen = idx;
+		e->nodes[r].variablesGeneration = g_variablesGeneration - 1;
+		return r;
+	}
+
+	idx = stop - s;
+	if(idx >= sizeof(tmp)) {
+		idx = sizeof(tmp) - 1;
 	}
-	if(g_expDebugBuffer==0){
-		g_expDebugBuffer = malloc(EXPRESSION_DEBUG_BUFFER_SIZE);
+	memcpy(tmp, s, idx);
+	tmp[idx] = 0;
+	ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_CompileExpressionPart: will call atof for %s",tmp);
+	r = CMD_AllocExpressionNode(e, EXPNODE_CONSTANT);
+	if(r >= 0) {
+		e->nodes[r].value = atof(tmp);
 	}
-	if(1) {
-		idx = stop - s;
-		memcpy(g_expDebugBuffer,s,idx);
-		g_expDebugBuffer[idx] = 0;
-		ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will run '%s'",g_expDebugBuffer);
+	return r;
+}
+static float CMD_RunExpressionNode(const expression_t *e, int idx) {
+	expNode_t *n;
+
+	n = &e->nodes[idx];
+	switch(n->type) {
+	case EXPNODE_CONSTANT:
+		return n->value;
+	case EXPNODE_CHANNEL:
+		return CHANNEL_Get(n->channel);
+	case EXPNODE_VARIABLE:
+		if(n->variablesGeneration != g_variablesGeneration) {
+			n->variable = CMD_FindVariable(n->variableName, n->variableNameLen, false);
+			n->variablesGeneration = g_variablesGeneration;
+		}
+		if(n->variable < 0) {
+			return 0;
+		}
+		return g_variables[n->variable].value;
+	case EXPNODE_GETTER:
+		return n->getValue(n->getterArg);
+	case EXPNODE_NOT:
+		return !CMD_RunExpressionNode(e, n->a);
+	case EXPNODE_OPERATOR:
+		return CMD_ApplyOperator(n->opCode, CMD_RunExpressionNode(e, n->a), CMD_RunExpressionNode(e, n->b));
 	}
+	return 0;
+}
+static void CMD_FreeExpression(expression_t *e) {
+	free(e->nodes);
+	free(e->text);
+	free(e);
+}
+// returns NULL if out of memory
+static expression_t *CMD_CompileExpression(const char *s, int len) {
+	expression_t *e;
 
-	op = CMD_FindOperator(s, stop, &opCode);
-	if(op) {
-		const char *p2;
+	e = malloc(sizeof(expression_t));
+	if(e == 0) {
+		return 0;
+	}
+	memset(e, 0, sizeof(expression_t));
+	e->textLen = len;
+	e->text = malloc(len + 1);
+	if(e->text == 0) {
+		free(e);
+		return 0;
+	}
+	memcpy(e->text, s, len);
+	e->text[len] = 0;
+	e->root = CMD_CompileExpressionPart(e, e->text, e->text + len);
+	if(e->root < 0) {
+		CMD_FreeExpression(e);
+		return 0;
+	}
+	return e;
+}
+static expressionList_t g_sharedExpressions;
+static SemaphoreHandle_t g_sharedExpressionsMutex = 0;
+
+// finds expression in owner list or compiles and adds it there,
+// dropping the least recently used one if list has max entries
+static expression_t *CMD_GetOwnedExpression(expressionList_t *owner, const char *s, int len, int max) {
+	expression_t *e, *prev, *beforePrev;
+	int count;
+
+	prev = 0;
+	beforePrev = 0;
+	count = 0;
+	for(e = owner->first; e; e = e->next) {
+		if(e->textLen == len && !memcmp(e->text, s, len)) {
+			if(prev) {
+				// move to front
+				prev->next = e->next;
+				e->next = owner->first;
+				owner->first = e;
+			}
+			return e;
+		}
+		beforePrev = prev;
+		prev = e;
+		count++;
+	}
+	e = CMD_CompileExpression(s, len);
+	if(e == 0) {
+		return 0;
+	}
+	if(count >= max) {
+		if(beforePrev) {
+			beforePrev->next = 0;
+		} else {
+			owner->first = 0;
+		}
+		CMD_FreeExpression(prev);
+	}
+	e->next = owner->first;
+	owner->first = e;
+	return e;
+}
+// owner is kept per task, like tokenizer context
+expressionList_t *CMD_SetExpressionOwner(expressionList_t *owner) {
+	cmdTaskState_t *st = CMD_GetTaskState();
+	expressionList_t *prev = st->expressionOwner;
 
-		ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: operator %i",opCode);
+	st->expressionOwner = owner;
+	return prev;
+}
+void CMD_FreeExpressions(expressionList_t *list) {
+	expression_t *e, *next;
 
-		// first token block begins at 's' and ends at 'op'
-		// second token block begins at 'p2' and ends at NULL
-		p2 = op + g_operators[opCode].len;
+	for(e = list->first; e; e = next) {
+		next = e->next;
+		CMD_FreeExpression(e);
+	}
+	list->first = 0;
+}
+// plain number has no operators and no constants, so it's just atof
+static bool CMD_IsPlainNumber(const char *s, const char *stop) {
+	for(; s < stop; s++) {
+		if((*s < '0' || *s > '9') && *s != '.') {
+			return false;
+		}
+	}
+	return true;
+}
+float CMD_EvaluateExpression(const char *s, const char *stop) {
+	expression_t *e;
+	expressionList_t *owner;
+	float ret;
+	char tmp[EXPRESSION_MAX_NUMBER_LEN];
 
-		a = CMD_EvaluateExpression(s, op);
-		b = CMD_EvaluateExpression(p2, stop);
+	if(s == 0)
+		return 0;
+	if(*s == 0)
+		return 0;
 
-		// Why, again, %f crashes?
-		//ADDLOG_INFO(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: a = %f, b = %f", a, b);
-		// It crashes even on sprintf.
-		//sprintf(g_expDebugBuffer,"CMD_EvaluateExpression: a = %f, b = %f", a, b);
-		//ADDLOG_INFO(LOG_FEATURE_EVENT, g_expDebugBuffer);
+	if(stop == 0) {
+		stop = s + strlen(s);
+	}
+	s = CMD_TrimExpression(s, &stop);
+	if(s >= stop) {
+		return 0;
+	}
+	ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will run '%.*s'",(int)(stop-s),s);
 
-		switch(opCode)
-		{
-		case OP_EQUAL:
-			c = a == b;
-			break;
-		case OP_EQUAL_OR_GREATER:
-			c = a >= b;
-			break;
-		case OP_EQUAL_OR_LESS:
-			c = a <= b;
-			break;
-		case OP_NOT_EQUAL:
-			c = a != b;
-			break;
-		case OP_GREATER:
-			c = a > b;
-			break;
-		case OP_LESS:
-			c = a < b;
-			break;
-		case OP_AND:
-			c = ((int)a) && ((int)b);
-			break;
-		case OP_OR:
-			c = ((int)a) || ((int)b);
-			break;
-		case OP_ADD:
-			c = a + b;
-			break;
-		case OP_SUB:
-			c = a - b;
-			break;
-		case OP_MUL:
-			c = a * b;
-			break;
-		case OP_DIV:
-			c = a / b;
-			break;
-		default:
-			c = 0;
-			break;
+	if(CMD_IsPlainNumber(s, stop) && stop - s < sizeof(tmp)) {
+		memcpy(tmp, s, stop - s);
+		tmp[stop - s] = 0;
+		return atof(tmp);
+	}
+	owner = CMD_GetTaskState()->expressionOwner;
+	if(owner) {
+		e = CMD_GetOwnedExpression(owner, s, stop - s, EXPRESSION_MAX_PER_OWNER);
+		if(e == 0) {
+			ADDLOG_ERROR(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: out of memory");
+			return 0;
 		}
-		return c;
+		return CMD_RunExpressionNode(e, e->root);
 	}
-	if(s[0] == '!') {
-		return !CMD_EvaluateExpression(s+1,stop);
+	// single constant, like $CH1, is not worth compiling
+	if(CMD_ExpandConstant(s, stop, &ret) == stop) {
+		return ret;
 	}
-	if(CMD_ExpandConstant(s,stop,&c)) {
-		return c;
+	if(g_sharedExpressionsMutex == 0) {
+		g_sharedExpressionsMutex = xSemaphoreCreateMutex();
 	}
-
-	if(1) {
-		idx = stop - s;
-		memcpy(g_expDebugBuffer,s,idx);
-		g_expDebugBuffer[idx] = 0;
+	// no waiting, lock may be held by this task if getter evaluates too
+	if(xSemaphoreTake(g_sharedExpressionsMutex, 0) == pdTRUE) {
+		e = CMD_GetOwnedExpression(&g_sharedExpressions, s, stop - s, EXPRESSION_MAX_SHARED);
+		ret = e ? CMD_RunExpressionNode(e, e->root) : 0;
+		xSemaphoreGive(g_sharedExpressionsMutex);
+		if(e == 0) {
+			ADDLOG_ERROR(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: out of memory");
+		}
+		return ret;
+	}
+	e = CMD_CompileExpression(s, stop - s);
+	if(e == 0) {
+		ADDLOG_ERROR(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: out of memory");
+		return 0;
 	}
-	ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will call atof for %s",g_expDebugBuffer);
-	return atof(g_expDebugBuffer);
+	ret = CMD_RunExpressionNode(e, e->root);
+	CMD_FreeExpression(e);
+	return ret;
 }
 
 // if MQTTOnline then "qq" else "qq"
@@ -637,7 +1090,6 @@ commandResult_t CMD_If(const void *context, const char *cmd, const char *args, i
 	const char *cmdA;
 	const char *cmdB;
 	const char *condition;
-	//char buffer[256];
 	int value;
 	int argsCount;
 
@@ -676,13 +1128,8 @@ commandResult_t CMD_If(const void *context, const char *cmd, const char *args, i
 
 	value = CMD_EvaluateExpression(condition, 0);
 
-	// This buffer is here because we may need to exec commands recursively
-	// and the Tokenizer_ etc is global?
-	//if(value)
-	//	strcpy_safe(buffer,cmdA);
-	//else
-	//	strcpy_safe(buffer,cmdB);
-	//CMD_ExecuteCommand(buffer,0);
+	// cmdA and cmdB point into our tokenizer context, nested
+	// command will be tokenized in its own context, so no copy is needed
 	if(value)
 		CMD_ExecuteCommand(cmdA,0);
 	else {
@@ -7,20 +7,104 @@ typedef struct command_s {
 	const char *name;
 	commandHandler_t handler;
 	const void *context;
+	// case-folded hash of name, see CMD_GenerateKey
+	unsigned int key;
 	struct command_s *next;
 } command_t;
 
 command_t *CMD_Find(const char *name);
+command_t *CMD_FindWithSuffix(const char *name);
+commandResult_t CMD_RunHandler(command_t *c, const char *cmd, const char *args, int cmdFlags);
+// changes every time commands are freed, command_t pointers kept from
+// an older generation must not be used
+int CMD_GetCommandsGeneration();
+
+// command execution state of a single task, see CMD_GetTaskState
+typedef struct cmdTaskState_s {
+	void *task;
+	// how many commands this task is running now (nested by backlog, if, etc)
+	int commandDepth;
+	// context of running command, taken from pool by CMD_RunHandler
+	tokenizer_t *tokenizer;
+	// used by Tokenizer_* outside of command handlers, see CMD_GetTokenizer
+	tokenizer_t *defaultTokenizer;
+	// see CMD_SetExpressionOwner
+	struct expressionList_s *expressionOwner;
+} cmdTaskState_t;
+
+// state of calling task, never NULL
+cmdTaskState_t *CMD_GetTaskState();
+// current tokenizer context of calling task, never NULL
+tokenizer_t *CMD_GetTokenizer();
+// how many tokenizer contexts were ever needed at once
+int CMD_GetNumPooledTokenizers();
 // for autocompletion?
 void CMD_ListAllCommands(void *userData, void (*callback)(command_t *cmd, void *userData));
 int get_cmd(const char *s, char *dest, int maxlen, int stripnum);
 
 
+// Compiled expressions of one command source (event handler, repeating
+// event, script line). While it's set as owner, expressions evaluated by
+// commands of this source are compiled once and kept in its list.
+typedef struct expressionList_s {
+	struct expression_s *first;
+} expressionList_t;
+
 float CMD_EvaluateExpression(const char *s, const char *stop);
+// returns previous owner, so it can be restored after command returns
+expressionList_t *CMD_SetExpressionOwner(expressionList_t *owner);
+void CMD_FreeExpressions(expressionList_t *list);
 commandResult_t CMD_If(const void *context, const char *cmd, const char *args, int cmdFlags);
+commandResult_t CMD_SetVar(const void *context, const char *cmd, const char *args, int cmdFlags);
+// forgets all variables set by setVar
+void CMD_ResetVariables();
 void CMD_ExpandConstantsWithinString(const char *in, char *out, int outLen);
 const char *CMD_ExpandConstant(const char *s, const char *stop, float *out);
 
+// cmd_arena.c
+#define ARENA_CHUNK_SIZE 512
+#define ARENA_INTERN_BUCKETS 16
+
+typedef struct arena_s {
+	const char *name;
+	struct arenaChunk_s *chunks;
+	struct arenaString_s *strings[ARENA_INTERN_BUCKETS];
+	int numChunks;
+	int reservedBytes;
+	int usedBytes;
+	// statistics, not cleared by reset
+	int numAllocs;
+	int numChunkMallocs;
+	int numInternHits;
+	int numResets;
+	int numReleases;
+	int freeHeapBefore;
+	int freeHeapAfter;
+	bool bRegistered;
+	struct arena_s *nextArena;
+} arena_t;
+
+#define ARENA_INIT(name) { name }
+
+void Arena_Init();
+void *Arena_Alloc(arena_t *a, int size);
+// returns shared, read-only copy of s, owned by arena
+const char *Arena_Intern(arena_t *a, const char *s);
+// frees all memory of arena
+void Arena_Reset(arena_t *a);
+// like Arena_Reset, but also records free heap before and after for arenaStats
+void Arena_Release(arena_t *a);
+// gives all memory of arena to another one, it's freed when that one is reset.
+// Arena is empty after that and can be used again.
+void Arena_MoveTo(arena_t *a, arena_t *to);
+// cmd_tasmota.c
+byte *LFS_ReadFileToArena(const char *fname, arena_t *a);
+
+// cmd_eventHandlers.c
+int EVENT_ParseEventName(const char *s);
+// cmd_script.c
+void SVM_WakeWaitingThreads(byte eventCode, bool bHasArgument, int argument);
+
 #endif // __CMD_LOCAL_H__
 
 
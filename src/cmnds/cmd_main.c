@@ -9,6 +9,7 @@
 #include "../driver/drv_public.h"
 #include "../hal/hal_adc.h"
 #include "../hal/hal_flashVars.h"
+#include "../mqtt/new_mqtt.h"
 
 #ifdef ENABLE_LITTLEFS
 #include "../littlefs/our_lfs.h"
@@ -16,28 +17,170 @@
 #ifdef PLATFORM_BL602
 #include <wifi_mgmr_ext.h>
 #endif
+#if PLATFORM_BEKEN
+#include <FreeRTOS.h>
+#include <task.h>
+#endif
 
-#define HASH_SIZE 128
+// All commands are kept in a single list (for listing) and in a contiguous,
+// open-addressed table of precomputed, case-folded keys. Table has at least
+// twice as many slots as there are commands, so lookup is usually a single
+// key compare followed by a name compare.
+// Commands are looked up by many tasks without locking. Registration takes
+// g_commandsMutex and writes new command into a free slot, cmd pointer last,
+// so a reader either sees the whole entry or an empty slot. When table is
+// too full, a twice bigger one is filled and published with a single pointer
+// store. Old table may still be read by another task, so it is kept on
+// 'retired' list until CMD_FreeAllCommands; tables doubled while
+// CMD_Init_Early runs (no other task runs commands yet) are freed at once.
+typedef struct commandTableEntry_s {
+	unsigned int key;
+	command_t *cmd;
+} commandTableEntry_t;
+
+typedef struct commandTable_s {
+	unsigned int mask;
+	int count;
+	struct commandTable_s *retired;
+	commandTableEntry_t entries[1];
+} commandTable_t;
+
+// command nodes and alias text, released only by CMD_FreeAllCommands
+static arena_t g_commandsArena = ARENA_INIT("commands");
+static command_t* g_commands = NULL;
+static commandTable_t* volatile g_commandTable = NULL;
+static SemaphoreHandle_t g_commandsMutex = 0;
+// set when other tasks may be running commands
+static bool g_bCommandsShared = false;
+// bumped by CMD_FreeAllCommands, see CMD_GetCommandsGeneration
+static int g_commandsGeneration = 0;
+
+// Key is a djb2 style hash over name with 0x20 bit forced on every character.
+// This folds case of letters, other characters may collide, but it is only
+// a key - names are always compared afterwards.
+#define CMD_KEY_START 5381u
+#define CMD_KEY_STEP(key, c) ((key) * 33u + ((byte)(c) | 0x20))
+#define CMD_TABLE_MIN_SIZE 16
+
+static unsigned int CMD_GenerateKey(const char* s, int len) {
+	unsigned int key = CMD_KEY_START;
+
+	while (len--) {
+		key = CMD_KEY_STEP(key, *s);
+		s++;
+	}
+	return key;
+}
+// case insensitive compare of NULL-terminated name with first len characters of s
+static bool CMD_NameEquals(const char* name, const char* s, int len) {
+	// names are mostly written the same way as registered
+	if (!strncmp(name, s, len)) {
+		return name[len] == 0;
+	}
+	while (len--) {
+		if (*name != *s) {
+			// only a letter may differ, and only by case
+			if ((*name ^ *s) != 0x20 || (unsigned int)((*name | 0x20) - 'a') > 'z' - 'a')
+				return false;
+		}
+		name++;
+		s++;
+	}
+	return *name == 0;
+}
+static void CMD_TableInsert(commandTable_t* t, command_t* cmd) {
+	unsigned int i;
 
-static int generateHashValue(const char* fname) {
-	int		i;
-	int		hash;
-	int		letter;
-	unsigned char* f = (unsigned char*)fname;
+	i = cmd->key & t->mask;
+	while (t->entries[i].cmd) {
+		i = (i + 1) & t->mask;
+	}
+	t->entries[i].key = cmd->key;
+	t->entries[i].cmd = cmd;
+	t->count++;
+}
+// Called with g_commandsMutex taken. Returns false if there was no room.
+static bool CMD_AddToTable(command_t* cmd) {
+	commandTable_t* old;
+	commandTable_t* t;
+	unsigned int size, i;
+
+	old = g_commandTable;
+	if (old && (old->count + 1) * 2 <= old->mask + 1) {
+		CMD_TableInsert(old, cmd);
+		return true;
+	}
+	size = old ? (old->mask + 1) * 2 : CMD_TABLE_MIN_SIZE;
+	t = (commandTable_t*)malloc(sizeof(commandTable_t) + sizeof(commandTableEntry_t) * (size - 1));
+	if (t == 0) {
+		// table may be fuller than planned, but not full
+		if (old && old->count + 1 < old->mask + 1) {
+			CMD_TableInsert(old, cmd);
+			return true;
+		}
+		return false;
+	}
+	memset(t, 0, sizeof(commandTable_t) + sizeof(commandTableEntry_t) * (size - 1));
+	t->mask = size - 1;
+	if (old) {
+		for (i = 0; i <= old->mask; i++) {
+			if (old->entries[i].cmd) {
+				CMD_TableInsert(t, old->entries[i].cmd);
+			}
+		}
+	}
+	CMD_TableInsert(t, cmd);
+	if (old && g_bCommandsShared) {
+		t->retired = old;
+	}
+	else if (old) {
+		t->retired = old->retired;
+		free(old);
+	}
+	g_commandTable = t;
+	ADDLOG_DEBUG(LOG_FEATURE_CMD, "Command table grown to %i slots", size);
+	return true;
+}
+static void CMD_FreeTables() {
+	commandTable_t* t;
+	commandTable_t* next;
 
-	hash = 0;
-	i = 0;
-	while (f[i]) {
-		letter = tolower(f[i]);
-		hash += (letter) * (i + 119);
-		i++;
+	t = g_commandTable;
+	g_commandTable = 0;
+	while (t) {
+		next = t->retired;
+		free(t);
+		t = next;
 	}
-	hash = (hash ^ (hash >> 10) ^ (hash >> 20));
-	hash &= (HASH_SIZE - 1);
-	return hash;
+}
+static bool CMD_Mutex_Take(int del) {
+	if (g_commandsMutex == 0) {
+		g_commandsMutex = xSemaphoreCreateMutex();
+	}
+	return xSemaphoreTake(g_commandsMutex, del) == pdTRUE;
+}
+static void CMD_Mutex_Free() {
+	xSemaphoreGive(g_commandsMutex);
+}
+static command_t* CMD_FindByKey(unsigned int key, const char* name, int len) {
+	commandTable_t* t;
+	command_t* cmd;
+	unsigned int i;
+
+	t = g_commandTable;
+	if (t == 0) {
+		return 0;
+	}
+	i = key & t->mask;
+	while ((cmd = t->entries[i].cmd) != 0) {
+		if (t->entries[i].key == key && CMD_NameEquals(cmd->name, name, len)) {
+			return cmd;
+		}
+		i = (i + 1) & t->mask;
+	}
+	return 0;
 }
 
-command_t* g_commands[HASH_SIZE] = { NULL };
 bool g_powersave;
 
 static commandResult_t CMD_PowerSave(const void* context, const char* cmd, const char* args, int cmdFlags) {
@@ -194,6 +337,8 @@ static commandResult_t CMD_ClearAll(const void* context, const char* cmd, const
 	CHANNEL_ClearAllChannels();
 	CMD_ClearAllHandlers(0, 0, 0, 0);
 	RepeatingEvents_Cmd_ClearRepeatingEvents(0, 0, 0, 0);
+	MQTT_Dedup_Clear();
+	CMD_ResetVariables();
 #if defined(WINDOWS) || defined(PLATFORM_BL602) || defined(PLATFORM_BEKEN)
 	CMD_resetSVM(0, 0, 0, 0);
 #endif
@@ -339,8 +484,8 @@ static commandResult_t runcmd(const void* context, const char* cmd, const char*
 static commandResult_t CMD_CreateAliasForCommand(const void* context, const char* cmd, const char* args, int cmdFlags) {
 	const char* alias;
 	const char* ocmd;
-	char* cmdMem;
-	char* aliasMem;
+	const char* cmdMem;
+	const char* aliasMem;
 	command_t* existing;
 
 	Tokenizer_TokenizeString(args, 0);
@@ -361,8 +506,15 @@ static commandResult_t CMD_CreateAliasForCommand(const void* context, const char
 		return CMD_RES_BAD_ARGUMENT;
 	}
 
-	cmdMem = strdup(ocmd);
-	aliasMem = strdup(alias);
+	// arena is shared with CMD_RegisterCommand
+	while (CMD_Mutex_Take(100) == false) {
+	}
+	cmdMem = Arena_Intern(&g_commandsArena, ocmd);
+	aliasMem = Arena_Intern(&g_commandsArena, alias);
+	CMD_Mutex_Free();
+	if (cmdMem == 0 || aliasMem == 0) {
+		return CMD_RES_ERROR;
+	}
 
 	ADDLOG_INFO(LOG_FEATURE_CMD, "New alias has been set: %s runs %s", alias, ocmd);
 
@@ -370,7 +522,7 @@ static commandResult_t CMD_CreateAliasForCommand(const void* context, const char
 	//cmddetail:"descr":"Internal usage only. See docs for 'alias' command.",
 	//cmddetail:"fn":"runcmd","file":"cmnds/cmd_test.c","requires":"",
 	//cmddetail:"examples":""}
-	CMD_RegisterCommand(aliasMem, runcmd, cmdMem);
+	CMD_RegisterCommand(aliasMem, runcmd, (void*)cmdMem);
 	return CMD_RES_OK;
 }
 void CMD_Init_Early() {
@@ -424,6 +576,11 @@ void CMD_Init_Early() {
 	//cmddetail:"fn":"CMD_If","file":"cmnds/cmd_main.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("if", CMD_If, NULL);
+	//cmddetail:{"name":"setVar","args":"[Name][Value]",
+	//cmddetail:"descr":"Sets a script variable, which can be later read as $Name in expressions and command arguments. Value can be an expression. Up to 32 variables, names up to 15 characters.",
+	//cmddetail:"fn":"CMD_SetVar","file":"cmnds/cmd_if.c","requires":"",
+	//cmddetail:"examples":"setVar counter $counter+1"}
+	CMD_RegisterCommand("setVar", CMD_SetVar, NULL);
 	//cmddetail:{"name":"ota_http","args":"[HTTP_URL]",
 	//cmddetail:"descr":"Starts the firmware update procedure, the argument should be a reachable HTTP server file. You can easily setup HTTP server with Xampp, or Visual Code, or Python, etc. Make sure you are using OTA file for a correct platform (getting N platform RBL on T will brick device, etc etc)",
 	//cmddetail:"fn":"CMD_HTTPOTA","file":"cmnds/cmd_main.c","requires":"",
@@ -460,9 +617,12 @@ void CMD_Init_Early() {
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("SafeMode", CMD_SafeMode, NULL);
 
+	Arena_Init();
 #if (defined WINDOWS) || (defined PLATFORM_BEKEN)
 	CMD_InitScripting();
 #endif
+	// from now on other tasks may be looking up commands
+	g_bCommandsShared = true;
 	if (!bSafeMode) {
 		if (CFG_HasFlag(OBK_FLAG_CMD_ACCEPT_UART_COMMANDS)) {
 			CMD_UART_Init();
@@ -478,68 +638,102 @@ void CMD_Init_Delayed() {
 
 
 void CMD_ListAllCommands(void* userData, void (*callback)(command_t* cmd, void* userData)) {
-	int i;
 	command_t* newCmd;
 
-	for (i = 0; i < HASH_SIZE; i++) {
-		newCmd = g_commands[i];
-		while (newCmd) {
-			callback(newCmd, userData);
-			newCmd = newCmd->next;
-		}
+	newCmd = g_commands;
+	while (newCmd) {
+		callback(newCmd, userData);
+		newCmd = newCmd->next;
 	}
 
 }
+// Only for simulator restart, when no other task is running commands
 void CMD_FreeAllCommands() {
-	int i;
-	command_t* cmd, * next;
-
-	for (i = 0; i < HASH_SIZE; i++) {
-		cmd = g_commands[i];
-		while (cmd) {
-			next = cmd->next;
-			free(cmd);
-			cmd = next;
-		}
-		g_commands[i] = 0;
-	}
-
+	while (CMD_Mutex_Take(100) == false) {
+	}
+	// command nodes and alias text are in arena
+	g_commands = 0;
+	CMD_FreeTables();
+	Arena_Release(&g_commandsArena);
+	g_bCommandsShared = false;
+	g_commandsGeneration++;
+	CMD_Mutex_Free();
+}
+int CMD_GetCommandsGeneration() {
+	return g_commandsGeneration;
 }
 void CMD_RegisterCommand(const char* name, commandHandler_t handler, void* context) {
-	int hash;
 	command_t* newCmd;
+	unsigned int key;
+	int len;
 
-	// check
-	newCmd = CMD_Find(name);
+	len = strlen(name);
+	key = CMD_GenerateKey(name, len);
+	// registration must not be lost, so wait for other one to finish
+	while (CMD_Mutex_Take(100) == false) {
+	}
+	newCmd = CMD_FindByKey(key, name, len);
 	if (newCmd != 0) {
+		CMD_Mutex_Free();
 		ADDLOG_ERROR(LOG_FEATURE_CMD, "command with name %s already exists!", name);
 		return;
 	}
 	ADDLOG_DEBUG(LOG_FEATURE_CMD, "Adding command %s", name);
 
-	hash = generateHashValue(name);
-	newCmd = (command_t*)malloc(sizeof(command_t));
+	newCmd = (command_t*)Arena_Alloc(&g_commandsArena, sizeof(command_t));
+	if (newCmd == 0) {
+		CMD_Mutex_Free();
+		return;
+	}
 	newCmd->handler = handler;
 	newCmd->name = name;
-	newCmd->next = g_commands[hash];
+	newCmd->key = key;
+	newCmd->next = g_commands;
 	newCmd->context = context;
-	g_commands[hash] = newCmd;
+	if (CMD_AddToTable(newCmd) == false) {
+		CMD_Mutex_Free();
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "no memory for command %s", name);
+		return;
+	}
+	g_commands = newCmd;
+	CMD_Mutex_Free();
 }
 
 command_t* CMD_Find(const char* name) {
-	int hash;
-	command_t* newCmd;
+	unsigned int key;
+	int len;
 
-	hash = generateHashValue(name);
+	// key and length in a single pass
+	key = CMD_KEY_START;
+	for (len = 0; name[len]; len++) {
+		key = CMD_KEY_STEP(key, name[len]);
+	}
+	return CMD_FindByKey(key, name, len);
+}
 
-	newCmd = g_commands[hash];
-	while (newCmd != 0) {
-		if (!stricmp(newCmd->name, name)) {
-			return newCmd;
+// Same as CMD_Find, but if there is no command with the complete name,
+// it also tries the name cut at first digit, so "POWER1" finds "POWER".
+// Both keys are computed in a single pass over the name.
+command_t* CMD_FindWithSuffix(const char* name) {
+	command_t* cmd;
+	unsigned int key, prefixKey;
+	int len, prefixLen;
+
+	key = CMD_KEY_START;
+	prefixKey = 0;
+	prefixLen = -1;
+	for (len = 0; name[len]; len++) {
+		if (prefixLen < 0 && name[len] >= '0' && name[len] <= '9') {
+			prefixKey = key;
+			prefixLen = len;
 		}
-		newCmd = newCmd->next;
+		key = CMD_KEY_STEP(key, name[len]);
 	}
-	return 0;
+	cmd = CMD_FindByKey(key, name, len);
+	if (cmd == 0 && prefixLen >= 0) {
+		cmd = CMD_FindByKey(prefixKey, name, prefixLen);
+	}
+	return cmd;
 }
 
 // get a string up to whitespace.
@@ -565,35 +759,202 @@ int get_cmd(const char* s, char* dest, int maxlen, int stripnum) {
 }
 
 
+// Commands are executed by main loop, HTTP workers, MQTT and TCP command
+// line, each in its own task. Every task that runs commands gets a slot
+// with its own command depth, tokenizer context and expression owner.
+// A slot belongs to its task for good. It is claimed under g_cmdTaskMutex
+// and its task is set before g_cmdNumTasks grows; tasks search slots without
+// locking, but each one only looks for its own handle, which no other task
+// writes. When all slots are taken, remaining tasks share g_sharedTaskState,
+// held under g_sharedTaskMutex while their outermost command runs.
+//
+// Tokenizer context is over 1KB, too much for stacks of most tasks (TCP
+// command line has 2KB), so every running handler takes one from a pool and
+// gives it back when it returns. Pool only grows when all its contexts are
+// in use, so it holds as many contexts as commands ever ran at once.
+#define CMD_MAX_TASKS 16
+
+typedef struct cmdPooledTokenizer_s {
+	tokenizer_t tok;
+	struct cmdPooledTokenizer_s *nextFree;
+} cmdPooledTokenizer_t;
+
+static cmdTaskState_t g_cmdTasks[CMD_MAX_TASKS];
+static volatile int g_cmdNumTasks = 0;
+static cmdTaskState_t g_sharedTaskState;
+static SemaphoreHandle_t g_sharedTaskMutex = 0;
+// guards slots claiming and tokenizer pool
+static SemaphoreHandle_t g_cmdTaskMutex = 0;
+static cmdPooledTokenizer_t* g_freeTokenizers = 0;
+static int g_numPooledTokenizers = 0;
+// last resort when there is no memory for a context
+static tokenizer_t g_sharedTokenizer;
+
+static void* CMD_GetCurrentTask() {
+#if WINDOWS
+	return (void*)(size_t)GetCurrentThreadId();
+#elif PLATFORM_XR809
+	return OS_ThreadGetCurrentHandle();
+#else
+	return xTaskGetCurrentTaskHandle();
+#endif
+}
+static bool CMD_TaskMutex_Take() {
+	if (g_cmdTaskMutex == 0) {
+		g_cmdTaskMutex = xSemaphoreCreateMutex();
+	}
+	return xSemaphoreTake(g_cmdTaskMutex, 100) == pdTRUE;
+}
+static cmdTaskState_t* CMD_ClaimTaskState(void* task) {
+	cmdTaskState_t* st;
+
+	if (CMD_TaskMutex_Take() == false) {
+		return &g_sharedTaskState;
+	}
+	st = 0;
+	if (g_cmdNumTasks < CMD_MAX_TASKS) {
+		st = &g_cmdTasks[g_cmdNumTasks];
+		st->commandDepth = 0;
+		st->tokenizer = 0;
+		st->defaultTokenizer = 0;
+		st->expressionOwner = 0;
+		st->task = task;
+		g_cmdNumTasks++;
+	}
+	xSemaphoreGive(g_cmdTaskMutex);
+	return st ? st : &g_sharedTaskState;
+}
+static cmdTaskState_t* CMD_GetTaskStateOf(void* task) {
+	int i;
+
+	for (i = 0; i < g_cmdNumTasks; i++) {
+		if (g_cmdTasks[i].task == task) {
+			return &g_cmdTasks[i];
+		}
+	}
+	return CMD_ClaimTaskState(task);
+}
+cmdTaskState_t* CMD_GetTaskState() {
+	return CMD_GetTaskStateOf(CMD_GetCurrentTask());
+}
+static tokenizer_t* CMD_TakeTokenizer() {
+	cmdPooledTokenizer_t* pt;
+
+	if (CMD_TaskMutex_Take() == false) {
+		return 0;
+	}
+	pt = g_freeTokenizers;
+	if (pt) {
+		g_freeTokenizers = pt->nextFree;
+	}
+	else {
+		pt = (cmdPooledTokenizer_t*)malloc(sizeof(cmdPooledTokenizer_t));
+		if (pt) {
+			g_numPooledTokenizers++;
+		}
+	}
+	xSemaphoreGive(g_cmdTaskMutex);
+	return pt ? &pt->tok : 0;
+}
+static void CMD_GiveTokenizer(tokenizer_t* t) {
+	cmdPooledTokenizer_t* pt = (cmdPooledTokenizer_t*)t;
+
+	// context must go back, or pool would grow with every lost one
+	while (CMD_TaskMutex_Take() == false) {
+	}
+	pt->nextFree = g_freeTokenizers;
+	g_freeTokenizers = pt;
+	xSemaphoreGive(g_cmdTaskMutex);
+}
+int CMD_GetNumPooledTokenizers() {
+	return g_numPooledTokenizers;
+}
+// context for Tokenizer_* functions of calling task. Outside of command
+// handlers task uses its default context, taken from pool on first use.
+tokenizer_t* CMD_GetTokenizer() {
+	cmdTaskState_t* st;
+	void* task;
+
+	task = CMD_GetCurrentTask();
+	st = CMD_GetTaskStateOf(task);
+	if (st == &g_sharedTaskState && st->task != task) {
+		// task without a slot, outside of command
+		return &g_sharedTokenizer;
+	}
+	if (st->tokenizer) {
+		return st->tokenizer;
+	}
+	if (st->defaultTokenizer == 0 && st != &g_sharedTaskState) {
+		st->defaultTokenizer = CMD_TakeTokenizer();
+	}
+	if (st->defaultTokenizer) {
+		return st->defaultTokenizer;
+	}
+	return &g_sharedTokenizer;
+}
+
+// runs handler of already found command
+commandResult_t CMD_RunHandler(command_t* c, const char* cmd, const char* args, int cmdFlags) {
+	commandResult_t res;
+	cmdTaskState_t* st;
+	tokenizer_t* tok, * prevTok;
+	void* task;
+	bool bHoldsShared;
+
+	if (c->handler == 0) {
+		return CMD_RES_UNKNOWN_COMMAND;
+	}
+	task = CMD_GetCurrentTask();
+	st = CMD_GetTaskStateOf(task);
+	bHoldsShared = false;
+	if (st == &g_sharedTaskState && st->task != task) {
+		// nested commands of the holder don't take it again
+		if (g_sharedTaskMutex == 0) {
+			g_sharedTaskMutex = xSemaphoreCreateMutex();
+		}
+		while (xSemaphoreTake(g_sharedTaskMutex, 100) != pdTRUE) {
+		}
+		st->task = task;
+		st->tokenizer = 0;
+		st->expressionOwner = 0;
+		bHoldsShared = true;
+	}
+	// Every command gets its own tokenizer context, so commands executed from
+	// within another command (backlog, alias, if, etc) don't overwrite
+	// arguments of outer one. Without memory, context of outer one is used.
+	prevTok = st->tokenizer;
+	tok = CMD_TakeTokenizer();
+	if (tok) {
+		st->tokenizer = tok;
+	}
+	st->commandDepth++;
+	res = c->handler(c->context, cmd, args, cmdFlags);
+	st->commandDepth--;
+	st->tokenizer = prevTok;
+	if (tok) {
+		CMD_GiveTokenizer(tok);
+	}
+	if (bHoldsShared) {
+		st->task = 0;
+		xSemaphoreGive(g_sharedTaskMutex);
+	}
+	return res;
+}
+
 // execute a command from cmd and args - used below and in MQTT
 commandResult_t CMD_ExecuteCommandArgs(const char* cmd, const char* args, int cmdFlags) {
 	command_t* newCmd;
 	//int len;
 
-	// look for complete commmand
-	newCmd = CMD_Find(cmd);
+	// look for complete commmand, then for command without numeric suffix
+	newCmd = CMD_FindWithSuffix(cmd);
 	if (!newCmd) {
-		// not found, so...
-		char nonums[32];
-		// get the complete string up to numbers.
-		//len =
-		get_cmd(cmd, nonums, 32, 1);
-		newCmd = CMD_Find(nonums);
-		if (!newCmd) {
-			// if still not found, then error
-			ADDLOG_ERROR(LOG_FEATURE_CMD, "cmd %s NOT found (args %s)", cmd, args);
-			return CMD_RES_UNKNOWN_COMMAND;
-		}
-	}
-	else {
+		// if still not found, then error
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "cmd %s NOT found (args %s)", cmd, args);
+		return CMD_RES_UNKNOWN_COMMAND;
 	}
 
-	if (newCmd->handler) {
-		commandResult_t res;
-		res = newCmd->handler(newCmd->context, cmd, args, cmdFlags);
-		return res;
-	}
-	return CMD_RES_UNKNOWN_COMMAND;
+	return CMD_RunHandler(newCmd, cmd, args, cmdFlags);
 }
 
 
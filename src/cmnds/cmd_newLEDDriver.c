@@ -164,7 +164,7 @@ static void sendFullRGBCW_IfEnabled() {
 
 	snprintf(s, sizeof(s),"%02X%02X%02X%02X%02X",c[0],c[1],c[2],c[3],c[4]);
 
-	MQTT_PublishMain_StringString_DeDuped(DEDUP_LED_FINALCOLOR_RGBCW,DEDUP_EXPIRE_TIME,"led_finalcolor_rgbcw",s, 0);
+	MQTT_PublishMain_StringString_DeDuped("led_finalcolor_rgbcw", DEDUP_EXPIRE_TIME, s, 0);
 }
 
 float led_rawLerpCurrent[5] = { 0 };
@@ -479,6 +479,7 @@ void apply_smart_light() {
 #ifndef OBK_DISABLE_ALL_DRIVERS
 	DRV_DGR_OnLedFinalColorsChange(baseRGBCW);
 #endif
+	STATE_MarkChanged(STATE_FIELD_LED);
 
 	// I am not sure if it's the best place to do it
 	// NOTE: this will broadcast MQTT only if a flag is set
@@ -588,7 +589,7 @@ OBK_Publish_Result sendColorChange() {
 
 	snprintf(s, sizeof(s), "%02X%02X%02X",c[0],c[1],c[2]);
 
-	return MQTT_PublishMain_StringString_DeDuped(DEDUP_LED_BASECOLOR_RGB,DEDUP_EXPIRE_TIME,"led_basecolor_rgb",s, 0);
+	return MQTT_PublishMain_StringString_DeDuped("led_basecolor_rgb", DEDUP_EXPIRE_TIME, s, 0);
 }
 void LED_GetBaseColorString(char * s) {
 	byte c[3];
@@ -613,17 +614,17 @@ OBK_Publish_Result sendFinalColor() {
 
 	snprintf(s, sizeof(s),"%02X%02X%02X",c[0],c[1],c[2]);
 
-	return MQTT_PublishMain_StringString_DeDuped(DEDUP_LED_FINALCOLOR_RGB,DEDUP_EXPIRE_TIME,"led_finalcolor_rgb",s, 0);
+	return MQTT_PublishMain_StringString_DeDuped("led_finalcolor_rgb", DEDUP_EXPIRE_TIME, s, 0);
 }
 OBK_Publish_Result LED_SendDimmerChange() {
 	int iValue;
 
 	iValue = g_brightness0to100;
 
-	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_LED_DIMMER,DEDUP_EXPIRE_TIME,"led_dimmer", iValue, 0);
+	return MQTT_PublishMain_StringInt_DeDuped("led_dimmer", DEDUP_EXPIRE_TIME, iValue, 0);
 }
 OBK_Publish_Result sendTemperatureChange(){
-	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_LED_TEMPERATURE,DEDUP_EXPIRE_TIME,"led_temperature", (int)led_temperature_current,0);
+	return MQTT_PublishMain_StringInt_DeDuped("led_temperature", DEDUP_EXPIRE_TIME, (int)led_temperature_current,0);
 }
 float LED_GetTemperature() {
 	return led_temperature_current;
@@ -720,6 +721,10 @@ static commandResult_t temperature(const void *context, const char *cmd, const c
         ADDLOG_DEBUG(LOG_FEATURE_CMD, " temperature (%s) received with args %s",cmd,args);
 
 		Tokenizer_TokenizeString(args, 0);
+		// no argument is just a query, state is reported by caller
+		if (Tokenizer_GetArgsCount() == 0) {
+			return CMD_RES_OK;
+		}
 
 		tmp = Tokenizer_GetArgInteger(0);
 
@@ -730,7 +735,7 @@ static commandResult_t temperature(const void *context, const char *cmd, const c
 	//return 0;
 }
 OBK_Publish_Result LED_SendEnableAllState() {
-	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_LED_ENABLEALL,DEDUP_EXPIRE_TIME,"led_enableAll",g_lightEnableAll,0);
+	return MQTT_PublishMain_StringInt_DeDuped("led_enableAll", DEDUP_EXPIRE_TIME, g_lightEnableAll,0);
 }
 
 void LED_ToggleEnabled() {
@@ -1020,6 +1025,10 @@ static commandResult_t dimmer(const void *context, const char *cmd, const char *
 			}
 		} else {
 			Tokenizer_TokenizeString(args, 0);
+			// no argument is just a query, state is reported by caller
+			if (Tokenizer_GetArgsCount() == 0) {
+				return CMD_RES_OK;
+			}
 
 			iVal = Tokenizer_GetArgInteger(0);
 
@@ -144,7 +144,39 @@ enum LightMode {
 // force single argument mode
 #define TOKENIZER_FORCE_SINGLE_ARGUMENT_MODE	8
 
+#define TOKENIZER_MAX_CMD_LEN					512
+#define TOKENIZER_MAX_ARGS						32
+
+typedef struct tokenizer_s {
+	char buffer[TOKENIZER_MAX_CMD_LEN];
+	const char *args[TOKENIZER_MAX_ARGS];
+	const char *argsFrom[TOKENIZER_MAX_ARGS];
+	char argsExpanded[TOKENIZER_MAX_ARGS][8];
+	// parsed numeric values of arguments, valid if valueTypes[i] says so
+	union {
+		int i;
+		float f;
+	} values[TOKENIZER_MAX_ARGS];
+	byte valueTypes[TOKENIZER_MAX_ARGS];
+	int numArgs;
+	int flags;
+} tokenizer_t;
+
 // cmd_tokenizer.c
+// Caller-owned tokenizer context API. The context can live on the stack,
+// so it's safe to use while other commands are being tokenized.
+void TokenizerCtx_TokenizeString(tokenizer_t *t, const char* s, int flags);
+int TokenizerCtx_GetArgsCount(tokenizer_t *t);
+bool TokenizerCtx_CheckArgsCountAndPrintWarning(tokenizer_t *t, const char* cmdStr, int reqCount);
+const char* TokenizerCtx_GetArg(tokenizer_t *t, int i);
+const char* TokenizerCtx_GetArgFrom(tokenizer_t *t, int i);
+int TokenizerCtx_GetArgInteger(tokenizer_t *t, int i);
+bool TokenizerCtx_IsArgInteger(tokenizer_t *t, int i);
+float TokenizerCtx_GetArgFloat(tokenizer_t *t, int i);
+int TokenizerCtx_GetArgIntegerRange(tokenizer_t *t, int i, int rangeMin, int rangeMax);
+// Functions below work on the current context of calling task,
+// which is set for every command handler by CMD_RunHandler
+tokenizer_t *Tokenizer_SetContext(tokenizer_t *t);
 int Tokenizer_GetArgsCount();
 bool Tokenizer_CheckArgsCountAndPrintWarning(const char* cmdStr, int reqCount);
 const char* Tokenizer_GetArg(int i);
@@ -156,7 +188,7 @@ int Tokenizer_GetArgIntegerRange(int i, int rangeMax, int rangeMin);
 void Tokenizer_TokenizeString(const char* s, int flags);
 // cmd_repeatingEvents.c
 void RepeatingEvents_Init();
-void RepeatingEvents_RunUpdate(float deltaTimeSeconds);
+void RepeatingEvents_RunUpdate(int deltaMS);
 void SIM_GenerateRepeatingEventsDesc(char *o, int outLen);
 // cmd_eventHandlers.c
 void EventHandlers_Init();
@@ -244,5 +276,7 @@ commandResult_t CMD_ClearAllHandlers(const void* context, const char* cmd, const
 commandResult_t RepeatingEvents_Cmd_ClearRepeatingEvents(const void* context, const char* cmd, const char* args, int cmdFlags);
 commandResult_t CMD_resetSVM(const void* context, const char* cmd, const char* args, int cmdFlags);
 int RepeatingEvents_GetActiveCount();
+// number of distinct command texts held by repeating events
+int RepeatingEvents_GetCommandCount();
 
 #endif // __CMD_PUBLIC_H__
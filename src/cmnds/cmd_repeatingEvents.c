@@ -11,153 +11,366 @@
 
 // turn off TuyaMCU after 5 seconds
 // addRepeatingEvent 5 1 setChannel 1 0
+
+// command text, shared by all events with the same command and freed
+// with the last of them
+typedef struct eventCommand_s {
+	struct eventCommand_s *next;
+	unsigned int hash;
+	int refCount;
+	char text[1];
+} eventCommand_t;
+
 typedef struct repeatingEvent_s {
 	// command string to execute
-	char *command;
+	eventCommand_t *command;
+	// expressions compiled while running command
+	expressionList_t expressions;
 	//char *condition;
 	// how often event repeats
-	float intervalSeconds;
-	// current value until next repeat (decremented every second)
-	float currentInterval;
+	int intervalMS;
+	// absolute time of next run, in g_repeatingEventsTimeMS units
+	unsigned int nextRunMS;
 	// number of times to repeat.
 	// If set to -1, then it's infinite repeater
-	// If set to EVENT_CANCELED_TIMES, then event structure is ready to be reused
+	// If set to EVENT_CANCELED_TIMES, then event is finished or canceled
 	int times;
 	// user can set an ID and then cancel repeating event by ID
 	int userID;
+	// position in g_eventHeap, or -1 if not scheduled
+	int heapIndex;
+	// links of userID hash bucket
+	struct repeatingEvent_s *prevWithID;
+	struct repeatingEvent_s *nextWithID;
+	// link in free pool
 	struct repeatingEvent_s *next;
 } repeatingEvent_t;
 
 #define EVENT_CANCELED_TIMES -999
 
-static repeatingEvent_t *g_repeatingEvents = 0;
+// Scheduled events are kept in a binary min-heap ordered by absolute
+// deadline in milliseconds, so a tick with nothing due is a single compare.
+// Events are also linked in a small hash by userID, so cancelRepeatingEvent
+// does not need to search. Finished and canceled events go back to a free pool.
+// Events are allocated from an arena, which is dropped as a whole once no event
+// is alive. Command texts are refcounted, so a forever event does not keep
+// texts of finished one-shot events alive.
+#define EVENT_ID_HASH_SIZE 16
+#define EVENT_COMMAND_HASH_SIZE 16
+
+static arena_t g_eventsArena = ARENA_INIT("repeatingEvents");
+
+static repeatingEvent_t **g_eventHeap = 0;
+static int g_eventHeapCount = 0;
+static int g_eventHeapSize = 0;
+static repeatingEvent_t *g_eventsByID[EVENT_ID_HASH_SIZE];
+static eventCommand_t *g_eventCommands[EVENT_COMMAND_HASH_SIZE];
+static int g_numEventCommands = 0;
+static repeatingEvent_t *g_freeEvents = 0;
+// event which command is being executed right now, it's not in the heap
+static repeatingEvent_t *g_runningEvent = 0;
+static unsigned int g_repeatingEventsTimeMS = 0;
+
+// true if a is earlier than b, wrap safe
+#define EVENT_TIME_BEFORE(a, b) ((int)((a) - (b)) < 0)
+
+static unsigned int RepeatingEvents_HashCommand(const char *s, int *len) {
+	unsigned int hash = 5381;
+	const char *p;
+
+	for (p = s; *p; p++) {
+		hash = hash * 33 + (byte)*p;
+	}
+	*len = p - s;
+	return hash;
+}
+// returns shared copy of command text, with reference taken
+static eventCommand_t *RepeatingEvents_GetCommand(const char *command) {
+	eventCommand_t *c;
+	unsigned int hash;
+	int len;
+
+	hash = RepeatingEvents_HashCommand(command, &len);
+	for (c = g_eventCommands[hash % EVENT_COMMAND_HASH_SIZE]; c; c = c->next) {
+		if (c->hash == hash && !strcmp(c->text, command)) {
+			c->refCount++;
+			return c;
+		}
+	}
+	c = malloc(sizeof(eventCommand_t) + len);
+	if (c == 0) {
+		return 0;
+	}
+	memcpy(c->text, command, len + 1);
+	c->hash = hash;
+	c->refCount = 1;
+	c->next = g_eventCommands[hash % EVENT_COMMAND_HASH_SIZE];
+	g_eventCommands[hash % EVENT_COMMAND_HASH_SIZE] = c;
+	g_numEventCommands++;
+	return c;
+}
+static void RepeatingEvents_PutCommand(eventCommand_t *c) {
+	eventCommand_t **p;
+
+	if (--c->refCount > 0) {
+		return;
+	}
+	for (p = &g_eventCommands[c->hash % EVENT_COMMAND_HASH_SIZE]; *p; p = &(*p)->next) {
+		if (*p == c) {
+			*p = c->next;
+			break;
+		}
+	}
+	g_numEventCommands--;
+	free(c);
+}
+static void RepeatingEvents_HeapSet(int i, repeatingEvent_t *ev) {
+	g_eventHeap[i] = ev;
+	ev->heapIndex = i;
+}
+static void RepeatingEvents_HeapUp(int i) {
+	repeatingEvent_t *ev = g_eventHeap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!EVENT_TIME_BEFORE(ev->nextRunMS, g_eventHeap[parent]->nextRunMS))
+			break;
+		RepeatingEvents_HeapSet(i, g_eventHeap[parent]);
+		i = parent;
+	}
+	RepeatingEvents_HeapSet(i, ev);
+}
+static void RepeatingEvents_HeapDown(int i) {
+	repeatingEvent_t *ev = g_eventHeap[i];
+	int child;
+
+	while (1) {
+		child = i * 2 + 1;
+		if (child >= g_eventHeapCount)
+			break;
+		if (child + 1 < g_eventHeapCount && EVENT_TIME_BEFORE(g_eventHeap[child + 1]->nextRunMS, g_eventHeap[child]->nextRunMS))
+			child++;
+		if (!EVENT_TIME_BEFORE(g_eventHeap[child]->nextRunMS, ev->nextRunMS))
+			break;
+		RepeatingEvents_HeapSet(i, g_eventHeap[child]);
+		i = child;
+	}
+	RepeatingEvents_HeapSet(i, ev);
+}
+static bool RepeatingEvents_Schedule(repeatingEvent_t *ev) {
+	repeatingEvent_t **newHeap;
+	int newSize;
+
+	if (g_eventHeapCount >= g_eventHeapSize) {
+		newSize = g_eventHeapSize ? g_eventHeapSize * 2 : 8;
+		newHeap = realloc(g_eventHeap, sizeof(repeatingEvent_t*) * newSize);
+		if (newHeap == 0) {
+			return false;
+		}
+		g_eventHeap = newHeap;
+		g_eventHeapSize = newSize;
+	}
+	ev->nextRunMS = g_repeatingEventsTimeMS + ev->intervalMS;
+	RepeatingEvents_HeapSet(g_eventHeapCount, ev);
+	g_eventHeapCount++;
+	RepeatingEvents_HeapUp(g_eventHeapCount - 1);
+	return true;
+}
+static void RepeatingEvents_Unschedule(repeatingEvent_t *ev) {
+	repeatingEvent_t *last;
+	int i = ev->heapIndex;
+
+	if (i < 0)
+		return;
+	ev->heapIndex = -1;
+	g_eventHeapCount--;
+	if (i == g_eventHeapCount)
+		return;
+	// move last event to the freed place and restore heap order
+	last = g_eventHeap[g_eventHeapCount];
+	RepeatingEvents_HeapSet(i, last);
+	RepeatingEvents_HeapDown(i);
+	RepeatingEvents_HeapUp(last->heapIndex);
+}
+static void RepeatingEvents_LinkID(repeatingEvent_t *ev) {
+	repeatingEvent_t **bucket = &g_eventsByID[ev->userID & (EVENT_ID_HASH_SIZE - 1)];
 
+	ev->prevWithID = 0;
+	ev->nextWithID = *bucket;
+	if (*bucket)
+		(*bucket)->prevWithID = ev;
+	*bucket = ev;
+}
+static void RepeatingEvents_UnlinkID(repeatingEvent_t *ev) {
+	if (ev->prevWithID)
+		ev->prevWithID->nextWithID = ev->nextWithID;
+	else if (g_eventsByID[ev->userID & (EVENT_ID_HASH_SIZE - 1)] == ev)
+		g_eventsByID[ev->userID & (EVENT_ID_HASH_SIZE - 1)] = ev->nextWithID;
+	else
+		return;
+	if (ev->nextWithID)
+		ev->nextWithID->prevWithID = ev->prevWithID;
+	ev->prevWithID = 0;
+	ev->nextWithID = 0;
+}
+// returns event to the free pool
+static void RepeatingEvents_Release(repeatingEvent_t *ev) {
+	CMD_FreeExpressions(&ev->expressions);
+	if (ev->command) {
+		RepeatingEvents_PutCommand(ev->command);
+		ev->command = 0;
+	}
+	ev->times = EVENT_CANCELED_TIMES;
+	ev->next = g_freeEvents;
+	g_freeEvents = ev;
+}
+// stops event; if it's currently running, it will be released after its command returns
+static void RepeatingEvents_Stop(repeatingEvent_t *ev) {
+	RepeatingEvents_UnlinkID(ev);
+	RepeatingEvents_Unschedule(ev);
+	ev->times = EVENT_CANCELED_TIMES;
+	if (ev != g_runningEvent) {
+		RepeatingEvents_Release(ev);
+	}
+}
+
+// when nothing is scheduled or running, all arena memory (pool) is garbage
+static void RepeatingEvents_FreeArenaIfIdle(bool bRelease) {
+	if (g_eventHeapCount > 0 || g_runningEvent != 0 || g_eventsArena.chunks == 0) {
+		return;
+	}
+	g_freeEvents = 0;
+	if (bRelease) {
+		Arena_Release(&g_eventsArena);
+	} else {
+		Arena_Reset(&g_eventsArena);
+	}
+}
 void RepeatingEvents_CancelRepeatingEvents(int userID)
 {
-	repeatingEvent_t *ev;
+	repeatingEvent_t *ev, *next;
 
-	// reuse existing
-	for(ev = g_repeatingEvents; ev; ev = ev->next) {
+	for(ev = g_eventsByID[userID & (EVENT_ID_HASH_SIZE - 1)]; ev; ev = next) {
+		next = ev->nextWithID;
 		if(ev->userID == userID) {
-			// mark as finished
-			ev->times = EVENT_CANCELED_TIMES;
-			addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"Event with id %i and cmd %s has been canceled",ev->userID,ev->command);
+			addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"Event with id %i and cmd %s has been canceled",ev->userID,ev->command->text);
+			RepeatingEvents_Stop(ev);
 		}
 	}
-
+	RepeatingEvents_FreeArenaIfIdle(false);
 }
 void RepeatingEvents_AddRepeatingEvent(const char *command, float secondsInterval, int times, int userID)
 {
 	repeatingEvent_t *ev;
-	char *cmd_copy;
-
-	// reuse existing
-	for(ev = g_repeatingEvents; ev; ev = ev->next) {
-		// is this event canceled/empty?
-		if(ev->times == EVENT_CANCELED_TIMES) {
-			if(!strcmp(ev->command,command)) {
-				ev->intervalSeconds = secondsInterval;
-				// fire after delay
-				ev->currentInterval = secondsInterval;
-				ev->times = times;
-				return;
-			}
-		}
-	}
-	// create new
-	ev = malloc(sizeof(repeatingEvent_t));
-	if(ev == 0) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: failed to malloc new event");
+	eventCommand_t *cmd_copy;
+
+	// -1 means 'forever', other non-positive counts would never run
+	if (times <= 0 && times != -1) {
 		return;
 	}
-	cmd_copy = strdup(command);
+	// same command text, added again and again, is stored once
+	cmd_copy = RepeatingEvents_GetCommand(command);
 	if(cmd_copy == 0) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: failed to malloc command text copy");
-		free(ev);
+		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_AddRepeatingEvent: failed to malloc command text copy");
 		return;
 	}
-
-	ev->next = g_repeatingEvents;
-	g_repeatingEvents = ev;
+	// reuse from pool or create new
+	if (g_freeEvents) {
+		ev = g_freeEvents;
+		g_freeEvents = ev->next;
+	}
+	else {
+		ev = Arena_Alloc(&g_eventsArena, sizeof(repeatingEvent_t));
+		if (ev == 0) {
+			addLogAdv(LOG_ERROR, LOG_FEATURE_CMD, "RepeatingEvents_AddRepeatingEvent: failed to malloc new event");
+			RepeatingEvents_PutCommand(cmd_copy);
+			return;
+		}
+	}
+	memset(ev, 0, sizeof(repeatingEvent_t));
 	ev->command = cmd_copy;
-	ev->intervalSeconds = secondsInterval;
+	ev->intervalMS = (int)(secondsInterval * 1000.0f + 0.5f);
+	if (ev->intervalMS < 1) {
+		ev->intervalMS = 1;
+	}
 	ev->times = times;
 	ev->userID = userID;
-	// fire next frame
-	// TODO: is this what we want? or do we want to fire after full interval?
-	//ev->currentInterval = 1;
+	ev->heapIndex = -1;
 	// fire after full interval
-	ev->currentInterval = secondsInterval;
+	if (RepeatingEvents_Schedule(ev) == false) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD, "RepeatingEvents_AddRepeatingEvent: failed to grow event heap");
+		RepeatingEvents_Release(ev);
+		return;
+	}
+	RepeatingEvents_LinkID(ev);
 }
 void SIM_GenerateRepeatingEventsDesc(char *o, int outLen) {
 	repeatingEvent_t *cur;
-	//int ci = 0;
-	char buffer[32];
-	cur = g_repeatingEvents;
-	while (cur) {
-		// -1 means 'forever'
-		if (cur->times > 0 || cur->times == -1) {
-			//ci++;
-			snprintf(buffer, outLen,"ID %i, repeats %i",(int) cur->userID, (int)cur->times);
-			strcat_safe(o, buffer, outLen);
-			snprintf(buffer, outLen, ", interval %i", (int)cur->intervalSeconds);
-			snprintf(buffer, outLen, " (cur left %i), cmd: ", (int)cur->currentInterval);
-			strcat_safe(o, buffer, outLen);
-			strcat_safe(o, cur->command, outLen);
-		}
-		cur = cur->next;
+	char buffer[64];
+	int i;
+
+	for (i = 0; i < g_eventHeapCount; i++) {
+		cur = g_eventHeap[i];
+		snprintf(buffer, sizeof(buffer), "ID %i, repeats %i", (int)cur->userID, (int)cur->times);
+		strcat_safe(o, buffer, outLen);
+		snprintf(buffer, sizeof(buffer), ", interval %i ms", cur->intervalMS);
+		strcat_safe(o, buffer, outLen);
+		snprintf(buffer, sizeof(buffer), " (cur left %i ms), cmd: ", (int)(cur->nextRunMS - g_repeatingEventsTimeMS));
+		strcat_safe(o, buffer, outLen);
+		strcat_safe(o, cur->command->text, outLen);
 	}
 }
 int RepeatingEvents_GetActiveCount() {
-	repeatingEvent_t *cur;
 	int c_active;
 	
-	c_active = 0;
-	cur = g_repeatingEvents;
-	while (cur) {
-		// -1 means 'forever'
-		if (cur->times > 0 || cur->times == -1) {
-			c_active++;
-		}
-		cur = cur->next;
+	c_active = g_eventHeapCount;
+	// running event will be scheduled again if it has repeats left
+	if (g_runningEvent && g_runningEvent->times != EVENT_CANCELED_TIMES) {
+		c_active++;
 	}
 	return c_active;
 }
-void RepeatingEvents_RunUpdate(float deltaTimeSeconds) {
+int RepeatingEvents_GetCommandCount() {
+	return g_numEventCommands;
+}
+void RepeatingEvents_RunUpdate(int deltaMS) {
 	repeatingEvent_t *cur;
-	int c_checked = 0;
-	int c_ran = 0;
-
-	cur = g_repeatingEvents;
-	while(cur) {
-		c_checked++;
-		// debug only check
-		if(cur == cur->next) {
-			addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: single linked list was broken?");
-			cur->next = 0;
-			return;
+	expressionList_t *prevOwner;
+
+	g_repeatingEventsTimeMS += deltaMS;
+
+	while(g_eventHeapCount > 0) {
+		cur = g_eventHeap[0];
+		if (EVENT_TIME_BEFORE(g_repeatingEventsTimeMS, cur->nextRunMS)) {
+			// nothing more is due
+			break;
 		}
+		RepeatingEvents_Unschedule(cur);
 		// -1 means 'forever'
-		if(cur->times > 0 || cur->times == -1) {
-			cur->currentInterval-= deltaTimeSeconds;
-			if(cur->currentInterval<=0){
-				c_ran++;
-				// -1 means 'forever'
-				if(cur->times != -1) {
-					cur->times -= 1;
-					if (cur->times <= 0) {
-						// if finished all calls, mark as empty so we can reuse later
-						cur->times = EVENT_CANCELED_TIMES;
-					}
-				}
-				cur->currentInterval = cur->intervalSeconds;
-				CMD_ExecuteCommand(cur->command, COMMAND_FLAG_SOURCE_SCRIPT);
+		if(cur->times != -1) {
+			cur->times -= 1;
+			if (cur->times <= 0) {
+				// finished all calls
+				cur->times = EVENT_CANCELED_TIMES;
+				RepeatingEvents_UnlinkID(cur);
 			}
 		}
-		cur = cur->next;
+		// command may add, cancel or clear events, including this one
+		g_runningEvent = cur;
+		prevOwner = CMD_SetExpressionOwner(&cur->expressions);
+		CMD_ExecuteCommand(cur->command->text, COMMAND_FLAG_SOURCE_SCRIPT);
+		CMD_SetExpressionOwner(prevOwner);
+		g_runningEvent = 0;
+		if (cur->times == EVENT_CANCELED_TIMES) {
+			RepeatingEvents_Release(cur);
+		}
+		else if (RepeatingEvents_Schedule(cur) == false) {
+			RepeatingEvents_UnlinkID(cur);
+			RepeatingEvents_Release(cur);
+		}
 	}
-
-	//addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond checked %i events, ran %i\n",c_checked,c_ran);
+	RepeatingEvents_FreeArenaIfIdle(false);
 }
 // addRepeatingEventID 1234 5 -1 DGR_SendPower "testgr" 1 1 
 // cancelRepeatingEvent 1234
@@ -197,20 +410,20 @@ commandResult_t RepeatingEvents_Cmd_AddRepeatingEvent(const void *context, const
 	return CMD_RES_OK;
 }
 commandResult_t RepeatingEvents_Cmd_ClearRepeatingEvents(const void *context, const char *cmd, const char *args, int cmdFlags) {
-	repeatingEvent_t *cur;
-	repeatingEvent_t *rem;
 	int c = 0;
 
-	cur = g_repeatingEvents;
-	while (cur) {
-		rem = cur;
-		cur = cur->next;
-		free(rem->command);
-		free(rem);
+	while (g_eventHeapCount > 0) {
+		RepeatingEvents_Stop(g_eventHeap[g_eventHeapCount - 1]);
 		c++;
 	}
+	if (g_runningEvent && g_runningEvent->times != EVENT_CANCELED_TIMES) {
+		RepeatingEvents_Stop(g_runningEvent);
+		c++;
+	}
+	// pool goes with the arena; if called from a running event,
+	// RepeatingEvents_RunUpdate will do it once the command returns
+	RepeatingEvents_FreeArenaIfIdle(true);
 	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, "Fried %i rep. events", c);
-	g_repeatingEvents = 0;
 	return CMD_RES_OK;
 }
 commandResult_t RepeatingEvents_Cmd_CancelRepeatingEvent(const void *context, const char *cmd, const char *args, int cmdFlags) {
@@ -236,14 +449,10 @@ static commandResult_t RepeatingEvents_Cmd_ListRepeatingEvents(const void *conte
 	repeatingEvent_t *ev;
 	int c;
 
-	ev = g_repeatingEvents;
-	c = 0;
-
-	while (ev) {
-		ADDLOG_INFO(LOG_FEATURE_EVENT, "Repeater %i has ID %i, interval %i, reps %i, and command %s",
-			c,  ev->userID, ev->intervalSeconds, ev->times, ev->command);
-		ev = ev->next;
-		c++;
+	for (c = 0; c < g_eventHeapCount; c++) {
+		ev = g_eventHeap[c];
+		ADDLOG_INFO(LOG_FEATURE_EVENT, "Repeater %i has ID %i, interval %i ms, next in %i ms, reps %i, and command %s",
+			c,  ev->userID, ev->intervalMS, (int)(ev->nextRunMS - g_repeatingEventsTimeMS), ev->times, ev->command->text);
 	}
 
 	return CMD_RES_OK;
@@ -225,29 +225,257 @@ addEventHandler OnHold 20 backlog AddChannel 10 2 0 255; DGR_SendBrightness room
 
 */
 
+// Scripts are compiled once, when file is loaded by SVM_RegisterFile.
+// Each non-empty, non-comment line becomes a single instruction,
+// command names are resolved to command_t pointers, labels are
+// resolved to instruction indices and the most common script-only
+// commands (goto, delay_ms, delay_s) with constant arguments are
+// turned into opcodes, so they don't go through the command parser at all.
+enum {
+	// generic command call, args are passed as string to the handler
+	SVM_OP_COMMAND,
+	// delay by a constant amount of ms, stored in iArg
+	SVM_OP_DELAY,
+	// jump to instruction index stored in iArg
+	SVM_OP_GOTO,
+};
+
+typedef struct svmInstruction_s {
+	byte op;
+	int iArg;
+	// for SVM_OP_COMMAND - resolved command, 0 if not yet registered
+	command_t *cmd;
+	const char *cmdName;
+	const char *args;
+	// expressions compiled while running this line
+	expressionList_t expressions;
+} svmInstruction_t;
+
+typedef struct svmLabel_s {
+	const char *name;
+	int instruction;
+} svmLabel_t;
+
+// files and their compiled code are allocated from g_scriptArena
 typedef struct scriptFile_s {
-	char *fname;
+	const char *fname;
 	char *data;
+	// compiled form, points into (modified) data
+	svmInstruction_t *code;
+	int codeLen;
+	svmLabel_t *labels;
+	int numLabels;
+	// commands generation at the time cmd pointers in code were resolved
+	int cmdGeneration;
 
 	struct scriptFile_s *next;
 } scriptFile_t;
 
+typedef enum {
+	// free entry, can be reused by SVM_RegisterThread
+	SVM_THREAD_IDLE,
+	// in run queue, will execute on next tick
+	SVM_THREAD_RUNNABLE,
+	// being executed right now (g_activeThread)
+	SVM_THREAD_RUNNING,
+	// in sleep queue, ordered by wakeTimeMS
+	SVM_THREAD_SLEEPING,
+	// in wait bucket for waitEventCode
+	SVM_THREAD_WAITING,
+} svmThreadState_t;
+
 typedef struct scriptInstance_s {
 	scriptFile_t *curFile;
 	int uniqueID;
-	const char *curLine;
+	// index of next instruction to execute in curFile->code
+	int curInstruction;
+	// delay requested during current run, turned into wakeTimeMS afterwards
 	int currentDelayMS;
 
+	byte state;
+	// for SVM_THREAD_SLEEPING
+	int wakeTimeMS;
+	// for SVM_THREAD_WAITING
+	byte waitEventCode;
+	bool bWaitArgument;
+	int waitArgument;
+	// for SVM_THREAD_RUNNABLE, tick in which thread was queued
+	unsigned int queuedTick;
+	// link in run queue, sleep queue or wait bucket (depending on state)
+	struct scriptInstance_s *nextInQueue;
+
 	struct scriptInstance_s *next;
 } scriptInstance_t;
 
-#define MAX_SCRIPT_LINE 512
+#define SVM_WAIT_BUCKETS 16
+// events that may wake waiting threads, fired but not yet applied
+#define SVM_MAX_PENDING_WAKES 16
+
+typedef struct svmWake_s {
+	byte eventCode;
+	bool bHasArgument;
+	int argument;
+} svmWake_t;
 
-char *g_scrBuffer = 0;
 int svm_deltaMS;
+static arena_t g_scriptArena = ARENA_INIT("scripts");
 scriptFile_t *g_scriptFiles = 0;
 scriptInstance_t *g_scriptThreads = 0;
 scriptInstance_t *g_activeThread = 0;
+// Only runnable threads are visited each tick. Sleeping threads are kept
+// sorted by wake time, so a tick only looks at the ones that are due,
+// and threads blocked in waitFor are not visited at all until their event fires.
+static scriptInstance_t *g_runQueue = 0;
+static scriptInstance_t *g_runQueueTail = 0;
+static scriptInstance_t *g_sleepQueue = 0;
+static scriptInstance_t *g_waitBuckets[SVM_WAIT_BUCKETS];
+static int g_svmTimeMS = 0;
+static unsigned int g_svmTick = 0;
+// Events are fired from any task (MQTT, HTTP, drivers), but queues above are
+// only touched by the task running SVM_RunThreads. Wakeups are queued here
+// and applied at the start of the next tick.
+static svmWake_t g_pendingWakes[SVM_MAX_PENDING_WAKES];
+static int g_numPendingWakes = 0;
+static SemaphoreHandle_t g_svmWakeMutex = 0;
+
+static void SVM_Enqueue(scriptInstance_t *t) {
+	t->state = SVM_THREAD_RUNNABLE;
+	t->queuedTick = g_svmTick;
+	t->nextInQueue = 0;
+	if (g_runQueueTail) {
+		g_runQueueTail->nextInQueue = t;
+	} else {
+		g_runQueue = t;
+	}
+	g_runQueueTail = t;
+}
+static void SVM_Sleep(scriptInstance_t *t, int delayMS) {
+	scriptInstance_t **p;
+
+	t->state = SVM_THREAD_SLEEPING;
+	t->wakeTimeMS = g_svmTimeMS + delayMS;
+	// keep FIFO order for equal deadlines
+	p = &g_sleepQueue;
+	while (*p && (int)((*p)->wakeTimeMS - t->wakeTimeMS) <= 0) {
+		p = &(*p)->nextInQueue;
+	}
+	t->nextInQueue = *p;
+	*p = t;
+}
+static void SVM_Wait(scriptInstance_t *t) {
+	scriptInstance_t **p;
+
+	// append, so threads are woken in the order they started waiting
+	p = &g_waitBuckets[t->waitEventCode % SVM_WAIT_BUCKETS];
+	while (*p) {
+		p = &(*p)->nextInQueue;
+	}
+	t->nextInQueue = 0;
+	*p = t;
+}
+static void SVM_RemoveFromList(scriptInstance_t **p, scriptInstance_t *t) {
+	while (*p) {
+		if (*p == t) {
+			*p = t->nextInQueue;
+			return;
+		}
+		p = &(*p)->nextInQueue;
+	}
+}
+// removes thread from whatever queue it is in
+static void SVM_Unqueue(scriptInstance_t *t) {
+	scriptInstance_t *prev;
+
+	switch (t->state) {
+	case SVM_THREAD_RUNNABLE:
+		SVM_RemoveFromList(&g_runQueue, t);
+		if (g_runQueueTail == t) {
+			prev = g_runQueue;
+			while (prev && prev->nextInQueue) {
+				prev = prev->nextInQueue;
+			}
+			g_runQueueTail = prev;
+		}
+		break;
+	case SVM_THREAD_SLEEPING:
+		SVM_RemoveFromList(&g_sleepQueue, t);
+		break;
+	case SVM_THREAD_WAITING:
+		SVM_RemoveFromList(&g_waitBuckets[t->waitEventCode % SVM_WAIT_BUCKETS], t);
+		break;
+	}
+	t->nextInQueue = 0;
+}
+static void SVM_StopThread(scriptInstance_t *t) {
+	SVM_Unqueue(t);
+	// running thread is just marked, SVM_RunThreads will retire it
+	if (t->state != SVM_THREAD_RUNNING) {
+		t->state = SVM_THREAD_IDLE;
+	}
+	t->curInstruction = 0;
+	t->curFile = 0;
+	t->uniqueID = 0;
+	t->currentDelayMS = 0;
+}
+// called by SVM_RunThreads, with wakeups queued by SVM_WakeWaitingThreads
+static void SVM_ApplyWake(byte eventCode, bool bHasArgument, int argument) {
+	scriptInstance_t **p;
+	scriptInstance_t *t;
+
+	p = &g_waitBuckets[eventCode % SVM_WAIT_BUCKETS];
+	while (*p) {
+		t = *p;
+		if (t->waitEventCode == eventCode
+			&& (t->bWaitArgument == false || (bHasArgument && t->waitArgument == argument))) {
+			*p = t->nextInQueue;
+			SVM_Enqueue(t);
+		} else {
+			p = &t->nextInQueue;
+		}
+	}
+}
+void SVM_WakeWaitingThreads(byte eventCode, bool bHasArgument, int argument) {
+	svmWake_t *w;
+
+	// nobody waits for it, which is the usual case
+	if (g_waitBuckets[eventCode % SVM_WAIT_BUCKETS] == 0) {
+		return;
+	}
+	if (g_svmWakeMutex == 0) {
+		g_svmWakeMutex = xSemaphoreCreateMutex();
+	}
+	if (xSemaphoreTake(g_svmWakeMutex, 100) != pdTRUE) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "SVM: failed to queue wakeup for event %i", eventCode);
+		return;
+	}
+	if (g_numPendingWakes < SVM_MAX_PENDING_WAKES) {
+		w = &g_pendingWakes[g_numPendingWakes++];
+		w->eventCode = eventCode;
+		w->bHasArgument = bHasArgument;
+		w->argument = argument;
+	} else {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "SVM: too many wakeups, event %i dropped", eventCode);
+	}
+	xSemaphoreGive(g_svmWakeMutex);
+}
+static void SVM_ApplyPendingWakes() {
+	svmWake_t wakes[SVM_MAX_PENDING_WAKES];
+	int i, count;
+
+	if (g_numPendingWakes == 0) {
+		return;
+	}
+	if (xSemaphoreTake(g_svmWakeMutex, 100) != pdTRUE) {
+		return;
+	}
+	count = g_numPendingWakes;
+	memcpy(wakes, g_pendingWakes, sizeof(svmWake_t) * count);
+	g_numPendingWakes = 0;
+	xSemaphoreGive(g_svmWakeMutex);
+	for (i = 0; i < count; i++) {
+		SVM_ApplyWake(wakes[i].eventCode, wakes[i].bHasArgument, wakes[i].argument);
+	}
+}
 
 scriptInstance_t *SVM_RegisterThread() {
 	scriptInstance_t *r;
@@ -255,7 +483,8 @@ scriptInstance_t *SVM_RegisterThread() {
 	r = g_scriptThreads;
 
 	while(r) {
-		if(r->curLine == 0) {
+		// thread that stopped itself is still being executed, so skip it
+		if(r->curFile == 0 && r->state == SVM_THREAD_IDLE) {
 			break;
 		}
 		r = r->next;
@@ -267,11 +496,168 @@ scriptInstance_t *SVM_RegisterThread() {
 		g_scriptThreads = r;
 	}
 	r->uniqueID = 0;
-	r->curLine = 0;
+	r->curInstruction = 0;
 	r->curFile = 0;
 	r->currentDelayMS = 0;
+	r->nextInQueue = 0;
 	return r;
 }
+char *SVM_SkipWS(char *p) {
+	// skip also whitespaces
+	while(*p == ' ' || *p == '\r' || *p == '\t') {
+		p++;
+	}
+	return p;
+}
+// returns true if whole string is a decimal number like 10, -5 or 0.25
+static bool SVM_ParseNumericLiteral(const char *s, float *out) {
+	const char *p;
+	bool bHadDigit = false;
+	bool bHadDot = false;
+
+	p = s;
+	if(*p == '-')
+		p++;
+	while(*p) {
+		if(*p >= '0' && *p <= '9') {
+			bHadDigit = true;
+		} else if(*p == '.' && bHadDot == false) {
+			bHadDot = true;
+		} else {
+			return false;
+		}
+		p++;
+	}
+	if(bHadDigit == false)
+		return false;
+	*out = atof(s);
+	return true;
+}
+static int SVM_FindLabel(scriptFile_t *f, const char *label) {
+	int i;
+
+	if(label == 0)
+		return 0;
+	if (!strcmp(label, "*"))
+		return 0;
+	if (*label == 0)
+		return 0;
+
+	for(i = 0; i < f->numLabels; i++) {
+		if(!strcmp(f->labels[i].name,label)) {
+			return f->labels[i].instruction;
+		}
+	}
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Label %s not found in %s - will go to the start of file",label,f->fname);
+	// NOTE: as before, this really means end of file, so thread will quit
+	return f->codeLen;
+}
+// Splits script text into lines. First call (with out == 0) only counts,
+// second call terminates lines in place and stores the ones that are
+// not labels in out. Returns number of such lines.
+static int SVM_SplitLines(scriptFile_t *f, char **out) {
+	char *p, *start, *end;
+	int cnt;
+
+	cnt = 0;
+	p = f->data;
+	while(*p) {
+		start = SVM_SkipWS(p);
+		end = start;
+		while(*end && *end != '\n') {
+			end++;
+		}
+		p = end;
+		if(*p == '\n')
+			p++;
+		while(end > start && (end[-1]==' '||end[-1]=='\r'||end[-1]=='\t')) {
+			end--;
+		}
+		// skip empty lines and comments
+		if(end == start)
+			continue;
+		if(start[0] == '/' && start[1] == '/')
+			continue;
+		if(end[-1] == ':') {
+			if(out == 0) {
+				f->numLabels++;
+			} else {
+				end[-1] = 0;
+				f->labels[f->numLabels].name = start;
+				f->labels[f->numLabels].instruction = cnt;
+				f->numLabels++;
+			}
+			continue;
+		}
+		if(out) {
+			*end = 0;
+			out[cnt] = start;
+		}
+		cnt++;
+	}
+	return cnt;
+}
+// returns false if there was no memory, file has no code then
+static bool SVM_CompileFile(scriptFile_t *f) {
+	svmInstruction_t *in;
+	char **lines;
+	char *s;
+	float literal;
+	int i;
+
+	// first pass only counts, so we can allocate everything at once
+	f->codeLen = SVM_SplitLines(f, 0);
+	lines = malloc(sizeof(char*) * (f->codeLen + 1));
+	f->code = Arena_Alloc(&g_scriptArena, sizeof(svmInstruction_t) * (f->codeLen + 1));
+	f->labels = Arena_Alloc(&g_scriptArena, sizeof(svmLabel_t) * (f->numLabels + 1));
+	f->numLabels = 0;
+	if(lines == 0 || f->code == 0 || f->labels == 0) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "SVM: no memory to compile %s", f->fname);
+		if(lines)
+			free(lines);
+		f->codeLen = 0;
+		return false;
+	}
+	f->cmdGeneration = CMD_GetCommandsGeneration();
+	SVM_SplitLines(f, lines);
+
+	for(i = 0; i < f->codeLen; i++) {
+		in = &f->code[i];
+		s = lines[i];
+
+		in->op = SVM_OP_COMMAND;
+		in->iArg = 0;
+		in->expressions.first = 0;
+		in->cmdName = s;
+		while(*s && isWhiteSpace(*s) == false) {
+			s++;
+		}
+		if(*s) {
+			*s = 0;
+			s++;
+			while(isWhiteSpace(*s)) {
+				s++;
+			}
+		}
+		in->args = s;
+		in->cmd = CMD_FindWithSuffix(in->cmdName);
+
+		if(!stricmp(in->cmdName,"goto") && *s && strpbrk(s," \t") == 0) {
+			in->op = SVM_OP_GOTO;
+			in->iArg = SVM_FindLabel(f, s);
+		} else if(!stricmp(in->cmdName,"delay_ms") && SVM_ParseNumericLiteral(s, &literal)) {
+			in->op = SVM_OP_DELAY;
+			in->iArg = (int)literal;
+		} else if(!stricmp(in->cmdName,"delay_s") && SVM_ParseNumericLiteral(s, &literal)) {
+			in->op = SVM_OP_DELAY;
+			in->iArg = literal * 1000;
+		}
+	}
+	free(lines);
+
+	ADDLOG_DEBUG(LOG_FEATURE_CMD, "SVM: compiled %s, %i instructions, %i labels",f->fname,f->codeLen,f->numLabels);
+	return true;
+}
 
 scriptFile_t *SVM_RegisterFile(const char *fname) {
 	scriptFile_t *r;
@@ -292,152 +678,132 @@ scriptFile_t *SVM_RegisterFile(const char *fname) {
 		}
 		r = r->next;
 	}
-	r = malloc(sizeof(scriptFile_t));
+	r = Arena_Alloc(&g_scriptArena, sizeof(scriptFile_t));
+	if(r == 0)
+		return 0;
 	memset(r,0,sizeof(scriptFile_t));
-	r->fname = strdup(fname);
-	// cast from byte* to char*
-	r->data = (char*)LFS_ReadFile(fname);
+	r->fname = Arena_Intern(&g_scriptArena, fname);
+	if(r->fname == 0)
+		return 0;
+	// text is read into arena, so it goes away together with compiled code
+	r->data = (char*)LFS_ReadFileToArena(fname, &g_scriptArena);
 	r->next = g_scriptFiles;
 	g_scriptFiles = r;
 	if(r->data == 0)
 		return 0;
-	return r;
-}
-const char *SVM_SkipWS(const char *p) {
-	if(p==0)
+	if(SVM_CompileFile(r) == false) {
+		// stays registered as a file that can't be run, like a missing one
+		r->data = 0;
 		return 0;
-	// skip also whitespaces
-	while(*p == ' ' || *p == '\r' || *p == '\t') {
-		p++;
 	}
-	return p;
-}
-const char *SVM_SkipLine(const char *p) {
-	if(p==0)
-		return 0;
-	while(*p) {
-		if(*p == '\n') {
-			p++;
-			return p;
-		}
-		p++;
-	}
-	return p;
+	return r;
 }
+// commands were freed (and maybe registered again) since file was
+// compiled, so forget resolved pointers and look them up again
+static void SVM_ForgetCommands(scriptFile_t *f) {
+	int i;
 
-const char *SVM_FindLabel(const char *text, const char *label, const char *fname) {
-	int labLen;
-
-	if(label == 0)
-		return text;
-	if (!strcmp(label, "*"))
-		return text;
-	if (*label == 0)
-		return text;
-
-	labLen = strlen(label);
-
-	while(*text) {
-		text = SVM_SkipWS(text); 
-		if(strncmp(text,label,labLen) == 0 && text[labLen] == ':') {
-			return text;
-		}
-		if(text[0] == '/' && text[1] == '/') {
-			text = SVM_SkipLine(text); 
-			text = SVM_SkipWS(text); 
-		} else {
-			text = SVM_SkipLine(text); 
-			text = SVM_SkipWS(text); 
-		}
+	for(i = 0; i < f->codeLen; i++) {
+		f->code[i].cmd = 0;
 	}
-	ADDLOG_INFO(LOG_FEATURE_CMD, "Label %s not found in %s - will go to the start of file",label,fname);
-	return text;
+	f->cmdGeneration = CMD_GetCommandsGeneration();
 }
 void SVM_RunThread(scriptInstance_t *t) {
 	int maxLoops = 10;
 	int loop = 0;
-	const char *start, *end;
-	int len, p;
+	svmInstruction_t *in;
+	expressionList_t *prevOwner;
 
 	while(1) {
 		loop++;
-		if(t->curLine == 0) {
-			t->curLine = 0;
-			t->curFile = 0;
+		if(t->curFile == 0) {
 			return;
 		}
 		if (loop > maxLoops) {
 			return;
 		}
-		t->curLine = SVM_SkipWS(t->curLine); 
-		if(t->curLine[0] == 0) {
-			t->curLine = 0;
+		if(t->curInstruction >= t->curFile->codeLen) {
+			t->curInstruction = 0;
 			t->curFile = 0;
 			return;
 		}
-		if(t->curLine[0] == '/' && t->curLine[1] == '/') {
-			t->curLine = SVM_SkipLine(t->curLine); 
-			t->curLine = SVM_SkipWS(t->curLine); 
-		} else {
-			start = t->curLine;
-			end = SVM_SkipLine(start);
-			t->curLine = SVM_SkipWS(end); 
+		in = &t->curFile->code[t->curInstruction];
+		t->curInstruction++;
 
-			while(end > start && (end[-1]==' '||end[-1]=='\r'||end[-1]=='\n'||end[-1]=='\t')) {
-				end--;
+		switch(in->op) {
+		case SVM_OP_GOTO:
+			t->curInstruction = in->iArg;
+			break;
+		case SVM_OP_DELAY:
+			t->currentDelayMS += in->iArg;
+			break;
+		default:
+			if(t->curFile->cmdGeneration != CMD_GetCommandsGeneration()) {
+				SVM_ForgetCommands(t->curFile);
 			}
-			len = (end - start);
-			//ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "Script len: %i",len);
-
-			// skip empty lines and skip labels
-			if(len > 0 && start[len-1] != ':') {
-				if(len >= MAX_SCRIPT_LINE) {
-					len = MAX_SCRIPT_LINE-1;
-				}
-				memcpy(g_scrBuffer,start,len);
-				g_scrBuffer[len] = 0;
-
-				p = start-t->curFile->data;
-				///ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "[Loop %i] Script line: %s, char index %i",loop,g_scrBuffer,p);
-				CMD_ExecuteCommand(g_scrBuffer,0);
-
-				// did we get a sleep?
-				if(t->currentDelayMS > 0) {
-					return;
-				}	
+			if(in->cmd == 0) {
+				// maybe it was registered after script was loaded (driver, alias)
+				in->cmd = CMD_FindWithSuffix(in->cmdName);
 			}
+			prevOwner = CMD_SetExpressionOwner(&in->expressions);
+			if(in->cmd == 0) {
+				// this will just print a proper error
+				CMD_ExecuteCommandArgs(in->cmdName, in->args, 0);
+			} else {
+				CMD_RunHandler(in->cmd, in->cmdName, in->args, 0);
+			}
+			CMD_SetExpressionOwner(prevOwner);
+			break;
+		}
+		// did we get a sleep or a waitFor?
+		if(t->currentDelayMS > 0 || t->state == SVM_THREAD_WAITING) {
+			return;
 		}
 	}
 }
 
 void SVM_RunThreads(int deltaMS) {
-	int c_sleep, c_run;
+	scriptInstance_t *t;
 
-	c_sleep = 0;
-	c_run = 0;
 	svm_deltaMS = deltaMS;
-
-	if(g_scrBuffer == 0) {
-		g_scrBuffer = malloc(MAX_SCRIPT_LINE);
-	}
-
-	g_activeThread = g_scriptThreads;
-	while(g_activeThread) {
-		if(g_activeThread->currentDelayMS > 0) {
-			g_activeThread->currentDelayMS -= deltaMS;
-			// the following block is needed to handle with long freezes on simulator
-			if (g_activeThread->currentDelayMS < 0) {
-				g_activeThread->currentDelayMS = 0;
-			}
-			c_sleep++;
+	g_svmTimeMS += deltaMS;
+	// woken threads were queued in previous tick, so they run now
+	SVM_ApplyPendingWakes();
+	g_svmTick++;
+
+	// run threads queued before this tick; threads queued while running
+	// (woken by an event, or after using up their instruction budget) wait for next tick
+	while(g_runQueue && g_runQueue->queuedTick != g_svmTick) {
+		t = g_runQueue;
+		g_runQueue = t->nextInQueue;
+		if (g_runQueue == 0) {
+			g_runQueueTail = 0;
+		}
+		t->nextInQueue = 0;
+		t->state = SVM_THREAD_RUNNING;
+
+		g_activeThread = t;
+		SVM_RunThread(t);
+		g_activeThread = 0;
+
+		if (t->curFile == 0) {
+			t->state = SVM_THREAD_IDLE;
+			t->currentDelayMS = 0;
+		} else if (t->state == SVM_THREAD_WAITING) {
+			SVM_Wait(t);
+		} else if (t->currentDelayMS > 0) {
+			SVM_Sleep(t, t->currentDelayMS);
+			t->currentDelayMS = 0;
 		} else {
-			SVM_RunThread(g_activeThread);
-			c_run++;
+			SVM_Enqueue(t);
 		}
-		g_activeThread = g_activeThread->next;
 	}
-
-	//ADDLOG_INFO(LOG_FEATURE_CMD, "SCR sleep %i, ran %i",c_sleep,c_run);
+	// due sleepers will run on next tick
+	while (g_sleepQueue && (int)(g_sleepQueue->wakeTimeMS - g_svmTimeMS) <= 0) {
+		t = g_sleepQueue;
+		g_sleepQueue = t->nextInQueue;
+		SVM_Enqueue(t);
+	}
 }
 void SVM_GoTo(scriptInstance_t *th, const char *fname, const char *label) {
 	scriptFile_t *f;
@@ -456,36 +822,31 @@ void SVM_GoTo(scriptInstance_t *th, const char *fname, const char *label) {
 		return;
 	}
 	th->curFile = f;
-	th->curLine = SVM_FindLabel(f->data,label,f->fname);
+	th->curInstruction = SVM_FindLabel(f,label);
 
 	return;
 }
 void SVM_FreeAllFiles() {
-	scriptFile_t *f; 
-
-	f = g_scriptFiles;
-	while(f) {
-		scriptFile_t *n;
-
-		n = f->next;
-
-		free(f->data);
-		free(f->fname);
-		free(f);
+	scriptFile_t *f;
+	int i;
 
-		f = n;
+	for(f = g_scriptFiles; f; f = f->next) {
+		for(i = 0; i < f->codeLen; i++) {
+			CMD_FreeExpressions(&f->code[i].expressions);
+		}
 	}
+	// this may run from a script line, its expressions are gone now
+	CMD_SetExpressionOwner(0);
+	// files, their text and compiled code are all in arena
 	g_scriptFiles = 0;
+	Arena_Release(&g_scriptArena);
 }
 void SVM_StopAllScripts() {
 	scriptInstance_t *t;
 
 	t = g_scriptThreads;
 	while(t) {
-		t->curLine = 0;
-		t->curFile = 0;
-		t->uniqueID = 0;
-		t->currentDelayMS = 0;
+		SVM_StopThread(t);
 
 		t = t->next;
 	}
@@ -498,23 +859,20 @@ void SVM_StopScripts(int id, int bExcludeSelf) {
 		if(t == g_activeThread && bExcludeSelf) {
 			// excluded
 		} else {
-			if(t->uniqueID == id) {
-				t->curLine = 0;
-				t->curFile = 0;
-				t->uniqueID = 0;
-				t->currentDelayMS = 0;
-			} 
+			if(t->uniqueID == id && t->curFile) {
+				SVM_StopThread(t);
+			}
 		}
 		t = t->next;
 	}
 }
 void SVM_GoToLocal(scriptInstance_t *th, const char *label) {
 
-	if(th == 0) {
+	if(th == 0 || th->curFile == 0) {
 
 		return;
 	}
-	th->curLine = SVM_FindLabel(th->curFile->data,label,th->curFile->fname);
+	th->curInstruction = SVM_FindLabel(th->curFile,label);
 
 	return;
 }
@@ -541,7 +899,8 @@ void SVM_StartScript(const char *fname, const char *label, int uniqueID) {
 	}
 	th->uniqueID = uniqueID;
 	th->curFile = f;
-	th->curLine = SVM_FindLabel(f->data,label,f->fname);
+	th->curInstruction = SVM_FindLabel(f,label);
+	SVM_Enqueue(th);
 
 	if(label==0) {
 		ADDLOG_INFO(LOG_FEATURE_CMD, "CMD_StartScript: started %s at the beginning",fname);
@@ -653,6 +1012,36 @@ static commandResult_t CMD_Delay_ms(const void *context, const char *cmd, const
 	g_activeThread->currentDelayMS += del;
 
 
+	return CMD_RES_OK;
+}
+static commandResult_t CMD_WaitFor(const void *context, const char *cmd, const char *args, int cmdFlags){
+	int eventCode;
+
+	Tokenizer_TokenizeString(args,0);
+	// following check must be done after 'Tokenizer_TokenizeString',
+	// so we know arguments count in Tokenizer. 'cmd' argument is
+	// only for warning display
+	if (Tokenizer_CheckArgsCountAndPrintWarning(cmd, 1)) {
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+	if(g_activeThread == 0) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "CMD_WaitFor: this can be only used from a script");
+		return CMD_RES_ERROR;
+	}
+	eventCode = EVENT_ParseEventName(Tokenizer_GetArg(0));
+	if(eventCode == CMD_EVENT_NONE || eventCode >= CMD_EVENT_MAX_TYPES) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "CMD_WaitFor: unknown event %s", Tokenizer_GetArg(0));
+		return CMD_RES_BAD_ARGUMENT;
+	}
+
+	// thread is parked by SVM_RunThreads and woken by event dispatcher
+	g_activeThread->waitEventCode = eventCode;
+	g_activeThread->bWaitArgument = Tokenizer_GetArgsCount() > 1;
+	g_activeThread->waitArgument = Tokenizer_GetArgInteger(1);
+	g_activeThread->state = SVM_THREAD_WAITING;
+
+	ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "CMD_WaitFor: thread will wait for event %i\n",eventCode);
+
 	return CMD_RES_OK;
 }
 static commandResult_t CMD_Return(const void *context, const char *cmd, const char *args, int cmdFlags){
@@ -664,7 +1053,7 @@ static commandResult_t CMD_Return(const void *context, const char *cmd, const ch
 
 	ADDLOG_INFO(LOG_FEATURE_CMD, "CMD_Return: thread will return\n");
 	g_activeThread->curFile = 0;
-	g_activeThread->curLine = 0;
+	g_activeThread->curInstruction = 0;
 
 
 	return CMD_RES_OK;
@@ -713,7 +1102,7 @@ static commandResult_t CMD_ListScripts(const void *context, const char *cmd, con
 	t = g_scriptThreads;
 	while(t) {
 		if(t->curFile) {
-			ADDLOG_INFO(LOG_FEATURE_CMD, "[%i] Thread UID %i - at file %s",cnt,t->uniqueID,t->curFile->fname);
+			ADDLOG_INFO(LOG_FEATURE_CMD, "[%i] Thread UID %i - at file %s, state %i",cnt,t->uniqueID,t->curFile->fname,t->state);
 		} else {
 			ADDLOG_INFO(LOG_FEATURE_CMD, "[%i] Empty thread.",cnt);
 		}
@@ -738,6 +1127,8 @@ commandResult_t CMD_resetSVM(const void *context, const char *cmd, const char *a
 	SVM_StopAllScripts();
 	// clear files
 	SVM_FreeAllFiles();
+	// and variables they have set
+	CMD_ResetVariables();
 
 	return CMD_RES_OK;
 }
@@ -777,6 +1168,11 @@ void CMD_InitScripting(){
 	//cmddetail:"fn":"CMD_Delay_ms","file":"cmnds/cmd_script.c","requires":"",
 	//cmddetail:"examples":""}
     CMD_RegisterCommand("delay_ms", CMD_Delay_ms, NULL);
+	//cmddetail:{"name":"waitFor","args":"[EventName][Argument]",
+	//cmddetail:"descr":"Script-only command. Pauses current script thread until given event is fired. Event names are the same as for addEventHandler/addChangeHandler. If an argument is given, thread waits for an event with that argument (pin index for button events, new value for channel changes, state for MQTTState, etc). Waiting threads are not polled.",
+	//cmddetail:"fn":"CMD_WaitFor","file":"cmnds/cmd_script.c","requires":"",
+	//cmddetail:"examples":"waitFor Channel1 1"}
+    CMD_RegisterCommand("waitFor", CMD_WaitFor, NULL);
 	//cmddetail:{"name":"return","args":"",
 	//cmddetail:"descr":"Script-only command. Currently it just stops totally current script thread.",
 	//cmddetail:"fn":"CMD_Return","file":"cmnds/cmd_script.c","requires":"",
@@ -135,9 +135,9 @@ static commandResult_t cmnd_backlog(const void * context, const char *cmd, const
 }
 
 // Our wrapper for LFS.
-// Returns a buffer created with malloc.
-// You must free it later.
-byte *LFS_ReadFile(const char *fname) {
+// Returns a buffer allocated from given arena, or with malloc if arena is NULL.
+// Buffer from malloc must be freed later.
+static byte *LFS_ReadFileInternal(const char *fname, arena_t *a) {
 #ifdef ENABLE_LITTLEFS
 	if (lfs_present()){
 		lfs_file_t file;
@@ -161,7 +161,11 @@ byte *LFS_ReadFile(const char *fname) {
 
 			lfs_file_seek(&lfs,&file,0,LFS_SEEK_SET);
 
-			res = malloc(len+1);
+			if (a) {
+				res = Arena_Alloc(a, len+1);
+			} else {
+				res = malloc(len+1);
+			}
 			at = res;
 
 			if(res == 0) {
@@ -211,6 +215,13 @@ byte *LFS_ReadFile(const char *fname) {
 #endif
 	return 0;
 }
+byte *LFS_ReadFile(const char *fname) {
+	return LFS_ReadFileInternal(fname, 0);
+}
+// file is read straight into arena, without a temporary copy
+byte *LFS_ReadFileToArena(const char *fname, arena_t *a) {
+	return LFS_ReadFileInternal(fname, a);
+}
 
 static commandResult_t cmnd_lfsexec(const void * context, const char *cmd, const char *args, int cmdFlags){
 #ifdef ENABLE_LITTLEFS
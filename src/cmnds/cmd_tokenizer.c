@@ -7,18 +7,14 @@
 #include "../new_cfg.h"
 #include "../logging/logging.h"
 
-#define MAX_CMD_LEN 512
-#define MAX_ARGS 32
+// Current context is kept per task. Every running command has its own,
+// outside of commands task uses its default one, see CMD_GetTokenizer.
+#define TOKENIZER_VALUE_NONE	0
+#define TOKENIZER_VALUE_INT		1
+#define TOKENIZER_VALUE_FLOAT	2
 
-static char g_buffer[MAX_CMD_LEN];
-static const char *g_args[MAX_ARGS];
-static char g_argsExpanded[MAX_ARGS][8];
-static const char *g_argsFrom[MAX_ARGS];
-static int g_numArgs = 0;
-static int tok_flags = 0;
-
-#define g_bAllowQuotes (tok_flags&TOKENIZER_ALLOW_QUOTES)
-#define g_bAllowExpand (!(tok_flags&TOKENIZER_DONT_EXPAND))
+#define t_bAllowQuotes (t->flags&TOKENIZER_ALLOW_QUOTES)
+#define t_bAllowExpand (!(t->flags&TOKENIZER_DONT_EXPAND))
 
 bool isWhiteSpace(char ch) {
 	if(ch == ' ')
@@ -34,47 +30,57 @@ bool isWhiteSpace(char ch) {
 		return true;
 	return false;
 }
-bool Tokenizer_CheckArgsCountAndPrintWarning(const char *cmdString, int reqCount) {
-	if (g_numArgs >= reqCount)
+tokenizer_t *Tokenizer_SetContext(tokenizer_t *t) {
+	cmdTaskState_t *st = CMD_GetTaskState();
+	tokenizer_t *prev = st->tokenizer;
+
+	// NULL goes back to default context of task
+	st->tokenizer = t;
+	return prev;
+}
+bool TokenizerCtx_CheckArgsCountAndPrintWarning(tokenizer_t *t, const char *cmdString, int reqCount) {
+	if (t->numArgs >= reqCount)
 		return false;
-	ADDLOG_ERROR(LOG_FEATURE_CMD, "Cant run '%s', expected at least %i args (given %i)", cmdString, reqCount, g_numArgs);
+	ADDLOG_ERROR(LOG_FEATURE_CMD, "Cant run '%s', expected at least %i args (given %i)", cmdString, reqCount, t->numArgs);
 	return true;
 }
-int Tokenizer_GetArgsCount() {
-	return g_numArgs;
+int TokenizerCtx_GetArgsCount(tokenizer_t *t) {
+	return t->numArgs;
 }
-bool Tokenizer_IsArgInteger(int i) {
-	if(i >= g_numArgs)
+bool TokenizerCtx_IsArgInteger(tokenizer_t *t, int i) {
+	if(i >= t->numArgs)
 		return false;
-	return strIsInteger(g_args[i]);
+	return strIsInteger(t->args[i]);
 }
-const char *Tokenizer_GetArg(int i) {
+const char *TokenizerCtx_GetArg(tokenizer_t *t, int i) {
 	const char *s;
 
-	if(i >= g_numArgs)
+	if(i >= t->numArgs)
 		return 0;
 
-	s = g_args[i];
+	s = t->args[i];
 
-	if(g_bAllowExpand && s[0] == '$' && s[1] == 'C' && s[2] == 'H') {
+	if(t_bAllowExpand && s[0] == '$' && s[1] == 'C' && s[2] == 'H') {
 		int channelIndex;
 		int value;
 
 		channelIndex = atoi(s+3);
 		value = CHANNEL_Get(channelIndex);
 		
-		sprintf(g_argsExpanded[i],"%i",value);
+		sprintf(t->argsExpanded[i],"%i",value);
 
-		return g_argsExpanded[i];
+		return t->argsExpanded[i];
 	}
 
-	return g_args[i];
+	return t->args[i];
 }
-const char *Tokenizer_GetArgFrom(int i) {
-	return g_argsFrom[i];
+const char *TokenizerCtx_GetArgFrom(tokenizer_t *t, int i) {
+	if(i >= t->numArgs)
+		return 0;
+	return t->argsFrom[i];
 }
-int Tokenizer_GetArgIntegerRange(int i, int rangeMin, int rangeMax) {
-	int ret = Tokenizer_GetArgInteger(i);
+int TokenizerCtx_GetArgIntegerRange(tokenizer_t *t, int i, int rangeMin, int rangeMax) {
+	int ret = TokenizerCtx_GetArgInteger(t, i);
 	if(ret < rangeMin) {
 		ret = rangeMin;
 		ADDLOG_ERROR(LOG_FEATURE_CMD, "Argument %i (val=%i) was out of range [%i,%i], clamped",i,ret,rangeMax,rangeMin);
@@ -85,70 +91,99 @@ int Tokenizer_GetArgIntegerRange(int i, int rangeMin, int rangeMax) {
 	}
 	return ret;
 }
-int Tokenizer_GetArgInteger(int i) {
-	const char *s;
+// Values of arguments referring to constants like $CH1 may change while
+// the command runs, so only plain numbers and expressions are cached
+static bool Tokenizer_IsArgCacheable(const char *s) {
+	return strchr(s, '$') == 0;
+}
+static int Tokenizer_ParseInteger(tokenizer_t *t, const char *s) {
 	int ret;
 
-	s = g_args[i];
-	if (s == 0)
-		return 0;
 	if(s[0] == '0' && s[1] == 'x') {
 		sscanf(s, "%x", &ret);
 		return ret;
 	}
 #if (!PLATFORM_BEKEN && !WINDOWS)
-	if(g_bAllowExpand && s[0] == '$') {
+	if(t_bAllowExpand && s[0] == '$') {
 		// constant
-		int channelIndex;
 		if(s[1] == 'C' && s[2] == 'H') {
-			channelIndex = atoi(s+3);
-			return CHANNEL_Get(channelIndex);
+			return CHANNEL_Get(atoi(s+3));
 		}
 	}
 #else
-	// TODO: make sure it's ok
 	// It is supposed to handle expressions like:
 	// - 5*10
 	// - $CH5+$CH11
 	// - $CH8*10
-	if(g_bAllowExpand) {
+	if(t_bAllowExpand) {
 		ret = CMD_EvaluateExpression(s,0);
 		return ret;
 	}
 #endif
 	return atoi(s);
 }
-float Tokenizer_GetArgFloat(int i) {
-#if !PLATFORM_BEKEN
-	int channelIndex;
-#endif
-	const char *s;
-	s = g_args[i];
+static float Tokenizer_ParseFloat(tokenizer_t *t, const char *s) {
 #if (!PLATFORM_BEKEN && !WINDOWS)
-	if(g_bAllowExpand && s[0] == '$') {
+	if(t_bAllowExpand && s[0] == '$') {
 		// constant
 		if(s[1] == 'C' && s[2] == 'H') {
-			channelIndex = atoi(s+3);
-			return CHANNEL_Get(channelIndex);
+			return CHANNEL_Get(atoi(s+3));
 		}
 	}
 #else
-	// TODO: make sure it's ok
 	// It is supposed to handle expressions like:
 	// - 5*10
 	// - $CH5+$CH11
 	// - $CH8*10
-	if(g_bAllowExpand) {
+	if(t_bAllowExpand) {
 		return CMD_EvaluateExpression(s,0);
 	}
 #endif
 	return atof(s);
 }
-void Tokenizer_TokenizeString(const char *s, int flags) {
+int TokenizerCtx_GetArgInteger(tokenizer_t *t, int i) {
+	const char *s;
+	int ret;
+
+	if (i >= t->numArgs)
+		return 0;
+	if (t->valueTypes[i] == TOKENIZER_VALUE_INT)
+		return t->values[i].i;
+	s = t->args[i];
+	ret = Tokenizer_ParseInteger(t, s);
+	if (Tokenizer_IsArgCacheable(s)) {
+		t->values[i].i = ret;
+		t->valueTypes[i] = TOKENIZER_VALUE_INT;
+	}
+	return ret;
+}
+float TokenizerCtx_GetArgFloat(tokenizer_t *t, int i) {
+	const char *s;
+	float ret;
+
+	if (i >= t->numArgs)
+		return 0;
+	if (t->valueTypes[i] == TOKENIZER_VALUE_FLOAT)
+		return t->values[i].f;
+	s = t->args[i];
+	ret = Tokenizer_ParseFloat(t, s);
+	if (Tokenizer_IsArgCacheable(s)) {
+		t->values[i].f = ret;
+		t->valueTypes[i] = TOKENIZER_VALUE_FLOAT;
+	}
+	return ret;
+}
+static void Tokenizer_AddArg(tokenizer_t *t, const char *s, const char *arg) {
+	t->args[t->numArgs] = arg;
+	t->argsFrom[t->numArgs] = s + (arg - t->buffer);
+	t->valueTypes[t->numArgs] = TOKENIZER_VALUE_NONE;
+	t->numArgs++;
+}
+void TokenizerCtx_TokenizeString(tokenizer_t *t, const char *s, int flags) {
 	char *p;
 
-	tok_flags = flags;
-	g_numArgs = 0;
+	t->flags = flags;
+	t->numArgs = 0;
 
 	if(s == 0) {
 		return;
@@ -162,56 +197,45 @@ void Tokenizer_TokenizeString(const char *s, int flags) {
 		return;
 	}
 
-	// not really needed, but nice for testing
-	memset(g_args, 0, sizeof(g_args));
-	memset(g_argsFrom, 0, sizeof(g_argsFrom));
-
 	if (flags & TOKENIZER_ALTERNATE_EXPAND_AT_START) {
-		CMD_ExpandConstantsWithinString(s, g_buffer, sizeof(g_buffer));
+		CMD_ExpandConstantsWithinString(s, t->buffer, sizeof(t->buffer));
 	} else {
-		strcpy_safe(g_buffer, s, sizeof(g_buffer));
+		strcpy_safe(t->buffer, s, sizeof(t->buffer));
 	}
 	if (flags & TOKENIZER_FORCE_SINGLE_ARGUMENT_MODE) {
-		g_args[g_numArgs] = g_buffer;
-		g_argsFrom[g_numArgs] = g_buffer;
-		g_numArgs = 1;
+		t->args[0] = t->buffer;
+		t->argsFrom[0] = t->buffer;
+		t->valueTypes[0] = TOKENIZER_VALUE_NONE;
+		t->numArgs = 1;
 		return;
 	}
-	p = g_buffer;
+	p = t->buffer;
 	// we need to rewrite this function and check it well with unit tests
 	if (*p == '"') {
 		goto quote;
 	}
-	g_args[g_numArgs] = p;
-	g_argsFrom[g_numArgs] = (s+(p-g_buffer));
-	g_numArgs++;
+	Tokenizer_AddArg(t, s, p);
 	while(*p != 0) {
 		if(isWhiteSpace(*p)) {
 			*p = 0;
 			if(p[1] != 0 && isWhiteSpace(p[1])==false) {
 				// we need to rewrite this function and check it well with unit tests
-				if(g_bAllowQuotes && p[1] == '"') { 
+				if(t_bAllowQuotes && p[1] == '"') { 
 					p++;
 					goto quote;
 				}
-				g_args[g_numArgs] = p+1;
-				g_argsFrom[g_numArgs] = (s+((p+1)-g_buffer));
-				g_numArgs++;
+				Tokenizer_AddArg(t, s, p + 1);
 			}
 		}
 		if(*p == ',') {
 			*p = 0;
-			g_args[g_numArgs] = p+1;
-			g_argsFrom[g_numArgs] = (s+((p+1)-g_buffer));
-			g_numArgs++;
+			Tokenizer_AddArg(t, s, p + 1);
 		}
-		if(g_bAllowQuotes && *p == '"') {
+		if(t_bAllowQuotes && *p == '"') {
 quote:
 			*p = 0;
-			g_argsFrom[g_numArgs] = (s+((p+1)-g_buffer));
 			p++;
-			g_args[g_numArgs] = p;
-			g_numArgs++;
+			Tokenizer_AddArg(t, s, p);
 			while(*p != 0) {
 				if(*p == '"') {
 					*p = 0;
@@ -220,7 +244,7 @@ quote:
 				p++;
 			}
 		}
-		if(g_numArgs>=MAX_ARGS) {
+		if(t->numArgs>=TOKENIZER_MAX_ARGS) {
 			ADDLOG_ERROR(LOG_FEATURE_CMD, "Too many args, skipped all after 32nd.");
 			break;
 		}
@@ -229,3 +253,32 @@ quote:
 
 
 }
+
+// current context wrappers, used by command handlers
+bool Tokenizer_CheckArgsCountAndPrintWarning(const char *cmdString, int reqCount) {
+	return TokenizerCtx_CheckArgsCountAndPrintWarning(CMD_GetTokenizer(), cmdString, reqCount);
+}
+int Tokenizer_GetArgsCount() {
+	return CMD_GetTokenizer()->numArgs;
+}
+bool Tokenizer_IsArgInteger(int i) {
+	return TokenizerCtx_IsArgInteger(CMD_GetTokenizer(), i);
+}
+const char *Tokenizer_GetArg(int i) {
+	return TokenizerCtx_GetArg(CMD_GetTokenizer(), i);
+}
+const char *Tokenizer_GetArgFrom(int i) {
+	return TokenizerCtx_GetArgFrom(CMD_GetTokenizer(), i);
+}
+int Tokenizer_GetArgIntegerRange(int i, int rangeMin, int rangeMax) {
+	return TokenizerCtx_GetArgIntegerRange(CMD_GetTokenizer(), i, rangeMin, rangeMax);
+}
+int Tokenizer_GetArgInteger(int i) {
+	return TokenizerCtx_GetArgInteger(CMD_GetTokenizer(), i);
+}
+float Tokenizer_GetArgFloat(int i) {
+	return TokenizerCtx_GetArgFloat(CMD_GetTokenizer(), i);
+}
+void Tokenizer_TokenizeString(const char *s, int flags) {
+	TokenizerCtx_TokenizeString(CMD_GetTokenizer(), s, flags);
+}
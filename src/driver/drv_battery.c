@@ -20,6 +20,7 @@ static float g_vref = 2400, g_vdivider = 2.29, g_maxbatt = 3000, g_minbatt = 200
 static void Batt_Measure() {
 	//this command has only been tested on CBU
 	float batt_ref, batt_res, vref;
+	float prevLevel = g_battlevel, prevVoltage = g_battvoltage;
 	ADDLOG_INFO(LOG_FEATURE_DRV, "DRV_BATTERY : Measure Battery volt en perc");
 	g_pin_adc = PIN_FindPinIndexForRole(IOR_BAT_ADC, g_pin_adc);
 	if (PIN_FindPinIndexForRole(IOR_BAT_Relay, -1) == -1) {
@@ -58,6 +59,9 @@ static void Batt_Measure() {
 	MQTT_PublishMain_StringInt("battery", (int)g_battlevel);
 	g_lastbattlevel = (int)g_battlevel;
 	g_lastbattvoltage = (int)g_battvoltage;
+	if (g_battlevel != prevLevel || g_battvoltage != prevVoltage) {
+		STATE_MarkChanged(STATE_FIELD_DRIVERS);
+	}
 	ADDLOG_INFO(LOG_FEATURE_DRV, "DRV_BATTERY : battery voltage : %f and percentage %f%%", g_battvoltage, g_battlevel);
 }
 
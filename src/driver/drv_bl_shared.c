@@ -347,6 +347,9 @@ void BL_ProcessUpdate(float voltage, float current, float power)
 			current = 0.0f;
 	}
 
+    // web panel shows them, so it must know they changed
+    if (lastReadings[OBK_POWER] != power || lastReadings[OBK_VOLTAGE] != voltage || lastReadings[OBK_CURRENT] != current)
+        STATE_MarkChanged(STATE_FIELD_DRIVERS);
     // those are final values, like 230V
     lastReadings[OBK_POWER] = power;
     lastReadings[OBK_VOLTAGE] = voltage;
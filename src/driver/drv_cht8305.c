@@ -83,8 +83,12 @@ void CHT8305_Init() {
 
 
 void CHT8305_OnEverySecond() {
+	float prevTemp = g_temp, prevHumid = g_humid;
 
 	CHT8305_ReadEnv(&g_temp, &g_humid);
+	if (g_temp != prevTemp || g_humid != prevHumid) {
+		STATE_MarkChanged(STATE_FIELD_DRIVERS);
+	}
 
 	channel_temp = g_cfg.pins.channels[g_softI2C.pin_data];
 	channel_humid = g_cfg.pins.channels2[g_softI2C.pin_data];
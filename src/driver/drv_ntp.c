@@ -6,6 +6,7 @@
 
 #include "../new_common.h"
 #include "../new_cfg.h"
+#include "../new_pins.h"
 // Commands register, execution API and cmd tokenizer
 #include "../cmnds/cmd_public.h"
 #include "../httpserver/new_http.h"
@@ -125,6 +126,7 @@ void NTP_SetSimulatedTime(unsigned int timeNow) {
 	g_time += g_timeOffsetSeconds;
 	g_synced = true;
 	b_ntp_simulatedTime = true;
+	STATE_MarkChanged(STATE_FIELD_DRIVERS);
 }
 #endif
 void NTP_Init() {
@@ -155,6 +157,7 @@ void NTP_Init() {
 
     addLogAdv(LOG_INFO, LOG_FEATURE_NTP, "NTP driver initialized with server=%s, offset=%d", CFG_GetNTPServer(), g_timeOffsetSeconds);
     g_synced = false;
+    STATE_MarkChanged(STATE_FIELD_DRIVERS);
 }
 
 unsigned int NTP_GetCurrentTime() {
@@ -282,7 +285,10 @@ void NTP_CheckForReceive() {
     ltm = localtime((time_t*)&g_time);
     addLogAdv(LOG_INFO, LOG_FEATURE_NTP,"Local Time : %04d/%02d/%02d %02d:%02d:%02d",
             ltm->tm_year+1900, ltm->tm_mon+1, ltm->tm_mday, ltm->tm_hour, ltm->tm_min, ltm->tm_sec);
-    g_synced = true;
+    if (g_synced == false) {
+        g_synced = true;
+        STATE_MarkChanged(STATE_FIELD_DRIVERS);
+    }
 #if 0
     //ptm = localtime (&g_time);
     ptm = gmtime(&g_time);
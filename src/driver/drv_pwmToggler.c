@@ -97,6 +97,7 @@ void apply(int index) {
 	}
 	publish_enableState(index);
 	publish_value(index);
+	STATE_MarkChanged(STATE_FIELD_DRIVERS);
 }
 void Toggler_Set(int index, int value) {
 	if (index < 0)
@@ -133,6 +134,7 @@ commandResult_t Toggler_NameX(const void *context, const char *cmd, const char *
 	if (g_names[index])
 		free(g_names[index]);
 	g_names[index] = strdup(args);
+	STATE_MarkChanged(STATE_FIELD_DRIVERS);
 
 	return CMD_RES_OK;
 }
@@ -21,6 +21,12 @@ static bool g_shtper = false;
 static softI2C_t g_softI2C;
 
 
+// web panel shows last reading, so tell it only when that changes
+static void SHT3X_MarkIfChanged(float prevTemp, float prevHumid) {
+	if (g_temp != prevTemp || g_humid != prevHumid) {
+		STATE_MarkChanged(STATE_FIELD_DRIVERS);
+	}
+}
 commandResult_t SHT3X_Calibrate(const void* context, const char* cmd, const char* args, int cmdFlags) {
 
 	Tokenizer_TokenizeString(args, TOKENIZER_ALLOW_QUOTES | TOKENIZER_DONT_EXPAND);
@@ -107,6 +113,7 @@ commandResult_t SHT3X_Heater(const void* context, const char* cmd, const char* a
 }
 
 void SHT3X_MeasurePercmd() {
+	float prevTemp = g_temp, prevHumid = g_humid;
 #if WINDOWS
 	// TODO: values for simulator so I can test SHT30 
 	// on my Windows machine
@@ -139,6 +146,7 @@ void SHT3X_MeasurePercmd() {
 
 	g_temp = (int)((g_temp + g_caltemp) * 10.0) / 10.0f;
 	g_humid = (int)(g_humid + g_calhum);
+	SHT3X_MarkIfChanged(prevTemp, prevHumid);
 
 	channel_temp = g_cfg.pins.channels[g_softI2C.pin_data];
 	channel_humid = g_cfg.pins.channels2[g_softI2C.pin_data];
@@ -153,6 +161,7 @@ commandResult_t SHT3X_MeasurePer(const void* context, const char* cmd, const cha
 	return CMD_RES_OK;
 }
 void SHT3X_Measurecmd() {
+	float prevTemp = g_temp, prevHumid = g_humid;
 #if WINDOWS
 	// TODO: values for simulator so I can test SHT30 
 	// on my Windows machine
@@ -186,6 +195,7 @@ void SHT3X_Measurecmd() {
 
 	g_temp = (int)((g_temp + g_caltemp) * 10.0) / 10.0f;
 	g_humid = (int)(g_humid + g_calhum);
+	SHT3X_MarkIfChanged(prevTemp, prevHumid);
 
 	channel_temp = g_cfg.pins.channels[g_softI2C.pin_data];
 	channel_humid = g_cfg.pins.channels2[g_softI2C.pin_data];
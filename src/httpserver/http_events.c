@@ -0,0 +1,370 @@
+#include "../new_common.h"
+#include "../logging/logging.h"
+#include "../new_pins.h"
+#include "lwip/sockets.h"
+#include "new_http.h"
+#include "http_fns.h"
+#include "http_events.h"
+
+/*
+Server-Sent Events stream.
+
+GET /events keeps the response open and pushes:
+	event: ch	data: {"v":<version>,"ch":[[index,value,type]]}
+	event: mqtt	data: {"v":<version>,"mqtt":<state>}
+	event: log	data: <log line>
+'v' and event id are the same versions as in 'state' reply, so client can
+read full state with 'state' once and then only apply events.
+
+Events are queued per client by whoever produces them (channel change can
+happen in any thread) and sent by HTTP server loop without blocking.
+Every client has a small fixed backlog, if it can't keep up the oldest
+events are dropped. Event that is already partially sent is never dropped,
+so stream stays well-formed.
+*/
+
+// events kept for a client that is not reading fast enough
+#define SSE_BACKLOG_EVENTS 8
+// whole event text, with 'event:', 'id:' and 'data:' lines
+#define SSE_EVENT_MAX 160
+// comment is sent after this many idle seconds, so dead clients are found
+#define SSE_KEEPALIVE_SECONDS 15
+// longer log lines are cut
+#define SSE_LOG_READ_SIZE 128
+// at most this many log reads per frame, backlog would drop more anyway
+#define SSE_LOG_READS_PER_FRAME 8
+
+#if WINDOWS
+// accepted sockets are non-blocking already
+#define SSE_SEND_FLAGS 0
+#define SSE_WOULD_BLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+#define SSE_CLOSE(fd) closesocket(fd)
+#else
+#define SSE_SEND_FLAGS MSG_DONTWAIT
+#define SSE_WOULD_BLOCK() (errno == EWOULDBLOCK || errno == EAGAIN)
+#define SSE_CLOSE(fd) lwip_close(fd)
+#endif
+
+typedef struct sseEvent_s {
+	short len;
+	char text[SSE_EVENT_MAX];
+} sseEvent_t;
+
+typedef struct sseClient_s {
+	bool bUsed;
+	int fd;
+	int types;
+	sseEvent_t events[SSE_BACKLOG_EVENTS];
+	// indices into events, first numQueued are queued (oldest first), rest are free
+	byte queue[SSE_BACKLOG_EVENTS];
+	int numQueued;
+	// bytes of queue[0] already sent
+	int sentBytes;
+	int dropped;
+	int lastSend;
+} sseClient_t;
+
+static sseClient_t g_sseClients[SSE_MAX_CLIENTS];
+static int g_sseNumClients = 0;
+static SemaphoreHandle_t g_sseMutex = 0;
+static int g_sseLastSecond = -1;
+static int g_sseMQTTVersion = -1;
+// log text read so far, it may end with a part of line
+static char g_sseLogLine[SSE_LOG_READ_SIZE];
+static int g_sseLogUsed = 0;
+
+void SSE_Init() {
+	if (g_sseMutex == 0) {
+		g_sseMutex = xSemaphoreCreateMutex();
+	}
+}
+int SSE_GetNumClients() {
+	return g_sseNumClients;
+}
+// removes event at given position of queue, its slot becomes free
+static void SSE_Unqueue(sseClient_t* c, int pos) {
+	byte idx;
+
+	idx = c->queue[pos];
+	memmove(c->queue + pos, c->queue + pos + 1, c->numQueued - pos - 1);
+	c->numQueued--;
+	c->queue[c->numQueued] = idx;
+}
+static void SSE_Queue(sseClient_t* c, const char* text, int len) {
+	sseEvent_t* e;
+
+	if (c->numQueued >= SSE_BACKLOG_EVENTS) {
+		// drop the oldest, or the one after it if the oldest is being sent
+		SSE_Unqueue(c, c->sentBytes ? 1 : 0);
+		c->dropped++;
+	}
+	e = &c->events[c->queue[c->numQueued]];
+	c->numQueued++;
+	memcpy(e->text, text, len);
+	e->len = len;
+}
+// Caller must hold mutex.
+static void SSE_FreeClient(sseClient_t* c) {
+	c->bUsed = false;
+	g_sseNumClients--;
+}
+static int SSE_FormatEvent(char* out, const char* event, int id, const char* data, int dataLen) {
+	int len;
+
+	if (id) {
+		len = snprintf(out, SSE_EVENT_MAX, "event: %s\nid: %i\ndata: ", event, id);
+	}
+	else {
+		len = snprintf(out, SSE_EVENT_MAX, "event: %s\ndata: ", event);
+	}
+	// too long data is cut, but event must always end with empty line
+	if (dataLen > SSE_EVENT_MAX - 2 - len) {
+		dataLen = SSE_EVENT_MAX - 2 - len;
+	}
+	memcpy(out + len, data, dataLen);
+	len += dataLen;
+	out[len++] = '\n';
+	out[len++] = '\n';
+	return len;
+}
+void SSE_Push(int type, const char* event, int id, const char* data, int dataLen) {
+	char text[SSE_EVENT_MAX];
+	int i, len;
+
+	// cheap check without lock, most of time nobody listens
+	if (g_sseNumClients == 0) {
+		return;
+	}
+	len = SSE_FormatEvent(text, event, id, data, dataLen);
+	if (xSemaphoreTake(g_sseMutex, 100) != pdTRUE) {
+		return;
+	}
+	for (i = 0; i < SSE_MAX_CLIENTS; i++) {
+		if (g_sseClients[i].bUsed && (g_sseClients[i].types & type)) {
+			SSE_Queue(&g_sseClients[i], text, len);
+		}
+	}
+	xSemaphoreGive(g_sseMutex);
+}
+void SSE_OnChannelChanged(int ch, float value, int chType, int version) {
+	char data[64];
+	int len;
+
+	if (g_sseNumClients == 0) {
+		return;
+	}
+	len = snprintf(data, sizeof(data), "{\"v\":%i,\"ch\":[[%i,%.2f,%i]]}", version, ch, value, chType);
+	SSE_Push(SSE_TYPE_CHANNEL, "ch", version, data, len);
+}
+// every log line is a separate event, line ends are not sent
+static void SSE_PushLog() {
+	int i, len, start, end;
+
+	for (i = 0; i < SSE_LOG_READS_PER_FRAME; i++) {
+		len = LOG_GetEventsData(g_sseLogLine + g_sseLogUsed, sizeof(g_sseLogLine) - g_sseLogUsed);
+		if (len <= 0) {
+			break;
+		}
+		len += g_sseLogUsed;
+		start = 0;
+		for (end = 0; end < len; end++) {
+			if (g_sseLogLine[end] == '\n' || g_sseLogLine[end] == '\r') {
+				if (end > start) {
+					SSE_Push(SSE_TYPE_LOG, "log", 0, g_sseLogLine + start, end - start);
+				}
+				start = end + 1;
+			}
+		}
+		// rest of line comes with next read, unless it does not fit at all
+		if (start == 0 && len >= sizeof(g_sseLogLine) - 1) {
+			SSE_Push(SSE_TYPE_LOG, "log", 0, g_sseLogLine, len);
+			start = len;
+		}
+		g_sseLogUsed = len - start;
+		memmove(g_sseLogLine, g_sseLogLine + start, g_sseLogUsed);
+	}
+}
+static void SSE_PushState() {
+	char data[32];
+	int v, len;
+
+	// state without a change hook is checked once per second
+	if (g_sseLastSecond == Time_getUpTimeSeconds()) {
+		return;
+	}
+	g_sseLastSecond = Time_getUpTimeSeconds();
+	http_checkStateChanges();
+	v = STATE_GetFieldVersion(STATE_FIELD_MQTT);
+	if (v != g_sseMQTTVersion) {
+		g_sseMQTTVersion = v;
+		len = snprintf(data, sizeof(data), "{\"v\":%i,\"mqtt\":%i}", v, http_getMQTTStateCode());
+		SSE_Push(SSE_TYPE_MQTT, "mqtt", v, data, len);
+	}
+}
+// Returns false if client has disconnected.
+static bool SSE_SendQueued(sseClient_t* c, int now) {
+	sseEvent_t* e;
+	int r;
+
+	if (c->numQueued == 0 && now - c->lastSend >= SSE_KEEPALIVE_SECONDS) {
+		SSE_Queue(c, ":\n\n", 3);
+	}
+	while (c->numQueued) {
+		e = &c->events[c->queue[0]];
+		r = send(c->fd, e->text + c->sentBytes, e->len - c->sentBytes, SSE_SEND_FLAGS);
+		if (r <= 0) {
+			return r < 0 && SSE_WOULD_BLOCK();
+		}
+		c->lastSend = now;
+		c->sentBytes += r;
+		if (c->sentBytes < e->len) {
+			break;
+		}
+		c->sentBytes = 0;
+		SSE_Unqueue(c, 0);
+	}
+	return true;
+}
+void SSE_RunFrame() {
+	sseClient_t* c;
+	int i, now, closed;
+
+	if (g_sseNumClients == 0) {
+		return;
+	}
+	SSE_PushLog();
+	SSE_PushState();
+
+	now = Time_getUpTimeSeconds();
+	closed = 0;
+	if (xSemaphoreTake(g_sseMutex, 100) != pdTRUE) {
+		return;
+	}
+	for (i = 0; i < SSE_MAX_CLIENTS; i++) {
+		c = &g_sseClients[i];
+		// fd is 0 in self tests, they check the backlog
+		if (c->bUsed == false || c->fd == 0) {
+			continue;
+		}
+		if (SSE_SendQueued(c, now) == false) {
+			SSE_CLOSE(c->fd);
+			SSE_FreeClient(c);
+			closed++;
+		}
+	}
+	xSemaphoreGive(g_sseMutex);
+	if (closed) {
+		ADDLOG_DEBUG(LOG_FEATURE_HTTP, "Event stream closed, %i left", g_sseNumClients);
+	}
+}
+void SSE_RemoveAllClients() {
+	int i;
+
+	if (xSemaphoreTake(g_sseMutex, 100) != pdTRUE) {
+		return;
+	}
+	for (i = 0; i < SSE_MAX_CLIENTS; i++) {
+		if (g_sseClients[i].bUsed) {
+			if (g_sseClients[i].fd) {
+				SSE_CLOSE(g_sseClients[i].fd);
+			}
+			SSE_FreeClient(&g_sseClients[i]);
+		}
+	}
+	xSemaphoreGive(g_sseMutex);
+}
+int SSE_GetQueued(int client, char* out, int maxLen) {
+	sseClient_t* c;
+	sseEvent_t* e;
+	int i, len;
+
+	len = 0;
+	c = &g_sseClients[client];
+	for (i = 0; c->bUsed && i < c->numQueued; i++) {
+		e = &c->events[c->queue[i]];
+		if (len + e->len >= maxLen) {
+			break;
+		}
+		memcpy(out + len, e->text, e->len);
+		len += e->len;
+	}
+	out[len] = 0;
+	return len;
+}
+int SSE_GetDropped(int client) {
+	return g_sseClients[client].dropped;
+}
+static bool SSE_AddClient(int fd, int types) {
+	sseClient_t* c;
+	int i;
+
+	if (xSemaphoreTake(g_sseMutex, 100) != pdTRUE) {
+		return false;
+	}
+	c = 0;
+	for (i = 0; i < SSE_MAX_CLIENTS; i++) {
+		if (g_sseClients[i].bUsed == false) {
+			c = &g_sseClients[i];
+			break;
+		}
+	}
+	if (c) {
+		memset(c, 0, sizeof(*c));
+		for (i = 0; i < SSE_BACKLOG_EVENTS; i++) {
+			c->queue[i] = i;
+		}
+		c->fd = fd;
+		c->types = types;
+		c->lastSend = Time_getUpTimeSeconds();
+		if (g_sseNumClients == 0) {
+			// old log was already seen in /lograw, stream starts with new lines
+			LOG_SkipEventsData();
+			g_sseLogUsed = 0;
+		}
+		c->bUsed = true;
+		g_sseNumClients++;
+	}
+	xSemaphoreGive(g_sseMutex);
+	return c != 0;
+}
+static int SSE_GetTypeArg(http_request_t* request, const char* name, int type) {
+	char tmp[8];
+
+	if (http_getArg(request->url, name, tmp, sizeof(tmp)) && atoi(tmp) == 0) {
+		return 0;
+	}
+	return type;
+}
+int http_fn_events(http_request_t* request) {
+	int types;
+
+	types = SSE_GetTypeArg(request, "ch", SSE_TYPE_CHANNEL)
+		| SSE_GetTypeArg(request, "mqtt", SSE_TYPE_MQTT)
+		| SSE_GetTypeArg(request, "log", SSE_TYPE_LOG);
+	SSE_Init();
+	if (g_sseNumClients >= SSE_MAX_CLIENTS) {
+		request->bKeepAlive = 0;
+		request->responseCode = 503;
+		http_setup(request, httpMimeTypeText);
+		poststr(request, "Too many event streams");
+		poststr(request, NULL);
+		return 0;
+	}
+	// stream has no length and it's not chunked, it ends when connection is closed
+	hprintf255(request, httpHeader, HTTP_RESPONSE_OK, "text/event-stream");
+	poststr(request, "\r\n");
+	poststr(request, httpCorsHeaders);
+	poststr(request, "\r\nCache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n");
+	// client reconnects after 2 seconds if stream breaks
+	poststr(request, "retry: 2000\n\n");
+	// headers must be sent before server loop may send first event
+	poststr(request, NULL);
+	if (SSE_AddClient(request->fd, types) == false) {
+		return 0;
+	}
+	// current MQTT state goes out with next frame
+	g_sseMQTTVersion = -1;
+	g_sseLastSecond = -1;
+	request->bDetached = 1;
+	return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef _HTTP_EVENTS_H
+#define _HTTP_EVENTS_H
+
+#include "new_http.h"
+
+// event types, a client may skip some of them with /events?ch=0&mqtt=0&log=0
+#define SSE_TYPE_CHANNEL	1
+#define SSE_TYPE_MQTT		2
+#define SSE_TYPE_LOG		4
+#define SSE_TYPE_ALL		(SSE_TYPE_CHANNEL | SSE_TYPE_MQTT | SSE_TYPE_LOG)
+
+// at most this many streams are open at once
+#define SSE_MAX_CLIENTS 2
+
+void SSE_Init();
+// GET /events - text/event-stream with channel changes, MQTT state and log lines
+int http_fn_events(http_request_t* request);
+// Called from HTTP server loop, collects log lines and state and sends
+// queued events without blocking.
+void SSE_RunFrame();
+int SSE_GetNumClients();
+// Queues event for every client subscribed to given type.
+// Data must be a single line. Id is skipped if 0.
+void SSE_Push(int type, const char* event, int id, const char* data, int dataLen);
+void SSE_OnChannelChanged(int ch, float value, int chType, int version);
+void SSE_RemoveAllClients();
+// for self tests, queued (not sent yet) text of given client
+int SSE_GetQueued(int client, char* out, int maxLen);
+int SSE_GetDropped(int client);
+
+#endif
@@ -965,6 +965,148 @@ int http_fn_index(http_request_t* request) {
 	return 0;
 }
 
+// how long a single 'state' request may wait for a change
+#define HTTP_STATE_MAX_WAIT_SECONDS 25
+// waiting 'state' requests hold a HTTP worker, so only this many may wait at once
+#define HTTP_STATE_MAX_WAITING 1
+
+// g_stateWaiting is changed by HTTP workers, under g_stateMutex
+static SemaphoreHandle_t g_stateMutex = 0;
+static int g_stateWaiting = 0;
+static int g_stateLastMQTT = -1;
+static int g_stateLastWiFi = -1;
+static int g_stateLastCfg = -1;
+
+int http_getMQTTStateCode() {
+	if (CFG_GetMQTTHost()[0] == 0) {
+		return 0; // not configured
+	}
+	if (mqtt_reconnect > 0) {
+		return 3; // awaiting reconnect
+	}
+	if (Main_HasMQTTConnected() == 1) {
+		return 1; // connected
+	}
+	return 2; // disconnected
+}
+// Takes one of HTTP_STATE_MAX_WAITING waiting places, false if all are taken
+static bool http_stateBeginWait() {
+	bool bTaken = false;
+
+	if (g_stateMutex == 0) {
+		g_stateMutex = xSemaphoreCreateMutex();
+	}
+	if (xSemaphoreTake(g_stateMutex, 100) != pdTRUE) {
+		return false;
+	}
+	if (g_stateWaiting < HTTP_STATE_MAX_WAITING) {
+		g_stateWaiting++;
+		bTaken = true;
+	}
+	xSemaphoreGive(g_stateMutex);
+	return bTaken;
+}
+static void http_stateEndWait() {
+	// place must be given back, or long polling would stop for good
+	while (xSemaphoreTake(g_stateMutex, 100) != pdTRUE) {
+	}
+	g_stateWaiting--;
+	xSemaphoreGive(g_stateMutex);
+}
+// State without a change hook is compared with the value seen last time
+void http_checkStateChanges() {
+	int i;
+
+	i = http_getMQTTStateCode();
+	if (i != g_stateLastMQTT) {
+		g_stateLastMQTT = i;
+		STATE_MarkChanged(STATE_FIELD_MQTT);
+	}
+	i = -1;
+	if (Main_HasWiFiConnected()) {
+		i = wifi_rssi_scale(HAL_GetWifiStrength());
+	}
+	if (i != g_stateLastWiFi) {
+		g_stateLastWiFi = i;
+		STATE_MarkChanged(STATE_FIELD_WIFI);
+	}
+	i = g_cfg.changeCounter + g_cfg_pendingChanges + g_hiddenChannels;
+	if (i != g_stateLastCfg) {
+		g_stateLastCfg = i;
+		STATE_MarkChanged(STATE_FIELD_CONFIG);
+	}
+}
+
+// Returns JSON with state that has changed since given version:
+//   state?since=<version>[&wait=<seconds>]
+// Without 'since' (or with 0) everything is returned. With 'wait', reply is
+// delayed until something changes, so web panel does not have to poll often.
+int http_fn_state(http_request_t* request) {
+	int since;
+	int wait;
+	int i;
+	bool bFirst;
+	char colorValue[16];
+
+	since = http_getArgInteger(request->url, "since");
+	wait = http_getArgInteger(request->url, "wait");
+	http_checkStateChanges();
+#if WINDOWS || PLATFORM_XR809
+	// requests are served by main loop or server thread, waiting would block everything
+	wait = 0;
+#endif
+	// when no waiting place is free, reply at once and panel asks again later
+	if (wait > 0 && since > 0 && STATE_GetVersion() <= since && http_stateBeginWait()) {
+		if (wait > HTTP_STATE_MAX_WAIT_SECONDS) {
+			wait = HTTP_STATE_MAX_WAIT_SECONDS;
+		}
+		for (i = 0; i < wait * 10 && STATE_GetVersion() <= since; i++) {
+			rtos_delay_milliseconds(100);
+			http_checkStateChanges();
+		}
+		http_stateEndWait();
+	}
+
+	http_setup(request, httpMimeTypeJson);
+	hprintf255(request, "{\"v\":%i", STATE_GetVersion());
+	// [index, value, type] of every changed channel
+	bFirst = true;
+	for (i = 0; i < CHANNEL_MAX; i++) {
+		if (since > 0 && STATE_GetChannelVersion(i) <= since) {
+			continue;
+		}
+		if (BIT_CHECK(g_hiddenChannels, i) || CHANNEL_IsInUse(i) == false) {
+			continue;
+		}
+		hprintf255(request, "%s[%i,%.2f,%i]", bFirst ? ",\"ch\":[" : ",", i, CHANNEL_GetFloat(i), CHANNEL_GetType(i));
+		bFirst = false;
+	}
+	if (bFirst == false) {
+		poststr(request, "]");
+	}
+	if (since <= 0 || STATE_GetFieldVersion(STATE_FIELD_LED) > since) {
+		LED_GetBaseColorString(colorValue);
+		hprintf255(request, ",\"led\":{\"on\":%i,\"dim\":%.0f,\"rgb\":\"%s\",\"ct\":%.0f,\"mode\":%i}",
+			LED_GetEnableAll(), LED_GetDimmer(), colorValue, LED_GetTemperature(), LED_GetMode());
+	}
+	if (since <= 0 || STATE_GetFieldVersion(STATE_FIELD_MQTT) > since) {
+		hprintf255(request, ",\"mqtt\":%i", g_stateLastMQTT);
+	}
+	if (since <= 0 || STATE_GetFieldVersion(STATE_FIELD_WIFI) > since) {
+		hprintf255(request, ",\"rssi\":%i", HAL_GetWifiStrength());
+	}
+	if (since <= 0 || STATE_GetFieldVersion(STATE_FIELD_CONFIG) > since) {
+		hprintf255(request, ",\"cfg\":%i", g_cfg.changeCounter);
+	}
+	// driver sections are not in JSON, panel reloads them from index
+	if (since > 0 && STATE_GetFieldVersion(STATE_FIELD_DRIVERS) > since) {
+		poststr(request, ",\"drv\":1");
+	}
+	poststr(request, "}");
+	poststr(request, NULL);
+	return 0;
+}
+
 int http_fn_about(http_request_t* request) {
 	http_setup(request, httpMimeTypeHTML);
 	http_html_start(request, "About");
@@ -1994,7 +2136,7 @@ int http_fn_ha_cfg(http_request_t* request) {
 	poststr(request, "<br/><div><label for=\"ha_disc_topic\">Discovery topic:</label><input id=\"ha_disc_topic\" value=\"homeassistant\"><button onclick=\"send_ha_disc();\">Start Home Assistant Discovery</button>&nbsp;<form action=\"cfg_mqtt\" class='disp-inline'><button type=\"submit\">Configure MQTT</button></form></div><br/>");
 	poststr(request, htmlFooterReturnToCfgLink);
 	http_html_end(request);
-	poststr(request, ha_discovery_script);
+	hprintf255(request, "<script src=\"/static/ha.js?v=%s\"></script>", ha_discovery_script_hash);
 	poststr(request, NULL);
 	return 0;
 }
@@ -24,6 +24,11 @@ int http_fn_cfg(http_request_t* request);
 int http_fn_cfg_pins(http_request_t* request);
 int http_fn_cfg_ping(http_request_t* request);
 int http_fn_index(http_request_t* request);
+int http_fn_state(http_request_t* request);
+// 0 - MQTT not configured, 1 - connected, 2 - disconnected, 3 - awaiting reconnect
+int http_getMQTTStateCode();
+// marks MQTT, WiFi and config state as changed if it differs from last check
+void http_checkStateChanges();
 int http_fn_testmsg(http_request_t* request);
 int http_fn_ota_exec(http_request_t* request);
 int http_fn_ota(http_request_t* request);
@@ -0,0 +1,318 @@
+#include "../new_common.h"
+#include "new_http.h"
+#include "http_routes.h"
+
+/*
+HTTP route table.
+
+Trie with one node per path segment. Children with fixed names are kept
+sorted by hash of the name, so segment is found with binary search and
+compared with memcmp only once. Every node has a list of callbacks keyed
+by method. Routes are normally added once at server start (and by drivers
+when they start), lookup does not allocate.
+Adding a child replaces the children array of its parent, so adding and
+lookup are done under g_routeMutex. Nodes are never freed, callback found
+may be used after mutex is given back.
+*/
+
+typedef struct httpRouteHandler_s {
+	int method;
+	http_callback_fn callback;
+	struct httpRouteHandler_s* next;
+} httpRouteHandler_t;
+
+typedef struct httpRouteNode_s {
+	// points into pattern, not terminated
+	const char* name;
+	int nameLen;
+	unsigned int hash;
+	// fixed name children, sorted by hash
+	struct httpRouteNode_s** children;
+	int numChildren;
+	// <name> and <name*> children
+	struct httpRouteNode_s* param;
+	struct httpRouteNode_s* rest;
+	httpRouteHandler_t* handlers;
+} httpRouteNode_t;
+
+static httpRouteNode_t g_routeRoot;
+static int g_numRouteNodes = 1;
+static SemaphoreHandle_t g_routeMutex = 0;
+
+static bool HTTP_Routes_Mutex_Take(int del) {
+	if (g_routeMutex == 0) {
+		g_routeMutex = xSemaphoreCreateMutex();
+	}
+	return xSemaphoreTake(g_routeMutex, del) == pdTRUE;
+}
+static void HTTP_Routes_Mutex_Free() {
+	xSemaphoreGive(g_routeMutex);
+}
+
+static unsigned int HTTP_HashSegment(const char* s, int len) {
+	unsigned int hash = 2166136261u;
+
+	while (len--) {
+		hash ^= (unsigned char)*s++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// segment ends at '/', query or end of url
+static int HTTP_SegmentLength(const char* s) {
+	const char* p = s;
+
+	while (*p != 0 && *p != '/' && *p != '?') {
+		p++;
+	}
+	return p - s;
+}
+
+// index of first child with hash not lower than given
+static int HTTP_LowerBound(httpRouteNode_t* node, unsigned int hash) {
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = node->numChildren;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (node->children[mid]->hash < hash) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static httpRouteNode_t* HTTP_FindChild(httpRouteNode_t* node, const char* name, int len) {
+	httpRouteNode_t* c;
+	unsigned int hash;
+	int i;
+
+	if (node->numChildren == 0) {
+		return 0;
+	}
+	hash = HTTP_HashSegment(name, len);
+	for (i = HTTP_LowerBound(node, hash); i < node->numChildren; i++) {
+		c = node->children[i];
+		if (c->hash != hash) {
+			break;
+		}
+		if (c->nameLen == len && !memcmp(c->name, name, len)) {
+			return c;
+		}
+	}
+	return 0;
+}
+
+static httpRouteNode_t* HTTP_NewRouteNode(const char* name, int len) {
+	httpRouteNode_t* n;
+
+	n = (httpRouteNode_t*)os_malloc(sizeof(httpRouteNode_t));
+	if (n == 0) {
+		return 0;
+	}
+	memset(n, 0, sizeof(httpRouteNode_t));
+	n->name = name;
+	n->nameLen = len;
+	n->hash = HTTP_HashSegment(name, len);
+	g_numRouteNodes++;
+	return n;
+}
+
+// returns child for pattern segment, creates it if needed
+static httpRouteNode_t* HTTP_AddChild(httpRouteNode_t* node, const char* name, int len) {
+	httpRouteNode_t** slot;
+	httpRouteNode_t** children;
+	httpRouteNode_t* c;
+	int at, i;
+
+	if (len >= 2 && name[0] == '<' && name[len - 1] == '>') {
+		slot = name[len - 2] == '*' ? &node->rest : &node->param;
+		if (*slot == 0) {
+			*slot = HTTP_NewRouteNode(name, len);
+		}
+		return *slot;
+	}
+	c = HTTP_FindChild(node, name, len);
+	if (c) {
+		return c;
+	}
+	c = HTTP_NewRouteNode(name, len);
+	if (c == 0) {
+		return 0;
+	}
+	children = (httpRouteNode_t**)os_malloc(sizeof(httpRouteNode_t*) * (node->numChildren + 1));
+	if (children == 0) {
+		os_free(c);
+		g_numRouteNodes--;
+		return 0;
+	}
+	at = HTTP_LowerBound(node, c->hash);
+	for (i = 0; i < at; i++) {
+		children[i] = node->children[i];
+	}
+	children[at] = c;
+	for (i = at; i < node->numChildren; i++) {
+		children[i + 1] = node->children[i];
+	}
+	if (node->children) {
+		os_free(node->children);
+	}
+	node->children = children;
+	node->numChildren++;
+	return c;
+}
+
+static int HTTP_AddRouteInternal(const char* pattern, int method, http_callback_fn callback) {
+	httpRouteNode_t* node;
+	httpRouteHandler_t* h;
+	const char* p;
+	int len;
+
+	node = &g_routeRoot;
+	p = pattern;
+	// empty pattern is the root page
+	if (*p) {
+		while (1) {
+			len = HTTP_SegmentLength(p);
+			node = HTTP_AddChild(node, p, len);
+			if (node == 0) {
+				return -2;
+			}
+			if (p[len] != '/') {
+				break;
+			}
+			p += len + 1;
+		}
+	}
+	for (h = node->handlers; h; h = h->next) {
+		if (h->method == method) {
+			return h->callback == callback ? 1 : -5;
+		}
+	}
+	h = (httpRouteHandler_t*)os_malloc(sizeof(httpRouteHandler_t));
+	if (h == 0) {
+		return -2;
+	}
+	h->method = method;
+	h->callback = callback;
+	h->next = node->handlers;
+	node->handlers = h;
+	return 0;
+}
+
+int HTTP_AddRoute(const char* pattern, int method, http_callback_fn callback) {
+	int res;
+
+	if (!pattern || !callback) {
+		return -1;
+	}
+	// adding waits, route would be lost otherwise
+	while (HTTP_Routes_Mutex_Take(100) == false) {
+	}
+	res = HTTP_AddRouteInternal(pattern, method, callback);
+	HTTP_Routes_Mutex_Free();
+	return res;
+}
+
+void HTTP_AddRoutes(const httpRoute_t* routes, int count) {
+	int i;
+
+	for (i = 0; i < count; i++) {
+		HTTP_AddRoute(routes[i].pattern, routes[i].method, routes[i].callback);
+	}
+}
+
+static http_callback_fn HTTP_GetRouteCallback(httpRouteNode_t* node, int method) {
+	httpRouteHandler_t* h;
+	http_callback_fn any = 0;
+
+	for (h = node->handlers; h; h = h->next) {
+		if (h->method == method) {
+			return h->callback;
+		}
+		if (h->method == HTTP_ANY) {
+			any = h->callback;
+		}
+	}
+	return any;
+}
+
+static void HTTP_PushRouteParam(http_request_t* request, const char* s, int len) {
+	if (request->numRouteParams < HTTP_MAX_ROUTE_PARAMS) {
+		request->routeParams[request->numRouteParams] = s;
+		request->routeParamLens[request->numRouteParams] = len;
+	}
+	request->numRouteParams++;
+}
+
+static http_callback_fn HTTP_MatchSegment(httpRouteNode_t* node, const char* seg, http_request_t* request, int method);
+
+// node has matched segment that ended at 'end'
+static http_callback_fn HTTP_MatchNext(httpRouteNode_t* node, const char* end, http_request_t* request, int method) {
+	if (*end == '/') {
+		return HTTP_MatchSegment(node, end + 1, request, method);
+	}
+	return HTTP_GetRouteCallback(node, method);
+}
+
+static http_callback_fn HTTP_MatchSegment(httpRouteNode_t* node, const char* seg, http_request_t* request, int method) {
+	httpRouteNode_t* c;
+	http_callback_fn cb;
+	const char* end;
+	int len;
+
+	len = HTTP_SegmentLength(seg);
+	end = seg + len;
+	c = HTTP_FindChild(node, seg, len);
+	if (c) {
+		cb = HTTP_MatchNext(c, end, request, method);
+		if (cb) {
+			return cb;
+		}
+	}
+	if (node->param && len > 0) {
+		HTTP_PushRouteParam(request, seg, len);
+		cb = HTTP_MatchNext(node->param, end, request, method);
+		if (cb) {
+			return cb;
+		}
+		request->numRouteParams--;
+	}
+	if (node->rest) {
+		cb = HTTP_GetRouteCallback(node->rest, method);
+		if (cb) {
+			while (*end != 0 && *end != '?') {
+				end++;
+			}
+			HTTP_PushRouteParam(request, seg, end - seg);
+			return cb;
+		}
+	}
+	return 0;
+}
+
+http_callback_fn HTTP_FindRoute(http_request_t* request, const char* url, int method) {
+	http_callback_fn cb;
+
+	request->numRouteParams = 0;
+	if (HTTP_Routes_Mutex_Take(1000) == false) {
+		return 0;
+	}
+	if (*url == 0 || *url == '?') {
+		cb = HTTP_GetRouteCallback(&g_routeRoot, method);
+	}
+	else {
+		cb = HTTP_MatchSegment(&g_routeRoot, url, request, method);
+	}
+	HTTP_Routes_Mutex_Free();
+	return cb;
+}
+
+int HTTP_GetNumRouteNodes() {
+	return g_numRouteNodes;
+}
@@ -0,0 +1,32 @@
+#ifndef _HTTP_ROUTES_H
+#define _HTTP_ROUTES_H
+
+#include "new_http.h"
+
+/*
+Route patterns are paths without leading slash, split at '/'.
+Segment written as <name> matches any single non-empty segment and <name*>
+matches the rest of path (may be empty). Matched parts are route params,
+read them with http_getRouteParam in order they appear in pattern.
+	"index"
+	"api/channels/<n>"
+	"api/lfs/<path*>"
+Static segment is preferred over <name>, and <name> over <name*>.
+*/
+typedef struct httpRoute_s {
+	const char* pattern;
+	int method;
+	http_callback_fn callback;
+} httpRoute_t;
+
+// Pattern is not copied, it must stay valid.
+// Returns 0 on success, 1 if it was added already, -5 if this pattern and
+// method has other callback.
+int HTTP_AddRoute(const char* pattern, int method, http_callback_fn callback);
+void HTTP_AddRoutes(const httpRoute_t* routes, int count);
+// Callback for url (query is skipped) and method, or HTTP_ANY callback.
+// Fills route params of request. Returns NULL if nothing matches.
+http_callback_fn HTTP_FindRoute(http_request_t* request, const char* url, int method);
+int HTTP_GetNumRouteNodes();
+
+#endif
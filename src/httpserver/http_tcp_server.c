@@ -5,6 +5,7 @@
 #include "lwip/inet.h"
 #include "../logging/logging.h"
 #include "new_http.h"
+#include "http_events.h"
 
 #define HTTP_SERVER_PORT            80
 #define REPLY_BUFFER_SIZE			2048
@@ -22,23 +23,76 @@
 #define HTTP_CLIENT_STACK_SIZE 2048
 #endif
 
-#define CREATE_THREAD_PER_EACH_HTTP_CLIENT
-
-#ifdef CREATE_THREAD_PER_EACH_HTTP_CLIENT
-
-
 #if PLATFORM_XR809
 
+// right now, I am getting OS_ThreadCreate everytime on XR809 platform,
+// so requests are served by the main server thread (blocking all other clients)
 #define DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT 1
+#define HTTP_WORKER_COUNT 1
+
+#else
+
+// Workers are created once and then take connections from a queue,
+// so a request does not pay for thread creation anymore
+#define HTTP_WORKER_COUNT 2
 
 #endif
 
-static void tcp_server_thread(beken_thread_arg_t arg);
-static void tcp_client_thread(beken_thread_arg_t arg);
+// connections waiting for a free worker
+#define HTTP_JOB_QUEUE_LENGTH 8
+// HTTP/1.1 connections kept open between requests and watched with select
+#define HTTP_MAX_KEEPALIVE_CONNECTIONS 4
+// Accepted connections are watched with select too, until request data comes.
+// They are kept apart from keep-alive ones, so a new connection never closes
+// one whose request is on the way. When this set is full, nothing is accepted
+// until there is room, so further clients wait in listen backlog of the same size.
+#define HTTP_LISTEN_BACKLOG 4
+#define HTTP_KEEPALIVE_TIMEOUT_MS 5000
+// send and receive on client socket give up after this, so a client that
+// stops reading or sending can't hold a worker
+#define HTTP_SOCKET_TIMEOUT_MS 5000
+// select timeout while some connection is being served by a worker,
+// it's returned to select only after that
+#define HTTP_SELECT_BUSY_MS 10
+#define HTTP_SELECT_IDLE_MS 1000
+// select timeout while event streams are open, events are sent after select
+#define HTTP_SELECT_EVENTS_MS 50
+// room for NULL terminator after received data
+#define HTTP_RECV_MAX (INCOMING_BUFFER_SIZE - 2)
+
+// what to do with connection after HTTP_ServeConnection
+#define HTTP_CONNECTION_CLOSE 0
+#define HTTP_CONNECTION_KEEP 1
+// handler has taken it (event stream), it's not closed nor kept by server
+#define HTTP_CONNECTION_DETACHED 2
+
+typedef struct httpWorker_s {
+	char* buf;
+	char* reply;
+} httpWorker_t;
+
+typedef struct httpIdleConnection_s {
+	int fd;
+	portTickType since;
+} httpIdleConnection_t;
 
+static void tcp_server_thread(beken_thread_arg_t arg);
 
 xTaskHandle g_http_thread = NULL;
 
+static httpWorker_t g_httpWorkers[HTTP_WORKER_COUNT];
+// connections for workers
+static QueueHandle_t g_httpJobs = 0;
+// connections given back by workers, -1 if worker has closed it
+static QueueHandle_t g_httpReturned = 0;
+static httpIdleConnection_t g_httpIdle[HTTP_MAX_KEEPALIVE_CONNECTIONS];
+static int g_httpNumIdle = 0;
+// accepted, but no request data yet
+static httpIdleConnection_t g_httpPending[HTTP_LISTEN_BACKLOG];
+static int g_httpNumPending = 0;
+// connections given to workers and not returned yet
+static int g_httpInFlight = 0;
+
 void HTTPServer_Start()
 {
 	OSStatus err = kNoErr;
@@ -62,211 +116,223 @@ int sendfn(int fd, char* data, int len) {
 	return -1;
 }
 
-static void tcp_client_thread(beken_thread_arg_t arg)
+// Serves requests from connection until there is no more data in buffer.
+// Request line and headers may come in many segments, they are collected
+// until complete. Body is collected too if it fits into buffer, larger body
+// is left in socket for handler to stream it with HTTP_StreamBody.
+// Pipelined requests that came in the same recv are handled one by one.
+// Returns one of HTTP_CONNECTION_*.
+static int HTTP_ServeConnection(httpWorker_t* w, int fd)
 {
-	OSStatus err = kNoErr;
-	int fd = (int)arg;
-	//fd_set readfds, errfds, readfds2;
-	char* buf = NULL;
-	char* reply = NULL;
-	int replyBufferSize = REPLY_BUFFER_SIZE;
-	//int res;
-	//char reply[8192];
-
-  //my_fd = fd;
-	rtos_delay_milliseconds(20);
-
-	reply = (char*)os_malloc(replyBufferSize);
-	buf = (char*)os_malloc(INCOMING_BUFFER_SIZE);
-
-	if (buf == 0 || reply == 0)
-	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client failed to malloc buffer");
-		goto exit;
-	}
 	http_request_t request;
-	os_memset(&request, 0, sizeof(request));
-
-	request.fd = fd;
-	request.received = buf;
-	request.receivedLenmax = INCOMING_BUFFER_SIZE - 2;
-	request.responseCode = HTTP_RESPONSE_OK;
-	request.receivedLen = recv(fd, request.received, request.receivedLenmax, 0);
-	request.received[request.receivedLen] = 0;
+	int used, reqLen, len, lenret, got;
+	char saved;
 
-	request.reply = reply;
-	request.replylen = 0;
-	reply[0] = '\0';
-
-	request.replymaxlen = replyBufferSize - 1;
-
-	if (request.receivedLen <= 0)
+	used = HTTP_Recv(fd, w->buf, HTTP_RECV_MAX);
+	if (used <= 0)
 	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client is disconnected, fd: %d", fd);
-		goto exit;
+		ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP Client is disconnected, fd: %d", fd);
+		return HTTP_CONNECTION_CLOSE;
 	}
-
-	//addLog( "TCP received string %s\n",buf );
-	// returns length to be sent if any
-	 // ADDLOG_DEBUG(LOG_FEATURE_HTTP,  "TCP will process packet of len %i\n", request.receivedLen );
-	int lenret = HTTP_ProcessPacket(&request);
-	if (lenret > 0) {
-		ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP sending reply len %i\n", lenret);
-		send(fd, reply, lenret, 0);
+	while (used > 0) {
+		reqLen = HTTP_GetRequestLength(w->buf, used);
+		while ((reqLen < 0 && used < HTTP_RECV_MAX) || (reqLen > used && reqLen <= HTTP_RECV_MAX)) {
+			got = HTTP_Recv(fd, w->buf + used, HTTP_RECV_MAX - used);
+			if (got <= 0) {
+				break;
+			}
+			used += got;
+			reqLen = HTTP_GetRequestLength(w->buf, used);
+		}
+		// without complete headers it's not known where the next request starts
+		len = (reqLen > 0 && reqLen < used) ? reqLen : used;
+		saved = w->buf[len];
+		w->buf[len] = 0;
+
+		os_memset(&request, 0, sizeof(request));
+		request.fd = fd;
+		request.received = w->buf;
+		request.receivedLen = len;
+		request.receivedLenmax = HTTP_RECV_MAX;
+		request.responseCode = HTTP_RESPONSE_OK;
+		request.reply = w->reply;
+		request.replylen = 0;
+		w->reply[0] = '\0';
+		request.replymaxlen = REPLY_BUFFER_SIZE - 1;
+		request.bKeepAliveAllowed = reqLen > 0;
+
+		// returns length to be sent if any
+		lenret = HTTP_ProcessPacket(&request);
+		if (HTTP_FinishReply(&request, lenret) == false) {
+			return request.bDetached ? HTTP_CONNECTION_DETACHED : HTTP_CONNECTION_CLOSE;
+		}
+		// move next pipelined request to the start of buffer
+		w->buf[len] = saved;
+		used -= len;
+		memmove(w->buf, w->buf + len, used);
 	}
+	return HTTP_CONNECTION_KEEP;
+}
 
-	//rtos_delay_milliseconds(10);
-
-exit:
-	if (err != kNoErr)
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP client thread exit with err: %d", err);
-
-	if (buf != NULL)
-		os_free(buf);
-	if (reply != NULL)
-		os_free(reply);
-
-	lwip_close(fd);;
 #if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
 
 #else
-	rtos_delete_thread(NULL);
-#endif
-}
 
-/* TCP server listener thread */
-static void tcp_server_thread(beken_thread_arg_t arg)
+static void tcp_worker_thread(beken_thread_arg_t arg)
 {
-	(void)(arg);
-	OSStatus err = kNoErr;
-	struct sockaddr_in server_addr, client_addr;
-	socklen_t sockaddr_t_size = sizeof(client_addr);
-	char client_ip_str[16];
-	int tcp_listen_fd = -1, client_fd = -1;
-	fd_set readfds;
+	httpWorker_t* w = (httpWorker_t*)arg;
+	int fd;
 
-	tcp_listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_addr.s_addr = INADDR_ANY;/* Accept conenction request on all network interface */
-	server_addr.sin_port = htons(HTTP_SERVER_PORT);/* Server listen on port: 20000 */
-	err = bind(tcp_listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
-
-	err = listen(tcp_listen_fd, 0);
-
-	while (1)
-	{
-		FD_ZERO(&readfds);
-		FD_SET(tcp_listen_fd, &readfds);
-
-		select(tcp_listen_fd + 1, &readfds, NULL, NULL, NULL);
-
-		if (FD_ISSET(tcp_listen_fd, &readfds))
-		{
-			client_fd = accept(tcp_listen_fd, (struct sockaddr*)&client_addr, &sockaddr_t_size);
-			if (client_fd >= 0)
-			{
-#if PLATFORM_XR809
-#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
+	while (1) {
+		if (xQueueReceive(g_httpJobs, &fd, portMAX_DELAY) != pdTRUE) {
+			continue;
+		}
+		switch (HTTP_ServeConnection(w, fd)) {
+		case HTTP_CONNECTION_CLOSE:
+			lwip_close(fd);
+			fd = -1;
+			break;
+		case HTTP_CONNECTION_DETACHED:
+			fd = -1;
+			break;
+		}
+		xQueueSend(g_httpReturned, &fd, portMAX_DELAY);
+	}
+}
 
-#else
-				OS_Thread_t clientThreadUnused;
-#endif
 #endif
-				os_strcpy(client_ip_str, inet_ntoa(client_addr.sin_addr));
-				//  ADDLOG_DEBUG(LOG_FEATURE_HTTP,  "TCP Client %s:%d connected, fd: %d", client_ip_str, client_addr.sin_port, client_fd );
-#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
-				// Use main server thread (blocking all other clients)
-				// right now, I am getting OS_ThreadCreate everytime on XR809 platform
-				tcp_client_thread((beken_thread_arg_t)client_fd);
-#else
-				// delay each accept by 20ms
-				// this allows previous to finish if
-				// in a loop of sends from the browser, e.g. OTA
-				// and we MUST get some IDLE thread time, else
-				// thread resources are not deleted.
-				rtos_delay_milliseconds(20);
-				// Create separate thread for client
-				if (kNoErr !=
-#if PLATFORM_XR809
-					OS_ThreadCreate(&clientThreadUnused,
-						"HTTP Client",
-						tcp_client_thread,
-						client_fd,
-						OS_THREAD_PRIO_CONSOLE,
-						0x400)
 
-#else
-					rtos_create_thread(NULL, BEKEN_APPLICATION_PRIORITY,
-						"HTTP Client",
-						(beken_thread_function_t)tcp_client_thread,
-						HTTP_CLIENT_STACK_SIZE,
-						(beken_thread_arg_t)client_fd)
+static void HTTP_RemoveFromSet(httpIdleConnection_t* set, int* num, int index)
+{
+	(*num)--;
+	set[index] = set[*num];
+}
 
-#endif
-					)
-				{
-					ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP Client %s:%d thread creation failed! fd: %d", client_ip_str, client_addr.sin_port, client_fd);
-					lwip_close(client_fd);
-					client_fd = -1;
-				}
-#endif
+static void HTTP_AddToSet(httpIdleConnection_t* set, int* num, int fd)
+{
+	set[*num].fd = fd;
+	set[*num].since = xTaskGetTickCount();
+	(*num)++;
+}
+
+// keeps connection that a worker is done with, for next request
+static void HTTP_AddIdle(int fd)
+{
+	int i, oldest;
+
+	if (g_httpNumIdle >= HTTP_MAX_KEEPALIVE_CONNECTIONS) {
+		// drop the one that was waiting for the longest time
+		oldest = 0;
+		for (i = 1; i < g_httpNumIdle; i++) {
+			if (g_httpIdle[i].since - g_httpIdle[oldest].since > 0x80000000u) {
+				oldest = i;
 			}
 		}
+		lwip_close(g_httpIdle[oldest].fd);
+		HTTP_RemoveFromSet(g_httpIdle, &g_httpNumIdle, oldest);
 	}
-
-	if (err != kNoErr)
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "Server listerner thread exit with err: %d", err);
-
-	lwip_close(tcp_listen_fd);
-
-	rtos_delete_thread(NULL);
-
+	HTTP_AddToSet(g_httpIdle, &g_httpNumIdle, fd);
 }
 
+static void HTTP_SetSocketTimeouts(int fd)
+{
+#if LWIP_SO_SNDRCVTIMEO_NONSTANDARD
+	int timeout = HTTP_SOCKET_TIMEOUT_MS;
 #else
+	struct timeval timeout;
 
+	timeout.tv_sec = HTTP_SOCKET_TIMEOUT_MS / 1000;
+	timeout.tv_usec = (HTTP_SOCKET_TIMEOUT_MS % 1000) * 1000;
+#endif
+#if LWIP_SO_SNDTIMEO
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#endif
+#if LWIP_SO_RCVTIMEO
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+	(void)timeout;
+}
 
-xTaskHandle g_http_thread = NULL;
-
-int sendfn(int fd, char* data, int len) {
-	if (fd) {
-		return send(fd, data, len, 0);
+// gives connection with pending request to a worker
+static void HTTP_Dispatch(int fd)
+{
+#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
+	switch (HTTP_ServeConnection(&g_httpWorkers[0], fd)) {
+	case HTTP_CONNECTION_KEEP:
+		HTTP_AddIdle(fd);
+		break;
+	case HTTP_CONNECTION_CLOSE:
+		lwip_close(fd);
+		break;
 	}
-	return -1;
+#else
+	if (xQueueSend(g_httpJobs, &fd, HTTP_KEEPALIVE_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE) {
+		ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP Client queue full, fd: %d", fd);
+		lwip_close(fd);
+		return;
+	}
+	g_httpInFlight++;
+#endif
 }
 
-static void tcp_client_thread(int fd, char* buf, char* reply)
+// Dispatches connections of set that have data (next request or close),
+// and closes the ones that waited for too long.
+static void HTTP_PollSet(httpIdleConnection_t* set, int* num, fd_set* readfds, portTickType now)
 {
-	//OSStatus err = kNoErr;
-
-	http_request_t request;
-	os_memset(&request, 0, sizeof(request));
-
-	request.fd = fd;
-	request.received = buf;
-	request.receivedLenmax = INCOMING_BUFFER_SIZE - 1;
-	request.responseCode = HTTP_RESPONSE_OK;
-	request.receivedLen = recv(fd, request.received, request.receivedLenmax, 0);
-	request.received[request.receivedLen] = 0;
+	int i, fd;
+
+	i = 0;
+	while (i < *num) {
+		fd = set[i].fd;
+		if (FD_ISSET(fd, readfds)) {
+			HTTP_RemoveFromSet(set, num, i);
+			HTTP_Dispatch(fd);
+		}
+		else if ((now - set[i].since) * portTICK_PERIOD_MS > HTTP_KEEPALIVE_TIMEOUT_MS) {
+			lwip_close(fd);
+			HTTP_RemoveFromSet(set, num, i);
+		}
+		else {
+			i++;
+		}
+	}
+}
 
-	request.reply = reply;
-	request.replylen = 0;
-	reply[0] = '\0';
+static bool HTTP_CreateWorkers()
+{
+	int i;
 
-	request.replymaxlen = REPLY_BUFFER_SIZE - 1;
+	for (i = 0; i < HTTP_WORKER_COUNT; i++) {
+		g_httpWorkers[i].reply = (char*)os_malloc(REPLY_BUFFER_SIZE);
+		g_httpWorkers[i].buf = (char*)os_malloc(INCOMING_BUFFER_SIZE);
+		if (g_httpWorkers[i].buf == 0 || g_httpWorkers[i].reply == 0)
+		{
+			ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client failed to malloc buffer");
+			return false;
+		}
+	}
+#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
 
-	if (request.receivedLen <= 0)
-	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client is disconnected, fd: %d", fd);
-		return;
+#else
+	g_httpJobs = xQueueCreate(HTTP_JOB_QUEUE_LENGTH, sizeof(int));
+	g_httpReturned = xQueueCreate(HTTP_JOB_QUEUE_LENGTH + HTTP_WORKER_COUNT, sizeof(int));
+	if (g_httpJobs == 0 || g_httpReturned == 0) {
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP server failed to create queues");
+		return false;
 	}
-	int lenret = HTTP_ProcessPacket(&request);
-	if (lenret > 0) {
-		send(fd, reply, lenret, 0);
+	for (i = 0; i < HTTP_WORKER_COUNT; i++) {
+		if (kNoErr != rtos_create_thread(NULL, BEKEN_APPLICATION_PRIORITY,
+			"HTTP Client",
+			(beken_thread_function_t)tcp_worker_thread,
+			HTTP_CLIENT_STACK_SIZE,
+			(beken_thread_arg_t)&g_httpWorkers[i]))
+		{
+			ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client thread creation failed!");
+			return false;
+		}
 	}
-	rtos_delay_milliseconds(10);
-
+#endif
+	return true;
 }
 
 /* TCP server listener thread */
@@ -276,11 +342,18 @@ static void tcp_server_thread(beken_thread_arg_t arg)
 	OSStatus err = kNoErr;
 	struct sockaddr_in server_addr, client_addr;
 	socklen_t sockaddr_t_size = sizeof(client_addr);
-	char client_ip_str[16];
 	int tcp_listen_fd = -1, client_fd = -1;
+	int i, maxfd, fd;
 	fd_set readfds;
-	char* buf = NULL;
-	char* reply = NULL;
+	struct timeval tv;
+	portTickType now;
+
+	HTTP_InitRoutes();
+	SSE_Init();
+	if (HTTP_CreateWorkers() == false) {
+		rtos_delete_thread(NULL);
+		return;
+	}
 
 	tcp_listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 
@@ -289,29 +362,71 @@ static void tcp_server_thread(beken_thread_arg_t arg)
 	server_addr.sin_port = htons(HTTP_SERVER_PORT);/* Server listen on port: 20000 */
 	err = bind(tcp_listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
 
-	err = listen(tcp_listen_fd, 0);
-
-	reply = (char*)os_malloc(REPLY_BUFFER_SIZE);
-	buf = (char*)os_malloc(INCOMING_BUFFER_SIZE);
+	err = listen(tcp_listen_fd, HTTP_LISTEN_BACKLOG);
 
 	while (1)
 	{
+#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
+
+#else
+		// take back connections that workers are done with
+		while (xQueueReceive(g_httpReturned, &fd, 0) == pdTRUE) {
+			g_httpInFlight--;
+			if (fd >= 0) {
+				HTTP_AddIdle(fd);
+			}
+		}
+#endif
 		FD_ZERO(&readfds);
-		FD_SET(tcp_listen_fd, &readfds);
+		maxfd = -1;
+		if (g_httpNumPending < HTTP_LISTEN_BACKLOG) {
+			FD_SET(tcp_listen_fd, &readfds);
+			maxfd = tcp_listen_fd;
+		}
+		for (i = 0; i < g_httpNumIdle; i++) {
+			FD_SET(g_httpIdle[i].fd, &readfds);
+			if (g_httpIdle[i].fd > maxfd) {
+				maxfd = g_httpIdle[i].fd;
+			}
+		}
+		for (i = 0; i < g_httpNumPending; i++) {
+			FD_SET(g_httpPending[i].fd, &readfds);
+			if (g_httpPending[i].fd > maxfd) {
+				maxfd = g_httpPending[i].fd;
+			}
+		}
+		if (g_httpInFlight) {
+			i = HTTP_SELECT_BUSY_MS;
+		}
+		else if (SSE_GetNumClients()) {
+			i = HTTP_SELECT_EVENTS_MS;
+		}
+		else {
+			i = HTTP_SELECT_IDLE_MS;
+		}
+		tv.tv_sec = i / 1000;
+		tv.tv_usec = (i % 1000) * 1000;
 
-		select(tcp_listen_fd + 1, &readfds, NULL, NULL, NULL);
+		if (select(maxfd + 1, &readfds, NULL, NULL, &tv) < 0) {
+			rtos_delay_milliseconds(HTTP_SELECT_BUSY_MS);
+			continue;
+		}
+		SSE_RunFrame();
 
-		if (FD_ISSET(tcp_listen_fd, &readfds))
+		now = xTaskGetTickCount();
+		HTTP_PollSet(g_httpIdle, &g_httpNumIdle, &readfds, now);
+		HTTP_PollSet(g_httpPending, &g_httpNumPending, &readfds, now);
+
+		if (g_httpNumPending < HTTP_LISTEN_BACKLOG && FD_ISSET(tcp_listen_fd, &readfds))
 		{
 			client_fd = accept(tcp_listen_fd, (struct sockaddr*)&client_addr, &sockaddr_t_size);
 			if (client_fd >= 0)
 			{
-				os_strcpy(client_ip_str, inet_ntoa(client_addr.sin_addr));
-				//  ADDLOG_DEBUG(LOG_FEATURE_HTTP,  "TCP Client %s:%d connected, fd: %d", client_ip_str, client_addr.sin_port, client_fd );
-
-				tcp_client_thread(client_fd, reply, buf);
-
-				lwip_close(client_fd);
+				//  ADDLOG_DEBUG(LOG_FEATURE_HTTP,  "TCP Client %s:%d connected, fd: %d", inet_ntoa(client_addr.sin_addr), client_addr.sin_port, client_fd );
+				HTTP_SetSocketTimeouts(client_fd);
+				// worker gets it once request data is there, so a client
+				// that connects and sends nothing does not hold a worker
+				HTTP_AddToSet(g_httpPending, &g_httpNumPending, client_fd);
 			}
 		}
 	}
@@ -324,22 +439,3 @@ static void tcp_server_thread(beken_thread_arg_t arg)
 	rtos_delete_thread(NULL);
 
 }
-
-void HTTPServer_Start()
-{
-	OSStatus err = kNoErr;
-
-	err = rtos_create_thread(&g_http_thread, BEKEN_APPLICATION_PRIORITY,
-		"TCP_server",
-		(beken_thread_function_t)tcp_server_thread,
-		0x800,
-		(beken_thread_arg_t)0);
-	if (err != kNoErr)
-	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "create \"TCP_server\" thread failed with %i!\r\n", err);
-	}
-}
-
-
-#endif
-
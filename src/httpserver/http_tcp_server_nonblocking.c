@@ -6,6 +6,7 @@
 #include "lwip/inet.h"
 #include "../logging/logging.h"
 #include "new_http.h"
+#include "http_events.h"
 #include <timeapi.h>
 
  SOCKET ListenSocket = INVALID_SOCKET;
@@ -68,6 +69,8 @@ int HTTPServer_Start() {
 		return 1;
 	}
 
+	HTTP_InitRoutes();
+	SSE_Init();
     argp = 1;
     if (ioctlsocket(ListenSocket,
         FIONBIO,
@@ -78,125 +81,179 @@ int HTTPServer_Start() {
     }
 }
 #define DEFAULT_BUFLEN 10000
-void HTTPServer_RunQuickTick() {
-	int iResult;
-	int err;
-    char recvbuf[DEFAULT_BUFLEN];
-    char outbuf[DEFAULT_BUFLEN];
-    int recvbuflen = DEFAULT_BUFLEN;
-    SOCKET ClientSocket = INVALID_SOCKET;
-	int len, iSendResult;
-	int argp;
+// HTTP/1.1 connections kept open between requests
+#define HTTP_MAX_CLIENTS 8
+#define HTTP_KEEPALIVE_TIMEOUT_MS 5000
+
+typedef struct httpClient_s {
+	bool bUsed;
+	SOCKET socket;
+	// bytes received and not processed yet, may hold more than one (pipelined) request
+	int used;
+	long lastActivity;
+	char buf[DEFAULT_BUFLEN];
+} httpClient_t;
+
+static httpClient_t g_clients[HTTP_MAX_CLIENTS];
+static char g_outbuf[DEFAULT_BUFLEN];
+
+static void HTTP_CloseClient(httpClient_t *c) {
+	int iResult, err;
+	char tmp[256];
+
+	// shutdown the connection since we're done
+	iResult = shutdown(c->socket, SD_SEND);
+	long firstAttempt = timeGetTime();
+	while (1) {
+		iResult = recv(c->socket, tmp, sizeof(tmp), 0);
+		if (iResult == 0)
+			break;
+		err = WSAGetLastError();
+		if (err != WSAEWOULDBLOCK) {
+			break;
+		}
+		long delta = timeGetTime() - firstAttempt;
+		if (delta > 2) {
+			printf("HTTP server would freeze to long!\n");
+			break; // too long freeze!
 
-	// Accept a client socket
-	ClientSocket = accept(ListenSocket, NULL, NULL);
-	if (ClientSocket == INVALID_SOCKET) {
-		iResult = WSAGetLastError();
-		if(iResult != WSAEWOULDBLOCK) {
-			printf("accept failed with error: %d\n", iResult);
 		}
-		return;
 	}
+	closesocket(c->socket);
+	c->bUsed = false;
+}
+static httpClient_t *HTTP_AllocClient() {
+	int i;
+	httpClient_t *oldest = 0;
 
-	//argp = 0;
-	//if (ioctlsocket(ClientSocket,
-	//	FIONBIO,
-	//	&argp) == SOCKET_ERROR)
-	//{
-	//	printf("ioctlsocket() error %d\n", WSAGetLastError());
-	//	return 1;
-	//}
-		// Receive until the peer shuts down the connection
-		do {
-
-			iResult = recv(ClientSocket, recvbuf, recvbuflen, 0);
-			if (iResult > 0) {
-				http_request_t request;
-				memset(&request, 0, sizeof(request));
+	for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+		if (g_clients[i].bUsed == false) {
+			return &g_clients[i];
+		}
+		if (oldest == 0 || g_clients[i].lastActivity < oldest->lastActivity) {
+			oldest = &g_clients[i];
+		}
+	}
+	// all slots taken by kept connections, drop the one that was idle for the longest time
+	HTTP_CloseClient(oldest);
+	return oldest;
+}
+// Processes all complete requests received so far.
+// Returns false if connection was closed.
+static bool HTTP_ServeClient(httpClient_t *c) {
+	http_request_t request;
+	int reqLen, len;
+	bool bKeep;
+	char saved;
 
-				recvbuf[iResult] = 0;
+	while (c->used > 0) {
+		reqLen = HTTP_GetRequestLength(c->buf, c->used);
+		if ((reqLen < 0 && c->used < DEFAULT_BUFLEN - 1) || (reqLen > c->used && reqLen < DEFAULT_BUFLEN)) {
+			// wait for the rest of headers, or body that will fit into buffer
+			return true;
+		}
+		// larger body is streamed by handler from socket
+		len = (reqLen > 0 && reqLen < c->used) ? reqLen : c->used;
+		saved = c->buf[len];
+		c->buf[len] = 0;
 
 #if 1
-				// debug test code, you can disable it but dont remove it
-				if (1) {
-					FILE *f;
+		// debug test code, you can disable it but dont remove it
+		if (1) {
+			FILE *f;
 
-					f = fopen("lastHTTPPacket.txt", "wb");
-					fwrite(recvbuf, 1, recvbuflen, f);
-					fclose(f);
-				}
+			f = fopen("lastHTTPPacket.txt", "wb");
+			fwrite(c->buf, 1, len, f);
+			fclose(f);
+		}
 #endif
+		memset(&request, 0, sizeof(request));
+		request.fd = c->socket;
+		request.responseCode = HTTP_RESPONSE_OK;
+		request.received = c->buf;
+		request.receivedLen = len;
+		g_outbuf[0] = '\0';
+		request.reply = g_outbuf;
+		request.replylen = 0;
+		request.replymaxlen = DEFAULT_BUFLEN;
+		request.receivedLenmax = DEFAULT_BUFLEN - 1;
+		request.bKeepAliveAllowed = reqLen > 0;
 
-				request.fd = ClientSocket;
-				request.received = recvbuf;
-				request.receivedLen = iResult;
-				outbuf[0] = '\0';
-				request.reply = outbuf;
-				request.replylen = 0;
-
-				request.replymaxlen = DEFAULT_BUFLEN;
-
-				//printf("HTTP Server for Windows: Bytes received: %d \n", iResult);
-				len = HTTP_ProcessPacket(&request);
-
-				if(len > 0) {
-					printf("Bytes rremaining tosend %d\n", len);
-					//printf("%s\n",outbuf);
-					// Echo the buffer back to the sender
-					//leen =  strlen(request.reply);
-					iSendResult = send( ClientSocket, outbuf,len, 0 );
-					if (iSendResult == SOCKET_ERROR) {
-						printf("send failed with error: %d\n", WSAGetLastError());
-						closesocket(ClientSocket);
-						return 1;
-					}
-					printf("HTTP Server for Windows: Bytes sent: %d\n", iSendResult);
-				}
-				break;
+		//printf("HTTP Server for Windows: Bytes received: %d \n", len);
+		bKeep = HTTP_FinishReply(&request, HTTP_ProcessPacket(&request));
+		if (bKeep == false) {
+			if (request.bDetached) {
+				// socket now belongs to event stream
+				c->bUsed = false;
+			}
+			else {
+				HTTP_CloseClient(c);
+			}
+			return false;
+		}
+		c->buf[len] = saved;
+		c->used -= len;
+		memmove(c->buf, c->buf + len, c->used);
+	}
+	return true;
+}
+void HTTPServer_RunQuickTick() {
+	int iResult;
+	int err;
+	int i;
+	long now;
+	SOCKET ClientSocket = INVALID_SOCKET;
+	httpClient_t *c;
+
+	SSE_RunFrame();
+
+	// Accept all waiting clients
+	while (1) {
+		ClientSocket = accept(ListenSocket, NULL, NULL);
+		if (ClientSocket == INVALID_SOCKET) {
+			iResult = WSAGetLastError();
+			if (iResult != WSAEWOULDBLOCK) {
+				printf("accept failed with error: %d\n", iResult);
+			}
+			break;
+		}
+		c = HTTP_AllocClient();
+		c->bUsed = true;
+		c->socket = ClientSocket;
+		c->used = 0;
+		c->lastActivity = timeGetTime();
+	}
+
+	now = timeGetTime();
+	for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+		c = &g_clients[i];
+		if (c->bUsed == false)
+			continue;
+		// Receive until there is nothing more waiting or the peer shuts down the connection
+		while (c->bUsed) {
+			iResult = recv(c->socket, c->buf + c->used, DEFAULT_BUFLEN - 1 - c->used, 0);
+			if (iResult > 0) {
+				c->used += iResult;
+				c->lastActivity = now;
+				HTTP_ServeClient(c);
 			}
 			else if (iResult == 0) {
-				printf("Connection closing...\n");
-				break;
+				HTTP_CloseClient(c);
 			}
 			else {
 				err = WSAGetLastError();
 				if (err != WSAEWOULDBLOCK) {
 					printf("recv failed with error: %d\n", err);
-					closesocket(ClientSocket);
-					break;
+					closesocket(c->socket);
+					c->bUsed = false;
+				}
+				else if (now - c->lastActivity > HTTP_KEEPALIVE_TIMEOUT_MS) {
+					HTTP_CloseClient(c);
 				}
-			}
-			break;
-		} while (1);
-		//byte zero = 0;
-		//send(ClientSocket, &zero, 0, 0);
-		//Sleep(50);
-		// shutdown the connection since we're done
-		iResult = shutdown(ClientSocket, SD_SEND);
-		long firstAttempt = timeGetTime();
-		while (1) {
-			iResult = recv(ClientSocket, recvbuf, recvbuflen, 0);
-			if (iResult == 0)
-				break;
-			err = WSAGetLastError();
-			if (err != WSAEWOULDBLOCK) {
 				break;
 			}
-			long delta = timeGetTime() - firstAttempt;
-			if (delta > 2) {
-				printf("HTTP server would freeze to long!\n");
-				break; // too long freeze!
-
-			}
 		}
-		//Sleep(50);
-		//iResult = closesocket(ClientSocket);
-		//if (iResult == SOCKET_ERROR) {
-		///	printf("shutdown failed with error: %d\n", WSAGetLastError());
-			closesocket(ClientSocket);
-			//WSACleanup();
-			//return 1;
-		//}
+	}
 }
 
 #endif
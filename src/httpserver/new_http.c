@@ -5,10 +5,16 @@
 #include "ctype.h"
 #include "new_http.h"
 #include "http_fns.h"
+#include "http_events.h"
+#include "http_routes.h"
 #include "../new_pins.h"
 #include "../new_cfg.h"
 #include "../ota/ota.h"
 #include "../hal/hal_wifi.h"
+#include "lwip/sockets.h"
+#if !WINDOWS
+#include "lwip/init.h"
+#endif
 
 
 // define the feature ADDLOGF_XXX will use
@@ -58,6 +64,18 @@ const char* g_build_str = "Build on " __DATE__ " " __TIME__ " version " USER_SW_
 
 const char httpCorsHeaders[] = "Access-Control-Allow-Origin: *\r\nAccess-Control-Allow-Headers: Origin, X-Requested-With, Content-Type, Accept";           // TEXT MIME type
 
+// chunk size line, up to 6 hex digits
+#define HTTP_CHUNK_HEADER_MAX 8
+#define HTTP_CHUNK_LAST "0\r\n\r\n"
+#define HTTP_CHUNK_LAST_LEN 5
+// Chunk framing is added when reply is sent. Unit tests (fd 0) get it
+// in reply buffer, so this much space is kept free there.
+#define HTTP_CHUNK_FRAMING_RESERVE (HTTP_CHUNK_HEADER_MAX + 2 + HTTP_CHUNK_LAST_LEN)
+// shorter constant data is copied, it's cheaper than a separate part
+#define HTTP_CONST_MIN_LEN 32
+// how long to wait for next part of request
+#define HTTP_RECV_TIMEOUT_MS 5000
+
 const char* methodNames[] = {
 	"GET",
 	"PUT",
@@ -73,50 +91,33 @@ const char* methodNames[] = {
 void misc_formatUpTimeString(int totalSeconds, char* o);
 int Time_getUpTimeSeconds();
 
-typedef struct http_callback_tag {
-	char* url;
-	int method;
-	http_callback_fn callback;
-} http_callback_t;
-
-#define MAX_HTTP_CALLBACKS 32
-static http_callback_t* callbacks[MAX_HTTP_CALLBACKS];
-static int numCallbacks = 0;
-
 int HTTP_RegisterCallback(const char* url, int method, http_callback_fn callback) {
-	int i;
+	char* pattern;
+	int len;
+	int res;
 
 	if (!url || !callback) {
 		return -1;
 	}
-	if (numCallbacks >= MAX_HTTP_CALLBACKS) {
-		return -4;
-	}
-	for (i = 0; i < MAX_HTTP_CALLBACKS; i++) {
-		if (callbacks[i]) {
-			if (callbacks[i]->callback == callback && !strcmp(callbacks[i]->url, url)
-				&& callbacks[i]->method == method) {
-				return i;
-			}
-		}
+	if (*url == '/') {
+		url++;
 	}
-	callbacks[numCallbacks] = (http_callback_t*)os_malloc(sizeof(http_callback_t));
-	if (!callbacks[numCallbacks]) {
+	// route table keeps pointers into pattern
+	len = strlen(url);
+	pattern = (char*)os_malloc(len + 8);
+	if (!pattern) {
 		return -2;
 	}
-	callbacks[numCallbacks]->url = (char*)os_malloc(strlen(url) + 1);
-	if (!callbacks[numCallbacks]->url) {
-		os_free(callbacks[numCallbacks]);
-		return -3;
+	strcpy(pattern, url);
+	if (len > 0 && url[len - 1] == '/') {
+		strcat(pattern, "<path*>");
 	}
-	strcpy(callbacks[numCallbacks]->url, url);
-	callbacks[numCallbacks]->callback = callback;
-	callbacks[numCallbacks]->method = method;
-
-	numCallbacks++;
-
-	// success
-	return 0;
+	res = HTTP_AddRoute(pattern, method, callback);
+	if (res == 1 || res == -5) {
+		// nothing new was added, so nothing points to it
+		os_free(pattern);
+	}
+	return res;
 }
 
 int my_strnicmp(const char* a, const char* b, int len) {
@@ -219,7 +220,7 @@ bool http_checkUrlBase(const char* base, const char* fileName) {
 void http_setup(http_request_t* request, const char* type) {
 	hprintf255(request, httpHeader, request->responseCode, type);
 	poststr(request, "\r\n"); // next header
-	poststr(request, httpCorsHeaders);
+	poststr_const(request, httpCorsHeaders);
 #if 0
 	poststr(request, "Server: Tasmota/10.1.0 (ESP8266EX)");
 	poststr(request, "\r\n");
@@ -234,26 +235,176 @@ void http_setup(http_request_t* request, const char* type) {
 	poststr(request, "Transfer-Encoding: chunked");
 #endif
 	poststr(request, "\r\n");
-	poststr(request, "Connection: close");
+	if (request->bodyRemaining > 0) {
+		// rest of request body was not read, so next request can't be found in stream
+		request->bKeepAlive = 0;
+	}
+	if (request->bKeepAlive) {
+		// length is not known in advance, so body is sent in chunks
+		poststr(request, "Transfer-Encoding: chunked");
+		poststr(request, "\r\n");
+		poststr(request, "Connection: keep-alive");
+	}
+	else {
+		poststr(request, "Connection: close");
+	}
 	poststr(request, "\r\n"); // end headers with double CRLF
 	poststr(request, "\r\n");
+	if (request->bKeepAlive && !request->bChunked) {
+		// everything queued after this goes into chunks
+		request->iovBody = request->numIov;
+		request->bChunked = 1;
+	}
+}
+
+void http_setup_length(http_request_t* request, const char* type, int length, const char* extraHeaders) {
+	if (request->bodyRemaining > 0) {
+		request->bKeepAlive = 0;
+	}
+	hprintf255(request, "HTTP/1.1 %d %s\r\n", request->responseCode,
+		request->responseCode == HTTP_RESPONSE_NOT_MODIFIED ? "Not Modified" : "OK");
+	if (type) {
+		hprintf255(request, "Content-Type: %s\r\n", type);
+	}
+	// 304 has no body, but headers are the same as for full reply
+	if (request->responseCode != HTTP_RESPONSE_NOT_MODIFIED) {
+		hprintf255(request, "Content-Length: %i\r\n", length);
+	}
+	poststr_const(request, httpCorsHeaders);
+	poststr(request, "\r\n");
+	if (extraHeaders) {
+		poststr(request, extraHeaders);
+	}
+	if (request->bKeepAlive) {
+		poststr(request, "Connection: keep-alive\r\n\r\n");
+	}
+	else {
+		poststr(request, "Connection: close\r\n\r\n");
+	}
+	request->bFixedLength = 1;
+}
+
+const char* http_getHeader(http_request_t* request, const char* name) {
+	const char* h;
+	int i, len;
+
+	len = strlen(name);
+	for (i = 0; i < request->numheaders; i++) {
+		h = request->headers[i];
+		if (!my_strnicmp(h, name, len) && h[len] == ':') {
+			h += len + 1;
+			while (*h == ' ') {
+				h++;
+			}
+			return h;
+		}
+	}
+	return 0;
+}
+
+bool http_acceptsGzip(http_request_t* request) {
+	const char* h;
+
+	h = http_getHeader(request, "Accept-Encoding");
+	return h && strstr(h, "gzip");
+}
+
+bool http_checkNotModified(http_request_t* request, const char* etag, const char* extraHeaders) {
+	const char* match;
+
+	match = http_getHeader(request, "If-None-Match");
+	if (match == 0) {
+		return false;
+	}
+	// may be a list of tags
+	if (strcmp(match, "*") && strstr(match, etag) == 0) {
+		return false;
+	}
+	request->responseCode = HTTP_RESPONSE_NOT_MODIFIED;
+	http_setup_length(request, NULL, 0, extraHeaders);
+	poststr(request, NULL);
+	return true;
+}
+
+// Style and scripts are also served as separate files, gzip-compressed at build
+// time (see gulpfile.js). URL has content hash in it, so browser may keep them
+// for long and pages don't carry the same CSS and JS every time.
+typedef struct httpStaticAsset_s {
+	const char* url;
+	const char* mimeType;
+	// minified text, with <style> or <script> tag around it
+	const char* text;
+	const char* hash;
+	const unsigned char* gz;
+	const int* gzLen;
+} httpStaticAsset_t;
+
+static const httpStaticAsset_t g_staticAssets[] = {
+	{ "style.css", "text/css", htmlHeadStyle, htmlHeadStyle_hash, htmlHeadStyle_gz, &htmlHeadStyle_gzLen },
+	{ "script.js", "text/javascript", pageScript, pageScript_hash, pageScript_gz, &pageScript_gzLen },
+	{ "ha.js", "text/javascript", ha_discovery_script, ha_discovery_script_hash, ha_discovery_script_gz, &ha_discovery_script_gzLen },
+};
+
+#define HTTP_STATIC_CACHE_CONTROL "Cache-Control: public, max-age=31536000, immutable\r\n"
+
+// GET static/<name>
+static int http_fn_static(http_request_t* request) {
+	const httpStaticAsset_t* a = 0;
+	char name[16];
+	char etag[24];
+	char headers[160];
+	const char* body;
+	const char* end;
+	bool bGzip;
+	int i;
+
+	http_getRouteParam(request, 0, name, sizeof(name));
+	for (i = 0; i < (int)(sizeof(g_staticAssets) / sizeof(g_staticAssets[0])); i++) {
+		if (!strcmp(name, g_staticAssets[i].url)) {
+			a = &g_staticAssets[i];
+			break;
+		}
+	}
+	if (a == 0) {
+		return http_fn_other(request);
+	}
+	bGzip = http_acceptsGzip(request);
+	// gzip and plain are different representations, so they have different tags
+	snprintf(etag, sizeof(etag), bGzip ? "\"%s-gz\"" : "\"%s\"", a->hash);
+	snprintf(headers, sizeof(headers), "%sVary: Accept-Encoding\r\nETag: %s\r\n" HTTP_STATIC_CACHE_CONTROL,
+		bGzip ? "Content-Encoding: gzip\r\n" : "", etag);
+	if (http_checkNotModified(request, etag, headers)) {
+		return 0;
+	}
+	if (bGzip) {
+		http_setup_length(request, a->mimeType, *a->gzLen, headers);
+		postconst(request, (const char*)a->gz, *a->gzLen);
+	}
+	else {
+		body = strchr(a->text, '>') + 1;
+		end = strrchr(a->text, '<');
+		http_setup_length(request, a->mimeType, end - body, headers);
+		postconst(request, body, end - body);
+	}
+	poststr(request, NULL);
+	return 0;
 }
 
 void http_html_start(http_request_t* request, const char* pagename) {
-	poststr(request, htmlDoctype);
+	poststr_const(request, htmlDoctype);
 	poststr(request, "<head><title>");
 	poststr(request, CFG_GetDeviceName());
 	if (pagename) {
 		hprintf255(request, " - %s", pagename);
 	}
 	poststr(request, "</title>");
-	poststr(request, htmlShortcutIcon);
-	poststr(request, htmlHeadMeta);
-	poststr(request, htmlHeadStyle);
+	poststr_const(request, htmlShortcutIcon);
+	poststr_const(request, htmlHeadMeta);
+	hprintf255(request, "<link rel=\"stylesheet\" href=\"/static/style.css?v=%s\">", htmlHeadStyle_hash);
 	poststr(request, "</head>");
-	poststr(request, htmlBodyStart);
+	poststr_const(request, htmlBodyStart);
 	poststr(request, CFG_GetDeviceName());
-	poststr(request, htmlBodyStart2);
+	poststr_const(request, htmlBodyStart2);
 }
 
 void http_html_end(http_request_t* request) {
@@ -261,9 +412,9 @@ void http_html_end(http_request_t* request) {
 	unsigned char mac[32];
 
 	poststr(request, " | ");
-	poststr(request, htmlFooterInfo);
+	poststr_const(request, htmlFooterInfo);
 	poststr(request, "<br>");
-	poststr(request, g_build_str);
+	poststr_const(request, g_build_str);
 
 	hprintf255(request, "<br>Online for&nbsp;<span id=\"onlineFor\" data-initial=\"%i\">-</span>", Time_getUpTimeSeconds());
 
@@ -274,8 +425,8 @@ void http_html_end(http_request_t* request) {
 	snprintf(upTimeStr, sizeof(upTimeStr), "<br>Short name: %s, Chipset %s", CFG_GetShortDeviceName(), PLATFORM_MCU_NAME);
 	poststr(request, upTimeStr);
 
-	poststr(request, htmlBodyEnd);
-	poststr(request, pageScript);
+	poststr_const(request, htmlBodyEnd);
+	hprintf255(request, "<script src=\"/static/script.js?v=%s\"></script>", pageScript_hash);
 }
 
 const char* http_checkArg(const char* p, const char* n) {
@@ -381,6 +532,27 @@ int http_getArgInteger(const char* base, const char* name) {
 		return 0;
 	return atoi(tmp);
 }
+int http_getRouteParam(http_request_t* request, int index, char* o, int maxSize) {
+	int len;
+
+	*o = '\0';
+	if (index >= request->numRouteParams || index >= HTTP_MAX_ROUTE_PARAMS) {
+		return 0;
+	}
+	len = request->routeParamLens[index];
+	if (len >= maxSize) {
+		len = maxSize - 1;
+	}
+	memcpy(o, request->routeParams[index], len);
+	o[len] = '\0';
+	return request->routeParamLens[index];
+}
+int http_getRouteParamInteger(http_request_t* request, int index) {
+	char tmp[16];
+	if (http_getRouteParam(request, index, tmp, sizeof(tmp)) == 0)
+		return 0;
+	return atoi(tmp);
+}
 
 const char* htmlPinRoleNames[] = {
 	" ",
@@ -490,6 +662,172 @@ void setupAllWB2SPinsAsButtons() {
 	PIN_SetPinChannelForPinIndex(27, 1);
 }
 
+#if WINDOWS
+// socket of simulator is non-blocking, wait until it can take more
+static bool HTTP_WaitWritable(int fd) {
+	fd_set writefds;
+	struct timeval tv;
+
+	if (WSAGetLastError() != WSAEWOULDBLOCK) {
+		return false;
+	}
+	FD_ZERO(&writefds);
+	FD_SET(fd, &writefds);
+	tv.tv_sec = HTTP_RECV_TIMEOUT_MS / 1000;
+	tv.tv_usec = (HTTP_RECV_TIMEOUT_MS % 1000) * 1000;
+	return select(fd + 1, NULL, &writefds, NULL, &tv) > 0;
+}
+static int HTTP_WriteV(int fd, httpIov_t* v, int n) {
+	WSABUF bufs[HTTP_MAX_IOV + 3];
+	DWORD sent;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		bufs[i].buf = (char*)v[i].data;
+		bufs[i].len = v[i].len;
+	}
+	if (WSASend(fd, bufs, n, &sent, 0, NULL, NULL) != 0) {
+		return -1;
+	}
+	return sent;
+}
+#else
+static bool HTTP_WaitWritable(int fd) {
+	// device sockets are blocking, so error is final
+	return false;
+}
+static int HTTP_WriteV(int fd, httpIov_t* v, int n) {
+#if LWIP_VERSION_MAJOR >= 2
+	struct iovec vec[HTTP_MAX_IOV + 3];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		vec[i].iov_base = (void*)v[i].data;
+		vec[i].iov_len = v[i].len;
+	}
+	return lwip_writev(fd, vec, n);
+#else
+	// no writev, first part only, caller sends the rest
+	return send(fd, v->data, v->len, 0);
+#endif
+}
+#endif
+
+// Sends all parts, continues after partial writes. Returns total length.
+// Unit tests have fd 0, then parts are joined in reply buffer instead. Parts
+// are in reply buffer in the same order and output only adds chunk framing
+// to them, so moving them from the last one never overwrites a part not moved yet.
+static int HTTP_SendVec(http_request_t* request, httpIov_t* v, int n) {
+	int total, at, i, res;
+
+	total = 0;
+	for (i = 0; i < n; i++) {
+		total += v[i].len;
+	}
+	if (request->fd == 0) {
+		at = total;
+		for (i = n - 1; i >= 0; i--) {
+			at -= v[i].len;
+			memmove(request->reply + at, v[i].data, v[i].len);
+		}
+		return total;
+	}
+	while (n > 0) {
+		res = HTTP_WriteV(request->fd, v, n);
+		if (res < 0) {
+			if (HTTP_WaitWritable(request->fd)) {
+				continue;
+			}
+			ADDLOGF_ERROR("send failed, %i bytes not sent", total);
+			return -1;
+		}
+		// skip what was sent
+		while (n > 0 && res >= v->len) {
+			res -= v->len;
+			v++;
+			n--;
+		}
+		if (n > 0) {
+			v->data += res;
+			v->len -= res;
+		}
+	}
+	return total;
+}
+
+// Sends queued parts of reply with one vectored send. Body parts go
+// out as a single chunk, when reply is chunked.
+static void HTTP_Flush(http_request_t* request, bool bLast) {
+	httpIov_t v[HTTP_MAX_IOV + 3];
+	char chunkHeader[HTTP_CHUNK_HEADER_MAX + 1];
+	int n, i, bodyLen, total;
+
+	n = 0;
+	for (i = 0; i < request->iovBody; i++) {
+		v[n++] = request->iov[i];
+	}
+	bodyLen = 0;
+	for (i = request->iovBody; i < request->numIov; i++) {
+		bodyLen += request->iov[i].len;
+	}
+	// zero size chunk would end the body
+	if (request->bChunked && bodyLen > 0) {
+		v[n].data = chunkHeader;
+		v[n].len = snprintf(chunkHeader, sizeof(chunkHeader), "%x\r\n", bodyLen);
+		n++;
+	}
+	for (i = request->iovBody; i < request->numIov; i++) {
+		v[n++] = request->iov[i];
+	}
+	if (request->bChunked && bodyLen > 0) {
+		v[n].data = "\r\n";
+		v[n].len = 2;
+		n++;
+	}
+	if (request->bChunked && bLast) {
+		v[n].data = HTTP_CHUNK_LAST;
+		v[n].len = HTTP_CHUNK_LAST_LEN;
+		n++;
+	}
+	total = 0;
+	if (n > 0) {
+		total = HTTP_SendVec(request, v, n);
+	}
+	request->numIov = 0;
+	request->iovBody = 0;
+	// unit tests check the whole reply in buffer
+	request->replylen = (request->fd == 0 && bLast && total > 0) ? total : 0;
+}
+
+// Adds part to queue, joining it with previous one if it's continuation of it.
+// Caller makes sure there is a free slot.
+static void HTTP_QueuePart(http_request_t* request, const char* data, int len) {
+	httpIov_t* last;
+
+	if (request->numIov > request->iovBody) {
+		last = &request->iov[request->numIov - 1];
+		if (last->data + last->len == data) {
+			last->len += len;
+			return;
+		}
+	}
+	request->iov[request->numIov].data = data;
+	request->iov[request->numIov].len = len;
+	request->numIov++;
+}
+
+// space for data copied into reply buffer
+static int HTTP_GetFreeSpace(http_request_t* request) {
+	return request->replymaxlen - HTTP_CHUNK_FRAMING_RESERVE - request->replylen;
+}
+
+// sends queued parts if len bytes don't fit into reply buffer or queue is full
+static void HTTP_MakeRoom(http_request_t* request, int len) {
+	if (HTTP_GetFreeSpace(request) < len || request->numIov >= HTTP_MAX_IOV) {
+		HTTP_Flush(request, false);
+	}
+}
+
 // add some more output safely, sending if necessary.
 // call with str == NULL to force send. - can be binary.
 // supply length
@@ -498,47 +836,93 @@ int postany(http_request_t* request, const char* str, int len) {
 	send(request->fd, str, len, 0);
 	return 0;
 #else
-	int currentlen;
-	int addlen = len;
-
 	if (NULL == str) {
 		// fd will be NULL for unit tests where HTTP packet is faked locally
 		if (request->fd == 0) {
 			return request->replylen;
 		}
-		if (request->replylen > 0) {
-			send(request->fd, request->reply, request->replylen, 0);
+		HTTP_Flush(request, false);
+		return 0;
+	}
+	if (len > HTTP_GetFreeSpace(request) && request->fd != 0) {
+		// too big to copy, it goes out now together with what is queued
+		if (request->numIov >= HTTP_MAX_IOV) {
+			HTTP_Flush(request, false);
 		}
-		request->reply[0] = 0;
-		request->replylen = 0;
+		HTTP_QueuePart(request, str, len);
+		HTTP_Flush(request, false);
 		return 0;
 	}
-
-	currentlen = request->replylen;
-	if (currentlen + addlen >= request->replymaxlen) {
-		send(request->fd, request->reply, request->replylen, 0);
-		request->reply[0] = 0;
-		request->replylen = 0;
-		currentlen = 0;
+	HTTP_MakeRoom(request, len);
+	if (len > HTTP_GetFreeSpace(request)) {
+		len = HTTP_GetFreeSpace(request);
 	}
-	while (addlen >= request->replymaxlen) {
-		if (request->replylen > 0) {
-			send(request->fd, request->reply, request->replylen, 0);
-			request->replylen = 0;
-		}
-		send(request->fd, str, (request->replymaxlen - 1), 0);
-		addlen -= (request->replymaxlen - 1);
-		str += (request->replymaxlen - 1);
+	memcpy(request->reply + request->replylen, str, len);
+	HTTP_QueuePart(request, request->reply + request->replylen, len);
+	request->replylen += len;
+	return request->replylen;
+#endif
+}
 
-		rtos_delay_milliseconds(1);
+int postconst(http_request_t* request, const char* str, int len) {
+#if !PLATFORM_BL602
+	// unit tests need whole reply in buffer
+	if (len >= HTTP_CONST_MIN_LEN && request->fd != 0) {
+		if (request->numIov >= HTTP_MAX_IOV) {
+			HTTP_Flush(request, false);
+		}
+		HTTP_QueuePart(request, str, len);
+		return request->replylen;
 	}
-
-	memcpy(request->reply + request->replylen, str, addlen);
-	request->replylen += addlen;
-	return (currentlen + addlen);
 #endif
+	return postany(request, str, len);
+}
+
+int poststr_const(http_request_t* request, const char* str) {
+	return postconst(request, str, strlen(str));
 }
 
+bool HTTP_FinishReply(http_request_t* request, int lenret) {
+	bool bFramed;
+
+	bFramed = request->bChunked || request->bFixedLength;
+	HTTP_Flush(request, true);
+	request->bChunked = 0;
+	return bFramed && request->bKeepAlive && request->bodyRemaining == 0;
+}
+
+int HTTP_GetRequestLength(const char* buf, int len) {
+	const char* end;
+	const char* line;
+	int i, headersLen, contentLength;
+
+	headersLen = -1;
+	for (i = 0; i + 3 < len; i++) {
+		if (buf[i] == '\r' && buf[i + 1] == '\n' && buf[i + 2] == '\r' && buf[i + 3] == '\n') {
+			headersLen = i + 4;
+			break;
+		}
+	}
+	if (headersLen < 0) {
+		return -1;
+	}
+	contentLength = 0;
+	end = buf + headersLen;
+	line = buf;
+	while (line < end) {
+		if (end - line > 15 && !my_strnicmp(line, "Content-Length:", 15)) {
+			contentLength = atoi(line + 15);
+			if (contentLength < 0) {
+				contentLength = 0;
+			}
+		}
+		while (line < end && *line != '\n') {
+			line++;
+		}
+		line++;
+	}
+	return headersLen + contentLength;
+}
 
 // add some more output safely, sending if necessary.
 // call with str == NULL to force send.
@@ -551,25 +935,155 @@ int poststr(http_request_t* request, const char* str) {
 
 int hprintf255(http_request_t* request, const char* fmt, ...) {
 	va_list argList;
-	//BaseType_t taken;
+#if PLATFORM_BL602
 	char tmp[256];
 	memset(tmp, 0, sizeof(tmp));
 	va_start(argList, fmt);
 	vsnprintf(tmp, 255, fmt, argList);
 	va_end(argList);
 	return postany(request, tmp, strlen(tmp));
+#else
+	char* at;
+	int len;
+
+	// formatted straight into reply buffer
+	HTTP_MakeRoom(request, 255);
+	at = request->reply + request->replylen;
+	va_start(argList, fmt);
+	len = vsnprintf(at, 255, fmt, argList);
+	va_end(argList);
+	if (len < 0 || len >= 255) {
+		len = strlen(at);
+	}
+	HTTP_QueuePart(request, at, len);
+	request->replylen += len;
+	return request->replylen;
+#endif
 }
 
 
+int HTTP_Recv(int fd, char* buf, int len) {
+	fd_set readfds;
+	struct timeval tv;
+
+	FD_ZERO(&readfds);
+	FD_SET(fd, &readfds);
+	tv.tv_sec = HTTP_RECV_TIMEOUT_MS / 1000;
+	tv.tv_usec = (HTTP_RECV_TIMEOUT_MS % 1000) * 1000;
+	if (select(fd + 1, &readfds, NULL, NULL, &tv) <= 0) {
+		return -1;
+	}
+	return recv(fd, buf, len, 0);
+}
+
+int HTTP_ReadBody(http_request_t* request) {
+	int len;
+
+	if (request->bodyRemaining <= 0) {
+		return 0;
+	}
+	// fd will be NULL for unit tests, there is nothing more to read
+	if (request->fd == 0) {
+		return -1;
+	}
+	len = request->bodyRemaining;
+	// never read past the body, next pipelined request may follow
+	if (len > request->receivedLenmax) {
+		len = request->receivedLenmax;
+	}
+	len = HTTP_Recv(request->fd, request->received, len);
+	if (len <= 0) {
+		ADDLOGF_ERROR("body recv returned %d - remaining %d", len, request->bodyRemaining);
+		return -1;
+	}
+	request->bodyRemaining -= len;
+	return len;
+}
+
+int HTTP_StreamBody(http_request_t* request, http_bodyCallback_fn cb, void* userData) {
+	int total;
+	int len;
+	int res;
+
+	total = 0;
+	if (request->bodylen > 0) {
+		res = cb(request, request->bodystart, request->bodylen, userData);
+		if (res < 0) {
+			return res;
+		}
+		total += request->bodylen;
+	}
+	while (request->bodyRemaining > 0) {
+		len = HTTP_ReadBody(request);
+		if (len <= 0) {
+			return -1;
+		}
+		res = cb(request, request->received, len, userData);
+		if (res < 0) {
+			return res;
+		}
+		total += len;
+	}
+	return total;
+}
+
+// built-in pages, other modules add theirs with HTTP_RegisterCallback
+static const httpRoute_t g_httpRoutes[] = {
+	{ "", HTTP_ANY, http_fn_empty_url },
+	{ "testmsg", HTTP_ANY, http_fn_testmsg },
+	{ "index", HTTP_ANY, http_fn_index },
+	{ "state", HTTP_ANY, http_fn_state },
+	{ "events", HTTP_ANY, http_fn_events },
+	{ "static/<name>", HTTP_ANY, http_fn_static },
+	{ "about", HTTP_ANY, http_fn_about },
+	{ "cfg_mqtt", HTTP_ANY, http_fn_cfg_mqtt },
+	{ "cfg_mqtt_set", HTTP_ANY, http_fn_cfg_mqtt_set },
+	{ "cfg_webapp", HTTP_ANY, http_fn_cfg_webapp },
+	{ "cfg_webapp_set", HTTP_ANY, http_fn_cfg_webapp_set },
+	{ "cfg_wifi", HTTP_ANY, http_fn_cfg_wifi },
+	{ "cfg_name", HTTP_ANY, http_fn_cfg_name },
+	{ "cfg_wifi_set", HTTP_ANY, http_fn_cfg_wifi_set },
+	{ "cfg_loglevel_set", HTTP_ANY, http_fn_cfg_loglevel_set },
+	{ "cfg_mac", HTTP_ANY, http_fn_cfg_mac },
+	{ "flash_read_tool", HTTP_ANY, http_fn_flash_read_tool },
+	{ "uart_tool", HTTP_ANY, http_fn_uart_tool },
+	{ "cmd_tool", HTTP_ANY, http_fn_cmd_tool },
+	{ "startup_command", HTTP_ANY, http_fn_startup_command },
+	{ "cfg_generic", HTTP_ANY, http_fn_cfg_generic },
+	{ "cfg_startup", HTTP_ANY, http_fn_cfg_startup },
+	{ "cfg_dgr", HTTP_ANY, http_fn_cfg_dgr },
+	{ "cfg_quick", HTTP_ANY, http_fn_cfg_quick },
+	{ "ha_cfg", HTTP_ANY, http_fn_ha_cfg },
+	{ "ha_discovery", HTTP_ANY, http_fn_ha_discovery },
+	{ "cfg", HTTP_ANY, http_fn_cfg },
+	{ "cfg_pins", HTTP_ANY, http_fn_cfg_pins },
+	{ "cfg_ping", HTTP_ANY, http_fn_cfg_ping },
+	{ "ota", HTTP_ANY, http_fn_ota },
+	{ "ota_exec", HTTP_ANY, http_fn_ota_exec },
+	{ "cm", HTTP_ANY, http_fn_cm },
+};
+static bool g_httpRoutesReady = false;
+
+void HTTP_InitRoutes() {
+	if (g_httpRoutesReady) {
+		return;
+	}
+	HTTP_AddRoutes(g_httpRoutes, sizeof(g_httpRoutes) / sizeof(g_httpRoutes[0]));
+	g_httpRoutesReady = true;
+}
+
 int HTTP_ProcessPacket(http_request_t* request) {
 	int i;
+	http_callback_fn callback;
 	char* p;
 	char* headers;
 	char* protocol;
+	char* connection = 0;
 	//int bChanged = 0;
 	char* urlStr = "";
 	char* recvbuf;
 
+	request->bKeepAlive = 0;
 	if (request->received == 0) {
 		ADDLOGF_ERROR("You gave request with NULL input");
 		return 0;
@@ -650,6 +1164,12 @@ int HTTP_ProcessPacket(http_request_t* request) {
 					if (!my_strnicmp(headers, "Content-Length:", 15)) {
 						request->contentLength = atoi(headers + 15);
 					}
+					else if (!my_strnicmp(headers, "Connection:", 11)) {
+						connection = headers + 11;
+						while (*connection == ' ') {
+							connection++;
+						}
+					}
 
 					*p = 0;
 					p++; // past \r
@@ -670,6 +1190,19 @@ int HTTP_ProcessPacket(http_request_t* request) {
 		} while (1);
 	}
 
+	// HTTP/1.1 keeps connection open unless told otherwise, HTTP/1.0 only when asked.
+	// BL602 sends every postany directly, so it can't do chunked replies
+#if !PLATFORM_BL602
+	if (request->bKeepAliveAllowed) {
+		if (connection) {
+			request->bKeepAlive = !my_strnicmp(connection, "keep-alive", 10);
+		}
+		else if (protocol) {
+			request->bKeepAlive = !strcmp(protocol, "HTTP/1.1");
+		}
+	}
+#endif
+
 	if (p == 0) {
 		request->bodystart = 0;
 		request->bodylen = 0;
@@ -678,6 +1211,10 @@ int HTTP_ProcessPacket(http_request_t* request) {
 		request->bodystart = p;
 		request->bodylen = request->receivedLen - (p - request->received);
 	}
+	request->bodyRemaining = 0;
+	if (request->contentLength > request->bodylen) {
+		request->bodyRemaining = request->contentLength - request->bodylen;
+	}
 #if 0
 	postany(request, "test", 4);
 	return 0;
@@ -685,56 +1222,13 @@ int HTTP_ProcessPacket(http_request_t* request) {
 	return http_fn_empty_url(request);
 #endif
 
-	// look for a callback with this URL and method, or HTTP_ANY
-	for (i = 0; i < numCallbacks; i++) {
-		char* url = callbacks[i]->url;
-		if (http_startsWith(urlStr, &url[1])) {
-			int method = callbacks[i]->method;
-			if (method == HTTP_ANY || method == request->method) {
-				return callbacks[i]->callback(request);
-			}
-		}
+	if (!g_httpRoutesReady) {
+		HTTP_InitRoutes();
+	}
+	callback = HTTP_FindRoute(request, urlStr, request->method);
+	if (callback) {
+		return callback(request);
 	}
-	if (http_checkUrlBase(urlStr, "")) return http_fn_empty_url(request);
-
-	if (http_checkUrlBase(urlStr, "testmsg")) return http_fn_testmsg(request);
-	if (http_checkUrlBase(urlStr, "index")) return http_fn_index(request);
-
-	if (http_checkUrlBase(urlStr, "about")) return http_fn_about(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_mqtt")) return http_fn_cfg_mqtt(request);
-	if (http_checkUrlBase(urlStr, "cfg_mqtt_set")) return http_fn_cfg_mqtt_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_webapp")) return http_fn_cfg_webapp(request);
-	if (http_checkUrlBase(urlStr, "cfg_webapp_set")) return http_fn_cfg_webapp_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_wifi")) return http_fn_cfg_wifi(request);
-	if (http_checkUrlBase(urlStr, "cfg_name")) return http_fn_cfg_name(request);
-	if (http_checkUrlBase(urlStr, "cfg_wifi_set")) return http_fn_cfg_wifi_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_loglevel_set")) return http_fn_cfg_loglevel_set(request);
-	if (http_checkUrlBase(urlStr, "cfg_mac")) return http_fn_cfg_mac(request);
-
-	if (http_checkUrlBase(urlStr, "flash_read_tool")) return http_fn_flash_read_tool(request);
-	if (http_checkUrlBase(urlStr, "uart_tool")) return http_fn_uart_tool(request);
-	if (http_checkUrlBase(urlStr, "cmd_tool")) return http_fn_cmd_tool(request);
-	if (http_checkUrlBase(urlStr, "startup_command")) return http_fn_startup_command(request);
-	if (http_checkUrlBase(urlStr, "cfg_generic")) return http_fn_cfg_generic(request);
-	if (http_checkUrlBase(urlStr, "cfg_startup")) return http_fn_cfg_startup(request);
-	if (http_checkUrlBase(urlStr, "cfg_dgr")) return http_fn_cfg_dgr(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_quick")) return http_fn_cfg_quick(request);
-	if (http_checkUrlBase(urlStr, "ha_cfg")) return http_fn_ha_cfg(request);
-	if (http_checkUrlBase(urlStr, "ha_discovery")) return http_fn_ha_discovery(request);
-	if (http_checkUrlBase(urlStr, "cfg")) return http_fn_cfg(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_pins")) return http_fn_cfg_pins(request);
-	if (http_checkUrlBase(urlStr, "cfg_ping")) return http_fn_cfg_ping(request);
-
-	if (http_checkUrlBase(urlStr, "ota")) return http_fn_ota(request);
-	if (http_checkUrlBase(urlStr, "ota_exec")) return http_fn_ota_exec(request);
-	if (http_checkUrlBase(urlStr, "cm")) return http_fn_cm(request);
-
 	return http_fn_other(request);
 }
 
@@ -752,9 +1246,144 @@ const char htmlHeadStyle[] = "<style>div,fieldset,input,select{padding:5px;font-
 //region_end htmlHeadStyle
 
 //region_start pageScript
-const char pageScript[] = "<script type='text/javascript'>var firstTime,lastTime,onlineFor,req=null,onlineForEl=null,getElement=e=>document.getElementById(e);function showState(){clearTimeout(firstTime),clearTimeout(lastTime),null!=req&&req.abort(),(req=new XMLHttpRequest).onreadystatechange=()=>{var e;4==req.readyState&&\"OK\"==req.statusText&&((\"INPUT\"!=document.activeElement.tagName||\"number\"!=document.activeElement.type&&\"color\"!=document.activeElement.type)&&(e=getElement(\"state\"))&&(e.innerHTML=req.responseText),clearTimeout(firstTime),clearTimeout(lastTime),lastTime=setTimeout(showState,3e3))},req.open(\"GET\",\"index?state=1\",!0),req.send(),firstTime=setTimeout(showState,3e3)}function fmtUpTime(e){var t,n,o=Math.floor(e/86400);return e%=86400,t=Math.floor(e/3600),e%=3600,n=Math.floor(e/60),e=e%60,0<o?o+` days, ${t} hours, ${n} minutes and ${e} seconds`:0<t?t+` hours, ${n} minutes and ${e} seconds`:0<n?n+` minutes and ${e} seconds`:`just ${e} seconds`}function updateOnlineFor(){onlineForEl.textContent=fmtUpTime(++onlineFor)}function onLoad(){(onlineForEl=getElement(\"onlineFor\"))&&(onlineFor=parseInt(onlineForEl.dataset.initial,10))&&setInterval(updateOnlineFor,1e3),showState()}function submitTemperature(e){var t=getElement(\"form132\");getElement(\"kelvin132\").value=Math.round(1e6/parseInt(e.value)),t.submit()}window.addEventListener(\"load\",onLoad),history.pushState(null,\"\",window.location.pathname.slice(1)),setTimeout(()=>{var e=getElement(\"changed\");e&&(e.innerHTML=\"\")},5e3);</script>";
+const char pageScript[] = "<script type='text/javascript'>var firstTime,lastTime,onlineFor,req=null,onlineForEl=null,stateVersion=0,lastRender=0,getElement=e=>document.getElementById(e);function showState(){clearTimeout(firstTime),clearTimeout(lastTime),null!=req&&req.abort(),(req=new XMLHttpRequest).onreadystatechange=()=>{var e;4==req.readyState&&\"OK\"==req.statusText&&(e=JSON.parse(req.responseText),clearTimeout(firstTime),e.v!=stateVersion||6e4<Date.now()-lastRender?(stateVersion=e.v,renderState()):lastTime=setTimeout(showState,3e3))},req.open(\"GET\",\"state?since=\"+stateVersion+\"&wait=20\",!0),req.send(),firstTime=setTimeout(showState,3e4)}function renderState(){(req=new XMLHttpRequest).onreadystatechange=()=>{var e;4==req.readyState&&\"OK\"==req.statusText&&((\"INPUT\"!=document.activeElement.tagName||\"number\"!=document.activeElement.type&&\"color\"!=document.activeElement.type)&&(e=getElement(\"state\"))&&(e.innerHTML=req.responseText),lastRender=Date.now(),clearTimeout(lastTime),lastTime=setTimeout(showState,3e3))},req.open(\"GET\",\"index?state=1\",!0),req.send()}function fmtUpTime(e){var t,n,o=Math.floor(e/86400);return e%=86400,t=Math.floor(e/3600),e%=3600,n=Math.floor(e/60),e=e%60,0<o?o+` days, ${t} hours, ${n} minutes and ${e} seconds`:0<t?t+` hours, ${n} minutes and ${e} seconds`:0<n?n+` minutes and ${e} seconds`:`just ${e} seconds`}function updateOnlineFor(){onlineForEl.textContent=fmtUpTime(++onlineFor)}function onLoad(){(onlineForEl=getElement(\"onlineFor\"))&&(onlineFor=parseInt(onlineForEl.dataset.initial,10))&&setInterval(updateOnlineFor,1e3),lastRender=Date.now(),showState()}function submitTemperature(e){var t=getElement(\"form132\");getElement(\"kelvin132\").value=Math.round(1e6/parseInt(e.value)),t.submit()}window.addEventListener(\"load\",onLoad),history.pushState(null,\"\",window.location.pathname.slice(1)),setTimeout(()=>{var e=getElement(\"changed\");e&&(e.innerHTML=\"\")},5e3);</script>";
 //region_end pageScript
 
 //region_start ha_discovery_script
 const char ha_discovery_script[] = "<script type='text/javascript'>function send_ha_disc(){var e=new XMLHttpRequest;e.open(\"GET\",\"/ha_discovery?prefix=\"+document.getElementById(\"ha_disc_topic\").value,!1),e.onload=function(){200===e.status?alert(e.responseText):404===e.status&&alert(\"Error invoking ha_discovery\")},e.onerror=function(){alert(\"Error invoking ha_discovery\")},e.send()}</script>";
 //region_end ha_discovery_script
+
+
+//region_start pageScript_gz
+const char pageScript_hash[] = "c52fe5066ea7efb4";
+const int pageScript_gzLen = 803;
+const unsigned char pageScript_gz[] = {
+0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0xb5,0x55,0x6d,0x6f,0xdb,0x36,
+0x10,0xfe,0x2b,0x0a,0xd1,0x18,0x24,0xcc,0xb1,0x72,0x9d,0x19,0x43,0x1d,0xd6,0xc0,
+0xb6,0x74,0xcd,0x9a,0x97,0xa1,0x75,0x87,0x7d,0x34,0x23,0x9d,0x63,0x6e,0xd2,0x51,
+0x21,0x4f,0x76,0x0c,0xc7,0xff,0xbd,0x90,0x94,0x48,0x72,0x86,0x74,0xc3,0x80,0x7d,
+0xa3,0xee,0x85,0xf7,0xdc,0x73,0x0f,0x4f,0x6b,0xe3,0xa3,0xa5,0xf5,0x81,0xe6,0x36,
+0x07,0x99,0x99,0xc7,0x83,0xc3,0xcc,0x22,0xbc,0x77,0x5e,0x7a,0xb8,0xd3,0x58,0x66,
+0x59,0x67,0x3a,0xcb,0x1a,0x43,0x20,0x43,0xf0,0x3b,0xf8,0x60,0x1d,0xea,0xb8,0xce,
+0xfd,0x04,0x98,0x82,0xd7,0xb1,0xbc,0x05,0x3a,0xcb,0x20,0x07,0x24,0x0d,0xfa,0x5d,
+0xea,0x92,0xb2,0x3a,0xab,0xce,0xfc,0xe3,0xf6,0x3c,0xe5,0x20,0xa6,0xcb,0x12,0x13,
+0xb2,0x0e,0xa3,0xb0,0x72,0x9b,0xcf,0xd5,0x8d,0x5c,0xec,0x92,0x0c,0x8c,0xaf,0x70,
+0xb8,0x92,0x78,0x8b,0x4e,0xc8,0x03,0xfb,0x13,0x56,0x21,0x2b,0x34,0x47,0xda,0xc3,
+0xdd,0x60,0xe0,0xe1,0x4e,0x99,0x1b,0xe7,0x89,0x0b,0xc9,0x6b,0xe8,0xb0,0x89,0xfe,
+0xb8,0xbc,0xf8,0x40,0x54,0x7c,0x82,0xbb,0x12,0x02,0x09,0xe5,0xd0,0x83,0x49,0xb7,
+0x35,0xfe,0x64,0x65,0xf0,0x16,0x34,0x17,0xfa,0xdd,0x6e,0x6d,0x7c,0x04,0xd3,0x13,
+0x5d,0x5d,0xa5,0xea,0x90,0x1a,0xd0,0x60,0xc0,0xae,0x3f,0xb2,0xc6,0x5a,0xe5,0x94,
+0x61,0x0e,0xf7,0x34,0x18,0x70,0xd0,0xbf,0x7e,0xbe,0xbe,0x52,0x85,0xf1,0x01,0x78,
+0x93,0x13,0x0a,0x87,0x01,0x2a,0xff,0x33,0xb4,0xbd,0x2e,0x40,0xad,0x8f,0x74,0x9f,
+0xbc,0x87,0x87,0x09,0x9c,0x9c,0xfe,0x6c,0x08,0x14,0xba,0x0d,0x17,0xdf,0x75,0x54,
+0xce,0xf8,0x01,0xcb,0xa0,0xd6,0xd2,0xd7,0x8e,0x47,0xaa,0xc4,0xdb,0x27,0x1a,0x74,
+0x00,0x7a,0x2a,0xd6,0x72,0x29,0xc7,0x30,0x16,0x62,0x5f,0x0d,0x51,0xb9,0x02,0x90,
+0xb3,0x5f,0xce,0xe6,0x4c,0xb2,0xfa,0xd2,0x59,0xb0,0x98,0x80,0x66,0xc3,0x7e,0x89,
+0x21,0x1b,0x6c,0x8c,0x25,0xfd,0x26,0x66,0xf2,0x28,0x16,0x75,0x66,0x00,0x4c,0xb9,
+0x90,0x6d,0x0b,0x2f,0x95,0x3a,0x11,0xfb,0x76,0x9c,0x07,0x28,0x77,0xff,0xfb,0x28,
+0x38,0x3b,0xbf,0xfa,0xed,0xcb,0x9c,0x1d,0xe9,0x56,0x6b,0x26,0x21,0xbb,0x86,0x47,
+0xb9,0x29,0x32,0xb7,0x57,0x26,0x87,0x87,0x07,0x86,0x65,0x7e,0x03,0xfe,0x1b,0x91,
+0xdb,0xa2,0xaa,0x93,0xb8,0xcc,0xfd,0x43,0x94,0xa8,0x35,0xd0,0x69,0x9a,0x37,0xbc,
+0x32,0x51,0x3b,0x94,0x45,0x04,0xff,0x61,0x7e,0x79,0xa1,0xff,0xae,0x8d,0xde,0x63,
+0xe9,0xe6,0xfe,0x92,0xbe,0xff,0xd3,0x88,0x2d,0xa6,0x70,0x3f,0xab,0x01,0xe9,0xd1,
+0xf3,0x59,0x76,0x73,0x5a,0xe6,0xf4,0xa5,0xa8,0x2e,0xe5,0x20,0x6a,0xd6,0x49,0xa2,
+0x74,0xfa,0xd2,0xd0,0x4a,0x2d,0x33,0xe7,0x3c,0x87,0xd7,0x3f,0x4c,0x4e,0xe2,0x58,
+0x4c,0x3d,0x50,0xe9,0x31,0x82,0x63,0x5d,0x1b,0x24,0x1d,0x46,0x8d,0x27,0x71,0x2c,
+0x24,0x1c,0xeb,0xea,0x20,0xf1,0xd0,0x39,0xa9,0x5c,0x1a,0x8e,0x27,0xb1,0x8c,0x4f,
+0xdd,0xcc,0x0d,0x17,0x51,0x6a,0xb6,0x41,0x46,0xaf,0x76,0xb4,0x8f,0x56,0xae,0xf4,
+0xf5,0x19,0xf7,0x51,0x6e,0xb1,0x24,0x08,0x91,0xc1,0x34,0x7a,0xb5,0x83,0x7d,0x14,
+0x20,0x71,0x98,0x86,0xc5,0xdb,0xf8,0x94,0x66,0x34,0x5c,0xfc,0xeb,0x68,0x9c,0xe1,
+0x70,0xf1,0x8d,0x88,0xc5,0x9f,0x65,0xa0,0x43,0x5b,0xc7,0x4b,0x59,0xa4,0x86,0xe0,
+0xfa,0x69,0xe7,0x71,0xb1,0xeb,0xed,0x3f,0x45,0x70,0x4f,0x3f,0x39,0xa4,0x6a,0xbf,
+0x75,0x0c,0x0e,0x87,0x6d,0x4c,0x8f,0x61,0x87,0x17,0xce,0xa4,0xd5,0x23,0xe8,0x6f,
+0xd0,0xbe,0x6a,0x5a,0x7b,0xa3,0x9c,0xf6,0x53,0xd7,0x9b,0xe5,0x1c,0xa9,0x9f,0xa9,
+0x52,0x43,0x26,0x00,0x29,0x8b,0x96,0xac,0xc9,0xe4,0x28,0xae,0xb2,0x02,0xd0,0x39,
+0x12,0xf8,0xb5,0xc9,0xf8,0x33,0xec,0x72,0x04,0xe3,0x97,0x14,0xd7,0xdb,0xba,0x1d,
+0xe2,0x50,0xde,0xe4,0x96,0xe6,0x90,0x17,0xe0,0x0d,0x95,0xbe,0xd3,0xc6,0x01,0xec,
+0xa5,0xf3,0xf9,0x68,0xfc,0x86,0x89,0x69,0xdf,0xfa,0x17,0x64,0x6b,0x8b,0xb5,0x5d,
+0xad,0x4d,0x56,0x42,0x23,0x04,0xef,0x4a,0x4c,0xf9,0x08,0x26,0xaf,0xdb,0xa6,0xa0,
+0xf1,0x0b,0x21,0x49,0x35,0x25,0xb9,0xd8,0x6f,0x2c,0xa6,0x6e,0xa3,0x4c,0x9a,0x9e,
+0xad,0x01,0xe9,0xc2,0x06,0x02,0x04,0xcf,0x59,0xe6,0x4c,0xca,0x64,0x43,0xa6,0x90,
+0x2b,0x1b,0xc8,0xf9,0xad,0x2a,0xca,0xb0,0x6a,0xf0,0xd7,0xbf,0x24,0xc6,0xe4,0xe3,
+0x05,0x99,0x4b,0x4c,0xd5,0x8c,0x2a,0x0c,0xad,0xd0,0xe4,0xa0,0x42,0x66,0x13,0xe0,
+0x23,0x21,0x64,0xef,0x19,0x75,0xcb,0xe6,0xa0,0xb5,0x66,0x15,0xa5,0x4c,0x4c,0xe1,
+0xd9,0x53,0x66,0x4c,0xec,0xe5,0xf7,0x30,0x16,0xd3,0xaf,0xf2,0x24,0x9c,0xcc,0x3a,
+0x07,0x00,0x00,
+};
+//region_end pageScript_gz
+
+//region_start ha_discovery_script_gz
+const char ha_discovery_script_hash[] = "1ab921f71ac76e3a";
+const int ha_discovery_script_gzLen = 222;
+const unsigned char ha_discovery_script_gz[] = {
+0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x8d,0x90,0xc1,0x4b,0xc3,0x30,
+0x1c,0x85,0xff,0x95,0x98,0xc3,0x48,0xb0,0xc4,0x3a,0x76,0x52,0xc2,0x40,0x28,0x2a,
+0xe8,0x45,0x76,0xf0,0x56,0x42,0xf3,0x3a,0x83,0x35,0x89,0xc9,0x2f,0x75,0x63,0xec,
+0x7f,0x1f,0xd5,0x1e,0x7a,0xf4,0xf6,0x0e,0xdf,0xe3,0x7b,0xbc,0xbe,0xf8,0x8e,0x5c,
+0xf0,0x2c,0xc3,0xdb,0xf6,0xc3,0xb4,0xd6,0xe5,0x4e,0xc8,0xd3,0x68,0x12,0x83,0xf6,
+0xf8,0x61,0xef,0xaf,0x2f,0x4f,0x44,0xf1,0x0d,0xdf,0x05,0x99,0xee,0xa1,0x42,0x84,
+0x17,0xfc,0xb1,0xd9,0xf1,0x8a,0xdf,0xcc,0x8d,0x30,0x22,0x1d,0xb7,0x31,0xa1,0x77,
+0x07,0xcd,0xaf,0x6d,0xe8,0xca,0x17,0x3c,0xa9,0x3d,0xa8,0x19,0x30,0xc5,0x87,0xe3,
+0xb3,0x15,0x7c,0xc6,0x5b,0x0a,0xd1,0x75,0x5c,0xaa,0xd1,0x0c,0x05,0xd5,0xd5,0xad,
+0xac,0xa0,0x82,0x1f,0x82,0xb1,0xba,0x9f,0x17,0x09,0x79,0x5a,0xd7,0xb5,0xd6,0x1a,
+0x2a,0x93,0xa1,0x92,0xb7,0x66,0x40,0x22,0x01,0x95,0x90,0x63,0xf0,0x19,0x3b,0x1c,
+0x48,0xde,0x6d,0xea,0xcd,0x02,0x5a,0xad,0xfe,0x28,0xde,0xa4,0x14,0x12,0x73,0x7e,
+0x0c,0x9f,0xce,0xef,0xd9,0x72,0x27,0x97,0xe7,0x5f,0x1d,0x26,0x64,0xe9,0xfb,0x6f,
+0x75,0xfa,0x4a,0xc8,0xf3,0x05,0x6d,0x45,0x1a,0xc7,0x3c,0x01,0x00,0x00,
+};
+//region_end ha_discovery_script_gz
+
+//region_start htmlHeadStyle_gz
+const char htmlHeadStyle_hash[] = "21a9d1953265aca2";
+const int htmlHeadStyle_gzLen = 761;
+const unsigned char htmlHeadStyle_gz[] = {
+0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x75,0x55,0x61,0x8f,0xa3,0x2c,
+0x10,0xfe,0x2b,0xbd,0x34,0x9b,0xdc,0x25,0x4a,0xb0,0xd6,0xee,0x2e,0xe6,0xfd,0x25,
+0x97,0xfd,0x30,0xca,0xa0,0x64,0x15,0x78,0x11,0x5b,0x7a,0x86,0xff,0x7e,0xc1,0xea,
+0x9e,0x6d,0xba,0x21,0x69,0xca,0xc0,0xcc,0xf3,0xcc,0x33,0x33,0xc8,0xe5,0x39,0x11,
+0x12,0x3b,0x3e,0xa0,0x4b,0xa4,0x32,0xa3,0x4b,0x06,0xec,0xb0,0x76,0x93,0x01,0xce,
+0xa5,0x6a,0x58,0x61,0x7c,0x29,0xb4,0x72,0xe9,0x20,0xff,0x20,0xcb,0xb0,0x2f,0x7b,
+0xb0,0x8d,0x54,0x8c,0xee,0xe8,0x8e,0x1c,0xb0,0x0f,0xab,0xff,0x54,0x41,0xfd,0xd9,
+0x58,0x3d,0x2a,0xce,0xf6,0x47,0x11,0x57,0x30,0xd3,0x72,0x9b,0x14,0xd8,0xef,0x68,
+0x98,0x21,0xa6,0x8b,0xe4,0xae,0x65,0x19,0xa5,0x2f,0x65,0xa5,0x7d,0x8c,0x1c,0x91,
+0x2a,0x6d,0x39,0xda,0xb4,0xd2,0xbe,0x4c,0x2f,0x58,0x7d,0x4a,0x97,0x7e,0x73,0xda,
+0xeb,0x3f,0xdf,0x1c,0x6d,0x29,0x70,0xce,0xcb,0x5a,0x77,0xda,0xb2,0x3d,0xa5,0x34,
+0x08,0x6d,0xfb,0x85,0x4d,0x5a,0x69,0xe7,0x74,0x3f,0x93,0xba,0x51,0xfa,0xed,0xae,
+0x06,0xff,0xab,0x5b,0xac,0x3f,0x2b,0xed,0x3f,0x92,0x8d,0xd1,0x02,0x97,0xfa,0x63,
+0xe5,0xfc,0x95,0x7f,0x6a,0x65,0xd3,0x3a,0x76,0x32,0xbe,0x3c,0xa3,0x75,0xb2,0x86,
+0x2e,0x85,0x4e,0x36,0x8a,0xa5,0x99,0xf1,0xe1,0x2e,0x80,0x6a,0x70,0x0d,0xf0,0xfe,
+0xfe,0x12,0x16,0x85,0xb7,0x2a,0x7c,0x4f,0xdb,0xa1,0x77,0x60,0x11,0x26,0x8b,0x73,
+0x05,0x56,0xb0,0x72,0x89,0xf7,0xf6,0x52,0xb6,0x38,0x53,0xc9,0xb3,0x37,0xe3,0xcb,
+0x6d,0xdd,0xf4,0x19,0xad,0xe8,0xf4,0x85,0xc1,0xe8,0xf4,0x1d,0x48,0x26,0xe2,0x5a,
+0x71,0x4e,0x45,0x9d,0x65,0x45,0xa8,0x34,0xbf,0x4e,0x11,0x6f,0x49,0xa4,0x46,0xe5,
+0xd0,0xde,0xaa,0x2f,0xa0,0x97,0xdd,0x35,0xa2,0x73,0x50,0x90,0x0c,0xa0,0x86,0x74,
+0x40,0x2b,0xc5,0xec,0x95,0xb4,0xd9,0x0e,0xee,0xea,0x7f,0xc8,0xf2,0x3c,0xc7,0x15,
+0x00,0x21,0xae,0xe0,0xf8,0x57,0x5b,0xd1,0x50,0x8d,0xce,0x69,0xb5,0x55,0x7a,0x18,
+0xab,0x5e,0xba,0x8f,0xe9,0x56,0x4f,0x46,0xcb,0xa5,0xb0,0xb1,0x02,0xe3,0xc0,0x48,
+0x6e,0xb1,0x7f,0xc8,0x02,0x72,0xac,0x57,0x10,0x01,0x42,0x08,0x51,0x76,0x52,0x61,
+0xba,0x48,0x72,0x20,0xc7,0xe8,0xb3,0xe9,0x5f,0x72,0x88,0x86,0x7a,0xb4,0x83,0xb6,
+0xcc,0x68,0x19,0x33,0x0c,0x4f,0x38,0x6c,0x8a,0xe3,0x2c,0xa8,0x41,0x3a,0xa9,0x55,
+0xca,0x47,0x0b,0xf1,0x0f,0x23,0xc7,0xe1,0x89,0x17,0x6b,0xa3,0xe2,0x77,0x3a,0x50,
+0x7c,0xa5,0x70,0x0c,0xa4,0xb2,0xc8,0xef,0x0e,0xf8,0x31,0x2f,0xf2,0xe2,0x87,0xec,
+0x8d,0xb6,0x0e,0x94,0xbb,0x5d,0x79,0x12,0xe1,0x3d,0x8f,0xa5,0xba,0xbb,0xd8,0x58,
+0x75,0x3f,0x6c,0xaf,0xf5,0xe1,0x74,0x7a,0xbc,0xf2,0x24,0x56,0x01,0x20,0x4e,0xdb,
+0x58,0x30,0x2d,0xe2,0x2d,0x52,0xce,0xd5,0xe7,0x58,0xeb,0x25,0x4f,0xa5,0x15,0x06,
+0x62,0x26,0xd1,0x69,0x70,0xac,0x43,0xe1,0xca,0x4d,0x83,0xc4,0x7d,0x20,0xff,0x2f,
+0xa7,0xf3,0x40,0x6c,0x8f,0x67,0x43,0x20,0x76,0x7a,0xac,0x23,0xf6,0x5f,0x6d,0x7a,
+0x30,0x7e,0x7d,0x50,0x4e,0xc6,0xef,0xe2,0x76,0x43,0x38,0xd6,0x12,0x6c,0xda,0x44,
+0x4f,0x54,0xee,0xe7,0x3b,0xe5,0xd8,0x24,0x7b,0x21,0x80,0x52,0x9a,0xec,0xe1,0xc4,
+0x33,0x21,0x7e,0x05,0xd2,0x8a,0x89,0xcb,0xc1,0x74,0x70,0x5d,0x18,0xb7,0x5c,0x9e,
+0xd7,0x89,0x2b,0x5e,0xca,0x4b,0x2b,0x1d,0xa6,0x83,0x81,0x1a,0x99,0xd2,0x17,0x0b,
+0x26,0x90,0x16,0x3b,0x5c,0xae,0x1c,0x32,0x6a,0x7c,0xb9,0x46,0x90,0x6a,0x6e,0xa1,
+0xaa,0xd3,0xf5,0xe7,0x3a,0xec,0x31,0xd3,0xc8,0x35,0x70,0x79,0xde,0x0f,0x0e,0x1c,
+0x6e,0x3a,0x39,0xda,0xea,0x36,0x4e,0xf9,0xa6,0xbf,0xd7,0xa9,0x3c,0xe4,0x8b,0x57,
+0x0f,0x52,0x4d,0x0f,0xe2,0x3d,0xc7,0xbc,0x1b,0x9a,0xb2,0x97,0x2a,0xbd,0xd1,0xcc,
+0x8f,0x74,0x56,0xcb,0x2f,0xfb,0x37,0x4a,0x8d,0x0f,0x0e,0xaa,0x0e,0xa7,0xf9,0x37,
+0xed,0xe0,0xaa,0x47,0xc7,0x84,0xf4,0xc8,0xcb,0x7f,0x2d,0x1c,0x48,0xc4,0x49,0xa3,
+0x34,0x0f,0x3a,0xcd,0xf6,0x1b,0xf8,0xf4,0x8c,0x4b,0x20,0x03,0x08,0x5c,0x9a,0xc4,
+0x22,0x9f,0x5f,0x51,0x22,0x15,0x47,0xf5,0xf5,0x89,0xb8,0x89,0x93,0x9d,0x8c,0x0f,
+0x9d,0x5c,0xdf,0xfb,0xc2,0xf8,0x1d,0x0d,0x44,0x0b,0x91,0x10,0xad,0xbe,0x7b,0x55,
+0xe6,0x99,0x2c,0x8e,0xc6,0x87,0x78,0x69,0x36,0x5d,0x6e,0xb2,0xbd,0x52,0x1a,0xfe,
+0x02,0xb0,0xd4,0x79,0x7e,0x9d,0x06,0x00,0x00,
+};
+//region_end htmlHeadStyle_gz
\ No newline at end of file
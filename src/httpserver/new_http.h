@@ -1,6 +1,8 @@
 #ifndef _NEW_HTTP_H
 #define _NEW_HTTP_H
 
+#include "../new_common.h"
+
 
 extern const char httpHeader[];  // HTTP header
 extern const char httpMimeTypeHTML[];              // HTML MIME type
@@ -8,6 +10,7 @@ extern const char httpMimeTypeText[];           // TEXT MIME type
 extern const char httpMimeTypeJson[];
 extern const char httpMimeTypeBinary[];
 extern const char httpMimeTypeXML[];
+extern const char httpCorsHeaders[];
 
 extern const char htmlShortcutIcon[];
 extern const char htmlDoctype[];
@@ -24,13 +27,33 @@ extern const char* g_build_str;
 extern const char htmlHeadStyle[];
 extern const char pageScript[];
 extern const char ha_discovery_script[];
+// gzip-compressed copies and content hashes, made by gulp together with text above
+extern const char htmlHeadStyle_hash[];
+extern const int htmlHeadStyle_gzLen;
+extern const unsigned char htmlHeadStyle_gz[];
+extern const char pageScript_hash[];
+extern const int pageScript_gzLen;
+extern const unsigned char pageScript_gz[];
+extern const char ha_discovery_script_hash[];
+extern const int ha_discovery_script_gzLen;
+extern const unsigned char ha_discovery_script_gz[];
 
 #define HTTP_RESPONSE_OK 200
+#define HTTP_RESPONSE_NOT_MODIFIED 304
 #define HTTP_RESPONSE_NOT_FOUND 404
 #define HTTP_RESPONSE_SERVER_ERROR 500
 
 #define MAX_QUERY 16
 #define MAX_HEADERS 16
+#define HTTP_MAX_ROUTE_PARAMS 2
+// parts of reply sent with one vectored send
+#define HTTP_MAX_IOV 8
+
+typedef struct httpIov_s {
+	const char* data;
+	int len;
+} httpIov_t;
+
 typedef struct http_request_tag {
 	char* received; // partial or whole received data, up to 1024
 	int receivedLen;
@@ -47,6 +70,8 @@ typedef struct http_request_tag {
 	char* bodystart; /// start start of the body (maybe all of it)
 	int bodylen;
 	int contentLength;
+	// body bytes still waiting in socket, read them with HTTP_StreamBody or HTTP_ReadBody
+	int bodyRemaining;
 	int responseCode;
 
 	// used to respond
@@ -54,21 +79,76 @@ typedef struct http_request_tag {
 	int replylen;
 	int replymaxlen;
 	int fd;
+
+	// set by server if connection can stay open after this request
+	int bKeepAliveAllowed;
+	// filled by HTTP_ProcessPacket, client wants connection to stay open
+	int bKeepAlive;
+	// reply body is sent with chunked transfer encoding, set by http_setup
+	int bChunked;
+	// parts of reply waiting to be sent, they point into reply buffer
+	// or to constant data given to postconst
+	httpIov_t iov[HTTP_MAX_IOV];
+	int numIov;
+	// first part of chunked body, parts before it are headers
+	int iovBody;
+	// connection was taken over by handler (event stream), server must not close it
+	int bDetached;
+	// reply has Content-Length, set by http_setup_length
+	int bFixedLength;
+	// parts of url matched by <name> segments of route, not terminated
+	int numRouteParams;
+	const char* routeParams[HTTP_MAX_ROUTE_PARAMS];
+	int routeParamLens[HTTP_MAX_ROUTE_PARAMS];
 } http_request_t;
 
 
 int HTTP_ProcessPacket(http_request_t* request);
+// sends what is left of reply after HTTP_ProcessPacket (lenret is not used),
+// returns true if connection can be used for next request
+bool HTTP_FinishReply(http_request_t* request, int lenret);
+// returns length of first request in buffer (headers and body),
+// or -1 if headers are not complete yet
+int HTTP_GetRequestLength(const char* buf, int len);
+// recv with timeout, returns -1 on error or timeout
+int HTTP_Recv(int fd, char* buf, int len);
+// receives next part of body into request->received,
+// returns its length, 0 if there is no more body and -1 on error
+int HTTP_ReadBody(http_request_t* request);
+// called with every part of request body, return negative value to abort
+typedef int (*http_bodyCallback_fn)(http_request_t* request, const char* data, int len, void* userData);
+// passes whole body, starting with the part that came with headers, to callback.
+// Next part is received only after callback returns, so slow consumer (flash write)
+// throttles the sender through TCP window instead of buffering in RAM.
+// Returns number of bytes passed or negative value on error.
+int HTTP_StreamBody(http_request_t* request, http_bodyCallback_fn cb, void* userData);
 void http_setup(http_request_t* request, const char* type);
+// Like http_setup, but for body of known length, so connection can stay open
+// without chunked encoding. Type may be NULL (304 reply). Extra headers are
+// "Name: value\r\n" lines, may be NULL.
+void http_setup_length(http_request_t* request, const char* type, int length, const char* extraHeaders);
+// value of request header, or NULL
+const char* http_getHeader(http_request_t* request, const char* name);
+bool http_acceptsGzip(http_request_t* request);
+// If client has given etag in If-None-Match, sends 304 with extra headers and returns true
+bool http_checkNotModified(http_request_t* request, const char* etag, const char* extraHeaders);
 void http_html_start(http_request_t* request, const char* pagename);
 void http_html_end(http_request_t* request);
 int poststr(http_request_t* request, const char* str);
 void poststr_escaped(http_request_t* request, char* str);
 int postany(http_request_t* request, const char* str, int len);
+// Like postany, but data is not copied into reply buffer, so it must stay
+// valid until reply is sent (string literals, const tables).
+int postconst(http_request_t* request, const char* str, int len);
+int poststr_const(http_request_t* request, const char* str);
 void misc_formatUpTimeString(int totalSeconds, char* o);
 // void HTTP_AddBuildFooter(http_request_t *request);
 // void HTTP_AddHeader(http_request_t *request);
 int http_getArg(const char* base, const char* name, char* o, int maxSize);
 int http_getArgInteger(const char* base, const char* name);
+// copies route param with given index (see http_routes.h), returns its length or 0
+int http_getRouteParam(http_request_t* request, int index, char* o, int maxSize);
+int http_getRouteParamInteger(http_request_t* request, int index);
 
 // poststr with format - for results LESS THAN 128
 int hprintf255(http_request_t* request, const char* fmt, ...);
@@ -83,9 +163,11 @@ typedef enum {
 
 // callback function for http
 typedef int (*http_callback_fn)(http_request_t* request);
-// url MUST start with '/'
-// urls must be unique (i.e. you can't have /about and /aboutme or /about/me)
+// url MUST start with '/', url ending with '/' gets all paths below it
+// (i.e. /api/ gets /api/info and /api/lfs/file.txt)
 int HTTP_RegisterCallback(const char* url, int method, http_callback_fn callback);
+// adds built-in pages to route table, called by HTTPServer_Start
+void HTTP_InitRoutes();
 
 #endif
 
@@ -3,6 +3,7 @@
 #include "../new_common.h"
 #include "../logging/logging.h"
 #include "../httpserver/new_http.h"
+#include "../httpserver/http_routes.h"
 #include "../new_pins.h"
 #include "../jsmn/jsmn_h.h"
 #include "../ota/ota.h"
@@ -85,9 +86,12 @@ static int http_rest_get_logconfig(http_request_t* request);
 static int http_rest_get_lfs_delete(http_request_t* request);
 static int http_rest_get_lfs_file(http_request_t* request);
 static int http_rest_post_lfs_file(http_request_t* request);
+static int http_rest_get_fsblock(http_request_t* request);
+static int http_rest_post_fsblock(http_request_t* request);
 #endif
 
 static int http_rest_post_reboot(http_request_t* request);
+static int http_rest_post_ota(http_request_t* request);
 static int http_rest_post_flash(http_request_t* request, int startaddr, int maxaddr);
 static int http_rest_get_flash(http_request_t* request, int startaddr, int len);
 static int http_rest_get_flash_advanced(http_request_t* request);
@@ -100,16 +104,49 @@ static int http_rest_get_testconfig(http_request_t* request);
 
 static int http_rest_post_channels(http_request_t* request);
 static int http_rest_get_channels(http_request_t* request);
+static int http_rest_post_channel(http_request_t* request);
+static int http_rest_get_channel(http_request_t* request);
 
 static int http_rest_get_flash_vars_test(http_request_t* request);
 
 static int http_rest_post_cmd(http_request_t* request);
 
 
+static const httpRoute_t g_restRoutes[] = {
+	{ "api/channels", HTTP_GET, http_rest_get_channels },
+	{ "api/channels", HTTP_POST, http_rest_post_channels },
+	{ "api/channels/<n>", HTTP_GET, http_rest_get_channel },
+	{ "api/channels/<n>", HTTP_POST, http_rest_post_channel },
+	{ "api/pins", HTTP_GET, http_rest_get_pins },
+	{ "api/pins", HTTP_POST, http_rest_post_pins },
+	{ "api/channelTypes", HTTP_GET, http_rest_get_channelTypes },
+	{ "api/channelTypes", HTTP_POST, http_rest_post_channelTypes },
+	{ "api/logconfig", HTTP_GET, http_rest_get_logconfig },
+	{ "api/logconfig", HTTP_POST, http_rest_post_logconfig },
+	{ "api/seriallog", HTTP_GET, http_rest_get_seriallog },
+#ifdef ENABLE_LITTLEFS
+	{ "api/fsblock", HTTP_GET, http_rest_get_fsblock },
+	{ "api/fsblock", HTTP_POST, http_rest_post_fsblock },
+	{ "api/lfs/<path*>", HTTP_GET, http_rest_get_lfs_file },
+	{ "api/lfs/<path*>", HTTP_POST, http_rest_post_lfs_file },
+	{ "api/del/<path*>", HTTP_GET, http_rest_get_lfs_delete },
+#endif
+	{ "api/info", HTTP_GET, http_rest_get_info },
+	{ "api/flash/<range>", HTTP_GET, http_rest_get_flash_advanced },
+	{ "api/flash/<range>", HTTP_POST, http_rest_post_flash_advanced },
+	{ "api/dumpconfig", HTTP_GET, http_rest_get_dumpconfig },
+	{ "api/testconfig", HTTP_GET, http_rest_get_testconfig },
+	{ "api/testflashvars", HTTP_GET, http_rest_get_flash_vars_test },
+	{ "api/reboot", HTTP_POST, http_rest_post_reboot },
+	{ "api/ota", HTTP_POST, http_rest_post_ota },
+	{ "api/cmnd", HTTP_POST, http_rest_post_cmd },
+	{ "api/<path*>", HTTP_GET, http_rest_get },
+	{ "api/<path*>", HTTP_POST, http_rest_post },
+	{ "app", HTTP_GET, http_rest_app },
+};
+
 void init_rest() {
-	HTTP_RegisterCallback("/api/", HTTP_GET, http_rest_get);
-	HTTP_RegisterCallback("/api/", HTTP_POST, http_rest_post);
-	HTTP_RegisterCallback("/app", HTTP_GET, http_rest_app);
+	HTTP_AddRoutes(g_restRoutes, sizeof(g_restRoutes) / sizeof(g_restRoutes[0]));
 }
 
 /* Extracts string token value into outBuffer (128 char). Returns true if the operation was successful. */
@@ -131,77 +168,10 @@ bool tryGetTokenString(const char* json, jsmntok_t* tok, char* outBuffer) {
 	return true;
 }
 
+// anything else below api/, just shows what was asked
 static int http_rest_get(http_request_t* request) {
 	ADDLOG_DEBUG(LOG_FEATURE_API, "GET of %s", request->url);
 
-	if (!strcmp(request->url, "api/channels")) {
-		return http_rest_get_channels(request);
-	}
-
-	if (!strcmp(request->url, "api/pins")) {
-		return http_rest_get_pins(request);
-	}
-	if (!strcmp(request->url, "api/channelTypes")) {
-		return http_rest_get_channelTypes(request);
-	}
-	if (!strcmp(request->url, "api/logconfig")) {
-		return http_rest_get_logconfig(request);
-	}
-
-	if (!strncmp(request->url, "api/seriallog", 13)) {
-		return http_rest_get_seriallog(request);
-	}
-
-#ifdef ENABLE_LITTLEFS
-	if (!strcmp(request->url, "api/fsblock")) {
-		uint32_t newsize = CFG_GetLFS_Size();
-		uint32_t newstart = (LFS_BLOCKS_END - newsize);
-
-		newsize = (newsize / LFS_BLOCK_SIZE) * LFS_BLOCK_SIZE;
-
-		// double check again that we're within bounds - don't want
-		// boot overwrite or anything nasty....
-		if (newstart < LFS_BLOCKS_START_MIN) {
-			return http_rest_error(request, -20, "LFS Size mismatch");
-		}
-		if ((newstart + newsize > LFS_BLOCKS_END) ||
-			(newstart + newsize < LFS_BLOCKS_START_MIN)) {
-			return http_rest_error(request, -20, "LFS Size mismatch");
-		}
-
-		return http_rest_get_flash(request, newstart, newsize);
-	}
-#endif
-
-#ifdef ENABLE_LITTLEFS
-	if (!strncmp(request->url, "api/lfs/", 8)) {
-		return http_rest_get_lfs_file(request);
-	}
-	if (!strncmp(request->url, "api/del/", 8)) {
-		return http_rest_get_lfs_delete(request);
-	}
-#endif
-
-	if (!strcmp(request->url, "api/info")) {
-		return http_rest_get_info(request);
-	}
-
-	if (!strncmp(request->url, "api/flash/", 10)) {
-		return http_rest_get_flash_advanced(request);
-	}
-
-	if (!strcmp(request->url, "api/dumpconfig")) {
-		return http_rest_get_dumpconfig(request);
-	}
-
-	if (!strcmp(request->url, "api/testconfig")) {
-		return http_rest_get_testconfig(request);
-	}
-
-	if (!strncmp(request->url, "api/testflashvars", 17)) {
-		return http_rest_get_flash_vars_test(request);
-	}
-
 	http_setup(request, httpMimeTypeHTML);
 	http_html_start(request, "GET REST API");
 	poststr(request, "GET of ");
@@ -215,77 +185,6 @@ static int http_rest_post(http_request_t* request) {
 	char tmp[20];
 	ADDLOG_DEBUG(LOG_FEATURE_API, "POST to %s", request->url);
 
-	if (!strcmp(request->url, "api/channels")) {
-		return http_rest_post_channels(request);
-	}
-	
-	if (!strcmp(request->url, "api/pins")) {
-		return http_rest_post_pins(request);
-	}
-	if (!strcmp(request->url, "api/channelTypes")) {
-		return http_rest_post_channelTypes(request);
-	}
-	if (!strcmp(request->url, "api/logconfig")) {
-		return http_rest_post_logconfig(request);
-	}
-
-	if (!strcmp(request->url, "api/reboot")) {
-		return http_rest_post_reboot(request);
-	}
-	if (!strcmp(request->url, "api/ota")) {
-#if PLATFORM_BK7231T
-		return http_rest_post_flash(request, START_ADR_OF_BK_PARTITION_OTA, LFS_BLOCKS_END);
-#elif PLATFORM_BK7231N
-		return http_rest_post_flash(request, START_ADR_OF_BK_PARTITION_OTA, LFS_BLOCKS_END);
-#elif PLATFORM_W600
-		return http_rest_post_flash(request, -1, -1);
-#elif PLATFORM_BL602
-		return http_rest_post_flash(request, -1, -1);
-#else
-		// TODO
-#endif
-	}
-	if (!strncmp(request->url, "api/flash/", 10)) {
-		return http_rest_post_flash_advanced(request);
-	}
-
-	if (!strcmp(request->url, "api/cmnd")) {
-		return http_rest_post_cmd(request);
-	}
-
-
-#ifdef ENABLE_LITTLEFS
-	if (!strcmp(request->url, "api/fsblock")) {
-		if (lfs_present()) {
-			release_lfs();
-		}
-		uint32_t newsize = CFG_GetLFS_Size();
-		uint32_t newstart = (LFS_BLOCKS_END - newsize);
-
-		newsize = (newsize / LFS_BLOCK_SIZE) * LFS_BLOCK_SIZE;
-
-		// double check again that we're within bounds - don't want
-		// boot overwrite or anything nasty....
-		if (newstart < LFS_BLOCKS_START_MIN) {
-			return http_rest_error(request, -20, "LFS Size mismatch");
-		}
-		if ((newstart + newsize > LFS_BLOCKS_END) ||
-			(newstart + newsize < LFS_BLOCKS_START_MIN)) {
-			return http_rest_error(request, -20, "LFS Size mismatch");
-		}
-
-		// we are writing the lfs block
-		int res = http_rest_post_flash(request, newstart, LFS_BLOCKS_END);
-		// initialise the filesystem, it should be there now.
-		// don't create if it does not mount
-		init_lfs(0);
-		return res;
-	}
-	if (!strncmp(request->url, "api/lfs/", 8)) {
-		return http_rest_post_lfs_file(request);
-	}
-#endif
-
 	http_setup(request, httpMimeTypeHTML);
 	http_html_start(request, "POST REST API");
 	poststr(request, "POST to ");
@@ -301,6 +200,70 @@ static int http_rest_post(http_request_t* request) {
 	return 0;
 }
 
+#ifdef ENABLE_LITTLEFS
+static bool http_rest_get_fsblock_range(uint32_t* start, uint32_t* size) {
+	uint32_t newsize = CFG_GetLFS_Size();
+	uint32_t newstart = (LFS_BLOCKS_END - newsize);
+
+	newsize = (newsize / LFS_BLOCK_SIZE) * LFS_BLOCK_SIZE;
+
+	// double check again that we're within bounds - don't want
+	// boot overwrite or anything nasty....
+	if (newstart < LFS_BLOCKS_START_MIN) {
+		return false;
+	}
+	if ((newstart + newsize > LFS_BLOCKS_END) ||
+		(newstart + newsize < LFS_BLOCKS_START_MIN)) {
+		return false;
+	}
+	*start = newstart;
+	*size = newsize;
+	return true;
+}
+
+static int http_rest_get_fsblock(http_request_t* request) {
+	uint32_t newstart, newsize;
+
+	if (!http_rest_get_fsblock_range(&newstart, &newsize)) {
+		return http_rest_error(request, -20, "LFS Size mismatch");
+	}
+	return http_rest_get_flash(request, newstart, newsize);
+}
+
+static int http_rest_post_fsblock(http_request_t* request) {
+	uint32_t newstart, newsize;
+	int res;
+
+	if (lfs_present()) {
+		release_lfs();
+	}
+	if (!http_rest_get_fsblock_range(&newstart, &newsize)) {
+		return http_rest_error(request, -20, "LFS Size mismatch");
+	}
+
+	// we are writing the lfs block
+	res = http_rest_post_flash(request, newstart, LFS_BLOCKS_END);
+	// initialise the filesystem, it should be there now.
+	// don't create if it does not mount
+	init_lfs(0);
+	return res;
+}
+#endif
+
+static int http_rest_post_ota(http_request_t* request) {
+#if PLATFORM_BK7231T
+	return http_rest_post_flash(request, START_ADR_OF_BK_PARTITION_OTA, LFS_BLOCKS_END);
+#elif PLATFORM_BK7231N
+	return http_rest_post_flash(request, START_ADR_OF_BK_PARTITION_OTA, LFS_BLOCKS_END);
+#elif PLATFORM_W600
+	return http_rest_post_flash(request, -1, -1);
+#elif PLATFORM_BL602
+	return http_rest_post_flash(request, -1, -1);
+#else
+	return http_rest_error(request, HTTP_RESPONSE_NOT_FOUND, "OTA not supported on this platform");
+#endif
+}
+
 static int http_rest_app(http_request_t* request) {
 	const char* webhost = CFG_GetWebappRoot();
 	const char* ourip = HAL_GetMyIPString(); //CFG_GetOurIP();
@@ -341,12 +304,86 @@ int EndsWith(const char* str, const char* suffix)
 	return strncmp(str + lenstr - lensuffix, suffix, lensuffix) == 0;
 }
 
+// Content hashes of recently served files. Entry is valid only while
+// LFS_GetWriteCounter is the same, so any write to LFS drops them all.
+#define LFS_ETAG_CACHE_SIZE 4
+
+typedef struct lfsETagCache_s {
+	unsigned int pathHash;
+	int size;
+	unsigned int hash;
+	int writeCounter;
+} lfsETagCache_t;
+
+static lfsETagCache_t g_lfsETags[LFS_ETAG_CACHE_SIZE];
+static int g_lfsETagNext = 0;
+
+static unsigned int http_rest_fnv1a(unsigned int hash, const char* s, int len) {
+	while (len--) {
+		hash = (hash ^ (byte)*s++) * 16777619u;
+	}
+	return hash;
+}
+
+// ETag is made from file size and FNV-1a hash of content. LittleFS has no
+// modification time and files may be changed by scripts and commands too,
+// so content is the only reliable version. Whole file is read only when
+// its hash is not cached yet.
+// Returns file size, file is rewound.
+static int http_rest_lfs_etag(const char* fpath, lfs_file_t* file, char* buff, int buffSize, char* etag, int etagSize, bool bGzip) {
+	lfsETagCache_t* e;
+	unsigned int pathHash;
+	unsigned int hash = 2166136261u;
+	int len, i, total;
+
+	pathHash = http_rest_fnv1a(2166136261u, fpath, strlen(fpath)) ^ bGzip;
+	total = lfs_file_size(&lfs, file);
+	for (i = 0; i < LFS_ETAG_CACHE_SIZE; i++) {
+		e = &g_lfsETags[i];
+		if (e->pathHash == pathHash && e->size == total && e->writeCounter == LFS_GetWriteCounter()) {
+			hash = e->hash;
+			break;
+		}
+	}
+	if (i == LFS_ETAG_CACHE_SIZE) {
+		total = 0;
+		while ((len = lfs_file_read(&lfs, file, buff, buffSize)) > 0) {
+			hash = http_rest_fnv1a(hash, buff, len);
+			total += len;
+		}
+		lfs_file_rewind(&lfs, file);
+		e = &g_lfsETags[g_lfsETagNext];
+		g_lfsETagNext = (g_lfsETagNext + 1) % LFS_ETAG_CACHE_SIZE;
+		e->pathHash = pathHash;
+		e->size = total;
+		e->hash = hash;
+		e->writeCounter = LFS_GetWriteCounter();
+	}
+	snprintf(etag, etagSize, "\"%x-%08x%s\"", total, hash, bGzip ? "-gz" : "");
+	return total;
+}
+
+// file path from api/lfs/<path*>, with room for extra chars
+static char* http_rest_alloc_path(http_request_t* request, int extra) {
+	char* fpath;
+	int len;
+
+	len = request->routeParamLens[0] + extra + 1;
+	fpath = os_malloc(len);
+	http_getRouteParam(request, 0, fpath, len);
+	return fpath;
+}
+
 static int http_rest_get_lfs_file(http_request_t* request) {
 	char* fpath;
 	char* buff;
 	int len;
 	int lfsres;
 	int total = 0;
+	int nameLen;
+	bool bGzip = false;
+	char etag[32];
+	char headers[128];
 	lfs_file_t* file;
 
 	// don't start LFS just because we're trying to read a file -
@@ -358,16 +395,26 @@ static int http_rest_get_lfs_file(http_request_t* request) {
 		return 0;
 	}
 
-	fpath = os_malloc(strlen(request->url) - strlen("api/lfs/") + 1);
+	// room for .gz
+	fpath = http_rest_alloc_path(request, 3);
 
 	buff = os_malloc(1024);
 	file = os_malloc(sizeof(lfs_file_t));
 	memset(file, 0, sizeof(lfs_file_t));
 
-	strcpy(fpath, request->url + strlen("api/lfs/"));
-
 	ADDLOG_DEBUG(LOG_FEATURE_API, "LFS read of %s", fpath);
-	lfsres = lfs_file_open(&lfs, file, fpath, LFS_O_RDONLY);
+	// precompressed <name>.gz is sent instead of <name> if client can take it
+	lfsres = -1;
+	if (http_acceptsGzip(request)) {
+		nameLen = strlen(fpath);
+		strcpy(fpath + nameLen, ".gz");
+		lfsres = lfs_file_open(&lfs, file, fpath, LFS_O_RDONLY);
+		fpath[nameLen] = 0;
+		bGzip = lfsres >= 0;
+	}
+	if (bGzip == false) {
+		lfsres = lfs_file_open(&lfs, file, fpath, LFS_O_RDONLY);
+	}
 
 	if (lfsres == -21) {
 		lfs_dir_t* dir;
@@ -433,6 +480,10 @@ static int http_rest_get_lfs_file(http_request_t* request) {
 					mimetype = "text/javascript";
 					break;
 				}
+				if (EndsWith(fpath, ".css")) {
+					mimetype = "text/css";
+					break;
+				}
 				if (EndsWith(fpath, ".json")) {
 					mimetype = httpMimeTypeJson;
 					break;
@@ -448,15 +499,21 @@ static int http_rest_get_lfs_file(http_request_t* request) {
 				break;
 			} while (0);
 
-			http_setup(request, mimetype);
-			do {
-				len = lfs_file_read(&lfs, file, buff, 1024);
-				total += len;
-				if (len) {
-					//ADDLOG_DEBUG(LOG_FEATURE_API, "%d bytes read", len);
-					postany(request, buff, len);
-				}
-			} while (len > 0);
+			len = http_rest_lfs_etag(fpath, file, buff, 1024, etag, sizeof(etag), bGzip);
+			// file may change any time, so browser must check ETag before using its copy
+			snprintf(headers, sizeof(headers), "%sVary: Accept-Encoding\r\nETag: %s\r\nCache-Control: no-cache\r\n",
+				bGzip ? "Content-Encoding: gzip\r\n" : "", etag);
+			if (http_checkNotModified(request, etag, headers) == false) {
+				http_setup_length(request, mimetype, len, headers);
+				do {
+					len = lfs_file_read(&lfs, file, buff, 1024);
+					if (len > 0) {
+						//ADDLOG_DEBUG(LOG_FEATURE_API, "%d bytes read", len);
+						postany(request, buff, len);
+						total += len;
+					}
+				} while (len > 0);
+			}
 			lfs_file_close(&lfs, file);
 			ADDLOG_DEBUG(LOG_FEATURE_API, "%d total bytes read", total);
 		}
@@ -488,9 +545,7 @@ static int http_rest_get_lfs_delete(http_request_t* request) {
 		return 0;
 	}
 
-	fpath = os_malloc(strlen(request->url) - strlen("api/del/") + 1);
-
-	strcpy(fpath, request->url + strlen("api/del/"));
+	fpath = http_rest_alloc_path(request, 0);
 
 	ADDLOG_DEBUG(LOG_FEATURE_API, "LFS delete of %s", fpath);
 	lfsres = lfs_remove(&lfs, fpath);
@@ -509,8 +564,18 @@ static int http_rest_get_lfs_delete(http_request_t* request) {
 	return 0;
 }
 
+static int http_rest_post_lfs_file_write(http_request_t* request, const char* data, int len, void* userData) {
+	lfs_file_t* file = (lfs_file_t*)userData;
+	int res;
+
+	res = lfs_file_write(&lfs, file, data, len);
+	if (res < 0) {
+		ADDLOG_ERROR(LOG_FEATURE_API, "Failed to write with error %i", res);
+	}
+	return res;
+}
+
 static int http_rest_post_lfs_file(http_request_t* request) {
-	int len;
 	int lfsres;
 	int total = 0;
 
@@ -522,11 +587,9 @@ static int http_rest_post_lfs_file(http_request_t* request) {
 	// create if it does not exist
 	init_lfs(1);
 
-	fpath = os_malloc(strlen(request->url) - strlen("api/lfs/") + 1);
+	fpath = http_rest_alloc_path(request, 0);
 	file = os_malloc(sizeof(lfs_file_t));
 	memset(file, 0, sizeof(lfs_file_t));
-
-	strcpy(fpath, request->url + strlen("api/lfs/"));
 	ADDLOG_DEBUG(LOG_FEATURE_API, "LFS write of %s len %d", fpath, request->contentLength);
 
 	folder = strchr(fpath, '/');
@@ -547,16 +610,8 @@ static int http_rest_post_lfs_file(http_request_t* request) {
 	lfsres = lfs_file_open(&lfs, file, fpath, LFS_O_RDWR | LFS_O_CREAT);
 	if (lfsres >= 0) {
 		//ADDLOG_DEBUG(LOG_FEATURE_API, "opened %s");
-		int towrite = request->bodylen;
-		char* writebuf = request->bodystart;
-		int writelen = request->bodylen;
-		if (request->contentLength >= 0) {
-			towrite = request->contentLength;
-		}
-		//ADDLOG_DEBUG(LOG_FEATURE_API, "bodylen %d, contentlen %d", request->bodylen, request->contentLength);
-
-		if (writelen < 0) {
-			ADDLOG_DEBUG(LOG_FEATURE_API, "ABORTED: %d bytes to write", writelen);
+		if (request->bodylen < 0) {
+			ADDLOG_DEBUG(LOG_FEATURE_API, "ABORTED: %d bytes to write", request->bodylen);
 			lfs_file_close(&lfs, file);
 			request->responseCode = HTTP_RESPONSE_SERVER_ERROR;
 			http_setup(request, httpMimeTypeJson);
@@ -564,26 +619,15 @@ static int http_rest_post_lfs_file(http_request_t* request) {
 			goto exit;
 		}
 
-		do {
-			//ADDLOG_DEBUG(LOG_FEATURE_API, "%d bytes to write", writelen);
-			len = lfs_file_write(&lfs, file, writebuf, writelen);
-			if (len < 0) {
-				ADDLOG_ERROR(LOG_FEATURE_API, "Failed to write to %s with error %i", fpath,len);
-				break;
-			}
-			total += len;
-			if (len > 0) {
-				//ADDLOG_DEBUG(LOG_FEATURE_API, "%d bytes written", len);
-			}
-			towrite -= len;
-			if (towrite > 0) {
-				writebuf = request->received;
-				writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-				if (writelen < 0) {
-					ADDLOG_DEBUG(LOG_FEATURE_API, "recv returned %d - end of data - remaining %d", writelen, towrite);
-				}
-			}
-		} while ((towrite > 0) && (writelen >= 0));
+		// file is written as it comes, it's never held whole in RAM
+		total = HTTP_StreamBody(request, http_rest_post_lfs_file_write, file);
+		if (total < 0) {
+			lfs_file_close(&lfs, file);
+			request->responseCode = HTTP_RESPONSE_SERVER_ERROR;
+			http_setup(request, httpMimeTypeJson);
+			hprintf255(request, "{\"fname\":\"%s\",\"error\":%d}", fpath, total);
+			goto exit;
+		}
 
 		// no more data
 		lfs_file_truncate(&lfs, file, total);
@@ -1122,6 +1166,16 @@ static int _check_ota_header(ota_header_t *ota_header, uint32_t *ota_len, int *u
 	return 0;
 }
 #endif
+#if PLATFORM_XR809 || PLATFORM_W800 || PLATFORM_W600 || PLATFORM_BL602
+
+#else
+static int http_rest_post_flash_write(http_request_t* request, const char* data, int len, void* userData) {
+	//ADDLOG_DEBUG(LOG_FEATURE_OTA, "%d bytes to write", len);
+	add_otadata((unsigned char*)data, len);
+	return len;
+}
+#endif
+
 static int http_rest_post_flash(http_request_t* request, int startaddr, int maxaddr) {
 
 #if PLATFORM_XR809 || PLATFORM_W800
@@ -1228,8 +1282,8 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 		if (towrite > 0) {
 			writebuf = request->received;
-			writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-			if (writelen < 0) {
+			writelen = HTTP_ReadBody(request);
+			if (writelen <= 0) {
 				sprintf(error_message, "recv returned %d - end of data - remaining %d", writelen, towrite);
 				nRetCode = -17;
 			}
@@ -1384,9 +1438,10 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 		if (towrite > 0) {
 			writebuf = request->received;
-			writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-			if (writelen < 0) {
+			writelen = HTTP_ReadBody(request);
+			if (writelen <= 0) {
 				ADDLOG_DEBUG(LOG_FEATURE_OTA, "recv returned %d - end of data - remaining %d", writelen, towrite);
+				writelen = -1;
 			}
 		}
 	} while ((towrite > 0) && (writelen >= 0));
@@ -1420,30 +1475,17 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 	init_ota(startaddr);
 
-	if (request->contentLength >= 0) {
-		towrite = request->contentLength;
-	}
-
 	if (writelen < 0 || (startaddr + writelen > maxaddr)) {
 		ADDLOG_DEBUG(LOG_FEATURE_OTA, "ABORTED: %d bytes to write", writelen);
 		return http_rest_error(request, -20, "writelen < 0 or end > 0x200000");
 	}
 
-	do {
-		//ADDLOG_DEBUG(LOG_FEATURE_OTA, "%d bytes to write", writelen);
-		add_otadata((unsigned char*)writebuf, writelen);
-		total += writelen;
-		startaddr += writelen;
-		towrite -= writelen;
-		if (towrite > 0) {
-			writebuf = request->received;
-			writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-			if (writelen < 0) {
-				ADDLOG_DEBUG(LOG_FEATURE_OTA, "recv returned %d - end of data - remaining %d", writelen, towrite);
-			}
-		}
-	} while ((towrite > 0) && (writelen >= 0));
+	// image is written to flash as it comes
+	total = HTTP_StreamBody(request, http_rest_post_flash_write, 0);
 	close_ota();
+	if (total < 0) {
+		return http_rest_error(request, -17, "recv failed - end of data");
+	}
 #endif
 
 	ADDLOG_DEBUG(LOG_FEATURE_OTA, "%d total bytes written", total);
@@ -1463,10 +1505,11 @@ static int http_rest_post_reboot(http_request_t* request) {
 }
 
 static int http_rest_get_flash_advanced(http_request_t* request) {
-	char* params = request->url + 10;
+	char params[32];
 	int startaddr = 0;
 	int len = 0;
 	int sres;
+	http_getRouteParam(request, 0, params, sizeof(params));
 	sres = sscanf(params, "%x-%x", &startaddr, &len);
 	if (sres == 2) {
 		return http_rest_get_flash(request, startaddr, len);
@@ -1475,9 +1518,10 @@ static int http_rest_get_flash_advanced(http_request_t* request) {
 }
 
 static int http_rest_post_flash_advanced(http_request_t* request) {
-	char* params = request->url + 10;
+	char params[32];
 	int startaddr = 0;
 	int sres;
+	http_getRouteParam(request, 0, params, sizeof(params));
 	sres = sscanf(params, "%x", &startaddr);
 	if (sres == 1 && startaddr >= START_ADR_OF_BK_PARTITION_OTA) {
 		// allow up to end of flash
@@ -1627,6 +1671,41 @@ static int http_rest_get_channels(http_request_t* request) {
 	return 0;
 }
 
+// GET api/channels/<n> - {"<n>":value}
+static int http_rest_get_channel(http_request_t* request) {
+	char tmp[16];
+	char* end;
+	int ch;
+
+	http_getRouteParam(request, 0, tmp, sizeof(tmp));
+	ch = strtol(tmp, &end, 10);
+	if (*end != 0 || ch < 0 || ch >= CHANNEL_MAX) {
+		return http_rest_error(request, 400, "invalid channel");
+	}
+	http_setup(request, httpMimeTypeJson);
+	hprintf255(request, "{\"%d\":%d}", ch, CHANNEL_Get(ch));
+	poststr(request, NULL);
+	return 0;
+}
+
+// POST api/channels/<n> with value as body
+static int http_rest_post_channel(http_request_t* request) {
+	char tmp[16];
+	char* end;
+	int ch;
+
+	http_getRouteParam(request, 0, tmp, sizeof(tmp));
+	ch = strtol(tmp, &end, 10);
+	if (*end != 0 || ch < 0 || ch >= CHANNEL_MAX) {
+		return http_rest_error(request, 400, "invalid channel");
+	}
+	if (request->bodystart == 0 || request->bodylen <= 0) {
+		return http_rest_error(request, 400, "value expected");
+	}
+	CHANNEL_Set(ch, atoi(request->bodystart), 0);
+	return http_rest_error(request, 200, "OK");
+}
+
 // currently crashes the MCU - maybe stack overflow?
 static int http_rest_post_channels(http_request_t* request) {
 	int i;
@@ -5,16 +5,41 @@ var firstTime,
 	req = null;
 var onlineFor;
 var onlineForEl = null;
+// state version already shown, see 'state' page
+var stateVersion = 0;
+var lastRender = 0;
 
 var getElement = (id) => document.getElementById(id);
 
-// refresh status section every 3 seconds
+// ask device what has changed since the shown version; device holds the request
+// until something changes, so status section is rendered only when needed
 function showState() {
 	clearTimeout(firstTime);
 	clearTimeout(lastTime);
 	if (req != null) {
 		req.abort();
 	}
+	req = new XMLHttpRequest();
+	req.onreadystatechange = () => {
+		if (req.readyState == 4 && req.statusText == "OK") {
+			var st = JSON.parse(req.responseText);
+			clearTimeout(firstTime);
+			// counters without version (MQTT stats etc) are refreshed once a minute
+			if (st.v != stateVersion || Date.now() - lastRender > 6e4) {
+				stateVersion = st.v;
+				renderState();
+			} else {
+				lastTime = setTimeout(showState, 3e3);
+			}
+		}
+	};
+	req.open("GET", "state?since=" + stateVersion + "&wait=20", true);
+	req.send();
+	firstTime = setTimeout(showState, 3e4);
+}
+
+// refresh status section
+function renderState() {
 	req = new XMLHttpRequest();
 	req.onreadystatechange = () => {
 		// somehow status was 0 on Windows, but "OK" works on both Beken and Windows
@@ -30,14 +55,13 @@ function showState() {
 					stateEl.innerHTML = req.responseText;
 				}
 			}
-			clearTimeout(firstTime);
+			lastRender = Date.now();
 			clearTimeout(lastTime);
 			lastTime = setTimeout(showState, 3e3);
 		}
 	};
 	req.open("GET", "index?state=1", true);
 	req.send();
-	firstTime = setTimeout(showState, 3e3);
 }
 
 function fmtUpTime(totalSeconds) {
@@ -75,6 +99,7 @@ function onLoad() {
 		}
 	}
 
+	lastRender = Date.now();
 	showState();
 }
 
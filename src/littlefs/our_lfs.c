@@ -29,6 +29,8 @@
 int lfs_initialised = 0;
 lfs_t lfs;
 lfs_file_t file;
+// changed on every flash write and erase, and when LFS is (un)mounted
+static int lfs_writeCounter = 0;
 
 // from flash.c
 extern UINT32 flash_read(char *user_buf, UINT32 count, UINT32 address);
@@ -86,6 +88,10 @@ int lfs_present(){
     return lfs_initialised;
 }
 
+int LFS_GetWriteCounter(){
+    return lfs_writeCounter;
+}
+
 static commandResult_t CMD_LFS_Size(const void *context, const char *cmd, const char *args, int cmdFlags){
     if (!args || !args[0]){
         ADDLOG_INFO(LOG_FEATURE_CMD, "unchanged LFS size 0x%X configured 0x%X", LFS_Size, CFG_GetLFS_Size());
@@ -374,6 +380,7 @@ void init_lfs(int create){
         LFS_Start = newstart;
         LFS_Size = newsize;
         cfg.block_count = (newsize/LFS_BLOCK_SIZE);
+        lfs_writeCounter++;
 
         int err = lfs_mount(&lfs, &cfg);
 
@@ -423,6 +430,7 @@ void release_lfs(){
 	if (lfs_initialised) {
 		lfs_unmount(&lfs);
 		lfs_initialised = 0;
+		lfs_writeCounter++;
 	}
 }
 
@@ -462,6 +470,7 @@ static int lfs_write(const struct lfs_config *c, lfs_block_t block,
     protect = FLASH_PROTECT_ALL;
     flash_ctrl(CMD_FLASH_SET_PROTECT, &protect);
     GLOBAL_INT_RESTORE();
+    lfs_writeCounter++;
 
     return res;
 }
@@ -484,6 +493,7 @@ static int lfs_erase(const struct lfs_config *c, lfs_block_t block){
     protect = FLASH_PROTECT_ALL;
     flash_ctrl(CMD_FLASH_SET_PROTECT, &protect);
     GLOBAL_INT_RESTORE();
+    lfs_writeCounter++;
     return res;
 }
 
@@ -37,4 +37,6 @@ void LFSAddCmds();
 void init_lfs(int create);
 void release_lfs();
 int lfs_present();
+// changes whenever LFS content may have changed
+int LFS_GetWriteCounter();
 #endif
\ No newline at end of file
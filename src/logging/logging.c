@@ -40,6 +40,10 @@ unsigned int logfeatures = (
 	);
 static int log_delay = 0;
 
+unsigned int g_logEmitted[LOG_FEATURE_COUNTERS];
+unsigned int g_logSuppressed[LOG_FEATURE_COUNTERS];
+unsigned int g_logEmittedBytes[LOG_FEATURE_COUNTERS];
+
 // must match header definitions in logging.h
 char* loglevelnames[] = {
 	"NONE:",
@@ -110,24 +114,90 @@ static void log_serial_thread(beken_thread_arg_t arg);
 static void startSerialLog();
 static void startLogServer();
 
+// must be a power of 2
 #define LOGSIZE 4096
 #define LOGPORT 9000
 
 int logTcpPort = LOGPORT;
 
+#if defined(_MSC_VER)
+#define LOG_MEMORY_BARRIER() MemoryBarrier()
+#else
+#define LOG_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+// Log ring.
+// Positions are sequence numbers (count of bytes ever written), so
+// 'pos & (LOGSIZE-1)' is the index in ring and 'head - cursor' is
+// the amount of unread data, also after the counters wrap.
+// Writers are serialized by mutex (they share g_loggingBuffer), readers
+// don't lock at all. Writer first moves 'reserved', then copies, then
+// moves 'head'. Reader copies data up to 'head' and after copying checks
+// 'reserved' to see if writer has overwritten part of it meanwhile.
+// Every sink has its own cursor, a sink that is too slow just loses
+// the oldest data, the writer never waits for it.
+typedef struct logRing_s {
+	char *data;
+	// must be a power of 2
+	int size;
+	// everything before head is written
+	volatile unsigned int head;
+	// writer may be changing everything before reserved
+	volatile unsigned int reserved;
+} logRing_t;
+
+typedef struct logSink_s {
+	// sequence number of next byte to read
+	unsigned int cursor;
+	// bytes overwritten before this sink could read them
+	unsigned int lostBytes;
+} logSink_t;
+
+// Binary logging (logbinary 1).
+// Call site only stores the format and raw arguments into a separate ring,
+// no printf is done there. Records are turned into text by whoever reads the
+// log (serial, tcp or http sink), see LOG_FlushBinary. Format is copied too,
+// because many callers pass a buffer of their own as format.
+#define LOG_BINARY_SIZE 2048
+#define LOG_BINARY_MAX_RECORD 256
+#define LOG_BINARY_MAX_STRING 64
+
+typedef struct logRecord_s {
+	// whole record, with arguments
+	unsigned short size;
+	byte level;
+	byte feature;
+	// with terminating zero
+	unsigned short fmtLen;
+	// format and arguments follow
+} logRecord_t;
+
+static char g_logText[LOGSIZE];
+
 static struct tag_logMemory {
-	char log[LOGSIZE];
-	int head;
-	int tailserial;
-	int tailtcp;
-	int tailhttp;
+	logRing_t ring;
+	logSink_t serial;
+	logSink_t tcp;
+	logSink_t http;
+	// log lines pushed to /events streams
+	logSink_t events;
 	SemaphoreHandle_t mutex;
+	// allocated when binary logging is enabled for the first time
+	logRing_t binary;
+	// binary records before this are already formatted
+	unsigned int binaryCursor;
+	unsigned int binaryLostBytes;
+	// one record copied out of ring
+	byte *binaryRecord;
+	bool bBinary;
 } logMemory;
 
 
 static int initialised = 0;
 static int tcpLogStarted = 0;
 
+static void LOG_FlushBinary();
+
 #if PLATFORM_BEKEN
 // to get uart.h
 #include "command_line.h"
@@ -142,7 +212,13 @@ commandResult_t log_command(const void* context, const char* cmd, const char* ar
 static void initLog(void)
 {
 	bk_printf("Entering initLog()...\r\n");
-	logMemory.head = logMemory.tailserial = logMemory.tailtcp = logMemory.tailhttp = 0;
+	memset(&logMemory.serial, 0, sizeof(logMemory.serial));
+	memset(&logMemory.tcp, 0, sizeof(logMemory.tcp));
+	memset(&logMemory.http, 0, sizeof(logMemory.http));
+	memset(&logMemory.events, 0, sizeof(logMemory.events));
+	logMemory.ring.data = g_logText;
+	logMemory.ring.size = LOGSIZE;
+	logMemory.ring.head = logMemory.ring.reserved = 0;
 	logMemory.mutex = xSemaphoreCreateMutex();
 	initialised = 1;
 	startSerialLog();
@@ -169,6 +245,16 @@ static void initLog(void)
 	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("logdelay", log_command, NULL);
+	//cmddetail:{"name":"logbinary","args":"[1or0]",
+	//cmddetail:"descr":"Enables binary logging. Log calls only store format and raw arguments, text is made later when log is sent to serial, TCP port 9000 or /lograw. Saves printf time in the code that logs. Lines with unsupported formats, and logs printed to web console, are still formatted at once.",
+	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":"logbinary 1"}
+	CMD_RegisterCommand("logbinary", log_command, NULL);
+	//cmddetail:{"name":"logstats","args":"[reset]",
+	//cmddetail:"descr":"Prints, for every log feature, how many messages were emitted (and their bytes) and how many were suppressed by loglevel/logfeature. Sites removed at build time by LOG_COMPILE_LEVEL/LOG_COMPILE_FEATURES are not counted. 'logstats reset' clears counters.",
+	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("logstats", log_command, NULL);
 
 	bk_printf("Commands registered!\r\n");
 	bk_printf("initLog() done!\r\n");
@@ -227,8 +313,430 @@ void LOG_SetCommandHTTPRedirectReply(http_request_t* request) {
 	}
 #endif
 
+// copies data into ring, at most two memcpy's.
+// Caller must hold logMemory.mutex.
+static void LOG_WriteRing(logRing_t *ring, const void *data, int len) {
+	const char *s = (const char*)data;
+	unsigned int at;
+	int first;
+
+	if (len > ring->size) {
+		s += len - ring->size;
+		len = ring->size;
+	}
+	at = ring->head;
+	ring->reserved = at + len;
+	LOG_MEMORY_BARRIER();
+	at &= (ring->size - 1);
+	first = ring->size - at;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(ring->data + at, s, first);
+	memcpy(ring->data, s + first, len - first);
+	LOG_MEMORY_BARRIER();
+	ring->head = ring->head + len;
+}
+// copies len bytes starting at sequence pos out of ring
+static void LOG_ReadRing(const logRing_t *ring, unsigned int pos, void *out, int len) {
+	int at, first;
+
+	at = pos & (ring->size - 1);
+	first = ring->size - at;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(out, ring->data + at, first);
+	memcpy((char*)out + first, ring->data, len - first);
+}
+// Moves sink cursor past data that writer has overwritten (or is overwriting)
+// Returns number of skipped bytes.
+static int LOG_SkipLostBytes(logSink_t *sink) {
+	unsigned int oldest;
+	int lost;
+
+	LOG_MEMORY_BARRIER();
+	oldest = logMemory.ring.reserved - LOGSIZE;
+	lost = (int)(oldest - sink->cursor);
+	// nothing written yet beyond one ring size gives negative value here
+	if (lost <= 0) {
+		return 0;
+	}
+	sink->cursor = oldest;
+	sink->lostBytes += lost;
+	return lost;
+}
+
+static char *LOG_AddPrefix(char *t, int level, int feature) {
+	int len;
+
+	if (feature == LOG_FEATURE_RAW)
+	{
+		// raw means no prefixes
+		return t;
+	}
+	// names are short, they always fit
+	len = strlen(loglevelnames[level]);
+	memcpy(t, loglevelnames[level], len);
+	t += len;
+	if (feature < sizeof(logfeaturenames) / sizeof(*logfeaturenames))
+	{
+		len = strlen(logfeaturenames[feature]);
+		memcpy(t, logfeaturenames[feature], len);
+		t += len;
+	}
+	return t;
+}
+// strips line ending given by caller and adds \r\n
+// buffer must have 3 bytes free after len
+static int LOG_FinishLine(char *tmp, int len) {
+	if (len > 0 && tmp[len - 1] == '\n') tmp[--len] = '\0';
+	if (len > 0 && tmp[len - 1] == '\r') tmp[--len] = '\0';
+
+	tmp[len++] = '\r';
+	tmp[len++] = '\n';
+	tmp[len] = '\0';
+	return len;
+}
+
+typedef enum {
+	LOG_ARG_NONE,
+	LOG_ARG_INT,
+	LOG_ARG_LONG,
+	LOG_ARG_LONGLONG,
+	LOG_ARG_SIZE,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_STRING,
+	LOG_ARG_POINTER,
+	// something we can't store, line is logged as text then
+	LOG_ARG_BAD,
+} logArgType_t;
+
+// precision given as '.*', it's the last star int
+#define LOG_PRECISION_FROM_ARG -2
+
+// parses printf conversion at p (which points at '%'),
+// returns pointer after it. Stars are ints that come before the value.
+// Precision is -1 if not given.
+static const char *LOG_ParseSpec(const char *p, int *type, int *stars, int *precision) {
+	int l = 0;
+
+	*stars = 0;
+	*precision = -1;
+	p++;
+	while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+		p++;
+	}
+	if (*p == '*') {
+		(*stars)++;
+		p++;
+	}
+	while (isdigit((unsigned char)*p)) {
+		p++;
+	}
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			(*stars)++;
+			*precision = LOG_PRECISION_FROM_ARG;
+			p++;
+		}
+		else {
+			*precision = 0;
+			while (isdigit((unsigned char)*p)) {
+				*precision = *precision * 10 + (*p - '0');
+				p++;
+			}
+		}
+	}
+	while (*p == 'h' || *p == 'l' || *p == 'z') {
+		if (*p == 'l')
+			l++;
+		if (*p == 'z')
+			l = 3;
+		p++;
+	}
+	switch (*p) {
+	case '%':
+		*type = LOG_ARG_NONE;
+		break;
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		if (l == 0)
+			*type = LOG_ARG_INT;
+		else if (l == 1)
+			*type = LOG_ARG_LONG;
+		else if (l == 2)
+			*type = LOG_ARG_LONGLONG;
+		else
+			*type = LOG_ARG_SIZE;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+		*type = LOG_ARG_DOUBLE;
+		break;
+	case 's':
+		*type = l ? LOG_ARG_BAD : LOG_ARG_STRING;
+		break;
+	case 'p':
+		*type = LOG_ARG_POINTER;
+		break;
+	default:
+		*type = LOG_ARG_BAD;
+		return p;
+	}
+	return p + 1;
+}
+static byte *LOG_PutArg(byte *p, const byte *end, const void *v, int size) {
+	if (p == 0 || p + size > end)
+		return 0;
+	memcpy(p, v, size);
+	return p + size;
+}
+// Stores raw arguments for fmt, returns their size or -1
+// if they don't fit or format has something we can't store.
+static int LOG_EncodeArgs(byte *out, int maxLen, const char *fmt, va_list argList) {
+	byte *p = out;
+	const byte *end = out + maxLen;
+	const char *str;
+	int type, stars, precision, maxStr, iv, len;
+	long lv;
+	long long llv;
+	size_t sv;
+	double dv;
+	void *pv;
+
+	while (*fmt) {
+		if (*fmt != '%') {
+			fmt++;
+			continue;
+		}
+		fmt = LOG_ParseSpec(fmt, &type, &stars, &precision);
+		while (stars--) {
+			iv = va_arg(argList, int);
+			p = LOG_PutArg(p, end, &iv, sizeof(iv));
+		}
+		// negative precision from argument means no precision
+		if (precision == LOG_PRECISION_FROM_ARG) {
+			precision = iv >= 0 ? iv : -1;
+		}
+		switch (type) {
+		case LOG_ARG_NONE:
+			break;
+		case LOG_ARG_INT:
+			iv = va_arg(argList, int);
+			p = LOG_PutArg(p, end, &iv, sizeof(iv));
+			break;
+		case LOG_ARG_LONG:
+			lv = va_arg(argList, long);
+			p = LOG_PutArg(p, end, &lv, sizeof(lv));
+			break;
+		case LOG_ARG_LONGLONG:
+			llv = va_arg(argList, long long);
+			p = LOG_PutArg(p, end, &llv, sizeof(llv));
+			break;
+		case LOG_ARG_SIZE:
+			sv = va_arg(argList, size_t);
+			p = LOG_PutArg(p, end, &sv, sizeof(sv));
+			break;
+		case LOG_ARG_DOUBLE:
+			dv = va_arg(argList, double);
+			p = LOG_PutArg(p, end, &dv, sizeof(dv));
+			break;
+		case LOG_ARG_STRING:
+			// caller's string may be gone when record is formatted
+			str = va_arg(argList, const char*);
+			if (str == 0)
+				str = "(null)";
+			// with precision string does not have to be terminated
+			maxStr = LOG_BINARY_MAX_STRING - 1;
+			if (precision >= 0 && precision < maxStr)
+				maxStr = precision;
+			for (len = 0; len < maxStr && str[len]; len++) {
+			}
+			p = LOG_PutArg(p, end, str, len);
+			p = LOG_PutArg(p, end, "", 1);
+			break;
+		case LOG_ARG_POINTER:
+			pv = va_arg(argList, void*);
+			p = LOG_PutArg(p, end, &pv, sizeof(pv));
+			break;
+		default:
+			return -1;
+		}
+		if (p == 0)
+			return -1;
+	}
+	return p - out;
+}
+#define LOG_GET_ARG(v) if (args + sizeof(v) > end) break; memcpy(&v, args, sizeof(v)); args += sizeof(v);
+
+// Formats record arguments with its format, one conversion at time
+static int LOG_FormatRecord(char *out, int outSize, const char *fmt, const byte *args, const byte *end) {
+	char spec[32];
+	const char *next, *c;
+	int type, stars, precision, len, n, k, iv;
+	long lv;
+	long long llv;
+	size_t sv;
+	double dv;
+	void *pv;
+
+	len = 0;
+	while (*fmt && len < outSize - 1) {
+		if (*fmt != '%') {
+			out[len++] = *fmt++;
+			continue;
+		}
+		next = LOG_ParseSpec(fmt, &type, &stars, &precision);
+		if (type == LOG_ARG_NONE) {
+			out[len++] = '%';
+			fmt = next;
+			continue;
+		}
+		// copy conversion, with stars replaced by stored values
+		k = 0;
+		for (c = fmt; c < next && k < sizeof(spec) - 12; c++) {
+			if (*c == '*') {
+				iv = 0;
+				if (args + sizeof(iv) <= end) {
+					memcpy(&iv, args, sizeof(iv));
+					args += sizeof(iv);
+				}
+				// negative precision means no precision
+				if (iv < 0 && k > 0 && spec[k - 1] == '.') {
+					k--;
+				}
+				else {
+					k += sprintf(spec + k, "%d", iv);
+				}
+			}
+			else {
+				spec[k++] = *c;
+			}
+		}
+		spec[k] = 0;
+		n = -1;
+		switch (type) {
+		case LOG_ARG_INT:
+			LOG_GET_ARG(iv);
+			n = snprintf(out + len, outSize - len, spec, iv);
+			break;
+		case LOG_ARG_LONG:
+			LOG_GET_ARG(lv);
+			n = snprintf(out + len, outSize - len, spec, lv);
+			break;
+		case LOG_ARG_LONGLONG:
+			LOG_GET_ARG(llv);
+			n = snprintf(out + len, outSize - len, spec, llv);
+			break;
+		case LOG_ARG_SIZE:
+			LOG_GET_ARG(sv);
+			n = snprintf(out + len, outSize - len, spec, sv);
+			break;
+		case LOG_ARG_DOUBLE:
+			LOG_GET_ARG(dv);
+			n = snprintf(out + len, outSize - len, spec, dv);
+			break;
+		case LOG_ARG_STRING:
+			if (memchr(args, 0, end - args) == 0)
+				break;
+			n = snprintf(out + len, outSize - len, spec, (const char*)args);
+			args += strlen((const char*)args) + 1;
+			break;
+		case LOG_ARG_POINTER:
+			LOG_GET_ARG(pv);
+			n = snprintf(out + len, outSize - len, spec, pv);
+			break;
+		}
+		// record is damaged or truncated
+		if (n < 0)
+			break;
+		len += n;
+		if (len > outSize - 1)
+			len = outSize - 1;
+		fmt = next;
+	}
+	out[len] = 0;
+	return len;
+}
+// Stores log line as binary record, caller must hold logMemory.mutex.
+// Returns false if it must be logged as text.
+static bool LOG_WriteBinaryRecord(int level, int feature, const char *fmt, va_list argList) {
+	logRecord_t hdr;
+	byte *args;
+	int len;
+
+	hdr.fmtLen = strlen(fmt) + 1;
+	if (sizeof(hdr) + hdr.fmtLen > LOG_BINARY_MAX_RECORD)
+		return false;
+	args = (byte*)g_loggingBuffer + sizeof(hdr) + hdr.fmtLen;
+	len = LOG_EncodeArgs(args, LOG_BINARY_MAX_RECORD - sizeof(hdr) - hdr.fmtLen, fmt, argList);
+	if (len < 0)
+		return false;
+	memcpy(g_loggingBuffer + sizeof(hdr), fmt, hdr.fmtLen);
+	hdr.size = sizeof(hdr) + hdr.fmtLen + len;
+	hdr.level = level;
+	hdr.feature = feature;
+	// records can't be skipped like text, so when readers are slow,
+	// new records are dropped and this is reported later
+	if (hdr.size > LOG_BINARY_SIZE - (logMemory.binary.head - logMemory.binaryCursor)) {
+		logMemory.binaryLostBytes += hdr.size;
+		return true;
+	}
+	memcpy(g_loggingBuffer, &hdr, sizeof(hdr));
+	LOG_WriteRing(&logMemory.binary, g_loggingBuffer, hdr.size);
+	g_logEmittedBytes[feature] += hdr.size;
+	return true;
+}
+static void LOG_EmitText(const char *tmp, int len) {
+#if WINDOWS
+	printf("%s", tmp);
+#endif
+#if PLATFORM_XR809
+	printf("%s", tmp);
+#endif
+	LOG_WriteRing(&logMemory.ring, tmp, len);
+}
+// Turns pending binary records into text lines. Called by log readers,
+// so formatting cost is paid by serial/tcp/http sending, not by log caller.
+static void LOG_FlushBinary() {
+	static unsigned int lostReported = 0;
+	logRecord_t hdr;
+	BaseType_t taken;
+	char *tmp, *t;
+	const char *fmt;
+	int len;
+
+	// cheap check without lock
+	if (logMemory.binary.data == 0 || logMemory.binary.head == logMemory.binaryCursor) {
+		return;
+	}
+	taken = xSemaphoreTake(logMemory.mutex, 100);
+	tmp = g_loggingBuffer;
+	while (logMemory.binaryCursor != logMemory.binary.head) {
+		LOG_ReadRing(&logMemory.binary, logMemory.binaryCursor, &hdr, sizeof(hdr));
+		LOG_ReadRing(&logMemory.binary, logMemory.binaryCursor, logMemory.binaryRecord, hdr.size);
+		logMemory.binaryCursor += hdr.size;
+
+		fmt = (const char*)logMemory.binaryRecord + sizeof(hdr);
+		t = LOG_AddPrefix(tmp, hdr.level, hdr.feature);
+		len = LOG_FormatRecord(t, LOGGING_BUFFER_SIZE - (3 + t - tmp), fmt,
+			(const byte*)fmt + hdr.fmtLen, logMemory.binaryRecord + hdr.size);
+		len = LOG_FinishLine(tmp, (t - tmp) + len);
+		LOG_EmitText(tmp, len);
+	}
+	if (lostReported != logMemory.binaryLostBytes) {
+		len = snprintf(tmp, LOGGING_BUFFER_SIZE, "^ binary log full, %u bytes of records dropped\r\n",
+			logMemory.binaryLostBytes - lostReported);
+		lostReported = logMemory.binaryLostBytes;
+		LOG_EmitText(tmp, len);
+	}
+	if (taken == pdTRUE) {
+		xSemaphoreGive(logMemory.mutex);
+	}
+}
+
 // adds a log to the log memory
-// if head collides with either tail, move the tails on.
+// slow readers are not waited for, they will skip the overwritten data
 void addLogAdv(int level, int feature, const char* fmt, ...)
 {
 	char* tmp;
@@ -236,18 +744,21 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 	int len;
 	va_list argList;
 	BaseType_t taken;
-	int i;
+	bool bBinaryDone;
 
 	if (fmt == 0)
 	{
 		return;
 	}
-	if (!((1 << feature) & logfeatures)) {
+	if (feature < 0 || feature >= LOG_FEATURE_COUNTERS) {
 		return;
 	}
-	if (level > loglevel) {
+	if (!((1 << feature) & logfeatures) || level > loglevel) {
+		// direct addLogAdv calls are filtered only here
+		g_logSuppressed[feature]++;
 		return;
 	}
+	g_logEmitted[feature]++;
 
 	// if not initialised, direct output
 	if (!initialised) {
@@ -260,35 +771,34 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 
 	taken = xSemaphoreTake(logMemory.mutex, 100);
 	tmp = g_loggingBuffer;
-	memset(tmp, 0, LOGGING_BUFFER_SIZE);
-	t = tmp;
 
-	if (feature == LOG_FEATURE_RAW)
-	{
-		// raw means no prefixes
-	}
-	else {
-		strncpy(t, loglevelnames[level], (LOGGING_BUFFER_SIZE - (3 + t - tmp)));
-		t += strlen(t);
-		if (feature < sizeof(logfeaturenames) / sizeof(*logfeaturenames))
-		{
-			strncpy(t, logfeaturenames[feature], (LOGGING_BUFFER_SIZE - (3 + t - tmp)));
-			t += strlen(t);
+	// things that need text right now are not deferred
+	if (logMemory.bBinary && g_log_alsoPrintToHTTP == 0 && g_extraSocketToSendLOG == 0
+		&& direct_serial_log != LOGTYPE_DIRECT) {
+		va_start(argList, fmt);
+		bBinaryDone = LOG_WriteBinaryRecord(level, feature, fmt, argList);
+		va_end(argList);
+		if (bBinaryDone) {
+			if (taken == pdTRUE) {
+				xSemaphoreGive(logMemory.mutex);
+			}
+#ifdef PLATFORM_BEKEN
+			trigger_log_send();
+#endif
+			return;
 		}
 	}
 
+	t = LOG_AddPrefix(tmp, level, feature);
+
 	va_start(argList, fmt);
 	//vsnprintf3(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
 	//vsnprintf2(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
 	vsnprintf(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
 	va_end(argList);
-	if (tmp[strlen(tmp) - 1] == '\n') tmp[strlen(tmp) - 1] = '\0';
-	if (tmp[strlen(tmp) - 1] == '\r') tmp[strlen(tmp) - 1] = '\0';
-
-	len = strlen(tmp); // save 3 bytes at end for /r/n/0
-	tmp[len++] = '\r';
-	tmp[len++] = '\n';
-	tmp[len] = '\0';
+	// save 3 bytes at end for /r/n/0
+	len = LOG_FinishLine(tmp, (t - tmp) + strlen(t));
+	g_logEmittedBytes[feature] += len;
 #if WINDOWS
 	printf(tmp);
 #endif
@@ -313,7 +823,7 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 	}
 	if (g_extraSocketToSendLOG)
 	{
-		send(g_extraSocketToSendLOG, tmp, strlen(tmp), 0);
+		send(g_extraSocketToSendLOG, tmp, len, 0);
 	}
 
 	if (direct_serial_log == LOGTYPE_DIRECT) {
@@ -333,23 +843,7 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 		return;
 	}
 
-	for ( i = 0; i < len; i++)
-	{
-		logMemory.log[logMemory.head] = tmp[i];
-		logMemory.head = (logMemory.head + 1) % LOGSIZE;
-		if (logMemory.tailserial == logMemory.head)
-		{
-			logMemory.tailserial = (logMemory.tailserial + 1) % LOGSIZE;
-		}
-		if (logMemory.tailtcp == logMemory.head)
-		{
-			logMemory.tailtcp = (logMemory.tailtcp + 1) % LOGSIZE;
-		}
-		if (logMemory.tailhttp == logMemory.head)
-		{
-			logMemory.tailhttp = (logMemory.tailhttp + 1) % LOGSIZE;
-		}
-	}
+	LOG_WriteRing(&logMemory.ring, tmp, len);
 
 	if (taken == pdTRUE) {
 		xSemaphoreGive(logMemory.mutex);
@@ -375,31 +869,36 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 }
 
 
-static int getData(char* buff, int buffsize, int* tail) {
-	BaseType_t taken;
-	int count;
-	char* p;
-	if (!initialised)
-		return 0;
-	taken = xSemaphoreTake(logMemory.mutex, 100);
+// Copies unread data of given sink into buff, without locking.
+// Each sink must be read only by one thread at once.
+static int getData(char* buff, int buffsize, logSink_t* sink) {
+	unsigned int head;
+	int count, lost;
 
-	count = 0;
-	p = buff;
-	while (buffsize > 1) {
-		if (*tail == logMemory.head) {
-			break;
-		}
-		*p = logMemory.log[*tail];
-		p++;
-		(*tail) = ((*tail) + 1) % LOGSIZE;
-		buffsize--;
-		count++;
+	if (!initialised || buffsize < 1)
+		return 0;
+	LOG_FlushBinary();
+	LOG_SkipLostBytes(sink);
+	head = logMemory.ring.head;
+	LOG_MEMORY_BARRIER();
+
+	count = head - sink->cursor;
+	if (count > buffsize - 1) {
+		count = buffsize - 1;
 	}
-	*p = 0;
+	LOG_ReadRing(&logMemory.ring, sink->cursor, buff, count);
 
-	if (taken == pdTRUE) {
-		xSemaphoreGive(logMemory.mutex);
+	// writer might have overwritten beginning of our copy meanwhile
+	lost = LOG_SkipLostBytes(sink);
+	if (lost > count) {
+		lost = count;
+	}
+	if (lost) {
+		memmove(buff, buff + lost, count - lost);
+		count -= lost;
 	}
+	sink->cursor += count;
+	buff[count] = 0;
 	return count;
 }
 
@@ -411,42 +910,42 @@ static int getData(char* buff, int buffsize, int* tail) {
 // H/W TX fifo seems to be 256 bytes!!!
 static int getSerial2() {
 	if (!initialised) return 0;
-	int* tail = &logMemory.tailserial;
+	logSink_t* sink = &logMemory.serial;
+	unsigned int head;
 	char c;
-	BaseType_t taken = xSemaphoreTake(logMemory.mutex, 100);
-	char overflow = 0;
-
+	LOG_FlushBinary();
 	// if we hit overflow
-	if (logMemory.tailserial == (logMemory.head + 1) % LOGSIZE) {
-		overflow = 1;
-	}
-
-	while ((*tail != logMemory.head) && !uart_is_tx_fifo_full(UART_PORT)) {
-		c = logMemory.log[*tail];
+	char overflow = LOG_SkipLostBytes(sink) != 0;
+
+	head = logMemory.ring.head;
+	LOG_MEMORY_BARRIER();
+	while ((sink->cursor != head) && !uart_is_tx_fifo_full(UART_PORT)) {
+		c = logMemory.ring.data[sink->cursor & (LOGSIZE - 1)];
+		// writer got there first, start again from oldest data
+		if (LOG_SkipLostBytes(sink)) {
+			overflow = 1;
+			head = logMemory.ring.head;
+			continue;
+		}
 		if (overflow) {
 			c = '^'; // replace the first char with ^ if we overflowed....
 			overflow = 0;
 		}
 
-		(*tail) = ((*tail) + 1) % LOGSIZE;
+		sink->cursor++;
 
 		if (direct_serial_log == LOGTYPE_THREAD) {
 			UART_WRITE_BYTE(UART_PORT_INDEX, c);
 		}
 	}
 
-	int remains = (*tail != logMemory.head);
-
-	if (taken == pdTRUE) {
-		xSemaphoreGive(logMemory.mutex);
-	}
-	return remains;
+	return sink->cursor != head;
 }
 
 #else
 
 static int getSerial(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailserial);
+	int len = getData(buff, buffsize, &logMemory.serial);
 	//bk_printf("got serial: %d:%s\r\n", len, buff);
 	return len;
 }
@@ -454,18 +953,27 @@ static int getSerial(char* buff, int buffsize) {
 #endif
 
 
+#ifdef PLATFORM_BEKEN
 static int getTcp(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailtcp);
+	int len = getData(buff, buffsize, &logMemory.tcp);
 	//bk_printf("got tcp: %d:%s\r\n", len,buff);
 	return len;
 }
+#endif
 
 static int getHttp(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailhttp);
+	int len = getData(buff, buffsize, &logMemory.http);
 	//printf("got tcp: %d:%s\r\n", len,buff);
 	return len;
 }
 
+int LOG_GetEventsData(char* buff, int buffsize) {
+	return getData(buff, buffsize, &logMemory.events);
+}
+void LOG_SkipEventsData() {
+	logMemory.events.cursor = logMemory.ring.head;
+}
+
 void startLogServer() {
 #if WINDOWS
 
@@ -581,9 +1089,10 @@ void log_server_thread(beken_thread_arg_t arg)
 }
 
 #define TCPLOGBUFSIZE 128
-static char tcplogbuf[TCPLOGBUFSIZE];
 
 #ifdef PLATFORM_BEKEN
+static char tcplogbuf[TCPLOGBUFSIZE];
+
 static void send_to_tcp(){
 	int i;
 	for (i = 0; i < MAX_TCP_LOG_PORTS; i++){
@@ -622,10 +1131,17 @@ static void send_to_tcp(){
 static void log_client_thread(beken_thread_arg_t arg)
 {
 	int fd = (int)arg;
+	// every client has its own cursor, so they all get full log.
+	// Start from the oldest data still in ring.
+	logSink_t sink;
+	char buf[TCPLOGBUFSIZE];
+	sink.cursor = 0;
+	sink.lostBytes = 0;
+	LOG_SkipLostBytes(&sink);
 	while (1) {
-		int count = getTcp(tcplogbuf, TCPLOGBUFSIZE);
+		int count = getData(buf, TCPLOGBUFSIZE, &sink);
 		if (count) {
-			int len = send(fd, tcplogbuf, count, 0);
+			int len = send(fd, buf, count, 0);
 			// if some error, close socket
 			if (len != count) {
 				break;
@@ -663,9 +1179,9 @@ static int http_getlograw(http_request_t* request) {
 	int len = 0;
 	http_setup(request, httpMimeTypeHTML);
 
-	// get log in small chunks, posting on http
+	// get log in chunks, posting on http
 	do {
-		char buf[128];
+		char buf[256];
 		len = getHttp(buf, sizeof(buf) - 1);
 		buf[len] = '\0';
 		if (len) {
@@ -757,6 +1273,50 @@ commandResult_t log_command(const void* context, const char* cmd, const char* ar
 			result = CMD_RES_OK;
 			break;
 		}
+		if (!stricmp(cmd, "logstats")) {
+			int i;
+			if (!stricmp(args, "reset")) {
+				memset(g_logEmitted, 0, sizeof(g_logEmitted));
+				memset(g_logSuppressed, 0, sizeof(g_logSuppressed));
+				memset(g_logEmittedBytes, 0, sizeof(g_logEmittedBytes));
+				result = CMD_RES_OK;
+				break;
+			}
+			ADDLOG_INFO(LOG_FEATURE_CMD, "Build filter: level %i, features 0x%08X", LOG_COMPILE_LEVEL, LOG_COMPILE_FEATURES);
+			for (i = 0; i < LOG_FEATURE_MAX; i++) {
+				if (g_logEmitted[i] == 0 && g_logSuppressed[i] == 0)
+					continue;
+				ADDLOG_INFO(LOG_FEATURE_CMD, "%s emitted %u (%u bytes), suppressed %u",
+					logfeaturenames[i], g_logEmitted[i], g_logEmittedBytes[i], g_logSuppressed[i]);
+			}
+			result = CMD_RES_OK;
+			break;
+		}
+		if (!stricmp(cmd, "logbinary")) {
+			int res, val;
+			res = sscanf(args, "%d", &val);
+			if (res != 1) {
+				ADDLOG_ERROR(LOG_FEATURE_CMD, "logbinary %s invalid?", args);
+				result = CMD_RES_BAD_ARGUMENT;
+				break;
+			}
+			if (val && logMemory.binary.data == 0) {
+				// record buffer is allocated together with ring
+				logMemory.binary.data = (char*)malloc(LOG_BINARY_SIZE + LOG_BINARY_MAX_RECORD);
+				if (logMemory.binary.data == 0) {
+					ADDLOG_ERROR(LOG_FEATURE_CMD, "logbinary: no memory");
+					result = CMD_RES_ERROR;
+					break;
+				}
+				logMemory.binary.size = LOG_BINARY_SIZE;
+				logMemory.binaryRecord = (byte*)logMemory.binary.data + LOG_BINARY_SIZE;
+			}
+			logMemory.bBinary = val != 0;
+			// keep order, what was stored so far goes before next text lines
+			LOG_FlushBinary();
+			result = CMD_RES_OK;
+			break;
+		}
 		if (!stricmp(cmd, "logdelay")) {
 			int res, delay;
 			res = sscanf(args, "%d", &delay);
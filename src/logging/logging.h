@@ -16,18 +16,53 @@
 
 void addLogAdv(int level, int feature, const char *fmt, ...);
 void LOG_SetRawSocketCallback(int newFD);
+// unread log text for /events streams, read only by HTTP server thread
+int LOG_GetEventsData(char* buff, int buffsize);
+// skips everything logged so far, new stream starts with fresh lines
+void LOG_SkipEventsData();
 
-#define ADDLOG_ERROR(x, fmt, ...) addLogAdv(LOG_ERROR, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_WARN(x, fmt, ...)  addLogAdv(LOG_WARN, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_INFO(x, fmt, ...)  addLogAdv(LOG_INFO, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_DEBUG(x, fmt, ...) addLogAdv(LOG_DEBUG, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_EXTRADEBUG(x, fmt, ...) addLogAdv(LOG_EXTRADEBUG, x, fmt, ##__VA_ARGS__)
+// Build time filter for ADDLOG_* macros.
+// Sites above LOG_COMPILE_LEVEL, or with feature not set in
+// LOG_COMPILE_FEATURES, are removed by compiler together with their arguments.
+// Set them in compiler flags, eg. -DLOG_COMPILE_LEVEL=3 keeps only INFO and below.
+// Level numbers are the same as in log_levels below.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 6
+#endif
+#ifndef LOG_COMPILE_FEATURES
+#define LOG_COMPILE_FEATURES 0xFFFFFFFF
+#endif
+
+// feature is a bit index in logfeatures, so there are at most 32 of them
+#define LOG_FEATURE_COUNTERS 32
+// out of range features are never logged; shift is masked so it's always defined
+#define LOG_FEATURE_VALID(feature) ((unsigned int)(feature) < LOG_FEATURE_COUNTERS)
+#define LOG_FEATURE_BIT(feature) (1u << ((feature) & (LOG_FEATURE_COUNTERS - 1)))
+
+#define LOG_SITE_ENABLED(level, feature) ((level) <= LOG_COMPILE_LEVEL && LOG_FEATURE_VALID(feature) && ((LOG_COMPILE_FEATURES) & LOG_FEATURE_BIT(feature)))
+// level and feature are checked before arguments are evaluated
+#define LOG_RUNTIME_ENABLED(level, feature) ((level) <= loglevel && (logfeatures & LOG_FEATURE_BIT(feature)))
 
-#define ADDLOGF_ERROR(fmt, ...) addLogAdv(LOG_ERROR, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_WARN(fmt, ...)  addLogAdv(LOG_WARN, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_INFO(fmt, ...)  addLogAdv(LOG_INFO, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_DEBUG(fmt, ...) addLogAdv(LOG_DEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_EXTRADEBUG(fmt, ...) addLogAdv(LOG_EXTRADEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOG_LEVEL(level, x, fmt, ...) do { \
+		if (LOG_SITE_ENABLED(level, x)) { \
+			if (LOG_RUNTIME_ENABLED(level, x)) \
+				addLogAdv(level, x, fmt, ##__VA_ARGS__); \
+			else \
+				g_logSuppressed[(x) & (LOG_FEATURE_COUNTERS - 1)]++; \
+		} \
+	} while (0)
+
+#define ADDLOG_ERROR(x, fmt, ...) ADDLOG_LEVEL(LOG_ERROR, x, fmt, ##__VA_ARGS__)
+#define ADDLOG_WARN(x, fmt, ...)  ADDLOG_LEVEL(LOG_WARN, x, fmt, ##__VA_ARGS__)
+#define ADDLOG_INFO(x, fmt, ...)  ADDLOG_LEVEL(LOG_INFO, x, fmt, ##__VA_ARGS__)
+#define ADDLOG_DEBUG(x, fmt, ...) ADDLOG_LEVEL(LOG_DEBUG, x, fmt, ##__VA_ARGS__)
+#define ADDLOG_EXTRADEBUG(x, fmt, ...) ADDLOG_LEVEL(LOG_EXTRADEBUG, x, fmt, ##__VA_ARGS__)
+
+#define ADDLOGF_ERROR(fmt, ...) ADDLOG_LEVEL(LOG_ERROR, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOGF_WARN(fmt, ...)  ADDLOG_LEVEL(LOG_WARN, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOGF_INFO(fmt, ...)  ADDLOG_LEVEL(LOG_INFO, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOGF_DEBUG(fmt, ...) ADDLOG_LEVEL(LOG_DEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOGF_EXTRADEBUG(fmt, ...) ADDLOG_LEVEL(LOG_EXTRADEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
 
 
 extern int loglevel;
@@ -38,6 +73,11 @@ extern char *logfeaturenames[];
 
 extern volatile int direct_serial_log;
 
+// per feature counters, see logstats command
+extern unsigned int g_logEmitted[];
+extern unsigned int g_logSuppressed[];
+extern unsigned int g_logEmittedBytes[];
+
 typedef enum logType_e {
 	LOGTYPE_NONE,
 	LOGTYPE_DIRECT,
@@ -50,61 +50,153 @@ static int g_intervalBetweenMQTTBroadcasts = 60;
 static int g_maxBroadcastItemsPublishedPerSecond = 1;
 
 /////////////////////////////////////////////////////////////
-// mqtt receive buffer, so we can action in our threads, not
+// mqtt receive queue, so we can action in our threads, not
 // in tcp_thread
 //
-#define MQTT_RX_BUFFER_MAX 4096
-unsigned char mqtt_rx_buffer[MQTT_RX_BUFFER_MAX];
-int mqtt_rx_buffer_head;
-int mqtt_rx_buffer_tail;
-int mqtt_rx_buffer_count;
-unsigned char temp_topic[128];
-unsigned char temp_data[2048];
-
-int addLenData(int len, const unsigned char *data){
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len >> 8) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	for (int i = 0; i < len; i++){
-		mqtt_rx_buffer[mqtt_rx_buffer_head] = data[i];
-		mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count++;
-	}
-	return len + 2;
-}
-
-int getLenData(int *len, unsigned char *data, int maxlen){
-	int l;
-	l = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-	l = l<<8;
-	l |= mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-
-	for (int i = 0; i < l; i++){
-		if (i < maxlen){
-			data[i] = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-		}
-		mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count--;
-	}
-	if (mqtt_rx_buffer_count < 0){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer underflow!!!");
-		mqtt_rx_buffer_count = 0;
-		mqtt_rx_buffer_tail = mqtt_rx_buffer_head = 0;
-	}
-
-	if (l > maxlen){
-		*len = maxlen;
-	} else {
-		*len = l;
+// Every received publish gets a slot. Topic and payload are stored one
+// after another, both NUL terminated, in one contiguous part of rx storage,
+// so handlers get pointers right into it, nothing is copied out.
+// Storage is used like a ring, but a message is never split at the end:
+// if it doesn't fit there, the rest is skipped and it starts from 0 again.
+// Big payloads come from lwIP in several fragments, they are appended with
+// memcpy and the slot is queued when the last fragment arrives.
+// Slots are reference counted - queue holds one reference, processing
+// takes it over while callbacks run. Storage is given back when the count
+// drops to 0 and all older slots are free (slots are freed in order anyway).
+//
+#define MQTT_RX_BUFFER_MAX 6144
+#define MQTT_RX_MAX_SLOTS 16
+
+typedef struct mqttRxSlot_s {
+	// where topic starts in storage
+	int offset;
+	// bytes taken in storage, with terminators and skipped end of ring
+	int size;
+	int topicLen;
+	int dataLen;
+	// payload bytes received so far
+	int dataReceived;
+	int refCount;
+	// all fragments are there
+	bool bComplete;
+	// handed over to MQTT_process_received
+	bool bTaken;
+} mqttRxSlot_t;
+
+static byte g_rxStorage[MQTT_RX_BUFFER_MAX];
+// next free byte in storage
+static int g_rxStorageHead = 0;
+static int g_rxStorageUsed = 0;
+// slots in arrival order, starting at g_rxFirstSlot
+static mqttRxSlot_t g_rxSlots[MQTT_RX_MAX_SLOTS];
+static int g_rxFirstSlot = 0;
+static int g_rxNumSlots = 0;
+// slot of publish that lwIP is currently giving us fragments of
+static mqttRxSlot_t *g_rxFilling = 0;
+static int g_rxDropped = 0;
+// The queue has its own lock, because it's taken from lwIP thread, which must not
+// wait for MQTT mutex - a publisher may hold it while waiting for tcpip core.
+// It's only held for queue bookkeeping, so waiting for it is always short.
+static SemaphoreHandle_t g_rxMutex = 0;
+
+static void MQTT_Rx_Lock() {
+	if (g_rxMutex == 0) {
+		g_rxMutex = xSemaphoreCreateMutex();
+	}
+	while (xSemaphoreTake(g_rxMutex, 100) != pdTRUE) {
+	}
+}
+static void MQTT_Rx_Unlock() {
+	xSemaphoreGive(g_rxMutex);
+}
+
+// Caller must hold RX lock
+static mqttRxSlot_t *MQTT_RxAllocSlot(const char *topic, int topicLen, int dataLen) {
+	mqttRxSlot_t *slot;
+	int need, offset, gap;
+
+	need = topicLen + 1 + dataLen + 1;
+	if (g_rxNumSlots >= MQTT_RX_MAX_SLOTS)
+		return 0;
+	offset = g_rxStorageHead;
+	gap = 0;
+	if (offset + need > MQTT_RX_BUFFER_MAX) {
+		gap = MQTT_RX_BUFFER_MAX - offset;
+		offset = 0;
+	}
+	if (g_rxStorageUsed + gap + need > MQTT_RX_BUFFER_MAX)
+		return 0;
+	slot = &g_rxSlots[(g_rxFirstSlot + g_rxNumSlots) % MQTT_RX_MAX_SLOTS];
+	g_rxNumSlots++;
+	g_rxStorageUsed += gap + need;
+	g_rxStorageHead = offset + need;
+
+	slot->offset = offset;
+	slot->size = gap + need;
+	slot->topicLen = topicLen;
+	slot->dataLen = dataLen;
+	slot->dataReceived = 0;
+	slot->refCount = 1;
+	slot->bComplete = false;
+	slot->bTaken = false;
+	memcpy(g_rxStorage + offset, topic, topicLen);
+	g_rxStorage[offset + topicLen] = 0;
+	return slot;
+}
+// Called only by the one who fills the slot, no lock needed
+static void MQTT_RxAppend(mqttRxSlot_t *slot, const unsigned char *data, int len) {
+	byte *payload = g_rxStorage + slot->offset + slot->topicLen + 1;
+
+	if (len > slot->dataLen - slot->dataReceived) {
+		len = slot->dataLen - slot->dataReceived;
+	}
+	if (len > 0) {
+		memcpy(payload + slot->dataReceived, data, len);
+		slot->dataReceived += len;
+	}
+}
+// Caller must hold RX lock
+static void MQTT_RxCommit(mqttRxSlot_t *slot) {
+	// if less than announced came, use what we have
+	slot->dataLen = slot->dataReceived;
+	g_rxStorage[slot->offset + slot->topicLen + 1 + slot->dataLen] = 0;
+	slot->bComplete = true;
+}
+// Caller must hold RX lock
+static void MQTT_RxRelease(mqttRxSlot_t *slot) {
+	slot->refCount--;
+	while (g_rxNumSlots > 0 && g_rxSlots[g_rxFirstSlot].refCount == 0) {
+		g_rxStorageUsed -= g_rxSlots[g_rxFirstSlot].size;
+		g_rxFirstSlot = (g_rxFirstSlot + 1) % MQTT_RX_MAX_SLOTS;
+		g_rxNumSlots--;
+	}
+	if (g_rxNumSlots == 0) {
+		// empty, start from beginning so big messages fit
+		g_rxStorageHead = 0;
+		g_rxStorageUsed = 0;
+	}
+}
+// Returns next complete slot, caller takes over the queue reference.
+// Caller must hold RX lock
+static mqttRxSlot_t *MQTT_RxTakeNext() {
+	mqttRxSlot_t *slot;
+	int i;
+
+	for (i = 0; i < g_rxNumSlots; i++) {
+		slot = &g_rxSlots[(g_rxFirstSlot + i) % MQTT_RX_MAX_SLOTS];
+		if (slot->bTaken)
+			continue;
+		// keep arrival order
+		if (slot->bComplete == false)
+			return 0;
+		slot->bTaken = true;
+		return slot;
 	}
-	return l + 2;
+	return 0;
+}
+int MQTT_GetReceiveDropCounter(void)
+{
+	return g_rxDropped;
 }
 
 static SemaphoreHandle_t g_mutex = 0;
@@ -135,14 +227,20 @@ static void MQTT_Mutex_Free()
 // system can use it to spoof MQTT packets to check if MQTT commands
 // are working...
 int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *data, int datalen){
-	MQTT_Mutex_Take(100);
-	if ((MQTT_RX_BUFFER_MAX - 1 - mqtt_rx_buffer_count) < topiclen + datalen + 2 + 2){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s", topic);
+	mqttRxSlot_t *slot;
+
+	MQTT_Rx_Lock();
+	slot = MQTT_RxAllocSlot(topic, topiclen, datalen);
+	if (slot == 0) {
+		g_rxDropped++;
 	} else {
-		addLenData(topiclen, (unsigned char *)topic);
-		addLenData(datalen, data);
+		MQTT_RxAppend(slot, data, datalen);
+		MQTT_RxCommit(slot);
+	}
+	MQTT_Rx_Unlock();
+	if (slot == 0) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %.*s", topiclen, topic);
 	}
-	MQTT_Mutex_Free();
 
 
 #ifdef PLATFORM_BEKEN
@@ -153,29 +251,24 @@ int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *dat
 int MQTT_Post_Received_Str(const char *topic, const char *data) {
 	return MQTT_Post_Received(topic, strlen(topic), (const unsigned char*)data, strlen(data));
 }
-int get_received(char **topic, int *topiclen, unsigned char **data, int *datalen){
-	int res = 0;
-	MQTT_Mutex_Take(100);
-	if (mqtt_rx_buffer_tail != mqtt_rx_buffer_head){
-		getLenData(topiclen, temp_topic, sizeof(temp_topic)-1);
-		temp_topic[*topiclen] = 0;
-		getLenData(datalen, temp_data, sizeof(temp_data)-1);
-		temp_data[*datalen] = 0;
-		*topic = (char *)temp_topic;
-		*data = temp_data;
-		res = 1;
-	}
-	MQTT_Mutex_Free();
-	return res;
-}
+
 //
 //////////////////////////////////////////////////////////////////////
 
-#define MQTT_QUEUE_ITEM_IS_REUSABLE(x)  (x->topic[0] == 0)
-#define MQTT_QUEUE_ITEM_SET_REUSABLE(x) (x->topic[0] = 0)
-
-MqttPublishItem_t* g_MqttPublishQueueHead = NULL;
-int g_MqttPublishItemsQueued = 0;   //Items in the queue waiting to be published. This is not the queue length.
+// Publish queue is a circular buffer of items, allocated once with
+// g_publishQueueCapacity items (MQTT_MAX_QUEUE_SIZE by default,
+// can be changed with mqtt_publishQueueSize while the queue is empty).
+static MqttPublishItem_t* g_publishQueue = NULL;
+static int g_publishQueueCapacity = MQTT_MAX_QUEUE_SIZE;
+static int g_publishQueueFirst = 0;
+int g_MqttPublishItemsQueued = 0;   //Items in the queue waiting to be published.
+static int g_publishQueuePeak = 0;
+static int g_publishQueueDrops = 0;
+static int g_publishQueueCoalesced = 0;
+// slot of item written by last MQTT_QueuePublish (new or merged), -1 if none
+static int g_publishQueueLast = -1;
+
+#define MQTT_QUEUE_ITEM(i) (&g_publishQueue[(g_publishQueueFirst + (i)) % g_publishQueueCapacity])
 
 // from mqtt.c
 extern void mqtt_disconnect(mqtt_client_t* client);
@@ -202,11 +295,71 @@ typedef struct mqtt_callback_tag {
 	mqtt_callback_fn callback;
 } mqtt_callback_t;
 
+// must fit in bits of mqttTrieNode_t callbackMask
 #define MAX_MQTT_CALLBACKS 32
 static mqtt_callback_t* callbacks[MAX_MQTT_CALLBACKS];
 static int numCallbacks = 0;
+
+// Subscription topics are compiled into a trie of topic levels, so routing
+// an incoming topic costs as much as its depth, not the number of callbacks.
+// '+' and '#' are children like any other level and are tried together
+// with exact match. Every node has a mask of callbacks whose subscription
+// ends there; bit is callback index, so callbacks are still tried in
+// registration order. Trie keeps its own copy of subscription topics.
+// Incoming topics are routed on tcp thread, so trie is never changed in
+// place: a new one is built and swapped in under trie lock, and routing
+// is done while holding it. It's not the MQTT mutex, because callbacks are
+// re-registered with that one held (MQTT_InitCallbacks from MQTT_RunEverySecondUpdate),
+// and tcp thread must not wait for it. Trie lock is only held for a swap
+// or a single lookup, so it's always taken in the end.
+#define MQTT_TRIE_MAX_NODES 96
+#define MQTT_ROUTE_MAX_MATCHES 8
+
+typedef struct mqttTrieNode_s {
+	const char *level;
+	short levelLen;
+	short firstChild;
+	short nextSibling;
+	unsigned int callbackMask;
+} mqttTrieNode_t;
+
+typedef struct mqttTopicTrie_s {
+	int numNodes;
+	mqttTrieNode_t nodes[MQTT_TRIE_MAX_NODES];
+	// subscription topics, levels point here
+	char text[1];
+} mqttTopicTrie_t;
+
+static mqttTopicTrie_t *g_topicTrie = 0;
+static SemaphoreHandle_t g_trieMutex = 0;
+
+static void MQTT_Trie_Lock() {
+	if (g_trieMutex == 0) {
+		g_trieMutex = xSemaphoreCreateMutex();
+	}
+	while (xSemaphoreTake(g_trieMutex, 100) != pdTRUE) {
+	}
+}
+static void MQTT_Trie_Unlock() {
+	xSemaphoreGive(g_trieMutex);
+}
+
+// one trie node that matched, with levels taken by '+' on the way
+typedef struct mqttRoute_s {
+	unsigned int callbackMask;
+	int numWildcards;
+	const char *wildcard[MQTT_MAX_TOPIC_WILDCARDS];
+	int wildcardLen[MQTT_MAX_TOPIC_WILDCARDS];
+} mqttRoute_t;
+
+typedef struct mqttRouteResult_s {
+	mqttRoute_t routes[MQTT_ROUTE_MAX_MATCHES];
+	int numRoutes;
+	unsigned int callbackMask;
+	// matches that did not fit in routes
+	int numDropped;
+} mqttRouteResult_t;
 // note: only one incomming can be processed at a time.
-static obk_mqtt_request_t g_mqtt_request;
 static obk_mqtt_request_t g_mqtt_request_cb;
 
 #define LOOPS_WITH_DISCONNECTED 15
@@ -288,6 +441,21 @@ int MQTT_GetReceivedEventCounter(void)
 	return mqtt_received_events;
 }
 
+int MQTT_GetPublishQueuePeak(void)
+{
+	return g_publishQueuePeak;
+}
+
+int MQTT_GetPublishQueueDropCounter(void)
+{
+	return g_publishQueueDrops;
+}
+
+int MQTT_GetPublishQueueCoalescedCounter(void)
+{
+	return g_publishQueueCoalesced;
+}
+
 int MQTT_GetConnectResult(void)
 {
 	return mqtt_connect_result;
@@ -355,6 +523,192 @@ char* MQTT_GetStatusMessage(void)
 	return mqtt_status_message;
 }
 
+static short MQTT_TrieChild(mqttTopicTrie_t *t, short parent, const char *level, int len) {
+	mqttTrieNode_t *n;
+	short c;
+
+	for (c = t->nodes[parent].firstChild; c >= 0; c = t->nodes[c].nextSibling) {
+		n = &t->nodes[c];
+		if (n->levelLen == len && !memcmp(n->level, level, len))
+			return c;
+	}
+	if (t->numNodes >= MQTT_TRIE_MAX_NODES)
+		return -1;
+	c = t->numNodes++;
+	n = &t->nodes[c];
+	n->level = level;
+	n->levelLen = len;
+	n->firstChild = -1;
+	n->callbackMask = 0;
+	n->nextSibling = t->nodes[parent].firstChild;
+	t->nodes[parent].firstChild = c;
+	return c;
+}
+static void MQTT_RebuildTopicTrie() {
+	mqttTopicTrie_t *t, *old;
+	const char *p, *end;
+	char *text;
+	short node;
+	int i, textLen;
+
+	textLen = 0;
+	for (i = 0; i < numCallbacks; i++) {
+		if (callbacks[i] && callbacks[i]->subscriptionTopic)
+			textLen += strlen(callbacks[i]->subscriptionTopic) + 1;
+	}
+	t = (mqttTopicTrie_t*)malloc(sizeof(mqttTopicTrie_t) + textLen);
+	if (t == 0) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT topic trie malloc failed, keeping old one");
+		return;
+	}
+	// root
+	t->numNodes = 1;
+	memset(&t->nodes[0], 0, sizeof(t->nodes[0]));
+	t->nodes[0].firstChild = -1;
+	text = t->text;
+	for (i = 0; i < numCallbacks; i++) {
+		if (callbacks[i] == 0 || callbacks[i]->subscriptionTopic == 0 || callbacks[i]->subscriptionTopic[0] == 0)
+			continue;
+		strcpy(text, callbacks[i]->subscriptionTopic);
+		node = 0;
+		p = text;
+		text += strlen(text) + 1;
+		while (node >= 0) {
+			end = strchr(p, '/');
+			if (end == 0)
+				end = p + strlen(p);
+			node = MQTT_TrieChild(t, node, p, end - p);
+			if (*end == 0)
+				break;
+			p = end + 1;
+		}
+		if (node < 0) {
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT topic trie full, %s will not be routed", callbacks[i]->subscriptionTopic);
+			continue;
+		}
+		t->nodes[node].callbackMask |= (1u << i);
+	}
+	MQTT_Trie_Lock();
+	old = g_topicTrie;
+	g_topicTrie = t;
+	MQTT_Trie_Unlock();
+	free(old);
+}
+static void MQTT_AddRoute(mqttRouteResult_t *res, const mqttTrieNode_t *n, const mqttRoute_t *cur) {
+	if (n->callbackMask == 0)
+		return;
+	if (res->numRoutes >= MQTT_ROUTE_MAX_MATCHES) {
+		res->numDropped++;
+		return;
+	}
+	res->routes[res->numRoutes] = *cur;
+	res->routes[res->numRoutes].callbackMask = n->callbackMask;
+	res->numRoutes++;
+	res->callbackMask |= n->callbackMask;
+}
+// p is start of topic level that should match one of children of node
+static void MQTT_RouteLevel(const mqttTopicTrie_t *t, short node, const char *p, const mqttRoute_t *cur, mqttRouteResult_t *res) {
+	const mqttTrieNode_t *n;
+	const char *end;
+	mqttRoute_t next;
+	short c, c2;
+
+	end = strchr(p, '/');
+	if (end == 0)
+		end = p + strlen(p);
+	for (c = t->nodes[node].firstChild; c >= 0; c = n->nextSibling) {
+		n = &t->nodes[c];
+		if (n->levelLen == 1 && n->level[0] == '#') {
+			// all remaining levels
+			MQTT_AddRoute(res, n, cur);
+			continue;
+		}
+		next = *cur;
+		if (n->levelLen == 1 && n->level[0] == '+') {
+			if (next.numWildcards < MQTT_MAX_TOPIC_WILDCARDS) {
+				next.wildcard[next.numWildcards] = p;
+				next.wildcardLen[next.numWildcards] = end - p;
+				next.numWildcards++;
+			}
+		}
+		else if (n->levelLen != end - p || memcmp(n->level, p, end - p)) {
+			continue;
+		}
+		if (*end == 0) {
+			MQTT_AddRoute(res, n, &next);
+			// "a/#" matches also "a"
+			for (c2 = n->firstChild; c2 >= 0; c2 = t->nodes[c2].nextSibling) {
+				if (t->nodes[c2].levelLen == 1 && t->nodes[c2].level[0] == '#') {
+					MQTT_AddRoute(res, &t->nodes[c2], &next);
+				}
+			}
+		}
+		else {
+			MQTT_RouteLevel(t, c, end + 1, &next, res);
+		}
+	}
+}
+// Route keeps pointers into topic only, not into trie, so it stays
+// valid after trie lock is given back.
+static void MQTT_RouteTopic(const char *topic, mqttRouteResult_t *res) {
+	mqttRoute_t start;
+
+	res->numRoutes = 0;
+	res->numDropped = 0;
+	res->callbackMask = 0;
+	MQTT_Trie_Lock();
+	if (g_topicTrie) {
+		start.numWildcards = 0;
+		MQTT_RouteLevel(g_topicTrie, 0, topic, &start, res);
+	}
+	MQTT_Trie_Unlock();
+	if (res->numDropped) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT topic %s matches too many subscriptions, %i skipped", topic, res->numDropped);
+	}
+}
+// Calls matching callbacks, in order, until one returns 1.
+// Returns number of callbacks called.
+static int MQTT_DispatchToCallbacks(obk_mqtt_request_t *request) {
+	mqttRouteResult_t res;
+	unsigned int bit;
+	int i, r, called;
+
+	MQTT_RouteTopic(request->topic, &res);
+	called = 0;
+	for (i = 0; i < numCallbacks && (res.callbackMask >> i); i++) {
+		bit = 1u << i;
+		if (!(res.callbackMask & bit) || callbacks[i] == 0)
+			continue;
+		for (r = 0; r < res.numRoutes; r++) {
+			if (res.routes[r].callbackMask & bit)
+				break;
+		}
+		if (r == res.numRoutes)
+			continue;
+		request->numWildcards = res.routes[r].numWildcards;
+		memcpy(request->wildcard, res.routes[r].wildcard, sizeof(request->wildcard));
+		memcpy(request->wildcardLen, res.routes[r].wildcardLen, sizeof(request->wildcardLen));
+		called++;
+		// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
+		// i.e. multiple people can get each topic if required.
+		if (callbacks[i]->callback(request))
+		{
+			// if no further processing, then break this loop.
+			break;
+		}
+	}
+	return called;
+}
+// true if given '+' level of request topic is equal to str (case insensitive)
+bool MQTT_WildcardIs(obk_mqtt_request_t *request, int index, const char *str) {
+	int len;
+
+	if (index >= request->numWildcards)
+		return false;
+	len = strlen(str);
+	return request->wildcardLen[index] == len && !wal_strnicmp(request->wildcard[index], str, len);
+}
+
 void MQTT_ClearCallbacks() {
 	int i;
 	for (i = 0; i < MAX_MQTT_CALLBACKS; i++) {
@@ -365,6 +719,8 @@ void MQTT_ClearCallbacks() {
 			callbacks[i] = 0;
 		}
 	}
+	numCallbacks = 0;
+	MQTT_RebuildTopicTrie();
 }
 // this can REPLACE callbacks, since we MAY wish to change the root topic....
 // in which case we would re-resigster all callbacks?
@@ -448,9 +804,11 @@ int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic,
 	}
 
 	callbacks[index]->callback = callback;
+	callbacks[index]->ID = ID;
 	if (index == numCallbacks) {
 		numCallbacks++;
 	}
+	MQTT_RebuildTopicTrie();
 
 	if (subscribechange) {
 		if (mqtt_client) {
@@ -477,6 +835,7 @@ int MQTT_RemoveCallback(int ID) {
 				}
 				os_free(callbacks[index]);
 				callbacks[index] = NULL;
+				MQTT_RebuildTopicTrie();
 				if (mqtt_client) {
 					mqtt_reconnect = 8;
 				}
@@ -540,33 +899,33 @@ int channelGet(obk_mqtt_request_t* request) {
 		return 1;
 	}
 
-	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "channelGet topic %i with arg %s", request->topic, request->received);
+	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "channelGet topic %s with arg %s", request->topic, request->received);
 
-	p = MQTT_RemoveClientFromTopic(request->topic,0);
-
-	if (p == NULL) {
+	// <chan> level was matched by '+' of subscription
+	if (request->numWildcards < 1) {
 		return 0;
 	}
+	p = request->wildcard[0];
 
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "channelGet part topic %s", p);
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "channelGet part topic %.*s", request->wildcardLen[0], p);
 
-	if (!stricmp(p, "led_enableAll")) {
+	if (MQTT_WildcardIs(request, 0, "led_enableAll")) {
 		LED_SendEnableAllState();
 		return 1;
 	}
-	if (!stricmp(p, "led_dimmer")) {
+	if (MQTT_WildcardIs(request, 0, "led_dimmer")) {
 		LED_SendDimmerChange();
 		return 1;
 	}
-	if (!stricmp(p, "led_temperature")) {
+	if (MQTT_WildcardIs(request, 0, "led_temperature")) {
 		sendTemperatureChange();
 		return 1;
 	}
-	if (!stricmp(p, "led_finalcolor_rgb")) {
+	if (MQTT_WildcardIs(request, 0, "led_finalcolor_rgb")) {
 		sendFinalColor();
 		return 1;
 	}
-	if (!stricmp(p, "led_basecolor_rgb")) {
+	if (MQTT_WildcardIs(request, 0, "led_basecolor_rgb")) {
 		sendColorChange();
 		return 1;
 	}
@@ -595,15 +954,13 @@ int channelSet(obk_mqtt_request_t* request) {
 	const char* p;
 	const char *argument;
 
-	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "channelSet topic %i with arg %s", request->topic, request->received);
-
-	p = MQTT_RemoveClientFromTopic(request->topic,0);
+	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "channelSet topic %s with arg %s", request->topic, request->received);
 
-	if (p == NULL) {
+	// <chan> level was matched by '+' of subscription, and trie already checked the '/set'
+	if (request->numWildcards < 1) {
 		return 0;
 	}
-
-	//addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "channelSet part topic %s", p);
+	p = request->wildcard[0];
 
 	// atoi won't parse any non-decimal chars, so it should skip over the rest of the topic.
 	channel = atoi(p);
@@ -615,15 +972,6 @@ int channelSet(obk_mqtt_request_t* request) {
 		return 0;
 	}
 
-	// make sure the topic ends with '/set'.
-	p = strchr(p, '/');
-
-	// if not /set, then stop here
-	if (strcmp(p, "/set")) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "channelSet NOT 'set'");
-		return 0;
-	}
-
 	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_data_cb data is %.*s for ch %i\n", MQTT_MAX_DATA_LOG_LENGTH, request->received, channel);
 
 	argument = ((const char*)request->received);
@@ -712,18 +1060,11 @@ int tasCmnd(obk_mqtt_request_t* request) {
 	const char *p, *args;
     //const char *p2;
 
-	p = MQTT_RemoveClientFromTopic(request->topic, "cmnd");
-	if (p == 0) {
-		p = MQTT_RemoveClientFromTopic(request->topic, "tele");
-		if (p == 0) {
-			p = MQTT_RemoveClientFromTopic(request->topic, "stat");
-			if (p == 0) {
-
-			}
-		}
-	}
-	if (p == 0)
+	// command is the last level of cmnd/<client>/+ (or tele/stat),
+	// so it's NUL terminated by the topic itself
+	if (request->numWildcards < 1)
 		return 1;
+	p = request->wildcard[request->numWildcards - 1];
 
 #if 1
 	args = (const char *)request->received;
@@ -790,104 +1131,302 @@ static void mqtt_pub_request_cb(void* arg, err_t result)
 	}
 }
 
-// This publishes value to the specified topic/channel.
-static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const char* sTopic, const char* sChannel, const char* sVal, int flags, bool appendGet)
-{
+// Publishes are sent in batches. Topic <sTopic>/<sChannel>[/get] is built into
+// batch text from a cached "<sTopic>/" prefix, without malloc and sprintf, and
+// whole batch is sent with a single LOCK_TCPIP_CORE and connection check.
+// A single publish is just a batch of one. Between MQTT_BeginPublishBatch and
+// MQTT_EndPublishBatch publishes (from any thread) are collected and sent when
+// the batch is closed or full, so full state broadcast costs one lock per tick.
+#define MQTT_PUBLISH_BATCH_MAX_ITEMS	16
+#define MQTT_PUBLISH_BATCH_TEXT_SIZE	2048
+
+// status of a tracked publish, batch may be sent later than publish call returns
+#define MQTT_PUBLISH_STATUS_PENDING		0
+#define MQTT_PUBLISH_STATUS_SENT		1
+// it can never be sent, for example topic is too long
+#define MQTT_PUBLISH_STATUS_REJECTED	2
+
+typedef struct mqttPublishBatchItem_s {
+	// offset of topic in batch text
+	short topic;
+	short valueLen;
+	// points into batch text when collected, otherwise to caller's string
+	const char *value;
+	byte qos;
+	byte retain;
 	err_t err;
-	u8_t qos = 2; /* 0 1 or 2, see MQTT specification */
-	u8_t retain = 0; /* No don't retain such crappy payload... */
-	size_t sVal_len;
-	char* pub_topic;
+	// optional, set to MQTT_PUBLISH_STATUS_SENT when publish is accepted by lwIP
+	byte *status;
+} mqttPublishBatchItem_t;
+
+typedef struct mqttPublishBatch_s {
+	mqttPublishBatchItem_t items[MQTT_PUBLISH_BATCH_MAX_ITEMS];
+	int numItems;
+	int textUsed;
+	// >0 while MQTT_BeginPublishBatch is active
+	int depth;
+	char text[MQTT_PUBLISH_BATCH_TEXT_SIZE];
+} mqttPublishBatch_t;
+
+static mqttPublishBatch_t g_publishBatch;
+// MQTT_EndPublishBatch calls that could not get the mutex; they are applied
+// by the next one that gets it, so batch does not stay open for ever
+static volatile int g_publishBatchEndsPending = 0;
+// "<sTopic>/" of the last publish, usually "<clientId>/"
+static char g_publishPrefix[MQTT_PUBLISH_ITEM_TOPIC_LENGTH + 2];
+static int g_publishPrefixLen = 0;
+
+// Sends collected publishes. Called with MQTT mutex taken.
+static OBK_Publish_Result MQTT_FlushPublishBatch(mqtt_client_t* client) {
+	mqttPublishBatchItem_t *it;
+	OBK_Publish_Result result;
+	int i, res;
+
+	if (g_publishBatch.numItems == 0)
+		return OBK_PUBLISH_WAS_NOT_REQUIRED;
 
-	if (client == 0)
-		return OBK_PUBLISH_WAS_DISCONNECTED;
+	result = OBK_PUBLISH_OK;
+	LOCK_TCPIP_CORE();
+	res = mqtt_client_is_connected(client);
+	if (res) {
+		for (i = 0; i < g_publishBatch.numItems; i++) {
+			it = &g_publishBatch.items[i];
+			it->err = mqtt_publish(client, g_publishBatch.text + it->topic, it->value, it->valueLen, it->qos, it->retain, mqtt_pub_request_cb, 0);
+		}
+	}
+	UNLOCK_TCPIP_CORE();
 
-	if (flags & OBK_PUBLISH_FLAG_MUTEX_SILENT)
+	if (res == 0) {
+		g_my_reconnect_mqtt_after_time = 5;
+		result = OBK_PUBLISH_WAS_DISCONNECTED;
+	}
+	else {
+		g_timeSinceLastMQTTPublish = 0;
+		for (i = 0; i < g_publishBatch.numItems; i++) {
+			it = &g_publishBatch.items[i];
+			if (it->valueLen < 128)
+			{
+				addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val %s to %s retain=%i\n", it->value, g_publishBatch.text + it->topic, it->retain);
+			}
+			else {
+				addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val (%d bytes) to %s retain=%i\n", it->valueLen, g_publishBatch.text + it->topic, it->retain);
+			}
+			if (it->err == ERR_OK) {
+				if (it->status) {
+					*it->status = MQTT_PUBLISH_STATUS_SENT;
+				}
+				mqtt_published_events++;
+				continue;
+			}
+			if (it->err == ERR_CONN)
+			{
+				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_CONN aka %d\n", it->err);
+			}
+			else if (it->err == ERR_MEM) {
+				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_MEM aka %d\n", it->err);
+				g_memoryErrorsThisSession++;
+			}
+			else {
+				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: %d\n", it->err);
+			}
+			mqtt_publish_errors++;
+			result = OBK_PUBLISH_MEM_FAIL;
+		}
+	}
+	g_publishBatch.numItems = 0;
+	g_publishBatch.textUsed = 0;
+	return result;
+}
+// Closes batches whose end could not take the mutex. Called with MQTT mutex taken.
+static void MQTT_ApplyPendingBatchEnds() {
+	int pending;
+
+	pending = g_publishBatchEndsPending;
+	if (pending == 0)
+		return;
+	g_publishBatchEndsPending -= pending;
+	g_publishBatch.depth -= pending;
+	if (g_publishBatch.depth < 0)
+		g_publishBatch.depth = 0;
+}
+// Adds publish to batch, sending the batch first if it's full.
+// Value is copied only when batch is collecting, otherwise caller flushes
+// before its string goes away. Called with MQTT mutex taken.
+static OBK_Publish_Result MQTT_AddToPublishBatch(mqtt_client_t* client, const char* sTopic, const char* sChannel, const char* sVal, int flags, bool appendGet, byte* status, bool* bMustFlush)
+{
+	mqttPublishBatchItem_t *it;
+	int topicLen, channelLen, valueLen, copyLen;
+	char *p;
+
+	*bMustFlush = false;
+	MQTT_ApplyPendingBatchEnds();
+	if (flags & OBK_PUBLISH_FLAG_FORCE_REMOVE_GET)
 	{
-		if (MQTT_Mutex_Take(100) == 0)
-		{
-			return OBK_PUBLISH_MUTEX_FAIL;
+		appendGet = false;
+	}
+	if (strcmp(g_publishPrefix, sTopic)) {
+		g_publishPrefixLen = strlen(sTopic);
+		if (g_publishPrefixLen + 2 > sizeof(g_publishPrefix)) {
+			g_publishPrefix[0] = 0;
+			g_publishPrefixLen = 0;
+			return OBK_PUBLISH_MEM_FAIL;
+		}
+		memcpy(g_publishPrefix, sTopic, g_publishPrefixLen);
+		g_publishPrefix[g_publishPrefixLen] = 0;
+	}
+	channelLen = strlen(sChannel);
+	valueLen = strlen(sVal);
+	topicLen = g_publishPrefixLen + 1 + channelLen + (appendGet ? 4 : 0) + 1;
+	copyLen = 0;
+	if (g_publishBatch.depth > 0) {
+		// big values are not copied, they are sent right away
+		if (valueLen < MQTT_PUBLISH_BATCH_TEXT_SIZE / 2) {
+			copyLen = valueLen + 1;
+		}
+		else {
+			*bMustFlush = true;
 		}
 	}
+	if (topicLen + copyLen > MQTT_PUBLISH_BATCH_TEXT_SIZE) {
+		return OBK_PUBLISH_MEM_FAIL;
+	}
+	if (g_publishBatch.numItems >= MQTT_PUBLISH_BATCH_MAX_ITEMS ||
+		g_publishBatch.textUsed + topicLen + copyLen > MQTT_PUBLISH_BATCH_TEXT_SIZE) {
+		MQTT_FlushPublishBatch(client);
+	}
+
+	it = &g_publishBatch.items[g_publishBatch.numItems];
+	it->topic = g_publishBatch.textUsed;
+	p = g_publishBatch.text + g_publishBatch.textUsed;
+	// prefix without NUL, it's "<sTopic>/"
+	g_publishPrefix[g_publishPrefixLen] = '/';
+	memcpy(p, g_publishPrefix, g_publishPrefixLen + 1);
+	g_publishPrefix[g_publishPrefixLen] = 0;
+	p += g_publishPrefixLen + 1;
+	memcpy(p, sChannel, channelLen);
+	p += channelLen;
+	if (appendGet) {
+		memcpy(p, "/get", 4);
+		p += 4;
+	}
+	*p = 0;
+	p++;
+	if (copyLen) {
+		memcpy(p, sVal, copyLen);
+		it->value = p;
+	}
 	else {
-		if (MQTT_Mutex_Take(500) == 0)
-		{
-			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_PublishTopicToClient: mutex failed for %s=%s\r\n", sChannel, sVal);
-			return OBK_PUBLISH_MUTEX_FAIL;
-		}
+		it->value = sVal;
 	}
+	it->valueLen = valueLen;
+	g_publishBatch.textUsed += topicLen + copyLen;
+
+	// 0 1 or 2, see MQTT specification
+	if (flags & OBK_PUBLISH_FLAG_QOS_ZERO)
+		it->qos = 0;
+	else if (flags & OBK_PUBLISH_FLAG_QOS_ONE)
+		it->qos = 1;
+	else
+		it->qos = 2;
+	it->retain = 0; /* No don't retain such crappy payload... */
 	if (flags & OBK_PUBLISH_FLAG_RETAIN)
 	{
-		retain = 1;
+		it->retain = 1;
 	}
 	// global tool
 	if (CFG_HasFlag(OBK_FLAG_MQTT_ALWAYSSETRETAIN))
 	{
-		retain = 1;
+		it->retain = 1;
 	}
-	if (flags & OBK_PUBLISH_FLAG_FORCE_REMOVE_GET)
-	{
-		appendGet = false;
+	it->err = ERR_OK;
+	it->status = status;
+	g_publishBatch.numItems++;
+	if (g_publishBatch.depth == 0 || g_publishBatch.numItems >= MQTT_PUBLISH_BATCH_MAX_ITEMS) {
+		*bMustFlush = true;
 	}
+	return OBK_PUBLISH_OK;
+}
 
+// This publishes value to the specified topic/channel.
+// If status is given, it tells later whether this publish was really sent,
+// it must stay valid until the batch is flushed.
+static OBK_Publish_Result MQTT_PublishTopicToClientTracked(mqtt_client_t* client, const char* sTopic, const char* sChannel, const char* sVal, int flags, bool appendGet, byte* status)
+{
+	OBK_Publish_Result result;
+	bool bMustFlush;
 
-	LOCK_TCPIP_CORE();
-	int res = mqtt_client_is_connected(client);
-	UNLOCK_TCPIP_CORE();
-
-	if (res == 0)
-	{
-		g_my_reconnect_mqtt_after_time = 5;
-		MQTT_Mutex_Free();
+	if (client == 0)
 		return OBK_PUBLISH_WAS_DISCONNECTED;
-	}
-
-	g_timeSinceLastMQTTPublish = 0;
+	if (sVal == 0)
+		return OBK_PUBLISH_MEM_FAIL;
 
-	pub_topic = (char*)os_malloc(strlen(sTopic) + 1 + strlen(sChannel) + 5 + 1); //5 for /get
-	if ((pub_topic != NULL) && (sVal != NULL))
+	if (flags & OBK_PUBLISH_FLAG_MUTEX_SILENT)
 	{
-		sVal_len = strlen(sVal);
-		sprintf(pub_topic, "%s/%s%s", sTopic, sChannel, (appendGet == true ? "/get" : ""));
-		if (sVal_len < 128)
+		if (MQTT_Mutex_Take(100) == 0)
 		{
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val %s to %s retain=%i\n", sVal, pub_topic, retain);
-		}
-		else {
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val (%d bytes) to %s retain=%i\n", sVal_len, pub_topic, retain);
+			return OBK_PUBLISH_MUTEX_FAIL;
 		}
-
-
-		LOCK_TCPIP_CORE();
-		err = mqtt_publish(client, pub_topic, sVal, strlen(sVal), qos, retain, mqtt_pub_request_cb, 0);
-		UNLOCK_TCPIP_CORE();
-		os_free(pub_topic);
-
-		if (err != ERR_OK)
+	}
+	else {
+		if (MQTT_Mutex_Take(500) == 0)
 		{
-			if (err == ERR_CONN)
-			{
-				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_CONN aka %d\n", err);
-			}
-			else if (err == ERR_MEM) {
-				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_MEM aka %d\n", err);
-				g_memoryErrorsThisSession++;
-			}
-			else {
-				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: %d\n", err);
-			}
-			mqtt_publish_errors++;
-			MQTT_Mutex_Free();
-			return OBK_PUBLISH_MEM_FAIL;
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_PublishTopicToClient: mutex failed for %s=%s\r\n", sChannel, sVal);
+			return OBK_PUBLISH_MUTEX_FAIL;
 		}
-		mqtt_published_events++;
-		MQTT_Mutex_Free();
-		return OBK_PUBLISH_OK;
 	}
-	else {
-		MQTT_Mutex_Free();
-		return OBK_PUBLISH_MEM_FAIL;
+	result = MQTT_AddToPublishBatch(client, sTopic, sChannel, sVal, flags, appendGet, status, &bMustFlush);
+	if (result != OBK_PUBLISH_OK) {
+		if (status) {
+			*status = MQTT_PUBLISH_STATUS_REJECTED;
+		}
+	}
+	else if (bMustFlush) {
+		result = MQTT_FlushPublishBatch(client);
+	}
+	MQTT_Mutex_Free();
+	return result;
+}
+static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const char* sTopic, const char* sChannel, const char* sVal, int flags, bool appendGet)
+{
+	return MQTT_PublishTopicToClientTracked(client, sTopic, sChannel, sVal, flags, appendGet, 0);
+}
+/// @brief Start collecting publishes, they are sent together by MQTT_EndPublishBatch.
+/// Batches can be nested.
+/// @return false if MQTT is not connected, then publishes are sent as usual
+bool MQTT_BeginPublishBatch() {
+	if (MQTT_IsReady() == false)
+		return false;
+	if (MQTT_Mutex_Take(100) == 0)
+		return false;
+	MQTT_ApplyPendingBatchEnds();
+	g_publishBatch.depth++;
+	MQTT_Mutex_Free();
+	return true;
+}
+// bFlushNow sends collected publishes even when an outer batch is still open
+static OBK_Publish_Result MQTT_EndPublishBatchInternal(bool bFlushNow) {
+	OBK_Publish_Result result = OBK_PUBLISH_WAS_NOT_REQUIRED;
+
+	if (MQTT_Mutex_Take(500) == 0) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_EndPublishBatch: mutex failed\r\n");
+		g_publishBatchEndsPending++;
+		return OBK_PUBLISH_MUTEX_FAIL;
+	}
+	MQTT_ApplyPendingBatchEnds();
+	if (g_publishBatch.depth > 0) {
+		g_publishBatch.depth--;
+		if ((g_publishBatch.depth == 0 || bFlushNow) && mqtt_client) {
+			result = MQTT_FlushPublishBatch(mqtt_client);
+		}
 	}
+	MQTT_Mutex_Free();
+	return result;
+}
+/// @brief Send publishes collected since MQTT_BeginPublishBatch.
+/// @return OBK_PUBLISH_MUTEX_FAIL if mutex could not be taken, batch is then
+/// closed (and sent) by the next publish
+OBK_Publish_Result MQTT_EndPublishBatch() {
+	return MQTT_EndPublishBatchInternal(false);
 }
 
 // This is used to publish channel values in "obk0696FB33/1/get" format with numerical value,
@@ -901,7 +1440,7 @@ OBK_Publish_Result MQTT_PublishTele(const char* teleName, const char* teleValue)
 {
 	char topic[64];
 	snprintf(topic, sizeof(topic), "tele/%s", CFG_GetMQTTClientId());
-	return MQTT_PublishTopicToClient(mqtt_client, topic, teleName, teleValue, 0, false);
+	return MQTT_PublishTopicToClient(mqtt_client, topic, teleName, teleValue, OBK_PUBLISH_FLAG_QOS_ZERO, false);
 }
 OBK_Publish_Result MQTT_PublishStat(const char* statName, const char* statValue)
 {
@@ -929,74 +1468,49 @@ void MQTT_OBK_Printf(char* s) {
 // we should do callbacks from one of our threads?
 static void mqtt_incoming_data_cb(void* arg, const u8_t* data, u16_t len, u8_t flags)
 {
-	int i;
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
-	// if we stored a topic in g_mqtt_request, then we found a matching callback, so use it.
-	if (g_mqtt_request.topic[0])
-	{
-		// note: data is NOT terminated (it may be binary...).
-		g_mqtt_request.received = data;
-		g_mqtt_request.receivedLen = len;
-
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT in topic %s", g_mqtt_request.topic);
+	// if we have a slot, then we found a matching callback in mqtt_incoming_publish_cb
+	if (g_rxFilling == 0)
+		return;
+	// note: data is NOT terminated (it may be binary...).
+	// Big payloads come in several calls, last one has MQTT_DATA_FLAG_LAST
+	MQTT_RxAppend(g_rxFilling, data, len);
+	if (flags & MQTT_DATA_FLAG_LAST) {
+		MQTT_Rx_Lock();
+		MQTT_RxCommit(g_rxFilling);
+		MQTT_Rx_Unlock();
+		g_rxFilling = 0;
 		mqtt_received_events++;
-
-		for (i = 0; i < numCallbacks; i++)
-		{
-			if (callbacks[i] == 0)
-				continue;
-			char* cbtopic = callbacks[i]->topic;
-			if (!strncmp(g_mqtt_request.topic, cbtopic, strlen(cbtopic)))
-			{
-				MQTT_Post_Received(g_mqtt_request.topic, strlen(g_mqtt_request.topic), data, len);
-				// if ANYONE is interested, store it.
-				break;
-				// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-				// i.e. multiple people can get each topic if required.
-				//if (callbacks[i]->callback(&g_mqtt_request))
-				//{
-				//	return;
-				//}
-			}
-		}
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT topic not handled: %s", g_mqtt_request.topic);
+#ifdef PLATFORM_BEKEN
+		MQTT_TriggerRead();
+#endif
 	}
 }
 
 
 // run from userland (quicktick or wakeable thread)
 int MQTT_process_received(){
-	char *topic;
-	int topiclen;
-	unsigned char *data;
-	int datalen;
-	int found = 0;
+	mqttRxSlot_t *slot;
 	int count = 0;
-	do{
-		found = get_received(&topic, &topiclen, &data, &datalen);
-		if (found){
-			count++;
-			strncpy(g_mqtt_request_cb.topic, topic, sizeof(g_mqtt_request_cb.topic));
-			g_mqtt_request_cb.received = data;
-			g_mqtt_request_cb.receivedLen = datalen;
-			for (int i = 0; i < numCallbacks; i++)
-			{
-				char* cbtopic = callbacks[i]->topic;
-				if (!strncmp(topic, cbtopic, strlen(cbtopic)))
-				{
-					// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-					// i.e. multiple people can get each topic if required.
-					if (callbacks[i]->callback(&g_mqtt_request_cb))
-					{
-						// if no further processing, then break this loop.
-						break;
-					}
-				}
-			}
-		}
-	} while (found);
+
+	while (1) {
+		MQTT_Rx_Lock();
+		slot = MQTT_RxTakeNext();
+		MQTT_Rx_Unlock();
+		if (slot == 0)
+			break;
+		count++;
+		// handlers get a view into the slot, it stays valid until released below
+		g_mqtt_request_cb.topic = (const char*)(g_rxStorage + slot->offset);
+		g_mqtt_request_cb.received = g_rxStorage + slot->offset + slot->topicLen + 1;
+		g_mqtt_request_cb.receivedLen = slot->dataLen;
+		MQTT_DispatchToCallbacks(&g_mqtt_request_cb);
+		MQTT_Rx_Lock();
+		MQTT_RxRelease(slot);
+		MQTT_Rx_Unlock();
+	}
 
 	return count;
 }
@@ -1006,24 +1520,35 @@ int MQTT_process_received(){
 // called from tcp_thread context
 static void mqtt_incoming_publish_cb(void* arg, const char* topic, u32_t tot_len)
 {
-	//const char *p;
-	int i;
+	mqttRouteResult_t route;
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
-	// look for a callback with this URL and method, or HTTP_ANY
-	g_mqtt_request.topic[0] = '\0';
-	for (i = 0; i < numCallbacks; i++)
-	{
-		char* cbtopic = callbacks[i]->topic;
-		if (strncmp(topic, cbtopic, strlen(cbtopic)))
-		{
-			strncpy(g_mqtt_request.topic, topic, sizeof(g_mqtt_request.topic) - 1);
-			g_mqtt_request.topic[sizeof(g_mqtt_request.topic) - 1] = 0;
-			break;
-		}
+	// previous publish was not finished, drop it
+	if (g_rxFilling) {
+		MQTT_Rx_Lock();
+		MQTT_RxCommit(g_rxFilling);
+		g_rxFilling->bTaken = true;
+		MQTT_RxRelease(g_rxFilling);
+		MQTT_Rx_Unlock();
+		g_rxFilling = 0;
+	}
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT in topic %s", topic);
+
+	// look for a callback with this topic
+	MQTT_RouteTopic(topic, &route);
+	if (route.callbackMask == 0) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT topic not handled: %s", topic);
+		return;
+	}
+	// whole payload is reserved now, fragments are copied in mqtt_incoming_data_cb
+	MQTT_Rx_Lock();
+	g_rxFilling = MQTT_RxAllocSlot(topic, strlen(topic), tot_len);
+	MQTT_Rx_Unlock();
+	if (g_rxFilling == 0) {
+		g_rxDropped++;
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s (%i bytes)", topic, (int)tot_len);
 	}
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_publish_cb topic %s\n", topic);
 }
 
 static void mqtt_request_cb(void* arg, err_t err)
@@ -1213,6 +1738,9 @@ OBK_Publish_Result MQTT_PublishMain_StringInt(const char* sChannel, int iv)
 {
 	char valueStr[16];
 
+	if (MQTT_Dedup_IsConfigured(sChannel)) {
+		return MQTT_PublishMain_StringInt_DeDuped(sChannel, DEDUP_EXPIRE_TIME, iv, 0);
+	}
 	sprintf(valueStr, "%i", iv);
 
 	return MQTT_PublishMain(mqtt_client, sChannel, valueStr, 0, true);
@@ -1222,6 +1750,9 @@ OBK_Publish_Result MQTT_PublishMain_StringFloat(const char* sChannel, float f)
 {
 	char valueStr[16];
 
+	if (MQTT_Dedup_IsConfigured(sChannel)) {
+		return MQTT_PublishMain_StringFloat_DeDuped(sChannel, DEDUP_EXPIRE_TIME, f, 0);
+	}
 	sprintf(valueStr, "%f", f);
 
 	return MQTT_PublishMain(mqtt_client, sChannel, valueStr, 0, true);
@@ -1505,6 +2036,37 @@ commandResult_t MQTT_SetMaxBroadcastItemsPublishedPerSecond(const void* context,
 
 	return CMD_RES_OK;
 }
+// mqtt_publishQueueSize [Items]
+commandResult_t MQTT_SetPublishQueueSize(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	int size;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish queue: %i items, %i queued, peak %i, dropped %i, coalesced %i",
+			g_publishQueueCapacity, g_MqttPublishItemsQueued, g_publishQueuePeak, g_publishQueueDrops, g_publishQueueCoalesced);
+		return CMD_RES_OK;
+	}
+	size = Tokenizer_GetArgInteger(0);
+	if (size < 1) {
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	if (g_MqttPublishItemsQueued > 0) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish queue is not empty, try again later");
+		return CMD_RES_ERROR;
+	}
+	if (g_publishQueue) {
+		os_free(g_publishQueue);
+		g_publishQueue = NULL;
+	}
+	// allocated again by next MQTT_QueuePublish
+	g_publishQueueCapacity = size;
+	g_publishQueueFirst = 0;
+	g_publishQueueLast = -1;
+
+	return CMD_RES_OK;
+}
 commandResult_t MQTT_SetBroadcastInterval(const void* context, const char* cmd, const char* args, int cmdFlags)
 {
 	Tokenizer_TokenizeString(args, 0);
@@ -1715,11 +2277,18 @@ void MQTT_init()
 	//cmddetail:"fn":"MQTT_SetMaxBroadcastItemsPublishedPerSecond","file":"mqtt/new_mqtt.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("mqtt_broadcastItemsPerSec", MQTT_SetMaxBroadcastItemsPublishedPerSecond, NULL);
+	//cmddetail:{"name":"mqtt_publishQueueSize","args":"[Items]",
+	//cmddetail:"descr":"Sets how many items can wait in the MQTT publish queue (used for example by Home Assistant discovery). Can be changed only when the queue is empty. Without argument, prints queue size, peak usage and counts of dropped and coalesced items. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
+	//cmddetail:"fn":"MQTT_SetPublishQueueSize","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("mqtt_publishQueueSize", MQTT_SetPublishQueueSize, NULL);
+	MQTT_Dedup_InitCommands();
 }
 
 OBK_Publish_Result MQTT_DoItemPublishString(const char* sChannel, const char* valueStr)
 {
-	return MQTT_PublishMain(mqtt_client, sChannel, valueStr, OBK_PUBLISH_FLAG_MUTEX_SILENT, false);
+	// self info is broadcasted periodically, so it doesn't need delivery guarantee
+	return MQTT_PublishMain(mqtt_client, sChannel, valueStr, OBK_PUBLISH_FLAG_MUTEX_SILENT | OBK_PUBLISH_FLAG_QOS_ZERO, false);
 }
 
 OBK_Publish_Result MQTT_DoItemPublish(int idx)
@@ -2013,7 +2582,11 @@ int MQTT_RunEverySecondUpdate()
 			{
 				OBK_Publish_Result publishRes;
 				int g_sent_thisFrame = 0;
+				int firstItemIndex;
+				bool bBatch;
 
+				firstItemIndex = g_publishItemIndex;
+				bBatch = MQTT_BeginPublishBatch();
 				while (g_publishItemIndex < CHANNEL_MAX)
 				{
 					publishRes = MQTT_DoItemPublish(g_publishItemIndex);
@@ -2045,6 +2618,13 @@ int MQTT_RunEverySecondUpdate()
 					// The item is not used for this device
 					g_publishItemIndex++;
 				}
+				if (bBatch) {
+					publishRes = MQTT_EndPublishBatch();
+					// items of this batch were not sent, retry them later
+					if (publishRes != OBK_PUBLISH_OK && publishRes != OBK_PUBLISH_WAS_NOT_REQUIRED) {
+						g_publishItemIndex = firstItemIndex;
+					}
+				}
 
 				if (g_publishItemIndex >= CHANNEL_MAX)
 				{
@@ -2070,25 +2650,6 @@ int MQTT_RunEverySecondUpdate()
 	return 1;
 }
 
-MqttPublishItem_t* get_queue_tail(MqttPublishItem_t* head) {
-	if (head == NULL) { return NULL; }
-
-	while (head->next != NULL) {
-		head = head->next;
-	}
-	return head;
-}
-
-MqttPublishItem_t* find_queue_reusable_item(MqttPublishItem_t* head) {
-	while (head != NULL) {
-		if (MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {
-			return head;
-		}
-		head = head->next;
-	}
-	return head;
-}
-
 /// @brief Queue an entry for publish and execute a command after the publish.
 /// @param topic 
 /// @param channel 
@@ -2097,33 +2658,52 @@ MqttPublishItem_t* find_queue_reusable_item(MqttPublishItem_t* head) {
 /// @param command Command to execute after the publish
 void MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command) {
 	MqttPublishItem_t* newItem;
-	if (g_MqttPublishItemsQueued >= MQTT_MAX_QUEUE_SIZE) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", g_MqttPublishItemsQueued);
-		return;
-	}
+	int i;
 
 	if ((strlen(topic) > MQTT_PUBLISH_ITEM_TOPIC_LENGTH) ||
 		(strlen(channel) > MQTT_PUBLISH_ITEM_CHANNEL_LENGTH) ||
 		(strlen(value) > MQTT_PUBLISH_ITEM_VALUE_LENGTH)) {
 		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! Topic (%i), channel (%i) or value (%i) exceeds size limit\r\n",
 			strlen(topic), strlen(channel), strlen(value));
+		g_publishQueueDrops++;
 		return;
 	}
+	if (g_publishQueue == NULL) {
+		g_publishQueue = (MqttPublishItem_t*)os_malloc(sizeof(MqttPublishItem_t) * g_publishQueueCapacity);
+		if (g_publishQueue == NULL) {
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! Failed to alloc %i items\r\n", g_publishQueueCapacity);
+			g_publishQueueDrops++;
+			return;
+		}
+	}
 
-	//Queue data for publish. This might be a new item in the queue or an existing item. This is done to prevent
-	//memory fragmentation. The total queue length is limited to MQTT_MAX_QUEUE_SIZE.
-
-	if (g_MqttPublishQueueHead == NULL) {
-		g_MqttPublishQueueHead = newItem = os_malloc(sizeof(MqttPublishItem_t));
-		newItem->next = NULL;
+	newItem = NULL;
+	if (g_MqttPublishItemsQueued >= g_publishQueueCapacity) {
+		// Queue is full. If there is an older publish to the same topic, new value replaces it,
+		// so the latest state gets published anyway.
+		for (i = 0; i < g_MqttPublishItemsQueued; i++) {
+			newItem = MQTT_QUEUE_ITEM(i);
+			if (!strcmp(newItem->topic, topic) && !strcmp(newItem->channel, channel)) {
+				break;
+			}
+		}
+		if (i == g_MqttPublishItemsQueued) {
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", g_MqttPublishItemsQueued);
+			g_publishQueueDrops++;
+			g_publishQueueLast = -1;
+			return;
+		}
+		g_publishQueueCoalesced++;
+		// keep command of the replaced entry, if the new one has none
+		if (command == None) {
+			command = newItem->command;
+		}
 	}
 	else {
-		newItem = find_queue_reusable_item(g_MqttPublishQueueHead);
-
-		if (newItem == NULL) {
-			newItem = os_malloc(sizeof(MqttPublishItem_t));
-			newItem->next = NULL;
-			get_queue_tail(g_MqttPublishQueueHead)->next = newItem; //Append new item
+		newItem = MQTT_QUEUE_ITEM(g_MqttPublishItemsQueued);
+		g_MqttPublishItemsQueued++;
+		if (g_MqttPublishItemsQueued > g_publishQueuePeak) {
+			g_publishQueuePeak = g_MqttPublishItemsQueued;
 		}
 	}
 
@@ -2133,21 +2713,28 @@ void MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const
 	os_strcpy(newItem->value, value);
 	newItem->command = command;
 	newItem->flags = flags;
+	g_publishQueueLast = newItem - g_publishQueue;
 
-	g_MqttPublishItemsQueued++;
 	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Queued topic=%s/%s, %i items in queue", newItem->topic, newItem->channel, g_MqttPublishItemsQueued);
 }
 
-/// @brief Add the specified command to the last entry in the queue.
+/// @brief Add the specified command to the entry written by last MQTT_QueuePublish.
+/// When queue was full, that's the older entry the publish was merged into, not the tail.
 /// @param command 
 void MQTT_InvokeCommandAtEnd(PostPublishCommands command) {
-	MqttPublishItem_t* tail = get_queue_tail(g_MqttPublishQueueHead);
-	if (tail == NULL){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "InvokeCommandAtEnd invoked but queue is empty");
+	int ofs;
+
+	if (g_publishQueueLast < 0) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "InvokeCommandAtEnd invoked but last publish was not queued");
+		return;
 	}
-	else {
-		tail->command = command;
+	// it may have been published already
+	ofs = (g_publishQueueLast - g_publishQueueFirst + g_publishQueueCapacity) % g_publishQueueCapacity;
+	if (ofs >= g_MqttPublishItemsQueued) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "InvokeCommandAtEnd invoked but queue is empty");
+		return;
 	}
+	g_publishQueue[g_publishQueueLast].command = command;
 }
 
 /// @brief Queue an entry for publish.
@@ -2160,43 +2747,80 @@ void MQTT_QueuePublish(const char* topic, const char* channel, const char* value
 }
 
 
+// Status of items published by PublishQueuedItems. Static, because batch keeps
+// pointers to it until it's flushed, even if ending it fails.
+static byte g_publishQueueStatus[MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE];
+
 /// @brief Publish MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE queued items.
+/// Items that were sent (or can never be) are dequeued, the others stay queued
+/// in order and are retried later. Post-publish commands run only for sent items.
 /// @return 
 OBK_Publish_Result PublishQueuedItems() {
 	OBK_Publish_Result result = OBK_PUBLISH_WAS_NOT_REQUIRED;
-
+	OBK_Publish_Result batchResult;
+	PostPublishCommands commands[MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE];
 	int count = 0;
-	MqttPublishItem_t* head = g_MqttPublishQueueHead;
+	int i, keep, removed, numCommands;
+	MqttPublishItem_t* head;
+	bool bBatch;
 
-	//The next actionable item might not be at the front. The queue size is limited to MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE
-	//so this traversal is fast.
 	//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems g_MqttPublishItemsQueued=%i",g_MqttPublishItemsQueued );
-	while ((head != NULL) && (count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) && (g_MqttPublishItemsQueued > 0)) {
-		if (!MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {  //Skip reusable entries
-			count++;
-			result = MQTT_PublishTopicToClient(mqtt_client, head->topic, head->channel, head->value, head->flags, false);
-			MQTT_QUEUE_ITEM_SET_REUSABLE(head); //Flag item as reusable
-			g_MqttPublishItemsQueued--;   //decrement queued count
-
-			//Stop if last publish failed
-			if (result != OBK_PUBLISH_OK) break;
-
-			switch (head->command) {
-			case None:
-				break;
-			case PublishAll:
-				MQTT_PublishWholeDeviceState_Internal(true);
-				break;
-			case PublishChannels:
-				MQTT_PublishOnlyDeviceChannelsIfPossible();
-				break;
-			}
+	memset(g_publishQueueStatus, MQTT_PUBLISH_STATUS_PENDING, sizeof(g_publishQueueStatus));
+	bBatch = MQTT_BeginPublishBatch();
+	while ((count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) && (count < g_MqttPublishItemsQueued)) {
+		head = MQTT_QUEUE_ITEM(count);
+		result = MQTT_PublishTopicToClientTracked(mqtt_client, head->topic, head->channel, head->value, head->flags, false, &g_publishQueueStatus[count]);
+		count++;
+
+		//Stop if last publish failed
+		if (result != OBK_PUBLISH_OK) break;
+	}
+	if (bBatch) {
+		// also when called within an outer batch, so status of items is known now
+		batchResult = MQTT_EndPublishBatchInternal(true);
+		if (batchResult != OBK_PUBLISH_OK && batchResult != OBK_PUBLISH_WAS_NOT_REQUIRED) {
+			result = batchResult;
 		}
-		else {
-			//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems item skipped reusable");
+	}
+	numCommands = 0;
+	for (i = 0; i < count; i++) {
+		head = MQTT_QUEUE_ITEM(i);
+		if (g_publishQueueStatus[i] == MQTT_PUBLISH_STATUS_SENT && head->command != None) {
+			commands[numCommands++] = head->command;
 		}
+	}
+	// dequeue sent and rejected items, unsent ones are moved
+	// to the end of published range, so they stay in order
+	keep = count - 1;
+	for (i = count - 1; i >= 0; i--) {
+		if (g_publishQueueStatus[i] == MQTT_PUBLISH_STATUS_PENDING) {
+			if (i != keep) {
+				*MQTT_QUEUE_ITEM(keep) = *MQTT_QUEUE_ITEM(i);
+			}
+			keep--;
+		}
+	}
+	removed = keep + 1;
+	if (removed > 0) {
+		// merged entry may have been moved
+		g_publishQueueLast = -1;
+	}
+	// items can be reused by next MQTT_QueuePublish
+	g_publishQueueFirst = (g_publishQueueFirst + removed) % g_publishQueueCapacity;
+	g_MqttPublishItemsQueued -= removed;
 
-		head = head->next;
+	// they may queue more publishes, so queue is already updated
+	for (i = 0; i < numCommands; i++) {
+		switch (commands[i]) {
+		case None:
+			break;
+		case PublishAll:
+			MQTT_PublishWholeDeviceState_Internal(true);
+			break;
+		case PublishChannels:
+			MQTT_PublishOnlyDeviceChannelsIfPossible();
+			break;
+		}
 	}
 
 	return result;
@@ -60,15 +60,27 @@ enum OBK_Publish_Result_e {
 #define OBK_PUBLISH_FLAG_MUTEX_SILENT			1
 #define OBK_PUBLISH_FLAG_RETAIN					2
 #define OBK_PUBLISH_FLAG_FORCE_REMOVE_GET		4
+// default QoS is 2
+#define OBK_PUBLISH_FLAG_QOS_ZERO				8
+#define OBK_PUBLISH_FLAG_QOS_ONE				16
 
 #include "new_mqtt_deduper.h"
 
 
+#define MQTT_MAX_TOPIC_WILDCARDS	2
+
 // ability to register callbacks for MQTT data
 typedef struct obk_mqtt_request_tag {
-	const unsigned char* received; // note: NOT terminated, may be binary
+	// note: may be binary, but there is always a NUL after receivedLen bytes
+	const unsigned char* received;
 	int receivedLen;
-	char topic[128];
+	// points into receive queue, valid only during callback
+	const char* topic;
+	// topic levels matched by '+' of subscription, in order.
+	// They point into topic and are not NUL terminated (except the last level).
+	const char* wildcard[MQTT_MAX_TOPIC_WILDCARDS];
+	int wildcardLen[MQTT_MAX_TOPIC_WILDCARDS];
+	int numWildcards;
 } obk_mqtt_request_t;
 
 #define MQTT_PUBLISH_ITEM_TOPIC_LENGTH    64
@@ -89,7 +101,6 @@ typedef struct MqttPublishItem
 	char channel[MQTT_PUBLISH_ITEM_CHANNEL_LENGTH];
 	char value[MQTT_PUBLISH_ITEM_VALUE_LENGTH];
 	int flags;
-	struct MqttPublishItem* next;
 	PostPublishCommands command;
 } MqttPublishItem_t;
 
@@ -99,15 +110,18 @@ typedef struct MqttPublishItem
 
 // Count of queued items published at once.
 #define MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE	3
+// default capacity of publish queue, see mqtt_publishQueueSize
+#ifndef MQTT_MAX_QUEUE_SIZE
 #define MQTT_MAX_QUEUE_SIZE	                7
+#endif
 
 // callback function for mqtt.
 // return 0 to allow the incoming topic/data to be processed by others/channel set.
 // return 1 to 'eat the packet and terminate further processing.
 typedef int (*mqtt_callback_fn)(obk_mqtt_request_t* request);
 
-// topics must be unique (i.e. you can't have /about and /aboutme or /about/me)
-// ALL topics currently must start with main device topic root.
+// incoming topics are routed by subscription topic ('+' and '#' allowed),
+// callbacks matching same topic are called in registration order.
 // ID is unique and non-zero - so that callbacks can be replaced....
 int MQTT_GetConnectEvents(void);
 const char* get_error_name(int err);
@@ -116,8 +130,15 @@ char* MQTT_GetStatusMessage(void);
 int MQTT_GetPublishEventCounter(void);
 int MQTT_GetPublishErrorCounter(void);
 int MQTT_GetReceivedEventCounter(void);
+int MQTT_GetReceiveDropCounter(void);
+int MQTT_GetPublishQueuePeak(void);
+int MQTT_GetPublishQueueDropCounter(void);
+int MQTT_GetPublishQueueCoalescedCounter(void);
+bool MQTT_WildcardIs(obk_mqtt_request_t *request, int index, const char *str);
 
 OBK_Publish_Result PublishQueuedItems();
+bool MQTT_BeginPublishBatch();
+OBK_Publish_Result MQTT_EndPublishBatch();
 OBK_Publish_Result MQTT_ChannelPublish(int channel, int flags);
 void MQTT_ClearCallbacks();
 int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic, int ID, mqtt_callback_fn callback);
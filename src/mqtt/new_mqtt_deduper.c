@@ -20,17 +20,59 @@
 // do not send the same publish (even with differnt value) more often that this:
 #define MIN_INTERVAL_BETWEEN_SENDS 1
 
-// TODO: diferriate between string and int types, do not malloc buffer for int type
+// Deduped publishes are kept in a fixed open-addressed table keyed by publish name,
+// nothing is malloced. Numbers are stored as numbers and compared with a delta,
+// so a reading that jitters around last published value is not republished.
+// Only string values take a buffer, from a small pool.
+// Slots with a value waiting for MIN_INTERVAL_BETWEEN_SENDS are linked in a dirty list,
+// so the tick doesn't have to look at all of them.
+// must be power of two
+#define DEDUP_TABLE_SIZE 32
+#define DEDUP_MAX_STRING_VALUES 8
+// default for publishes configured with mqtt_dedup
+#define DEDUP_CONFIGURED_EXPIRE_TIME 60
+
+typedef enum {
+	DEDUP_TYPE_NONE,
+	DEDUP_TYPE_INT,
+	DEDUP_TYPE_FLOAT,
+	DEDUP_TYPE_STRING,
+} dedupType_t;
+
 typedef struct mqtt_dedup_slot_s {
-	int flags;
 	char name[DEDUPER_MAX_STRING_LEN];
-	char value[DEDUPER_MAX_STRING_LEN];
+	unsigned int hash;
+	byte type;
+	// set by mqtt_dedup, then also generic int/float publishes of this name are deduped
+	byte bConfigured;
 	// if dirty, then it needs to be resend manually
-	bool bValueDirty;
-	int timeSinceLastSend;
+	byte bValueDirty;
+	byte bInDirtyList;
+	byte bSent;
+	short nextDirty;
+	int flags;
+	// used when bConfigured
+	int expireTime;
+	// numbers closer than that to the last value are treated as the same
+	float delta;
+	// g_dedupTime of last send
+	int lastSendTime;
+	// last published value, or the value that waits to be published
+	union {
+		int i;
+		float f;
+		// index in g_dedupStrings
+		int stringIndex;
+	} value;
 } mqtt_dedup_slot_t;
 
-static mqtt_dedup_slot_t *mqtt_dedups[DEDUP_MAX];
+static mqtt_dedup_slot_t g_dedups[DEDUP_TABLE_SIZE];
+static char g_dedupStrings[DEDUP_MAX_STRING_VALUES][DEDUPER_MAX_STRING_LEN];
+static int g_dedupStringsUsed = 0;
+static int g_dedupConfigured = 0;
+static short g_dedupDirtyHead = -1;
+// seconds, increased by MQTT_Dedup_Tick
+static int g_dedupTime = 0;
 
 static int stat_deduper_send = 0;
 static int stat_deduper_culled_duplicates = 0;
@@ -58,25 +100,108 @@ static void DD_Mutex_Free()
     xSemaphoreGive(g_mutex);
 }
 
+static unsigned int DD_Hash(const char *s) {
+	unsigned int hash = 5381;
+
+	while (*s) {
+		hash = hash * 33 + (byte)*s;
+		s++;
+	}
+	return hash;
+}
+static mqtt_dedup_slot_t *DD_FindSlot(const char *name, bool bCreate) {
+	mqtt_dedup_slot_t *slot;
+	unsigned int hash;
+	int i, probe;
+
+	hash = DD_Hash(name);
+	i = hash & (DEDUP_TABLE_SIZE - 1);
+	for (probe = 0; probe < DEDUP_TABLE_SIZE; probe++) {
+		slot = &g_dedups[i];
+		if (slot->name[0] == 0) {
+			if (bCreate == false || strlen(name) >= DEDUPER_MAX_STRING_LEN)
+				return 0;
+			strcpy(slot->name, name);
+			slot->hash = hash;
+			slot->nextDirty = -1;
+			return slot;
+		}
+		if (slot->hash == hash && !strcmp(slot->name, name)) {
+			return slot;
+		}
+		i = (i + 1) & (DEDUP_TABLE_SIZE - 1);
+	}
+	return 0;
+}
+static void DD_MarkDirty(mqtt_dedup_slot_t *slot) {
+	slot->bValueDirty = true;
+	if (slot->bInDirtyList)
+		return;
+	slot->bInDirtyList = true;
+	slot->nextDirty = g_dedupDirtyHead;
+	g_dedupDirtyHead = slot - g_dedups;
+}
+static void DD_FormatValue(mqtt_dedup_slot_t *slot, char *out, int outSize) {
+	switch (slot->type) {
+	case DEDUP_TYPE_INT:
+		snprintf(out, outSize, "%i", slot->value.i);
+		break;
+	case DEDUP_TYPE_FLOAT:
+		// same as MQTT_PublishMain_StringFloat
+		snprintf(out, outSize, "%f", slot->value.f);
+		break;
+	case DEDUP_TYPE_STRING:
+		strcpy_safe(out, g_dedupStrings[slot->value.stringIndex], outSize);
+		break;
+	default:
+		out[0] = 0;
+		break;
+	}
+}
+static int DD_TimeSinceLastSend(mqtt_dedup_slot_t *slot) {
+	if (slot->bSent == false)
+		return 999;
+	return g_dedupTime - slot->lastSendTime;
+}
+static void DD_MarkSent(mqtt_dedup_slot_t *slot) {
+	slot->bValueDirty = false;
+	slot->bSent = true;
+	slot->lastSendTime = g_dedupTime;
+}
+
 void MQTT_Dedup_Tick() {
-	int i;
+	mqtt_dedup_slot_t *slot;
+	short i, next, prev;
+	char value[DEDUPER_MAX_STRING_LEN];
 
 	//if(DD_Mutex_Take(10)) {
 	//	return;
 	///}
-	for(i = 0; i < DEDUP_MAX; i++) {
-		if(mqtt_dedups[i]) {
-			mqtt_dedups[i]->timeSinceLastSend++;
+	g_dedupTime++;
+	prev = -1;
+	for (i = g_dedupDirtyHead; i >= 0; i = next) {
+		slot = &g_dedups[i];
+		next = slot->nextDirty;
 #if DEDUPER_ENABLE_DELAY_SEND_OF_FAST_CHANGING_VALUES
-			if(mqtt_dedups[i]->timeSinceLastSend > MIN_INTERVAL_BETWEEN_SENDS && mqtt_dedups[i]->bValueDirty) {
-				// Some values of this publish were not published, because we had too many publish requests in one second or so.
-				// Now the cooldown has passed, so we can send the LATEST, most up-to-date value of this publish.
-				MQTT_PublishMain_StringString(mqtt_dedups[i]->name,mqtt_dedups[i]->value,mqtt_dedups[i]->flags);
-				mqtt_dedups[i]->bValueDirty = false;
-				mqtt_dedups[i]->timeSinceLastSend = 0;
-			}
+		if (slot->bValueDirty && DD_TimeSinceLastSend(slot) > MIN_INTERVAL_BETWEEN_SENDS) {
+			// Some values of this publish were not published, because we had too many publish requests in one second or so.
+			// Now the cooldown has passed, so we can send the LATEST, most up-to-date value of this publish.
+			DD_FormatValue(slot, value, sizeof(value));
+			MQTT_PublishMain_StringString(slot->name, value, slot->flags);
+			DD_MarkSent(slot);
+		}
 #endif
+		if (slot->bValueDirty) {
+			prev = i;
+			continue;
 		}
+		// unlink
+		slot->bInDirtyList = false;
+		slot->nextDirty = -1;
+		if (prev < 0)
+			g_dedupDirtyHead = next;
+		else
+			g_dedups[prev].nextDirty = next;
 	}
 //	DD_Mutex_Free();
 	if (CFG_HasLoggerFlag(LOGGER_FLAG_MQTT_DEDUPER)) {
@@ -85,56 +210,98 @@ void MQTT_Dedup_Tick() {
 	}
 
 }
-OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(int slotCode, int expireTime, const char* sChannel, int val, int flags) {
-	char buffer[16];
-	sprintf(buffer,"%i",val);
-	return MQTT_PublishMain_StringString_DeDuped(slotCode,expireTime,sChannel,buffer,flags);
+// Returns true if new value is the same as stored one (within delta for numbers).
+// Otherwise stores it, unless bStore is false.
+static bool DD_CompareAndStore(mqtt_dedup_slot_t *slot, dedupType_t type, int iVal, float fVal, const char *sVal, bool bStore) {
+	float diff;
+
+	if (slot->type != type) {
+		if (bStore == false)
+			return false;
+		if (type == DEDUP_TYPE_STRING) {
+			if (g_dedupStringsUsed >= DEDUP_MAX_STRING_VALUES)
+				return false;
+			slot->value.stringIndex = g_dedupStringsUsed++;
+		}
+		slot->type = type;
+	}
+	else {
+		switch (type) {
+		case DEDUP_TYPE_INT:
+			diff = (float)(iVal - slot->value.i);
+			if (diff < 0)
+				diff = -diff;
+			if (diff <= slot->delta)
+				return true;
+			break;
+		case DEDUP_TYPE_FLOAT:
+			diff = fVal - slot->value.f;
+			if (diff < 0)
+				diff = -diff;
+			if (diff <= slot->delta)
+				return true;
+			break;
+		case DEDUP_TYPE_STRING:
+			if (!strcmp(g_dedupStrings[slot->value.stringIndex], sVal))
+				return true;
+			break;
+		}
+		if (bStore == false)
+			return false;
+	}
+	switch (type) {
+	case DEDUP_TYPE_INT:
+		slot->value.i = iVal;
+		break;
+	case DEDUP_TYPE_FLOAT:
+		slot->value.f = fVal;
+		break;
+	case DEDUP_TYPE_STRING:
+		strcpy_safe(g_dedupStrings[slot->value.stringIndex], sVal, DEDUPER_MAX_STRING_LEN);
+		break;
+	}
+	return false;
 }
-OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int slotCode, int expireTime, const char* sChannel, const char* valueStr, int flags) {
+static OBK_Publish_Result DD_Publish(const char* sChannel, int expireTime, dedupType_t type, int iVal, float fVal, const char *valueStr, int flags) {
 	mqtt_dedup_slot_t *slot;
 	OBK_Publish_Result res;
+	int timeSinceLastSend;
 
-	// for simulator, we don't currently need dups removal
+	slot = DD_FindSlot(sChannel, true);
+	// table full, name too long or string pool used up
+	if (slot == 0 || (type == DEDUP_TYPE_STRING && slot->type != type && g_dedupStringsUsed >= DEDUP_MAX_STRING_VALUES)) {
+		return MQTT_PublishMain_StringString(sChannel, valueStr, flags);
+	}
+	// for simulator, we don't currently need dups removal of builtin publishes
 #ifdef WINDOWS
-	return MQTT_PublishMain_StringString(sChannel, valueStr, flags);
+	if (slot->bConfigured == false) {
+		return MQTT_PublishMain_StringString(sChannel, valueStr, flags);
+	}
 #endif
-
-	// alloc only when it's required
-	if(mqtt_dedups[slotCode] == 0) {
-		mqtt_dedups[slotCode] = malloc(sizeof(mqtt_dedup_slot_t));
-		// just in case malloc fails..
-		if (mqtt_dedups[slotCode] == 0) {
-			 return MQTT_PublishMain_StringString(sChannel, valueStr, flags);
-		}
-		memset(mqtt_dedups[slotCode],0,sizeof(mqtt_dedup_slot_t));
-		mqtt_dedups[slotCode]->timeSinceLastSend = 999;
+	if (slot->bConfigured) {
+		expireTime = slot->expireTime;
 	}
-
-	slot = mqtt_dedups[slotCode];
+	timeSinceLastSend = DD_TimeSinceLastSend(slot);
 
 	// is value the same?
-	if(!strcmp(slot->value,valueStr)) {
+	if (DD_CompareAndStore(slot, type, iVal, fVal, valueStr, false)) {
 		// has minimal time to republish passed?
-		if(expireTime > slot->timeSinceLastSend) {
+		if(expireTime > timeSinceLastSend) {
 			stat_deduper_culled_duplicates++;
 			return OBK_PUBLISH_OK; // do not resend if just few seconds passed
 		}
 	}
 #if DEDUPER_ENABLE_DELAY_SEND_OF_FAST_CHANGING_VALUES
 	// has minimal time to republish passed?
-	// 'slot->timeSinceLastSend' is increased ONCE per second
 	// So we check if it was just sent this second or previous second
-	if(MIN_INTERVAL_BETWEEN_SENDS >= slot->timeSinceLastSend) {
+	if(MIN_INTERVAL_BETWEEN_SENDS >= timeSinceLastSend) {
 		// It was sent in last second, don't resend just again
 
 		// Just save values for later
-
-		// save previous value
-		strcpy_safe(slot->value,valueStr, DEDUPER_MAX_STRING_LEN);
-		strcpy_safe(slot->name,sChannel, DEDUPER_MAX_STRING_LEN);
-		// mark as 'have to republish later'
-		slot->bValueDirty = true;
+		DD_CompareAndStore(slot, type, iVal, fVal, valueStr, true);
 		slot->flags = flags;
+		// mark as 'have to republish later'
+		DD_MarkDirty(slot);
 		stat_deduper_culled_tooFast++;
 		return OBK_PUBLISH_OK; // do not resend if just few seconds passed
 	}
@@ -142,12 +309,74 @@ OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int slotCode, int expir
 	// send futher
 	res = MQTT_PublishMain_StringString(sChannel,valueStr,flags);
 	if(res == OBK_PUBLISH_OK) {
-		slot->bValueDirty = false;
 		// mark as sent
-		slot->timeSinceLastSend = 0;
+		DD_MarkSent(slot);
 		// save previous value
-		strcpy_safe(slot->value,valueStr, DEDUPER_MAX_STRING_LEN);
+		DD_CompareAndStore(slot, type, iVal, fVal, valueStr, true);
 	}
 	stat_deduper_send++;
 	return res;
 }
+OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(const char* sChannel, int expireTime, int val, int flags) {
+	char buffer[16];
+	sprintf(buffer,"%i",val);
+	return DD_Publish(sChannel, expireTime, DEDUP_TYPE_INT, val, 0, buffer, flags);
+}
+OBK_Publish_Result MQTT_PublishMain_StringFloat_DeDuped(const char* sChannel, int expireTime, float val, int flags) {
+	char buffer[32];
+	// same as MQTT_PublishMain_StringFloat
+	sprintf(buffer, "%f", val);
+	return DD_Publish(sChannel, expireTime, DEDUP_TYPE_FLOAT, 0, val, buffer, flags);
+}
+OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(const char* sChannel, int expireTime, const char* valueStr, int flags) {
+	return DD_Publish(sChannel, expireTime, DEDUP_TYPE_STRING, 0, 0, valueStr, flags);
+}
+bool MQTT_Dedup_IsConfigured(const char* sChannel) {
+	mqtt_dedup_slot_t *slot;
+
+	if (g_dedupConfigured == 0)
+		return false;
+	slot = DD_FindSlot(sChannel, false);
+	return slot && slot->bConfigured;
+}
+static commandResult_t MQTT_Dedup_Command(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	mqtt_dedup_slot_t *slot;
+	const char *name;
+
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_CheckArgsCountAndPrintWarning(cmd, 2)) {
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+	name = Tokenizer_GetArg(0);
+	slot = DD_FindSlot(name, true);
+	if (slot == 0) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "mqtt_dedup: no room for %s", name);
+		return CMD_RES_ERROR;
+	}
+	if (slot->bConfigured == false) {
+		slot->bConfigured = true;
+		g_dedupConfigured++;
+	}
+	slot->delta = Tokenizer_GetArgFloat(1);
+	if (Tokenizer_GetArgsCount() > 2) {
+		slot->expireTime = Tokenizer_GetArgInteger(2);
+	}
+	else {
+		slot->expireTime = DEDUP_CONFIGURED_EXPIRE_TIME;
+	}
+	return CMD_RES_OK;
+}
+// forgets all values and configuration
+void MQTT_Dedup_Clear() {
+	memset(g_dedups, 0, sizeof(g_dedups));
+	g_dedupStringsUsed = 0;
+	g_dedupConfigured = 0;
+	g_dedupDirtyHead = -1;
+}
+void MQTT_Dedup_InitCommands() {
+	//cmddetail:{"name":"mqtt_dedup","args":"[PublishName] [Delta] [ExpireTimeSeconds]",
+	//cmddetail:"descr":"Enables deduplication of given numeric MQTT publish (for example, power). New value is not published if it differs by no more than Delta from the last published one, unless ExpireTimeSeconds (default 60) has passed. Too fast changes are also delayed, just like for builtin LED publishes.",
+	//cmddetail:"fn":"MQTT_Dedup_Command","file":"mqtt/new_mqtt_deduper.c","requires":"",
+	//cmddetail:"examples":"mqtt_dedup power 1.5 60"}
+	CMD_RegisterCommand("mqtt_dedup", MQTT_Dedup_Command, NULL);
+}
@@ -6,6 +6,7 @@
 #include "quicktick.h"
 #include "new_cfg.h"
 #include "httpserver/new_http.h"
+#include "httpserver/http_events.h"
 #include "logging/logging.h"
 #include "mqtt/new_mqtt.h"
 // Commands register, execution API and cmd tokenizer
@@ -69,6 +70,10 @@ char g_enable_pins = 0;
 //int g_channelStates;
 int g_channelValues[CHANNEL_MAX] = { 0 };
 float g_channelValuesFloats[CHANNEL_MAX] = { 0 };
+// see STATE_GetVersion
+static int g_stateVersion = 0;
+static int g_channelVersions[CHANNEL_MAX] = { 0 };
+static int g_stateFieldVersions[STATE_FIELD_COUNT] = { 0 };
 
 pinButton_s g_buttons[PLATFORM_GPIO_MAX];
 
@@ -857,6 +862,22 @@ void Channel_SaveInFlashIfNeeded(int ch) {
 		//addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Channel_SaveInFlashIfNeeded: Channel %i is not saved to flash, state %i", ch, g_channelValues[ch]);
 	}
 }
+int STATE_GetVersion() {
+	return g_stateVersion;
+}
+int STATE_GetChannelVersion(int ch) {
+	if (ch < 0 || ch >= CHANNEL_MAX) {
+		return 0;
+	}
+	return g_channelVersions[ch];
+}
+int STATE_GetFieldVersion(int field) {
+	return g_stateFieldVersions[field];
+}
+void STATE_MarkChanged(int field) {
+	g_stateVersion++;
+	g_stateFieldVersions[field] = g_stateVersion;
+}
 static void Channel_OnChanged(int ch, int prevValue, int iFlags) {
 	int i;
 	int iVal;
@@ -868,6 +889,9 @@ static void Channel_OnChanged(int ch, int prevValue, int iFlags) {
 	iVal = g_channelValues[ch];
 	g_channelValuesFloats[ch] = (float)iVal;
 	bOn = iVal > 0;
+	g_stateVersion++;
+	g_channelVersions[ch] = g_stateVersion;
+	SSE_OnChannelChanged(ch, g_channelValuesFloats[ch], g_cfg.pins.channelTypes[ch], g_stateVersion);
 
 #if ENABLE_I2C
 	I2C_OnChannelChanged(ch, iVal);
@@ -993,6 +1017,9 @@ void CHANNEL_Set_FloatPWM(int ch, float fVal, int iFlags) {
 
 	g_channelValues[ch] = (int)fVal;
 	g_channelValuesFloats[ch] = fVal;
+	g_stateVersion++;
+	g_channelVersions[ch] = g_stateVersion;
+	SSE_OnChannelChanged(ch, fVal, g_cfg.pins.channelTypes[ch], g_stateVersion);
 
 	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
 		if (g_cfg.pins.channels[i] == ch) {
@@ -1033,6 +1033,22 @@ int CHANNEL_HasChannelPinWithRoleOrRole(int ch, int iorType, int iorType2);
 bool CHANNEL_IsInUse(int ch);
 void Channel_SaveInFlashIfNeeded(int ch);
 int CHANNEL_FindMaxValueForChannel(int ch);
+// State versions for web panel. Every change of channel or other state
+// takes next number of one global counter, so panel can ask only for
+// what has changed since version it has already seen.
+typedef enum {
+	STATE_FIELD_LED,
+	STATE_FIELD_MQTT,
+	STATE_FIELD_WIFI,
+	STATE_FIELD_CONFIG,
+	// values shown by drivers on index page (energy meter, sensors)
+	STATE_FIELD_DRIVERS,
+	STATE_FIELD_COUNT
+} stateField_t;
+int STATE_GetVersion();
+int STATE_GetChannelVersion(int ch);
+int STATE_GetFieldVersion(int field);
+void STATE_MarkChanged(int field);
 // cmd_channels.c
 const char* CHANNEL_GetLabel(int ch);
 //ledRemap_t *CFG_GetLEDRemap();
@@ -0,0 +1,290 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../logging/logging.h"
+#include <timeapi.h>
+
+/*
+Throughput benchmarks for command/script engine hot paths.
+
+Run simulator with:
+	-runBenchmarks results.jsonl
+Every benchmark is written as a single JSON line:
+	{"name":"...","ops":N,"ms":T,"opsPerSec":X,"allocsPerOp":Y}
+allocsPerOp is -1 when allocations can't be counted in this build.
+Allocations are counted with CRT alloc hook in MSVC Debug builds,
+or with linker malloc wrapping when built with BENCHMARK_WRAP_MALLOC
+(link with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc).
+*/
+
+// every benchmark runs in batches until it took at least this long
+#define BENCHMARK_MIN_MS 250
+#define BENCHMARK_FIRST_BATCH 64
+
+static int g_benchAllocs = 0;
+static bool g_benchCanCountAllocs = false;
+
+#if defined(_MSC_VER) && defined(_DEBUG)
+#include <crtdbg.h>
+static int Benchmark_AllocHook(int allocType, void *userData, size_t size, int blockType,
+	long requestNumber, const unsigned char *filename, int lineNumber) {
+	if (allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC) {
+		g_benchAllocs++;
+	}
+	return TRUE;
+}
+static void Benchmark_InstallAllocCounter() {
+	_CrtSetAllocHook(Benchmark_AllocHook);
+	g_benchCanCountAllocs = true;
+}
+#elif defined(BENCHMARK_WRAP_MALLOC)
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void *__wrap_malloc(size_t size) {
+	g_benchAllocs++;
+	return __real_malloc(size);
+}
+void *__wrap_calloc(size_t n, size_t size) {
+	g_benchAllocs++;
+	return __real_calloc(n, size);
+}
+void *__wrap_realloc(void *p, size_t size) {
+	g_benchAllocs++;
+	return __real_realloc(p, size);
+}
+static void Benchmark_InstallAllocCounter() {
+	g_benchCanCountAllocs = true;
+}
+#else
+static void Benchmark_InstallAllocCounter() {
+	g_benchCanCountAllocs = false;
+}
+#endif
+
+typedef void (*benchmarkFunc_t)(int count);
+
+static FILE *g_benchOut = 0;
+static int g_benchCount = 0;
+
+// Runs func in growing batches until BENCHMARK_MIN_MS passed, then reports.
+// opsPerCall is number of operations done by single iteration (eg. script instructions).
+static void Benchmark_Run(const char *name, benchmarkFunc_t func, int opsPerCall) {
+	int batch, total, allocs;
+	DWORD start, took, elapsed;
+	double ops, opsPerSec, allocsPerOp;
+
+	// warm up caches (expressions, command table, tokenizer contexts)
+	func(BENCHMARK_FIRST_BATCH);
+
+	batch = BENCHMARK_FIRST_BATCH;
+	total = 0;
+	allocs = 0;
+	elapsed = 0;
+	while (elapsed < BENCHMARK_MIN_MS) {
+		g_benchAllocs = 0;
+		start = timeGetTime();
+		func(batch);
+		took = timeGetTime() - start;
+		allocs += g_benchAllocs;
+		elapsed += took;
+		total += batch;
+		if (took < BENCHMARK_MIN_MS / 4) {
+			batch *= 2;
+		}
+	}
+	ops = (double)total * opsPerCall;
+	opsPerSec = ops * 1000.0 / (elapsed ? elapsed : 1);
+	allocsPerOp = g_benchCanCountAllocs ? allocs / ops : -1;
+
+	printf("Benchmark %-36s %12.0f ops/sec %8.3f allocs/op\n", name, opsPerSec, allocsPerOp);
+	if (g_benchOut) {
+		fprintf(g_benchOut, "{\"name\":\"%s\",\"ops\":%.0f,\"ms\":%i,\"opsPerSec\":%.0f,\"allocsPerOp\":%.3f}\n",
+			name, ops, (int)elapsed, opsPerSec, allocsPerOp);
+	}
+	g_benchCount++;
+}
+
+static const char *bench_exactNames[] = { "MqttUser", "power", "setChannel", "addRepeatingEvent", "led_dimmer", "echo" };
+static const char *bench_suffixedNames[] = { "POWER1", "Channel3x", "led_dimmer5", "toggler_enable2" };
+
+static void Bench_FindCommand(int count) {
+	int i;
+
+	while (count--) {
+		for (i = 0; i < sizeof(bench_exactNames) / sizeof(bench_exactNames[0]); i++) {
+			CMD_Find(bench_exactNames[i]);
+		}
+	}
+}
+static void Bench_FindCommandWithSuffix(int count) {
+	int i;
+
+	while (count--) {
+		for (i = 0; i < sizeof(bench_suffixedNames) / sizeof(bench_suffixedNames[0]); i++) {
+			CMD_FindWithSuffix(bench_suffixedNames[i]);
+		}
+	}
+}
+static void Bench_ExecuteCommand(int count) {
+	while (count--) {
+		CMD_ExecuteCommand("setChannel 1 5", 0);
+	}
+}
+static void Bench_ExecuteCommandWithConstant(int count) {
+	while (count--) {
+		CMD_ExecuteCommand("addChannel 2 $CH1", 0);
+	}
+}
+static void Bench_ExecuteBacklog(int count) {
+	while (count--) {
+		CMD_ExecuteCommand("backlog setChannel 1 5; setChannel 3 7; addChannel 2 1", 0);
+	}
+}
+static void Bench_EvaluateExpression(int count) {
+	expressionList_t owner;
+	expressionList_t *prevOwner;
+
+	// as if evaluated by a script line, which keeps compiled expression
+	owner.first = 0;
+	prevOwner = CMD_SetExpressionOwner(&owner);
+	while (count--) {
+		CMD_EvaluateExpression("$CH1*10+5>3", 0);
+	}
+	CMD_SetExpressionOwner(prevOwner);
+	CMD_FreeExpressions(&owner);
+}
+static void Bench_EvaluateExpressionNoOwner(int count) {
+	// as if sent from console, MQTT or HTTP
+	while (count--) {
+		CMD_EvaluateExpression("$CH1*10+5>3", 0);
+	}
+}
+static void Bench_EvaluateExpressionLong(int count) {
+	expressionList_t owner;
+	expressionList_t *prevOwner;
+
+	// parentheses are not supported, so it's written out; 5*2+3*2-8/4 = 14
+	CMD_ExecuteCommand("backlog setChannel 1 5; setChannel 2 3; setChannel 3 8", 0);
+	// as if evaluated by a script line, which keeps compiled expression
+	owner.first = 0;
+	prevOwner = CMD_SetExpressionOwner(&owner);
+	SELFTEST_ASSERT(CMD_EvaluateExpression("$CH1*2+$CH2*2-$CH3/4>=14&&$CH1!=0", 0) == 1);
+	SELFTEST_ASSERT(CMD_EvaluateExpression("$CH1*2+$CH2*2-$CH3/4>=15&&$CH1!=0", 0) == 0);
+	while (count--) {
+		CMD_EvaluateExpression("$CH1*2+$CH2*2-$CH3/4>=14&&$CH1!=0", 0);
+	}
+	CMD_SetExpressionOwner(prevOwner);
+	CMD_FreeExpressions(&owner);
+}
+static void Bench_SetVar(int count) {
+	while (count--) {
+		CMD_ExecuteCommand("setVar counter $counter+1", 0);
+	}
+}
+static void Bench_Tokenize(int count) {
+	while (count--) {
+		Tokenizer_TokenizeString("1 2 3 abc def 4.5", 0);
+		Tokenizer_GetArgInteger(1);
+	}
+}
+static void Bench_TokenizeQuotedExpand(int count) {
+	while (count--) {
+		Tokenizer_TokenizeString("\"quoted text\" $CH1 $CH2 15", TOKENIZER_ALLOW_QUOTES);
+		Tokenizer_GetArgInteger(1);
+	}
+}
+static void Bench_FireEvent_Match(int count) {
+	while (count--) {
+		// one handler matches, it runs a cheap command
+		EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 7);
+	}
+}
+static void Bench_FireEvent_NoMatch(int count) {
+	while (count--) {
+		EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 9999);
+	}
+}
+static void Bench_ChangeHandlers(int count) {
+	while (count--) {
+		EventHandlers_ProcessVariableChange_Integer(CMD_EVENT_CHANGE_CHANNEL0 + 30, 0, 1);
+	}
+}
+static void Bench_SVM(int count) {
+	while (count--) {
+		// single runnable thread, 10 instructions per call
+		SVM_RunThreads(0);
+	}
+}
+
+static const char *bench_script =
+"again:\r\n"
+"    addChannel 10 1\r\n"
+"    goto again\r\n";
+
+static void Benchmark_EventHandlers(int numHandlers) {
+	char name[64];
+	int i;
+
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+	for (i = 0; i < numHandlers; i++) {
+		CMD_ExecuteCommand(va("addEventHandler OnClick %i setChannel 4 %i", i, i), 0);
+		CMD_ExecuteCommand(va("addChangeHandler Channel%i == %i setChannel 5 1", i % 64, i), 0);
+	}
+	snprintf(name, sizeof(name), "FireEvent_Match_%iHandlers", numHandlers);
+	Benchmark_Run(name, Bench_FireEvent_Match, 1);
+	snprintf(name, sizeof(name), "FireEvent_NoMatch_%iHandlers", numHandlers);
+	Benchmark_Run(name, Bench_FireEvent_NoMatch, 1);
+	snprintf(name, sizeof(name), "ChangeHandlers_%iHandlers", numHandlers);
+	Benchmark_Run(name, Bench_ChangeHandlers, 1);
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+}
+
+int Win_DoBenchmarks(const char *outFileName) {
+	int prevLogLevel;
+
+	g_benchCount = 0;
+	g_benchOut = 0;
+	if (outFileName && *outFileName) {
+		g_benchOut = fopen(outFileName, "w");
+		if (g_benchOut == 0) {
+			printf("Benchmark: failed to open %s\n", outFileName);
+		}
+	}
+	SIM_ClearOBK();
+	Benchmark_InstallAllocCounter();
+	// logging is a separate path, it's not measured here
+	prevLogLevel = loglevel;
+	loglevel = LOG_NONE;
+
+	Benchmark_Run("CMD_Find", Bench_FindCommand, sizeof(bench_exactNames) / sizeof(bench_exactNames[0]));
+	Benchmark_Run("CMD_FindWithSuffix", Bench_FindCommandWithSuffix, sizeof(bench_suffixedNames) / sizeof(bench_suffixedNames[0]));
+	Benchmark_Run("CMD_ExecuteCommand", Bench_ExecuteCommand, 1);
+	Benchmark_Run("CMD_ExecuteCommand_Constant", Bench_ExecuteCommandWithConstant, 1);
+	Benchmark_Run("CMD_ExecuteCommand_Backlog3", Bench_ExecuteBacklog, 1);
+	Benchmark_Run("CMD_EvaluateExpression", Bench_EvaluateExpression, 1);
+	Benchmark_Run("CMD_EvaluateExpression_Long", Bench_EvaluateExpressionLong, 1);
+	Benchmark_Run("CMD_EvaluateExpression_NoOwner", Bench_EvaluateExpressionNoOwner, 1);
+	Benchmark_Run("CMD_SetVar", Bench_SetVar, 1);
+	Benchmark_Run("Tokenizer_TokenizeString", Bench_Tokenize, 1);
+	Benchmark_Run("Tokenizer_TokenizeString_Expand", Bench_TokenizeQuotedExpand, 1);
+
+	Benchmark_EventHandlers(10);
+	Benchmark_EventHandlers(100);
+
+	CMD_ExecuteCommand("lfs_format", 0);
+	Test_FakeHTTPClientPacket_POST("api/lfs/bench_loop.txt", bench_script);
+	CMD_ExecuteCommand("startScript bench_loop.txt", 0);
+	// ops are script instructions
+	Benchmark_Run("SVM_Instructions", Bench_SVM, 10);
+	CMD_ExecuteCommand("stopAllScripts", 0);
+
+	loglevel = prevLogLevel;
+	if (g_benchOut) {
+		fclose(g_benchOut);
+		g_benchOut = 0;
+	}
+	return g_benchCount;
+}
+
+#endif
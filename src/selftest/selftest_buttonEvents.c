@@ -95,6 +95,55 @@ void Test_ButtonEvents() {
 	SELFTEST_ASSERT_CHANNEL(11, (123 + 123 + 123));
 	SELFTEST_ASSERT_CHANNEL(12, 22);
 	SELFTEST_ASSERT_CHANNEL(13, 1201);
+
+	//
+	// Test dispatch with many handlers for different arguments
+	//
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+	for (int i = 0; i < 32; i++) {
+		CMD_ExecuteCommand(va("addEventHandler OnClick %i addChannel 20 %i", i, i + 1), 0);
+		CMD_ExecuteCommand(va("addEventHandler2 IR_Samsung 0x707 %i addChannel 21 %i", i, i + 1), 0);
+		CMD_ExecuteCommand(va("addEventHandler OnUART 55AA%02X setChannel 22 %i", i, i + 1), 0);
+	}
+	CMD_ExecuteCommand("addChangeHandler Channel20 > 50 setChannel 23 1", 0);
+	SELFTEST_ASSERT(EventHandlers_GetActiveCount() == 32 * 3 + 1);
+	SELFTEST_ASSERT_CHANNEL(20, 0);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 7);
+	SELFTEST_ASSERT_CHANNEL(20, 8);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 31);
+	SELFTEST_ASSERT_CHANNEL(20, (8 + 32));
+	// no handler for this pin
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 40);
+	SELFTEST_ASSERT_CHANNEL(20, (8 + 32));
+	// only the handler for matching address and command runs
+	EventHandlers_FireEvent2(CMD_EVENT_IR_SAMSUNG, 0x707, 5);
+	SELFTEST_ASSERT_CHANNEL(21, 6);
+	EventHandlers_FireEvent2(CMD_EVENT_IR_SAMSUNG, 0x708, 5);
+	SELFTEST_ASSERT_CHANNEL(21, 6);
+	// single argument event ignores second argument of handler
+	EventHandlers_FireEvent(CMD_EVENT_IR_SAMSUNG, 0x707);
+	SELFTEST_ASSERT_CHANNEL(21, (6 + 528));
+	// handlers with the same first argument are keyed again by second and third one
+	CMD_ExecuteCommand("addEventHandler3 IR_NEC 0x10 0x20 1 addChannel 24 1", 0);
+	CMD_ExecuteCommand("addEventHandler3 IR_NEC 0x10 0x20 2 addChannel 24 10", 0);
+	CMD_ExecuteCommand("addEventHandler3 IR_NEC 0x10 0x28 1 addChannel 24 100", 0);
+	EventHandlers_FireEvent3(CMD_EVENT_IR_NEC, 0x10, 0x20, 2);
+	SELFTEST_ASSERT_CHANNEL(24, 10);
+	EventHandlers_FireEvent3(CMD_EVENT_IR_NEC, 0x10, 0x28, 1);
+	SELFTEST_ASSERT_CHANNEL(24, 110);
+	// fewer arguments ignore the remaining ones of handler
+	EventHandlers_FireEvent2(CMD_EVENT_IR_NEC, 0x10, 0x20);
+	SELFTEST_ASSERT_CHANNEL(24, (110 + 11));
+	EventHandlers_FireEvent(CMD_EVENT_IR_NEC, 0x10);
+	SELFTEST_ASSERT_CHANNEL(24, (110 + 11 + 111));
+	// hex payload match is case insensitive
+	EventHandlers_FireEvent_String(CMD_EVENT_ON_UART, "55aa1f");
+	SELFTEST_ASSERT_CHANNEL(22, 32);
+	// change handler still sees every value change of its channel
+	SELFTEST_ASSERT_CHANNEL(23, 0);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 30);
+	SELFTEST_ASSERT_CHANNEL(20, (8 + 32 + 31));
+	SELFTEST_ASSERT_CHANNEL(23, 1);
 }
 
 
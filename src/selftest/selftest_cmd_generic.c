@@ -2,7 +2,106 @@
 
 #include "selftest_local.h".
 
+static void Test_Commands_Lookup() {
+	const char *exact[] = { "MqttUser", "power", "setChannel", "addRepeatingEvent", "led_dimmer", "echo" };
+	const char *suffixed[] = { "POWER1", "led_dimmer5", "setChannel12" };
+	int j;
+
+	for (j = 0; j < sizeof(exact) / sizeof(exact[0]); j++) {
+		SELFTEST_ASSERT(CMD_Find(exact[j]) != 0);
+		SELFTEST_ASSERT(CMD_FindWithSuffix(exact[j]) == CMD_Find(exact[j]));
+	}
+	// case does not matter
+	SELFTEST_ASSERT(CMD_Find("SETCHANNEL") == CMD_Find("setChannel"));
+	SELFTEST_ASSERT(CMD_Find("mqttuser") == CMD_Find("MqttUser"));
+	for (j = 0; j < sizeof(suffixed) / sizeof(suffixed[0]); j++) {
+		SELFTEST_ASSERT(CMD_Find(suffixed[j]) == 0);
+		SELFTEST_ASSERT(CMD_FindWithSuffix(suffixed[j]) != 0);
+	}
+	SELFTEST_ASSERT(CMD_Find("noSuchCommand") == 0);
+	SELFTEST_ASSERT(CMD_FindWithSuffix("noSuchCommand5") == 0);
+}
+
+// arenas are listed by arenaStats once used, so this one must stay alive
+static arena_t g_testArena = ARENA_INIT("selftest");
+
+static void Test_Commands_Arena() {
+	arena_t *a = &g_testArena;
+	const char *s1, *s2, *s3;
+	void *p1, *p2, *big;
+	int i;
+
+	// interned text is stored once
+	s1 = Arena_Intern(a, "setChannel 1 0");
+	s2 = Arena_Intern(a, "setChannel 1 0");
+	s3 = Arena_Intern(a, "setChannel 1 1");
+	SELFTEST_ASSERT(s1 == s2);
+	SELFTEST_ASSERT(s1 != s3);
+	SELFTEST_ASSERT_STRING(s3, "setChannel 1 1");
+	SELFTEST_ASSERT_INTEGER(a->numInternHits, 1);
+	SELFTEST_ASSERT_INTEGER(a->numChunks, 1);
+
+	// allocations are aligned and packed into chunks
+	p1 = Arena_Alloc(a, 3);
+	p2 = Arena_Alloc(a, 5);
+	SELFTEST_ASSERT((((size_t)p1) % sizeof(void*)) == 0);
+	SELFTEST_ASSERT((((size_t)p2) % sizeof(void*)) == 0);
+	SELFTEST_ASSERT(p1 != p2);
+	SELFTEST_ASSERT_INTEGER(a->numChunks, 1);
+	// big one gets a chunk of its own, small ones still go to the first chunk
+	big = Arena_Alloc(a, ARENA_CHUNK_SIZE * 4);
+	memset(big, 0x55, ARENA_CHUNK_SIZE * 4);
+	SELFTEST_ASSERT_INTEGER(a->numChunks, 2);
+	Arena_Alloc(a, 8);
+	SELFTEST_ASSERT_INTEGER(a->numChunks, 2);
+	for (i = 0; i < 200; i++) {
+		Arena_Alloc(a, 16);
+	}
+	SELFTEST_ASSERT(a->numChunks > 2);
+
+	Arena_Release(a);
+	SELFTEST_ASSERT_INTEGER(a->numChunks, 0);
+	SELFTEST_ASSERT_INTEGER(a->usedBytes, 0);
+	SELFTEST_ASSERT_INTEGER(a->numReleases, 1);
+	// intern table was cleared as well
+	s1 = Arena_Intern(a, "setChannel 1 0");
+	SELFTEST_ASSERT_STRING(s1, "setChannel 1 0");
+	SELFTEST_ASSERT_INTEGER(a->numInternHits, 1);
+	Arena_Reset(a);
+
+	// handlers with the same command share text, and are released at once
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+	for (i = 0; i < 10; i++) {
+		CMD_ExecuteCommand(va("addEventHandler OnClick %i addChannel 5 1", i), 0);
+	}
+	SELFTEST_ASSERT_INTEGER(EventHandlers_GetActiveCount(), 10);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 3);
+	SELFTEST_ASSERT_CHANNEL(5, 1);
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+	SELFTEST_ASSERT_INTEGER(EventHandlers_GetActiveCount(), 0);
+	CMD_ExecuteCommand("addEventHandler OnClick 3 addChannel 5 10", 0);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 3);
+	SELFTEST_ASSERT_CHANNEL(5, 11);
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+
+	// handler may clear all handlers, its own memory is kept until it returns
+	// and the cleared handlers are not run anymore
+	CMD_ExecuteCommand("addEventHandler OnClick 3 addChannel 7 1", 0);
+	CMD_ExecuteCommand("addEventHandler OnClick 3 backlog setChannel 6 $CH6+1; clearAllHandlers; setChannel 6 $CH6+10; addEventHandler OnClick 3 addChannel 8 1", 0);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 3);
+	SELFTEST_ASSERT_CHANNEL(6, 11);
+	SELFTEST_ASSERT_CHANNEL(7, 0);
+	SELFTEST_ASSERT_INTEGER(EventHandlers_GetActiveCount(), 1);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 3);
+	SELFTEST_ASSERT_CHANNEL(6, 11);
+	SELFTEST_ASSERT_CHANNEL(8, 1);
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+
+	SELFTEST_ASSERT(CMD_ExecuteCommand("arenaStats", 0) == CMD_RES_OK);
+}
 void Test_Commands_Generic() {
+	int i;
+
 	// reset whole device
 	SIM_ClearOBK();
 
@@ -17,6 +116,37 @@ void Test_Commands_Generic() {
 
 	CMD_ExecuteCommand("SSID1 TPLink123", 0);
 	SELFTEST_ASSERT_STRING(CFG_GetWiFiSSID(), "TPLink123");
+
+	// lookup is case insensitive
+	SELFTEST_ASSERT(CMD_Find("mqttuser") == CMD_Find("MQTTUSER"));
+	SELFTEST_ASSERT(CMD_Find("MqttUser") != 0);
+	SELFTEST_ASSERT(CMD_Find("MqttUse") == 0);
+	SELFTEST_ASSERT(CMD_Find("MqttUserX") == 0);
+	// numeric suffix is split only when complete name is not a command
+	SELFTEST_ASSERT(CMD_Find("POWER1") == 0);
+	SELFTEST_ASSERT(CMD_FindWithSuffix("POWER1") == CMD_Find("power"));
+	SELFTEST_ASSERT(CMD_FindWithSuffix("SSID1") == CMD_Find("SSID1"));
+	SELFTEST_ASSERT(CMD_FindWithSuffix("123") == 0);
+
+	// command registered after the table was built is found too
+	CMD_ExecuteCommand("alias test_lookup_alias setChannel 1 15", 0);
+	SELFTEST_ASSERT(CMD_Find("TEST_LOOKUP_ALIAS") != 0);
+	CMD_ExecuteCommand("test_lookup_alias", 0);
+	SELFTEST_ASSERT_CHANNEL(1, 15);
+	// late registrations make table grow, nothing is lost
+	for (i = 0; i < 300; i++) {
+		CMD_ExecuteCommand(va("alias test_grow_%i setChannel 1 %i", i, i), 0);
+	}
+	for (i = 0; i < 300; i++) {
+		SELFTEST_ASSERT(CMD_Find(va("TEST_GROW_%i", i)) != 0);
+	}
+	SELFTEST_ASSERT(CMD_Find("test_lookup_alias") != 0);
+	SELFTEST_ASSERT(CMD_FindWithSuffix("POWER1") == CMD_Find("power"));
+	CMD_ExecuteCommand("test_grow_299", 0);
+	SELFTEST_ASSERT_CHANNEL(1, 299);
+
+	Test_Commands_Arena();
+	Test_Commands_Lookup();
 }
 
 
@@ -232,6 +232,93 @@ void Test_Expressions_RunTests_Basic() {
 	SELFTEST_ASSERT_EXPRESSION("1 <= 1", 1);
 	SELFTEST_ASSERT_EXPRESSION("1 <= 0", 0);
 	SELFTEST_ASSERT_EXPRESSION("1 <= -1", 0);
+
+	// compiled expressions may be kept, so make sure that
+	// the same text gives a fresh result after channel change
+	for (int i = 0; i < 40; i++) {
+		CHANNEL_Set(7, i, 0);
+		SELFTEST_ASSERT_EXPRESSION("$CH7*10+$CH1", i * 10 + 2);
+		SELFTEST_ASSERT_EXPRESSION("!$CH7", i == 0);
+		SELFTEST_ASSERT_EXPRESSION(va("%i+2*3", i), i + 6);
+	}
+	// owner keeps its compiled expressions, more of them than it can
+	// keep must still evaluate right
+	{
+		expressionList_t owner;
+		expressionList_t *prevOwner;
+
+		owner.first = 0;
+		prevOwner = CMD_SetExpressionOwner(&owner);
+		for (int i = 0; i < 20; i++) {
+			CHANNEL_Set(7, i, 0);
+			SELFTEST_ASSERT_EXPRESSION("$CH7*2+1", i * 2 + 1);
+			SELFTEST_ASSERT_EXPRESSION(va("$CH7+%i", i % 7), i + i % 7);
+		}
+		SELFTEST_ASSERT(owner.first != 0);
+		CMD_SetExpressionOwner(prevOwner);
+		CMD_FreeExpressions(&owner);
+		SELFTEST_ASSERT(owner.first == 0);
+	}
+	// constants are dispatched by first character, make sure
+	// wildcard and non-wildcard ones still match the same way
+	CHANNEL_Set(11, 5, 0);
+	CHANNEL_Set(12, 3, 0);
+	SELFTEST_ASSERT_EXPRESSION("$CH11+$CH12*100", 305);
+	SELFTEST_ASSERT_EXPRESSION("$CH11-$CH1", 3);
+	SELFTEST_ASSERT_EXPRESSION("$uptime>=0", 1);
+
+	// script variables
+	SELFTEST_ASSERT_EXPRESSION("$myVar+1", 1);
+	CMD_ExecuteCommand("setVar myVar 10", 0);
+	// cached expression must see the new value
+	SELFTEST_ASSERT_EXPRESSION("$myVar+1", 11);
+	CMD_ExecuteCommand("setVar $myVar $myVar*2+$CH1", 0);
+	SELFTEST_ASSERT_EXPRESSION("$myVar", 22);
+	// names are case insensitive, like commands
+	SELFTEST_ASSERT_EXPRESSION("$MYVAR", 22);
+	CMD_ExecuteCommand("setVar other_2 1.5", 0);
+	SELFTEST_ASSERT_EXPRESSION("$other_2*2+$myVar", 25);
+	// variables are expanded in command arguments
+	CMD_ExecuteCommand("setChannel 13 $myVar", 0);
+	SELFTEST_ASSERT_CHANNEL(13, 22);
+	CMD_ExecuteCommand("if $myVar>20 then \"setChannel 13 1\"", 0);
+	SELFTEST_ASSERT_CHANNEL(13, 1);
+	for (int i = 0; i < 10; i++) {
+		CMD_ExecuteCommand("setVar myVar $myVar+1", 0);
+	}
+	SELFTEST_ASSERT_EXPRESSION("$myVar", 32);
+	// reading unknown names does not use up variable slots
+	for (int i = 0; i < 40; i++) {
+		SELFTEST_ASSERT_EXPRESSION(va("$unset%i+1", i), 1);
+	}
+	CMD_ExecuteCommand("setVar late 7", 0);
+	SELFTEST_ASSERT_EXPRESSION("$late", 7);
+	// variables are forgotten by clearAll, also by expressions compiled before
+	{
+		expressionList_t owner;
+		expressionList_t *prevOwner;
+
+		owner.first = 0;
+		prevOwner = CMD_SetExpressionOwner(&owner);
+		SELFTEST_ASSERT_EXPRESSION("$myVar+$late", 39);
+		CMD_ExecuteCommand("clearAll", 0);
+		SELFTEST_ASSERT_EXPRESSION("$myVar+$late", 0);
+		CMD_ExecuteCommand("setVar late 2", 0);
+		SELFTEST_ASSERT_EXPRESSION("$myVar+$late", 2);
+		CMD_SetExpressionOwner(prevOwner);
+		CMD_FreeExpressions(&owner);
+	}
+	// expressions without owner are kept in shared list, values still change
+	CHANNEL_Set(4, 3, 0);
+	SELFTEST_ASSERT_EXPRESSION("$CH4*10+5", 35);
+	CHANNEL_Set(4, 4, 0);
+	SELFTEST_ASSERT_EXPRESSION("$CH4*10+5", 45);
+	for (int i = 0; i < 12; i++) {
+		SELFTEST_ASSERT_EXPRESSION(va("$CH4*%i", i), 4 * i);
+	}
+	SELFTEST_ASSERT_EXPRESSION("$CH4*10+5", 45);
+	SELFTEST_ASSERT_EXPRESSION("$CH4*11", 44);
+
 	//CHANNEL_Set(18, 15, 0);
 	//SELFTEST_ASSERT_EXPRESSION("15.0+$CH18+1000\n\r", 30.0f + 1000);
 	//SELFTEST_ASSERT_EXPRESSION("15.0/$CH18+1000\n\r", 1.0f + 1000);
@@ -2,6 +2,9 @@
 
 #include "selftest_local.h"
 #include "../httpserver/new_http.h"
+#include "../httpserver/http_events.h"
+#include "../httpserver/http_routes.h"
+#include "../logging/logging.h"
 //#define JSMN_HEADER
 ///#include "../jsmn/jsmn.h"
 #include "../cJSON/cJSON.h"
@@ -892,6 +895,440 @@ void Test_Http_LED_RGB() {
 	*/
 
 }
+// processes raw request on a connection that may be kept open,
+// returns true if server wants to keep it
+static bool Test_FakeHTTPClientPacket_KeepAlive(const char *raw) {
+	http_request_t request;
+	bool bKeep;
+
+	strcpy(buffer, raw);
+	memset(&request, 0, sizeof(request));
+	request.fd = 0;
+	request.received = buffer;
+	request.receivedLen = strlen(buffer);
+	outbuf[0] = '\0';
+	request.reply = outbuf;
+	request.replylen = 0;
+	request.replymaxlen = sizeof(outbuf) - 1;
+	request.bKeepAliveAllowed = 1;
+	request.responseCode = HTTP_RESPONSE_OK;
+
+	bKeep = HTTP_FinishReply(&request, HTTP_ProcessPacket(&request));
+	outbuf[request.replylen] = 0;
+	replyAt = Helper_GetPastHTTPHeader(outbuf);
+	return bKeep;
+}
+void Test_Http_KeepAlive() {
+	const char *first = "GET /cm?cmnd=POWER HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+	const char *second = "POST /cm HTTP/1.1\r\nContent-Length: 10\r\n\r\ncmnd=POWER";
+	const char *third = "GET /index HTTP/1.1\r\nHost:";
+	char pipelined[256];
+	char *end;
+	int chunkLen;
+
+	SIM_ClearOBK();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+
+	// pipelined requests are split by headers and Content-Length
+	snprintf(pipelined, sizeof(pipelined), "%s%s%s", first, second, third);
+	SELFTEST_ASSERT(HTTP_GetRequestLength(pipelined, strlen(pipelined)) == strlen(first));
+	SELFTEST_ASSERT(HTTP_GetRequestLength(pipelined + strlen(first), strlen(second) + strlen(third)) == strlen(second));
+	SELFTEST_ASSERT(HTTP_GetRequestLength(third, strlen(third)) == -1);
+	// body is not complete yet
+	SELFTEST_ASSERT(HTTP_GetRequestLength(second, strlen(second) - 3) == strlen(second));
+
+	// HTTP/1.1 is kept open by default and reply is chunked
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive(first));
+	SELFTEST_ASSERT(strstr(outbuf, "Transfer-Encoding: chunked") != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Connection: keep-alive") != 0);
+	SELFTEST_ASSERT(replyAt != 0);
+	chunkLen = strtol(replyAt, &end, 16);
+	SELFTEST_ASSERT(chunkLen > 0);
+	SELFTEST_ASSERT(!strncmp(end, "\r\n", 2));
+	end += 2;
+	Test_GetJSONValue_Setup(end);
+	SELFTEST_ASSERT_JSON_VALUE_STRING(0, "POWER", "OFF");
+	SELFTEST_ASSERT(!strncmp(end + chunkLen, "\r\n0\r\n\r\n", 7));
+	SELFTEST_ASSERT(end[chunkLen + 7] == 0);
+
+	// explicit close and HTTP/1.0 are not kept
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive("GET /cm?cmnd=POWER HTTP/1.1\r\nConnection: close\r\n\r\n") == false);
+	SELFTEST_ASSERT(strstr(outbuf, "Connection: close") != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "chunked") == 0);
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive("GET /cm?cmnd=POWER HTTP/1.0\r\n\r\n") == false);
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive("GET /cm?cmnd=POWER HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n"));
+}
+void Test_Http_StreamBody() {
+	char *raw;
+	char *body;
+	int i, len;
+
+	SIM_ClearOBK();
+	CMD_ExecuteCommand("lfs_format", 0);
+
+	len = 3000;
+	body = malloc(len + 1);
+	for (i = 0; i < len; i++) {
+		body[i] = 'a' + (i % 26);
+	}
+	body[len] = 0;
+	raw = malloc(len + 256);
+
+	// whole body came with headers, it's passed to handler in one part
+	sprintf(raw, "POST /api/lfs/stream.txt HTTP/1.1\r\nContent-Length: %i\r\n\r\n%s", len, body);
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive(raw));
+	SELFTEST_ASSERT(strstr(outbuf, "\"size\":3000") != 0);
+	Test_FakeHTTPClientPacket_GET("api/lfs/stream.txt");
+	SELFTEST_ASSERT_HTML_REPLY(body);
+
+	// rest of body never comes, upload fails and connection can't be reused
+	sprintf(raw, "POST /api/lfs/stream2.txt HTTP/1.1\r\nContent-Length: %i\r\n\r\n%s", len + 100, body);
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive(raw) == false);
+	SELFTEST_ASSERT(strstr(outbuf, "\"error\"") != 0);
+
+	free(raw);
+	free(body);
+}
+void Test_Http_StateDelta() {
+	cJSON *ch;
+	int v0, v1;
+
+	SIM_ClearOBK();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	CMD_ExecuteCommand("setChannelType 2 Temperature", 0);
+	CMD_ExecuteCommand("setChannel 2 21", 0);
+
+	// without 'since' everything is returned
+	Test_FakeHTTPClientPacket_JSON("state");
+	v0 = Test_GetJSONValue_Integer("v", "");
+	ch = Test_GetJSONValue_Generic("ch", "");
+	SELFTEST_ASSERT(ch != 0);
+	SELFTEST_ASSERT(cJSON_GetArraySize(ch) >= 2);
+	SELFTEST_ASSERT(Test_GetJSONValue_Generic("led", "") != 0);
+	SELFTEST_ASSERT(Test_GetJSONValue_Generic("mqtt", "") != 0);
+
+	// nothing has changed
+	Test_FakeHTTPClientPacket_JSON(va("state?since=%i", v0));
+	SELFTEST_ASSERT(Test_GetJSONValue_Integer("v", "") == v0);
+	SELFTEST_ASSERT(Test_GetJSONValue_Generic("ch", "") == 0);
+	SELFTEST_ASSERT(Test_GetJSONValue_Generic("led", "") == 0);
+	SELFTEST_ASSERT(Test_GetJSONValue_Generic("mqtt", "") == 0);
+
+	// only changed channel is returned
+	CMD_ExecuteCommand("setChannel 2 23", 0);
+	Test_FakeHTTPClientPacket_JSON(va("state?since=%i", v0));
+	v1 = Test_GetJSONValue_Integer("v", "");
+	SELFTEST_ASSERT(v1 > v0);
+	ch = Test_GetJSONValue_Generic("ch", "");
+	SELFTEST_ASSERT(cJSON_GetArraySize(ch) == 1);
+	SELFTEST_ASSERT(cJSON_GetArrayItem(cJSON_GetArrayItem(ch, 0), 0)->valueint == 2);
+	SELFTEST_ASSERT(cJSON_GetArrayItem(cJSON_GetArrayItem(ch, 0), 1)->valueint == 23);
+
+	// setting the same value is not a change
+	CMD_ExecuteCommand("setChannel 2 23", 0);
+	Test_FakeHTTPClientPacket_JSON(va("state?since=%i", v1));
+	SELFTEST_ASSERT(Test_GetJSONValue_Integer("v", "") == v1);
+	SELFTEST_ASSERT(Test_GetJSONValue_Generic("ch", "") == 0);
+	SELFTEST_ASSERT(Test_GetJSONValue_Generic("drv", "") == 0);
+
+	// energy meter readings are shown by driver, they change version too
+	CMD_ExecuteCommand("startDriver TESTPOWER", 0);
+	CMD_ExecuteCommand("SetupTestPower 230 0.26 60 0", 0);
+	Sim_RunSeconds(2, false);
+	Test_FakeHTTPClientPacket_JSON(va("state?since=%i", v1));
+	SELFTEST_ASSERT(Test_GetJSONValue_Integer("v", "") > v1);
+	SELFTEST_ASSERT(Test_GetJSONValue_Integer("drv", "") == 1);
+	CMD_ExecuteCommand("stopDriver TESTPOWER", 0);
+}
+void Test_Http_Events() {
+	char queued[2048];
+	int i;
+
+	SIM_ClearOBK();
+	SSE_RemoveAllClients();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+
+	// selftests log a lot, first stream is without log lines
+	Test_FakeHTTPClientPacket_GET("events?log=0");
+	SELFTEST_ASSERT(strstr(outbuf, "Content-type: text/event-stream") != 0);
+	SELFTEST_ASSERT(SSE_GetNumClients() == 1);
+
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	SSE_GetQueued(0, queued, sizeof(queued));
+	SELFTEST_ASSERT(strstr(queued, "event: ch\nid: ") == queued);
+	SELFTEST_ASSERT(strstr(queued, "\"ch\":[[1,1.00,") != 0);
+	SELFTEST_ASSERT(strstr(queued, "event: log") == 0);
+
+	// MQTT state is sent once after stream is opened
+	SSE_RunFrame();
+	SSE_GetQueued(0, queued, sizeof(queued));
+	SELFTEST_ASSERT(strstr(queued, "event: mqtt\n") != 0);
+
+	// client that does not read keeps only the newest events
+	for (i = 0; i < 20; i++) {
+		CMD_ExecuteCommand(va("setChannel 2 %i", 100 + i), 0);
+	}
+	SELFTEST_ASSERT(SSE_GetDropped(0) > 0);
+	SSE_GetQueued(0, queued, sizeof(queued));
+	SELFTEST_ASSERT(strstr(queued, "[[2,119.00,") != 0);
+	SELFTEST_ASSERT(strstr(queued, "[[2,100.00,") == 0);
+
+	// log only stream
+	Test_FakeHTTPClientPacket_GET("events?ch=0&mqtt=0");
+	SELFTEST_ASSERT(SSE_GetNumClients() == 2);
+	addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "Event stream test line");
+	for (i = 0; i < 100; i++) {
+		SSE_RunFrame();
+	}
+	SSE_GetQueued(1, queued, sizeof(queued));
+	SELFTEST_ASSERT(strstr(queued, "Event stream test line\n\n") != 0);
+	SELFTEST_ASSERT(strstr(queued, "event: ch") == 0);
+
+	// no room for third stream
+	Test_FakeHTTPClientPacket_GET("events");
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 503") == outbuf);
+	SELFTEST_ASSERT(SSE_GetNumClients() == 2);
+
+	SSE_RemoveAllClients();
+	SELFTEST_ASSERT(SSE_GetNumClients() == 0);
+}
+// copies value of reply header, without CRLF
+static bool Test_GetReplyHeader(const char *name, char *out, int maxLen) {
+	const char *p;
+	int len;
+
+	p = strstr(outbuf, name);
+	if (p == 0) {
+		return false;
+	}
+	p += strlen(name) + 2;
+	len = strstr(p, "\r\n") - p;
+	if (len >= maxLen) {
+		len = maxLen - 1;
+	}
+	memcpy(out, p, len);
+	out[len] = 0;
+	return true;
+}
+void Test_Http_StaticCache() {
+	char req[256];
+	char etag[40];
+
+	SIM_ClearOBK();
+
+	// pages link style and script with content hash as version
+	Test_FakeHTTPClientPacket_GET("index");
+	SELFTEST_ASSERT(strstr(outbuf, va("/static/style.css?v=%s", htmlHeadStyle_hash)) != 0);
+	SELFTEST_ASSERT(strstr(outbuf, va("/static/script.js?v=%s", pageScript_hash)) != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "<style>") == 0);
+
+	// compressed copy has Content-Length, so connection stays open without chunks
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive("GET /static/script.js?v=1 HTTP/1.1\r\nAccept-Encoding: gzip, deflate\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200 OK\r\n") == outbuf);
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Encoding: gzip\r\n") != 0);
+	SELFTEST_ASSERT(strstr(outbuf, va("Content-Length: %i\r\n", pageScript_gzLen)) != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Transfer-Encoding") == 0);
+	SELFTEST_ASSERT(strstr(outbuf, "max-age=31536000") != 0);
+	SELFTEST_ASSERT(replyAt != 0 && !memcmp(replyAt, pageScript_gz, pageScript_gzLen));
+	SELFTEST_ASSERT(Test_GetReplyHeader("ETag", etag, sizeof(etag)));
+	SELFTEST_ASSERT(!strcmp(etag, va("\"%s-gz\"", pageScript_hash)));
+
+	// browser has it already
+	snprintf(req, sizeof(req), "GET /static/script.js HTTP/1.1\r\nAccept-Encoding: gzip\r\nIf-None-Match: %s\r\n\r\n", etag);
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive(req));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304 Not Modified\r\n") == outbuf);
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Length") == 0);
+	SELFTEST_ASSERT(replyAt != 0 && *replyAt == 0);
+
+	// client without gzip gets text without <style> tag
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive("GET /static/style.css HTTP/1.1\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Encoding") == 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Type: text/css\r\n") != 0);
+	SELFTEST_ASSERT(strlen(replyAt) == strlen(htmlHeadStyle) - strlen("<style></style>"));
+	SELFTEST_ASSERT(!strncmp(replyAt, htmlHeadStyle + strlen("<style>"), strlen(replyAt)));
+	SELFTEST_ASSERT(Test_GetReplyHeader("ETag", etag, sizeof(etag)));
+	SELFTEST_ASSERT(!strcmp(etag, va("\"%s\"", htmlHeadStyle_hash)));
+
+	// LittleFS files are checked with ETag every time
+	CMD_ExecuteCommand("lfs_format", 0);
+	Test_FakeHTTPClientPacket_POST("api/lfs/page.css", "body{color:red}");
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive("GET /api/lfs/page.css HTTP/1.1\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Type: text/css\r\n") != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Cache-Control: no-cache\r\n") != 0);
+	SELFTEST_ASSERT(!strcmp(replyAt, "body{color:red}"));
+	SELFTEST_ASSERT(Test_GetReplyHeader("ETag", etag, sizeof(etag)));
+	snprintf(req, sizeof(req), "GET /api/lfs/page.css HTTP/1.1\r\nIf-None-Match: %s\r\n\r\n", etag);
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive(req));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304 Not Modified\r\n") == outbuf);
+
+	// changed file does not match old tag
+	Test_FakeHTTPClientPacket_POST("api/lfs/page.css", "body{color:blue}");
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive(req));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200 OK\r\n") == outbuf);
+	SELFTEST_ASSERT(!strcmp(replyAt, "body{color:blue}"));
+
+	// tag of served file is remembered, but write of same size still changes it
+	SELFTEST_ASSERT(Test_GetReplyHeader("ETag", etag, sizeof(etag)));
+	snprintf(req, sizeof(req), "GET /api/lfs/page.css HTTP/1.1\r\nIf-None-Match: %s\r\n\r\n", etag);
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive(req));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304 Not Modified\r\n") == outbuf);
+	CMD_ExecuteCommand("lfs_write page.css body{color:pink}", 0);
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive(req));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200 OK\r\n") == outbuf);
+	SELFTEST_ASSERT(!strcmp(replyAt, "body{color:pink}"));
+
+	// precompressed copy is used when client accepts gzip
+	Test_FakeHTTPClientPacket_POST("api/lfs/page.css.gz", "GZ");
+	SELFTEST_ASSERT(Test_FakeHTTPClientPacket_KeepAlive("GET /api/lfs/page.css HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Encoding: gzip\r\n") != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Type: text/css\r\n") != 0);
+	SELFTEST_ASSERT(!strcmp(replyAt, "GZ"));
+}
+static char g_routeParams[2][32];
+static int g_routeHits;
+static int Test_RouteCallback(http_request_t *request) {
+	g_routeHits++;
+	http_getRouteParam(request, 0, g_routeParams[0], sizeof(g_routeParams[0]));
+	http_getRouteParam(request, 1, g_routeParams[1], sizeof(g_routeParams[1]));
+	http_setup(request, httpMimeTypeText);
+	hprintf255(request, "route %i", request->numRouteParams);
+	poststr(request, NULL);
+	return 0;
+}
+static int Test_RouteCallback2(http_request_t *request) {
+	http_setup(request, httpMimeTypeText);
+	poststr(request, "fixed");
+	poststr(request, NULL);
+	return 0;
+}
+void Test_Http_Routes() {
+	char tmp[8];
+
+	SIM_ClearOBK();
+
+	// built-in pages, with and without query
+	Test_FakeHTTPClientPacket_GET("index?x=1");
+	SELFTEST_ASSERT(strstr(outbuf, "Not found") == 0);
+	Test_FakeHTTPClientPacket_GET("indexx");
+	SELFTEST_ASSERT(strstr(outbuf, "Not found") != 0);
+	Test_FakeHTTPClientPacket_GET("static/nothing.js");
+	SELFTEST_ASSERT(strstr(outbuf, "Not found") != 0);
+	Test_FakeHTTPClientPacket_GET("api/nothing");
+	SELFTEST_ASSERT(strstr(outbuf, "GET of api/nothing") != 0);
+	Test_FakeHTTPClientPacket_GET("api");
+	SELFTEST_ASSERT(strstr(outbuf, "Not found") != 0);
+	// no OTA in simulator
+	Test_FakeHTTPClientPacket_POST("api/ota", "");
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 404") == outbuf);
+	SELFTEST_ASSERT(strstr(replyAt, "OTA not supported") != 0);
+
+	// single channel
+	CMD_ExecuteCommand("setChannel 3 42", 0);
+	Test_FakeHTTPClientPacket_GET("api/channels/3");
+	SELFTEST_ASSERT(!strcmp(replyAt, "{\"3\":42}"));
+	Test_FakeHTTPClientPacket_POST("api/channels/5", "17");
+	SELFTEST_ASSERT(strstr(replyAt, "\"success\":200") != 0);
+	SELFTEST_ASSERT_CHANNEL(5, 17);
+	Test_FakeHTTPClientPacket_GET("api/channels/abc");
+	SELFTEST_ASSERT(strstr(replyAt, "invalid channel") != 0);
+	Test_FakeHTTPClientPacket_GET("api/channels/999");
+	SELFTEST_ASSERT(strstr(replyAt, "invalid channel") != 0);
+
+	// params, more specific segment is preferred, falls back to <name> when it leads nowhere
+	SELFTEST_ASSERT(HTTP_AddRoute("rt/<a>/x/<b*>", HTTP_GET, Test_RouteCallback) == 0);
+	SELFTEST_ASSERT(HTTP_AddRoute("rt/<a>/x/<b*>", HTTP_GET, Test_RouteCallback) == 1);
+	SELFTEST_ASSERT(HTTP_AddRoute("rt/<a>/x/<b*>", HTTP_GET, Test_RouteCallback2) == -5);
+	SELFTEST_ASSERT(HTTP_AddRoute("rt/fixed/y", HTTP_GET, Test_RouteCallback2) == 0);
+	g_routeHits = 0;
+	Test_FakeHTTPClientPacket_GET("rt/foo/x/bar/baz.txt?q=1");
+	SELFTEST_ASSERT(g_routeHits == 1);
+	SELFTEST_ASSERT(!strcmp(g_routeParams[0], "foo"));
+	SELFTEST_ASSERT(!strcmp(g_routeParams[1], "bar/baz.txt"));
+	Test_FakeHTTPClientPacket_GET("rt/fixed/y");
+	SELFTEST_ASSERT(!strcmp(replyAt, "fixed"));
+	Test_FakeHTTPClientPacket_GET("rt/fixed/x/");
+	SELFTEST_ASSERT(g_routeHits == 2);
+	SELFTEST_ASSERT(!strcmp(g_routeParams[0], "fixed"));
+	SELFTEST_ASSERT(!strcmp(g_routeParams[1], ""));
+	// empty segment is not a <name>
+	Test_FakeHTTPClientPacket_GET("rt//x/a");
+	SELFTEST_ASSERT(g_routeHits == 2);
+	// method is part of route
+	Test_FakeHTTPClientPacket_POST("rt/foo/x/bar", "");
+	SELFTEST_ASSERT(g_routeHits == 2);
+
+	// old style registration, trailing slash takes everything below
+	SELFTEST_ASSERT(HTTP_RegisterCallback("/rtold/", HTTP_ANY, Test_RouteCallback) == 0);
+	SELFTEST_ASSERT(HTTP_RegisterCallback("/rtold/", HTTP_ANY, Test_RouteCallback) == 1);
+	Test_FakeHTTPClientPacket_POST("rtold/some/file", "");
+	SELFTEST_ASSERT(g_routeHits == 3);
+	SELFTEST_ASSERT(!strcmp(g_routeParams[0], "some/file"));
+
+	// copy is cut to buffer, full length is returned
+	SELFTEST_ASSERT(HTTP_GetNumRouteNodes() > 30);
+	{
+		http_request_t request;
+		memset(&request, 0, sizeof(request));
+		SELFTEST_ASSERT(HTTP_FindRoute(&request, "rt/abcdefghij/x/1", HTTP_GET) == Test_RouteCallback);
+		SELFTEST_ASSERT(http_getRouteParam(&request, 0, tmp, sizeof(tmp)) == 10);
+		SELFTEST_ASSERT(!strcmp(tmp, "abcdefg"));
+		SELFTEST_ASSERT(http_getRouteParamInteger(&request, 1) == 1);
+		SELFTEST_ASSERT(HTTP_FindRoute(&request, "nothing/here", HTTP_GET) == 0);
+	}
+}
+void Test_Http_ReplyWriter() {
+	http_request_t request;
+	char longArg[300];
+	char *end;
+	int chunkLen;
+	int styleLen;
+
+	memset(&request, 0, sizeof(request));
+	outbuf[0] = 0;
+	request.reply = outbuf;
+	request.replymaxlen = sizeof(outbuf) - 1;
+	request.responseCode = HTTP_RESPONSE_OK;
+	request.bKeepAlive = 1;
+
+	// headers, then body parts framed as one chunk when reply is finished
+	http_setup(&request, httpMimeTypeText);
+	poststr_const(&request, htmlHeadStyle);
+	hprintf255(&request, "<%i>", 42);
+	postany(&request, "end", 3);
+	memset(longArg, 'x', sizeof(longArg) - 1);
+	longArg[sizeof(longArg) - 1] = 0;
+	// formatted text is limited as before
+	hprintf255(&request, "%s", longArg);
+	SELFTEST_ASSERT(HTTP_FinishReply(&request, 0));
+	outbuf[request.replylen] = 0;
+	SELFTEST_ASSERT(strstr(outbuf, "Transfer-Encoding: chunked\r\n") != 0);
+	replyAt = Helper_GetPastHTTPHeader(outbuf);
+	SELFTEST_ASSERT(replyAt != 0);
+	styleLen = strlen(htmlHeadStyle);
+	chunkLen = strtol(replyAt, &end, 16);
+	SELFTEST_ASSERT(chunkLen == styleLen + 4 + 3 + 254);
+	SELFTEST_ASSERT(!strncmp(end, "\r\n", 2));
+	end += 2;
+	SELFTEST_ASSERT(!strncmp(end, htmlHeadStyle, styleLen));
+	SELFTEST_ASSERT(!strncmp(end + styleLen, "<42>endxxx", 10));
+	SELFTEST_ASSERT(!strcmp(end + chunkLen, "\r\n0\r\n\r\n"));
+
+	// empty body is only the last chunk
+	memset(&request, 0, sizeof(request));
+	request.reply = outbuf;
+	request.replymaxlen = sizeof(outbuf) - 1;
+	request.responseCode = HTTP_RESPONSE_OK;
+	request.bKeepAlive = 1;
+	http_setup(&request, httpMimeTypeText);
+	poststr(&request, NULL);
+	SELFTEST_ASSERT(HTTP_FinishReply(&request, 0));
+	outbuf[request.replylen] = 0;
+	replyAt = Helper_GetPastHTTPHeader(outbuf);
+	SELFTEST_ASSERT(replyAt != 0 && !strcmp(replyAt, "0\r\n\r\n"));
+}
 void Test_Http() {
 	Test_Http_SingleRelayOnChannel1();
 	Test_Http_TwoRelays();
@@ -901,6 +1338,13 @@ void Test_Http() {
 	Test_Http_LED_SingleChannel();
 	Test_Http_LED_CW();
 	Test_Http_LED_RGB();
+	Test_Http_KeepAlive();
+	Test_Http_StreamBody();
+	Test_Http_StateDelta();
+	Test_Http_Events();
+	Test_Http_StaticCache();
+	Test_Http_Routes();
+	Test_Http_ReplyWriter();
 }
 
 
@@ -88,10 +88,12 @@ void Test_Demo_FanCyclingRelays();
 void Test_Role_ToggleAll();
 void Test_Demo_SimpleShuttersScript();
 void Test_Commands_Generic();
+int Win_DoBenchmarks(const char *outFileName);
 void Test_ChangeHandlers_MQTT();
 void Test_Commands_Calendar();
 void Test_CFG_Via_HTTP();
 void Test_Demo_ButtonScrollingChannelValues();
+void Test_Logging();
 
 void Test_GetJSONValue_Setup(const char *text);
 void Test_FakeHTTPClientPacket_GET(const char *tg);
@@ -117,9 +119,12 @@ void SIM_SendFakeMQTTAndRunSimFrame_CMND_ViaGroupTopic(const char *command, cons
 void SIM_SendFakeMQTTRawChannelSet(int channelIndex, const char *arguments);
 void SIM_SendFakeMQTTRawChannelSet_ViaGroupTopic(int channelIndex, const char *arguments);
 void SIM_ClearMQTTHistory();
+// NULL or "" to publish everything again
+void SIM_SetMQTTPublishFailTopic(const char *topic);
 bool SIM_CheckMQTTHistoryForString(const char *topic, const char *value, bool bRetain);
 bool SIM_CheckMQTTHistoryForFloat(const char *topic, float value, bool bRetain);
 const char *SIM_GetMQTTHistoryString(const char *topic, bool bPrefixMode);
+int SIM_GetMQTTHistoryQoS(const char *topic);
 bool SIM_BeginParsingMQTTJSON(const char *topic, bool bPrefixMode);
 
 void SIM_SimulateUserClickOnPin(int pin);
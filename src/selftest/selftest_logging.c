@@ -0,0 +1,149 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../logging/logging.h"
+
+static int g_argEvaluations = 0;
+
+static int Test_Logging_CountedArg() {
+	g_argEvaluations++;
+	return 5;
+}
+
+void Test_Logging() {
+	const char *r;
+	char tmp[64];
+	char part[8];
+	int i;
+	int prevLogLevel;
+	unsigned int prevLogFeatures;
+
+	// reset whole device
+	SIM_ClearOBK();
+
+	// drain whatever was logged before
+	Test_FakeHTTPClientPacket_GET("lograw");
+
+	addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "LogTest first line");
+	addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "LogTest second line\n");
+	Test_FakeHTTPClientPacket_GET("lograw");
+	r = Test_GetLastHTMLReply();
+	SELFTEST_ASSERT(strstr(r, "LogTest first line\r\nLogTest second line\r\n") != 0);
+
+	// it was already read by http sink
+	Test_FakeHTTPClientPacket_GET("lograw");
+	r = Test_GetLastHTMLReply();
+	SELFTEST_ASSERT(strstr(r, "LogTest first line") == 0);
+
+	// write much more than ring size, reader lags and must skip old data
+	for (i = 0; i < 300; i++) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "LogTest line %03i abcdefghijklmnopqrstuvwxyz", i);
+	}
+	Test_FakeHTTPClientPacket_GET("lograw");
+	r = Test_GetLastHTMLReply();
+	SELFTEST_ASSERT(strstr(r, "LogTest line 000 ") == 0);
+	SELFTEST_ASSERT(strstr(r, "LogTest line 250 abcdefghijklmnopqrstuvwxyz\r\nLogTest line 251 ") != 0);
+	SELFTEST_ASSERT(strstr(r, "LogTest line 299 abcdefghijklmnopqrstuvwxyz\r\n") != 0);
+	SELFTEST_ASSERT(strlen(r) <= 4096);
+
+	// lines written across ring end must come out whole and in order
+	for (i = 0; i < 50; i++) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "LogTest wrap %03i", i);
+		if (i % 7 == 6) {
+			Test_FakeHTTPClientPacket_GET("lograw");
+			r = Test_GetLastHTMLReply();
+			snprintf(tmp, sizeof(tmp), "LogTest wrap %03i\r\n", i);
+			SELFTEST_ASSERT(strstr(r, tmp) != 0);
+			snprintf(tmp, sizeof(tmp), "LogTest wrap %03i\r\nLogTest wrap %03i\r\n", i - 1, i);
+			SELFTEST_ASSERT(strstr(r, tmp) != 0);
+		}
+	}
+
+	// binary logging, text is made only when log is read
+	CMD_ExecuteCommand("logbinary 1", 0);
+	Test_FakeHTTPClientPacket_GET("lograw");
+	strcpy(tmp, "original");
+	addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "LogBin %i|%5d|%-4s|%.2f|%x|%c|%%|%*d|%lu|%s", -12, 42, "ab", 3.14159f, 255, 'Z', 4, 7, 123456lu, tmp);
+	// string is copied at call time
+	strcpy(tmp, "changed");
+	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, "LogBin prefixed %s", "x");
+	addLogAdv(LOG_DEBUG, LOG_FEATURE_CMD, "LogBin not shown at this level");
+	Test_FakeHTTPClientPacket_GET("lograw");
+	r = Test_GetLastHTMLReply();
+	SELFTEST_ASSERT(strstr(r, "LogBin -12|   42|ab  |3.14|ff|Z|%|   7|123456|original\r\n") != 0);
+	SELFTEST_ASSERT(strstr(r, "Info:CMD:LogBin prefixed x\r\n") != 0);
+	SELFTEST_ASSERT(strstr(r, "LogBin not shown") == 0);
+
+	// precision limits how much of string is read, it may be not terminated
+	memcpy(part, "topicXYZ", sizeof(part));
+	addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "LogBin part %.*s|%.3s|%.*s", 5, part, part, -1, "all");
+	Test_FakeHTTPClientPacket_GET("lograw");
+	r = Test_GetLastHTMLReply();
+	SELFTEST_ASSERT(strstr(r, "LogBin part topic|top|all\r\n") != 0);
+
+	// caller's buffer used as format is copied at call time as well
+	snprintf(tmp, sizeof(tmp), "LogBin buffer %s %%i", "fmt");
+	addLogAdv(LOG_INFO, LOG_FEATURE_RAW, tmp, 7);
+	strcpy(tmp, "garbage");
+	Test_FakeHTTPClientPacket_GET("lograw");
+	r = Test_GetLastHTMLReply();
+	SELFTEST_ASSERT(strstr(r, "LogBin buffer fmt 7\r\n") != 0);
+
+	// when nobody reads, newest records are dropped and that is reported
+	for (i = 0; i < 200; i++) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "LogBin flood %i %s", i, "abcdefghijklmnopqrstuvwxyz");
+	}
+	Test_FakeHTTPClientPacket_GET("lograw");
+	r = Test_GetLastHTMLReply();
+	SELFTEST_ASSERT(strstr(r, "LogBin flood 0 abcdefghijklmnopqrstuvwxyz\r\nLogBin flood 1 ") != 0);
+	SELFTEST_ASSERT(strstr(r, "LogBin flood 199 ") == 0);
+	SELFTEST_ASSERT(strstr(r, "^ binary log full") != 0);
+
+	CMD_ExecuteCommand("logbinary 0", 0);
+	addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "LogText again %i", 5);
+	Test_FakeHTTPClientPacket_GET("lograw");
+	r = Test_GetLastHTMLReply();
+	SELFTEST_ASSERT(strstr(r, "LogText again 5\r\n") != 0);
+
+	// disabled sites don't evaluate their arguments, but are counted
+	prevLogLevel = loglevel;
+	prevLogFeatures = logfeatures;
+	CMD_ExecuteCommand("logstats reset", 0);
+	SELFTEST_ASSERT(g_logSuppressed[LOG_FEATURE_GENERAL] == 0);
+	CMD_ExecuteCommand("loglevel 3", 0);
+	ADDLOG_DEBUG(LOG_FEATURE_GENERAL, "LogTest counted %i", Test_Logging_CountedArg());
+	ADDLOG_EXTRADEBUG(LOG_FEATURE_GENERAL, "LogTest counted %i", Test_Logging_CountedArg());
+	SELFTEST_ASSERT(g_argEvaluations == 0);
+	SELFTEST_ASSERT(g_logSuppressed[LOG_FEATURE_GENERAL] == 2);
+	SELFTEST_ASSERT(g_logEmitted[LOG_FEATURE_GENERAL] == 0);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "LogTest counted %i", Test_Logging_CountedArg());
+	SELFTEST_ASSERT(g_argEvaluations == 1);
+	SELFTEST_ASSERT(g_logEmitted[LOG_FEATURE_GENERAL] == 1);
+	SELFTEST_ASSERT(g_logEmittedBytes[LOG_FEATURE_GENERAL] == strlen("Info:GEN:LogTest counted 5\r\n"));
+	// feature filter, LFS is turned off for this test
+	CMD_ExecuteCommand("logfeature 9 0", 0);
+	ADDLOG_ERROR(LOG_FEATURE_LFS, "LogTest counted %i", Test_Logging_CountedArg());
+	SELFTEST_ASSERT(g_argEvaluations == 1);
+	SELFTEST_ASSERT(g_logSuppressed[LOG_FEATURE_LFS] == 1);
+	// direct calls are filtered and counted inside
+	addLogAdv(LOG_DEBUG, LOG_FEATURE_GENERAL, "LogTest direct");
+	SELFTEST_ASSERT(g_logSuppressed[LOG_FEATURE_GENERAL] == 3);
+
+	Test_FakeHTTPClientPacket_GET("lograw");
+	CMD_ExecuteCommand("logstats", 0);
+	Test_FakeHTTPClientPacket_GET("lograw");
+	r = Test_GetLastHTMLReply();
+	SELFTEST_ASSERT(strstr(r, "GEN: emitted 1 (28 bytes), suppressed 3") != 0);
+
+	// features out of range are dropped, not counted
+	ADDLOG_ERROR(LOG_FEATURE_COUNTERS + 3, "LogTest counted %i", Test_Logging_CountedArg());
+	addLogAdv(LOG_ERROR, -1, "LogTest out of range");
+	SELFTEST_ASSERT(g_argEvaluations == 1);
+	SELFTEST_ASSERT(g_logSuppressed[3] == 0);
+
+	// undo 'loglevel 3' and 'logfeature 9 0' for tests that follow
+	loglevel = prevLogLevel;
+	logfeatures = prevLogFeatures;
+}
+
+#endif
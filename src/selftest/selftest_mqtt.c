@@ -2,6 +2,10 @@
 
 #include "selftest_local.h"
 #include "../hal/hal_wifi.h"
+#include "../mqtt/new_mqtt.h"
+
+extern int g_bPublishAllStatesNow;
+extern int g_MqttPublishItemsQueued;
 
 void SIM_ClearAndPrepareForMQTTTesting(const char *clientName, const char *groupName) {
 	SIM_ClearOBK();
@@ -280,6 +284,340 @@ void Test_MQTT_Misc() {
 	//SELFTEST_ASSERT_HAD_MQTT_PUBLISH_FLOAT("miscDevice/thirdTest/get", (314*0.01f+100), false);
 	//SIM_ClearMQTTHistory();
 }
+void Test_MQTT_ReceiveQueue() {
+	char topic[64];
+	char *big;
+	int i, dropsBefore;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("rxDevice", "bekens");
+
+	// burst - many publishes queued before they are processed
+	for (i = 0; i < 10; i++) {
+		snprintf(topic, sizeof(topic), "rxDevice/%i/set", i + 1);
+		MQTT_Post_Received_Str(topic, va("%i", 100 + i));
+	}
+	Sim_RunFrames(1, false);
+	for (i = 0; i < 10; i++) {
+		SELFTEST_ASSERT_CHANNEL(i + 1, 100 + i);
+	}
+
+	// payload is NUL terminated even if it's not in source data
+	MQTT_Post_Received("rxDevice/2/set", strlen("rxDevice/2/set"), (const unsigned char*)"55xyz", 2);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(2, 55);
+
+	// big payload, longer than old 2048 temp buffer
+	big = (char*)malloc(3000);
+	strcpy(big, "setChannel 3 77; echo ");
+	memset(big + strlen(big), 'a', 2900);
+	big[2950] = 0;
+	MQTT_Post_Received_Str("cmnd/rxDevice/backlog", big);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(3, 77);
+
+	// more than storage can hold - later ones are dropped and counted,
+	// and queue works normally after it's drained
+	dropsBefore = MQTT_GetReceiveDropCounter();
+	for (i = 0; i < 3; i++) {
+		MQTT_Post_Received_Str("cmnd/rxDevice/backlog", big);
+	}
+	SELFTEST_ASSERT(MQTT_GetReceiveDropCounter() == dropsBefore + 1);
+	Sim_RunFrames(1, false);
+	// wraps around the end of storage
+	for (i = 0; i < 40; i++) {
+		MQTT_Post_Received_Str("rxDevice/4/set", va("%i", i));
+		MQTT_Post_Received_Str("cmnd/rxDevice/backlog", big);
+		Sim_RunFrames(1, false);
+		SELFTEST_ASSERT_CHANNEL(4, i);
+	}
+	SELFTEST_ASSERT(MQTT_GetReceiveDropCounter() == dropsBefore + 1);
+	free(big);
+}
+static int g_routeCalls = 0;
+static char g_routeWildcards[64];
+static int Test_MQTT_RouteCallback(obk_mqtt_request_t* request) {
+	int i;
+
+	g_routeCalls++;
+	g_routeWildcards[0] = 0;
+	for (i = 0; i < request->numWildcards; i++) {
+		snprintf(g_routeWildcards + strlen(g_routeWildcards), sizeof(g_routeWildcards) - strlen(g_routeWildcards),
+			"[%.*s]", request->wildcardLen[i], request->wildcard[i]);
+	}
+	return 1;
+}
+// lets others get the topic too
+static int Test_MQTT_RouteCallbackPass(obk_mqtt_request_t* request) {
+	Test_MQTT_RouteCallback(request);
+	return 0;
+}
+void Test_MQTT_TopicRouting() {
+	const char *multi[] = { "routeDevice/#", "routeDevice/+/x", "routeDevice/multi/#", "routeDevice/multi/+",
+		"routeDevice/+/+", "+/multi/x", "routeDevice/multi/x" };
+	int i;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("routeDevice", "bekens");
+
+	// '+' takes one level only
+	MQTT_Post_Received_Str("routeDevice/5/set", "12");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(5, 12);
+	MQTT_Post_Received_Str("routeDevice/5/set/more", "13");
+	MQTT_Post_Received_Str("routeDevice/5/6/set", "14");
+	MQTT_Post_Received_Str("routeDeviceX/5/set", "15");
+	MQTT_Post_Received_Str("otherDevice/5/set", "16");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(5, 12);
+	// group topic
+	MQTT_Post_Received_Str("bekens/5/set", "17");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(5, 17);
+
+	// custom callback with '#', it also matches parent level
+	g_routeCalls = 0;
+	MQTT_RegisterCallback("routeDevice/custom/", "routeDevice/custom/#", 20, Test_MQTT_RouteCallback);
+	MQTT_Post_Received_Str("routeDevice/custom", "");
+	MQTT_Post_Received_Str("routeDevice/custom/a/b/c", "");
+	MQTT_Post_Received_Str("routeDevice/customX", "");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(g_routeCalls == 2);
+
+	// registering same ID again replaces callback
+	MQTT_RegisterCallback("routeDevice/", "routeDevice/+/x/+", 20, Test_MQTT_RouteCallback);
+	g_routeCalls = 0;
+	MQTT_Post_Received_Str("routeDevice/custom/a", "");
+	MQTT_Post_Received_Str("routeDevice/abc/x/def", "");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(g_routeCalls == 1);
+	SELFTEST_ASSERT_STRING(g_routeWildcards, "[abc][def]");
+
+	// removed callback is not routed, and builtin ones still work
+	MQTT_RemoveCallback(20);
+	g_routeCalls = 0;
+	MQTT_Post_Received_Str("routeDevice/abc/x/def", "");
+	MQTT_Post_Received_Str("routeDevice/6/set", "21");
+	MQTT_Post_Received_Str("cmnd/routeDevice/setChannel", "7 22");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(g_routeCalls == 0);
+	SELFTEST_ASSERT_CHANNEL(6, 21);
+	SELFTEST_ASSERT_CHANNEL(7, 22);
+
+	// many subscriptions matching one topic all get it
+	for (i = 0; i < sizeof(multi) / sizeof(multi[0]); i++) {
+		MQTT_RegisterCallback("routeDevice/", multi[i], 30 + i, Test_MQTT_RouteCallbackPass);
+	}
+	g_routeCalls = 0;
+	MQTT_Post_Received_Str("routeDevice/multi/x", "");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(g_routeCalls == sizeof(multi) / sizeof(multi[0]));
+	for (i = 0; i < sizeof(multi) / sizeof(multi[0]); i++) {
+		MQTT_RemoveCallback(30 + i);
+	}
+}
+void Test_MQTT_PublishBatch() {
+	char *big;
+	int i;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("batchDevice", "bekens");
+	SIM_ClearMQTTHistory();
+
+	// default QoS is 2, it can be chosen per publish
+	MQTT_Publish("batchDevice", "a", "1", 0);
+	MQTT_Publish("batchDevice", "b", "2", OBK_PUBLISH_FLAG_QOS_ZERO);
+	MQTT_Publish("batchDevice", "c", "3", OBK_PUBLISH_FLAG_QOS_ONE);
+	MQTT_PublishTele("d", "4");
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("batchDevice/a") == 2);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("batchDevice/b") == 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("batchDevice/c") == 1);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("tele/batchDevice/d") == 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/batchDevice/d", "4", false);
+
+	// publishes are collected until batch is closed or full
+	SIM_ClearMQTTHistory();
+	SELFTEST_ASSERT(MQTT_BeginPublishBatch());
+	for (i = 0; i < 20; i++) {
+		SELFTEST_ASSERT(MQTT_Publish("batchDevice", va("item%i", i), va("%i", i * 3), 0) == OBK_PUBLISH_OK);
+	}
+	// other topic in the middle of batch
+	MQTT_Publish("other/device", "x", "y", OBK_PUBLISH_FLAG_RETAIN);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/item0", "0", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("batchDevice/item19") == -1);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("other/device/x") == -1);
+	MQTT_EndPublishBatch();
+	for (i = 0; i < 20; i++) {
+		SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR(va("batchDevice/item%i", i), va("%i", i * 3), false);
+	}
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("other/device/x", "y", true);
+
+	// big value is not copied, it's sent right away together with batch
+	big = (char*)malloc(1501);
+	memset(big, 'b', 1500);
+	big[1500] = 0;
+	SIM_ClearMQTTHistory();
+	SELFTEST_ASSERT(MQTT_BeginPublishBatch());
+	MQTT_Publish("batchDevice", "small", "s", 0);
+	MQTT_Publish("batchDevice", "big", big, 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/small", "s", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/big", big, false);
+	MQTT_EndPublishBatch();
+	free(big);
+
+	// full state broadcast goes through batch
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("publishAll", 0);
+	for (i = 0; i < 10; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDevice/host", CFG_GetShortDeviceName(), false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("batchDevice/host") == 0);
+}
+void Test_MQTT_Deduper() {
+	int i;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("ddDevice", "bekens");
+
+	CMD_ExecuteCommand("mqtt_dedup power 1.5 10", 0);
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringFloat("power", 100.0f);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_FLOAT("ddDevice/power/get", 100.0f, false);
+	MQTT_Dedup_Tick();
+	MQTT_Dedup_Tick();
+
+	// jitter within delta is not published
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringFloat("power", 100.4f);
+	MQTT_PublishMain_StringFloat("power", 98.6f);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("ddDevice/power/get") == -1);
+	// real change is
+	MQTT_PublishMain_StringFloat("power", 102.0f);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_FLOAT("ddDevice/power/get", 102.0f, false);
+
+	// too fast change is delayed, and latest value is sent by tick
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringFloat("power", 110.0f);
+	MQTT_PublishMain_StringFloat("power", 120.0f);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("ddDevice/power/get") == -1);
+	MQTT_Dedup_Tick();
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("ddDevice/power/get") == -1);
+	MQTT_Dedup_Tick();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_FLOAT("ddDevice/power/get", 120.0f, false);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForFloat("ddDevice/power/get", 110.0f, false));
+
+	// same value is republished after expire time
+	for (i = 0; i < 5; i++) {
+		MQTT_Dedup_Tick();
+	}
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringFloat("power", 120.5f);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("ddDevice/power/get") == -1);
+	for (i = 0; i < 10; i++) {
+		MQTT_Dedup_Tick();
+	}
+	MQTT_PublishMain_StringFloat("power", 120.5f);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_FLOAT("ddDevice/power/get", 120.5f, false);
+
+	// ints with zero delta, names that are not configured are not deduped
+	CMD_ExecuteCommand("mqtt_dedup battery 0", 0);
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringInt("battery", 50);
+	MQTT_PublishMain_StringInt("voltage", 3);
+	MQTT_Dedup_Tick();
+	MQTT_Dedup_Tick();
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringInt("battery", 50);
+	MQTT_PublishMain_StringInt("voltage", 3);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("ddDevice/battery/get") == -1);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("ddDevice/voltage/get", "3", false);
+	MQTT_PublishMain_StringInt("battery", 49);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("ddDevice/battery/get", "49", false);
+
+	// configuration is removed by clearAll
+	CMD_ExecuteCommand("clearAll", 0);
+	SELFTEST_ASSERT(!MQTT_Dedup_IsConfigured("power"));
+}
+void Test_MQTT_PublishQueue() {
+	int i, dropsBefore, coalescedBefore;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("queueDevice", "bekens");
+	CMD_ExecuteCommand("mqtt_publishQueueSize 4", 0);
+	SIM_ClearMQTTHistory();
+
+	dropsBefore = MQTT_GetPublishQueueDropCounter();
+	coalescedBefore = MQTT_GetPublishQueueCoalescedCounter();
+	for (i = 0; i < 6; i++) {
+		MQTT_QueuePublish("queueDevice", va("q%i", i), va("%i", i), 0);
+	}
+	// two didn't fit
+	SELFTEST_ASSERT(MQTT_GetPublishQueueDropCounter() == dropsBefore + 2);
+	SELFTEST_ASSERT(MQTT_GetPublishQueuePeak() >= 4);
+	// full, but same topic is already queued, so it's replaced
+	MQTT_QueuePublish("queueDevice", "q1", "new", 0);
+	SELFTEST_ASSERT(MQTT_GetPublishQueueCoalescedCounter() == coalescedBefore + 1);
+	SELFTEST_ASSERT(MQTT_GetPublishQueueDropCounter() == dropsBefore + 2);
+	// size can't be changed while items are waiting
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_publishQueueSize 8", 0) == CMD_RES_ERROR);
+
+	// MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE per call, in order
+	PublishQueuedItems();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/q0", "0", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/q1", "new", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/q2", "2", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("queueDevice/q3") == -1);
+	// wraps around
+	MQTT_QueuePublish("queueDevice", "q6", "6", 0);
+	MQTT_QueuePublish("queueDevice", "q7", "7", 0);
+	PublishQueuedItems();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/q3", "3", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/q6", "6", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/q7", "7", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("queueDevice/q4") == -1);
+	SELFTEST_ASSERT(MQTT_GetPublishQueueDropCounter() == dropsBefore + 2);
+	while (g_MqttPublishItemsQueued > 0) {
+		PublishQueuedItems();
+	}
+
+	// command goes to the item publish was merged into, not to the tail
+	for (i = 0; i < 4; i++) {
+		MQTT_QueuePublish("queueDevice", va("c%i", i), va("%i", i), 0);
+	}
+	MQTT_QueuePublish("queueDevice", "c1", "new", 0);
+	g_bPublishAllStatesNow = 0;
+	MQTT_InvokeCommandAtEnd(PublishChannels);
+	// c0, c1 and c2 are published, c1 starts channels publish
+	PublishQueuedItems();
+	SELFTEST_ASSERT(g_bPublishAllStatesNow == 1);
+	g_bPublishAllStatesNow = 0;
+	PublishQueuedItems();
+	SELFTEST_ASSERT(g_bPublishAllStatesNow == 0);
+	// nothing queued, nothing to attach to
+	MQTT_InvokeCommandAtEnd(PublishChannels);
+
+	// only items that were sent are dequeued, and only they run their command
+	MQTT_QueuePublish("queueDevice", "f0", "0", 0);
+	MQTT_QueuePublishWithCommand("queueDevice", "f1", "1", 0, PublishChannels);
+	MQTT_QueuePublish("queueDevice", "f2", "2", 0);
+	SIM_SetMQTTPublishFailTopic("queueDevice/f1");
+	PublishQueuedItems();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/f0", "0", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/f2", "2", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("queueDevice/f1") == -1);
+	SELFTEST_ASSERT(g_MqttPublishItemsQueued == 1);
+	SELFTEST_ASSERT(g_bPublishAllStatesNow == 0);
+	SIM_SetMQTTPublishFailTopic(0);
+	SIM_ClearMQTTHistory();
+	PublishQueuedItems();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDevice/f1", "1", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("queueDevice/f0") == -1);
+	SELFTEST_ASSERT(g_MqttPublishItemsQueued == 0);
+	SELFTEST_ASSERT(g_bPublishAllStatesNow == 1);
+	g_bPublishAllStatesNow = 0;
+	SELFTEST_ASSERT(CMD_ExecuteCommand(va("mqtt_publishQueueSize %i", MQTT_MAX_QUEUE_SIZE), 0) == CMD_RES_OK);
+}
 void Test_MQTT_Topic_With_Slashes() {
 	SIM_ClearOBK();
 	SIM_ClearAndPrepareForMQTTTesting("obk/kitchen/mySwitch1", "bekens");
@@ -411,6 +749,11 @@ void Test_MQTT(){
 	Test_MQTT_LED_RGB();
 	Test_MQTT_Topic_With_Slash();
 	Test_MQTT_Topic_With_Slashes();
+	Test_MQTT_ReceiveQueue();
+	Test_MQTT_TopicRouting();
+	Test_MQTT_PublishBatch();
+	Test_MQTT_Deduper();
+	Test_MQTT_PublishQueue();
 }
 
 #endif
@@ -3,6 +3,9 @@
 #include "selftest_local.h".
 
 void Test_RepeatingEvents() {
+	char buffer[64];
+	int i;
+
 	// reset whole device
 	SIM_ClearOBK();
 	SELFTEST_ASSERT_CHANNEL(10, 0);
@@ -20,6 +23,59 @@ void Test_RepeatingEvents() {
 	SELFTEST_ASSERT_CHANNEL(11, 2);
 	Sim_RunSeconds(6.0f, false);
 	SELFTEST_ASSERT_CHANNEL(11, 2);
+	SELFTEST_ASSERT_EXPRESSION("$activeRepeatingEvents", 0);
+
+	// events with different intervals, canceled by ID
+	CMD_ExecuteCommand("addRepeatingEventID 1 -1 100 addChannel 12 1", 0);
+	CMD_ExecuteCommand("addRepeatingEventID 3 -1 200 addChannel 13 1", 0);
+	CMD_ExecuteCommand("addRepeatingEventID 0.5 -1 300 addChannel 14 1", 0);
+	SELFTEST_ASSERT_EXPRESSION("$activeRepeatingEvents", 3);
+	Sim_RunSeconds(6.2f, false);
+	SELFTEST_ASSERT_CHANNEL(12, 6);
+	SELFTEST_ASSERT_CHANNEL(13, 2);
+	SELFTEST_ASSERT_CHANNEL(14, 12);
+	CMD_ExecuteCommand("cancelRepeatingEvent 200", 0);
+	SELFTEST_ASSERT_EXPRESSION("$activeRepeatingEvents", 2);
+	Sim_RunSeconds(3.0f, false);
+	SELFTEST_ASSERT_CHANNEL(12, 9);
+	SELFTEST_ASSERT_CHANNEL(13, 2);
+	SELFTEST_ASSERT_CHANNEL(14, 18);
+	CMD_ExecuteCommand("cancelRepeatingEvent 100", 0);
+	CMD_ExecuteCommand("cancelRepeatingEvent 300", 0);
+	SELFTEST_ASSERT_EXPRESSION("$activeRepeatingEvents", 0);
+	Sim_RunSeconds(3.0f, false);
+	SELFTEST_ASSERT_CHANNEL(12, 9);
+	SELFTEST_ASSERT_CHANNEL(14, 18);
+
+	// event can cancel itself from its own command
+	CMD_ExecuteCommand("addRepeatingEventID 1 -1 400 backlog addChannel 15 1; if $CH15>=3 then cancelRepeatingEvent 400", 0);
+	Sim_RunSeconds(10.0f, false);
+	SELFTEST_ASSERT_CHANNEL(15, 3);
+	SELFTEST_ASSERT_EXPRESSION("$activeRepeatingEvents", 0);
+
+	// and can be cleared while running
+	CMD_ExecuteCommand("addRepeatingEvent 1 -1 backlog addChannel 16 1; clearRepeatingEvents", 0);
+	CMD_ExecuteCommand("addRepeatingEvent 5 -1 addChannel 17 1", 0);
+	Sim_RunSeconds(3.0f, false);
+	SELFTEST_ASSERT_CHANNEL(16, 1);
+	SELFTEST_ASSERT_CHANNEL(17, 0);
+	SELFTEST_ASSERT_EXPRESSION("$activeRepeatingEvents", 0);
+	SELFTEST_ASSERT(RepeatingEvents_GetCommandCount() == 0);
+
+	// texts of finished one-shot events are freed while a forever event stays alive
+	CMD_ExecuteCommand("addRepeatingEventID 1 -1 500 addChannel 18 1", 0);
+	for (i = 0; i < 50; i++) {
+		sprintf(buffer, "addRepeatingEvent 0.5 1 setChannel 19 %i", i);
+		CMD_ExecuteCommand(buffer, 0);
+		Sim_RunSeconds(1.0f, false);
+		SELFTEST_ASSERT(RepeatingEvents_GetCommandCount() == 1);
+	}
+	SELFTEST_ASSERT_CHANNEL(19, 49);
+	// same text is shared
+	CMD_ExecuteCommand("addRepeatingEventID 1 -1 500 addChannel 18 1", 0);
+	SELFTEST_ASSERT(RepeatingEvents_GetCommandCount() == 1);
+	CMD_ExecuteCommand("cancelRepeatingEvent 500", 0);
+	SELFTEST_ASSERT(RepeatingEvents_GetCommandCount() == 0);
 }
 
 
@@ -28,6 +28,28 @@ const char *demo_loop_3 =
 "    if $CH20>0 then goto again\r\n"
 "    setChannel 0 0\r\n";
 
+const char *demo_loop_4 =
+"// comments, empty lines and labels are skipped by compiler\r\n"
+"setChannel 10 0\r\n"
+"\r\n"
+"goto skip\r\n"
+"setChannel 11 111\r\n"
+"skip:\r\n"
+"again:\r\n"
+"    addChannel 10 1\r\n"
+"    delay_ms 100\r\n"
+"    if $CH10<5 then goto again\r\n"
+"    setChannel 12 222\r\n";
+
+const char *demo_waitFor =
+"setChannel 2 0\r\n"
+"waitFor Channel1 1\r\n"
+"setChannel 2 111\r\n"
+"waitFor MQTTState\r\n"
+"setChannel 3 222\r\n"
+"waitFor OnClick 5\r\n"
+"setChannel 4 333\r\n";
+
 void Test_Scripting_Loop1() {
 	char buffer[64];
 
@@ -108,10 +130,92 @@ void Test_Scripting_Loop3() {
 	SELFTEST_ASSERT_CHANNEL(20, 0);
 	//system("pause");
 }
+void Test_Scripting_Loop4() {
+	// reset whole device
+	SIM_ClearOBK();
+	CMD_ExecuteCommand("lfs_format", 0);
+
+	// put file in LittleFS
+	Test_FakeHTTPClientPacket_POST("api/lfs/demo_loop_4.txt", demo_loop_4);
+
+	CMD_ExecuteCommand("startScript demo_loop_4.txt", 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 1);
+	// first iteration is done at once, then it sleeps for 100ms
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(10, 1);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 1);
+	Sim_RunSeconds(1, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(10, 5);
+	// must have been skipped by goto
+	SELFTEST_ASSERT_CHANNEL(11, 0);
+	SELFTEST_ASSERT_CHANNEL(12, 222);
+}
+void Test_Scripting_WaitFor() {
+	// reset whole device
+	SIM_ClearOBK();
+	CMD_ExecuteCommand("lfs_format", 0);
+
+	Test_FakeHTTPClientPacket_POST("api/lfs/demo_waitFor.txt", demo_waitFor);
+
+	CMD_ExecuteCommand("startScript demo_waitFor.txt * 12", 0);
+	// second copy will be stopped while waiting
+	CMD_ExecuteCommand("startScript demo_waitFor.txt * 13", 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 2);
+	Sim_RunFrames(5, false);
+	// both are parked on channel 1
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 2);
+	SELFTEST_ASSERT_CHANNEL(2, 0);
+	CMD_ExecuteCommand("stopScript 13", 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 1);
+	// wrong value does not wake it
+	CHANNEL_Set(1, 2, 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_CHANNEL(2, 0);
+	CHANNEL_Set(1, 1, 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_CHANNEL(2, 111);
+	SELFTEST_ASSERT_CHANNEL(3, 0);
+	// any MQTT state will do, no argument was given
+	EventHandlers_FireEvent(CMD_EVENT_MQTT_STATE, 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_CHANNEL(3, 222);
+	// click on other pin is ignored
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 4);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_CHANNEL(4, 0);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 5);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_CHANNEL(4, 333);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+
+	// waitFor outside of a script is an error
+	SELFTEST_ASSERT(CMD_ExecuteCommand("waitFor Channel1", 0) != CMD_RES_OK);
+}
+void Test_Scripting_CommandsReloaded() {
+	// reset whole device
+	SIM_ClearOBK();
+	CMD_ExecuteCommand("lfs_format", 0);
+
+	Test_FakeHTTPClientPacket_POST("api/lfs/demo_waitFor.txt", demo_waitFor);
+
+	CMD_ExecuteCommand("startScript demo_waitFor.txt", 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_CHANNEL(2, 0);
+	// commands are freed and registered again while script waits,
+	// so command pointers resolved at load time are stale now
+	Main_Init();
+	CHANNEL_Set(1, 1, 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_CHANNEL(2, 111);
+}
 void Test_Scripting() {
 	Test_Scripting_Loop1();
 	Test_Scripting_Loop2();
 	Test_Scripting_Loop3();
+	Test_Scripting_Loop4();
+	Test_Scripting_WaitFor();
+	Test_Scripting_CommandsReloaded();
 }
 
 #endif
@@ -2,7 +2,21 @@
 
 #include "selftest_local.h".
 
+static volatile int g_tokenizerThreadArgs;
+
+static DWORD WINAPI Test_Tokenizer_OtherThread(LPVOID arg) {
+	Tokenizer_TokenizeString("other thread", 0);
+	g_tokenizerThreadArgs = Tokenizer_GetArgsCount();
+	return 0;
+}
+static DWORD WINAPI Test_Tokenizer_CommandThread(LPVOID arg) {
+	CMD_ExecuteCommand(va("backlog setChannel 3 %i; addChannel 3 1", (int)(size_t)arg), 0);
+	g_tokenizerThreadArgs = 1;
+	return 0;
+}
 void Test_Tokenizer() {
+	int pooled, i;
+
 	// reset whole device
 	SIM_ClearOBK();
 
@@ -107,6 +121,73 @@ void Test_Tokenizer() {
 	SELFTEST_ASSERT_ARGUMENT_INTEGER(3, 4);
 	SELFTEST_ASSERT_ARGUMENT_INTEGER(4, 77);// $CH3
 
+	// constants are not cached, value follows the channel
+	CHANNEL_Set(1, 56, 0);
+	SELFTEST_ASSERT_ARGUMENT_INTEGER(0, 56); // $CH1
+	// plain values are parsed once, then cached
+	Tokenizer_TokenizeString("12 2*3 1.5 0x10", 0);
+	SELFTEST_ASSERT_ARGUMENT_INTEGER(0, 12);
+	SELFTEST_ASSERT_ARGUMENT_INTEGER(0, 12);
+	SELFTEST_ASSERT_ARGUMENT_INTEGER(1, 6);
+	SELFTEST_ASSERT_FLOATCOMPARE(Tokenizer_GetArgFloat(2), 1.5f);
+	SELFTEST_ASSERT_FLOATCOMPARE(Tokenizer_GetArgFloat(2), 1.5f);
+	SELFTEST_ASSERT_ARGUMENT_INTEGER(3, 16);
+	// out of range arguments
+	SELFTEST_ASSERT_ARGUMENT_INTEGER(4, 0);
+	SELFTEST_ASSERT(Tokenizer_GetArgFrom(4) == 0);
+
+	// caller-owned context is not affected by the default one
+	{
+		tokenizer_t tok;
+
+		TokenizerCtx_TokenizeString(&tok, "first 10 second", 0);
+		Tokenizer_TokenizeString("other 20", 0);
+		SELFTEST_ASSERT(TokenizerCtx_GetArgsCount(&tok) == 3);
+		SELFTEST_ASSERT_STRING(TokenizerCtx_GetArg(&tok, 0), "first");
+		SELFTEST_ASSERT(TokenizerCtx_GetArgInteger(&tok, 1) == 10);
+		SELFTEST_ASSERT_STRING(TokenizerCtx_GetArgFrom(&tok, 2), "second");
+		SELFTEST_ASSERT_ARGUMENTS_COUNT(2);
+		SELFTEST_ASSERT_ARGUMENT_INTEGER(1, 20);
+	}
+
+	// nested commands don't overwrite arguments of outer command
+	CMD_ExecuteCommand("setChannel 2 0", 0);
+	CMD_ExecuteCommand("if 1 then \"backlog setChannel 2 5; addChannel 2 3\" else \"setChannel 2 100\"", 0);
+	SELFTEST_ASSERT_CHANNEL(2, 8);
+	CMD_ExecuteCommand("alias nested_test if $CH2>5 then \"addChannel 2 10\"", 0);
+	CMD_ExecuteCommand("backlog nested_test; addChannel 2 1", 0);
+	SELFTEST_ASSERT_CHANNEL(2, 19);
+
+	// other task has its own context
+	Tokenizer_TokenizeString("main task 1 2", 0);
+	g_tokenizerThreadArgs = -1;
+	CreateThread(NULL, 0, Test_Tokenizer_OtherThread, NULL, 0, NULL);
+	for (int i = 0; i < 10000 && g_tokenizerThreadArgs < 0; i++) {
+		Sleep(1);
+	}
+	SELFTEST_ASSERT(g_tokenizerThreadArgs == 2);
+	SELFTEST_ASSERT_ARGUMENTS_COUNT(4);
+	SELFTEST_ASSERT_STRING(Tokenizer_GetArg(1), "task");
+
+	// contexts are given back, nesting again does not need more
+	CMD_ExecuteCommand("backlog nested_test; addChannel 2 1", 0);
+	pooled = CMD_GetNumPooledTokenizers();
+	for (i = 0; i < 10; i++) {
+		CMD_ExecuteCommand("backlog nested_test; addChannel 2 1", 0);
+	}
+	SELFTEST_ASSERT(CMD_GetNumPooledTokenizers() == pooled);
+
+	// more tasks than slots, later ones share state while their command runs
+	for (i = 0; i < 24; i++) {
+		g_tokenizerThreadArgs = -1;
+		CreateThread(NULL, 0, Test_Tokenizer_CommandThread, (LPVOID)(size_t)(i * 10), 0, NULL);
+		for (int j = 0; j < 10000 && g_tokenizerThreadArgs < 0; j++) {
+			Sleep(1);
+		}
+		SELFTEST_ASSERT_CHANNEL(3, i * 10 + 1);
+	}
+	SELFTEST_ASSERT(CMD_GetNumPooledTokenizers() == pooled);
+	SELFTEST_ASSERT_ARGUMENTS_COUNT(4);
 
 	//system("pause");
 }
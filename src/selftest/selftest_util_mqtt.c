@@ -48,9 +48,15 @@ mqttHistoryEntry_t mqtt_history[MAX_MQTT_HISTORY];
 int history_head = 0;
 int history_tail = 0;
 
+// publishes to this topic are refused, like lwIP does when out of memory
+static char sim_failPublishTopic[256];
+
 void SIM_ClearMQTTHistory() {
 	history_head = history_tail = 0;
 }
+void SIM_SetMQTTPublishFailTopic(const char *topic) {
+	strcpy_safe(sim_failPublishTopic, topic ? topic : "", sizeof(sim_failPublishTopic));
+}
 bool SIM_CheckMQTTHistoryForString(const char *topic, const char *value, bool bRetain) {
 	mqttHistoryEntry_t *ne;
 	int cur = history_tail;
@@ -98,9 +104,26 @@ bool SIM_CheckMQTTHistoryForFloat(const char *topic, float value, bool bRetain)
 	}
 	return false;
 }
-void SIM_OnMQTTPublish(const char *topic, const char *value, int len, int qos, bool bRetain) {
+// returns -1 if topic was not published
+int SIM_GetMQTTHistoryQoS(const char *topic) {
+	mqttHistoryEntry_t *ne;
+	int cur = history_tail;
+	while (cur != history_head) {
+		ne = &mqtt_history[cur];
+		if (!strcmp(ne->topic, topic)) {
+			return ne->qos;
+		}
+		cur++;
+		cur %= MAX_MQTT_HISTORY;
+	}
+	return -1;
+}
+bool SIM_OnMQTTPublish(const char *topic, const char *value, int len, int qos, bool bRetain) {
 	mqttHistoryEntry_t *ne;
 
+	if (sim_failPublishTopic[0] && !strcmp(topic, sim_failPublishTopic)) {
+		return false;
+	}
 	ne = &mqtt_history[history_head];
 
 	history_head++;
@@ -133,8 +156,7 @@ void SIM_OnMQTTPublish(const char *topic, const char *value, int len, int qos, b
 	}
 #endif
 
-
-
+	return true;
 }
 
 #endif
@@ -686,7 +686,7 @@ void QuickTick(void* param)
 #if (defined WINDOWS) || (defined PLATFORM_BEKEN)
 	SVM_RunThreads(t_diff);
 #endif
-	RepeatingEvents_RunUpdate(t_diff*0.001f);
+	RepeatingEvents_RunUpdate(t_diff);
 #ifndef OBK_DISABLE_ALL_DRIVERS
 	DRV_RunQuickTick();
 #endif
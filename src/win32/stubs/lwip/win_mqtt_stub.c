@@ -929,7 +929,7 @@ err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_re
 	return ERR_OK;
 }
 
-void SIM_OnMQTTPublish(const char *topic, const char *value, int len, int qos, bool bRetain);
+bool SIM_OnMQTTPublish(const char *topic, const char *value, int len, int qos, bool bRetain);
 
 /** Publish data to topic */
 err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload, u16_t payload_length, u8_t qos, u8_t retain,
@@ -945,7 +945,8 @@ err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload
 #endif
 	if (MQTT_IsFakingOnlineMQTT()) {
 		// on Windows simulator, forward MQTT publish for unit testing
-		SIM_OnMQTTPublish(topic, payload, payload_length, qos, retain);
+		if (SIM_OnMQTTPublish(topic, payload, payload_length, qos, retain) == false)
+			return ERR_MEM;
 		return 0;
 	}
 
@@ -159,6 +159,7 @@ void Win_DoUnitTests() {
 	Test_Command_If_Else(); 
 	Test_Tokenizer();
 	Test_Http();
+	Test_Logging();
 	Test_DeviceGroups();
 
 	// this is slowest
@@ -193,9 +194,13 @@ int rtos_get_time() {
 int g_bDoingUnitTestsNow = 0;
 
 #include "sim/sim_public.h"
+// selftest/selftest_benchmark.c
+int Win_DoBenchmarks(const char *outFileName);
+
 int __cdecl main(int argc, char **argv)
 {
 	bool bWantsUnitTests = 1;
+	const char *benchmarkOutput = 0;
 
 	if (argc > 1) {
 		int value;
@@ -214,6 +219,15 @@ int __cdecl main(int argc, char **argv)
 					if (i < argc && sscanf(argv[i], "%d", &value) == 1) {
 						bWantsUnitTests = value != 0;
 					}
+				} else if (wal_strnicmp(argv[i] + 1, "runBenchmarks", 13) == 0) {
+					// -runBenchmarks [OutputFile], results are JSON lines
+					// output file is optional, next option is not taken as one
+					if (i + 1 < argc && argv[i + 1][0] != '-') {
+						i++;
+						benchmarkOutput = argv[i];
+					} else {
+						benchmarkOutput = "";
+					}
 				}
 			}
 		}
@@ -298,6 +312,14 @@ int __cdecl main(int argc, char **argv)
 		Sim_RunFrames(50, false);
 		g_bDoingUnitTestsNow = 0;
 	}
+	if (benchmarkOutput) {
+		if (bObkStarted == false) {
+			SIM_DoFreshOBKBoot();
+			Sim_RunFrames(50, false);
+		}
+		Win_DoBenchmarks(benchmarkOutput);
+		return 0;
+	}
 
 
 	SIM_CreateWindow(argc, argv);